@@ -11,11 +11,12 @@
 #include <linux/rbtree.h>
 #include <linux/list.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <p2/spd.h>
 #include <linux/rtctrl.h>
 
 /* Сֹ */
-#define P2IOFILTER_VERSION "1.10"
+#define P2IOFILTER_VERSION "1.12"
 
 /* ǥХåѥå */
 /* #define DBG_TRACE */
@@ -50,7 +51,7 @@ enum buffer_types
 #define SYS_TMOUT (HZ >> 1)		/* 0.5sec(Windowsե륿ɥ饤ФƱ) */
 #define DEF_TMOUT (180*HZ)		/* 桼ΰ˻Ȥ */
 
-#define EXEC_FIFO_MAX_DEPTH  (2)        /* AṲ֤ޤexec_fifoˤĤʤΤ */
+#define EXEC_FIFO_MAX_DEPTH  (2)        /* AṲ֤ޤexec_fifoˤĤʤΤ() */
 
 /* p2IoFilter_buffer->flags Υӥå */
 enum buffer_flags
@@ -78,6 +79,10 @@ struct p2IoFilter_buffer
   struct work_struct unplug_work;	/* 񤭤ѥ */
   unsigned long max_wait_time;	/* ॢȻ */
   spinlock_t buffer_lock;	/* ΥХåե˴ؤlock */
+  unsigned long deadline;	/* αrequestΤǤᤤ(jiffies) */
+  unsigned long nr_merges;	/* ޡ */
+  unsigned long nr_timeouts;	/* ॢȤǽ񤭽Ф */
+  unsigned long nr_forced;	/* 񤭽Фؼ줿 */
   struct request_queue *queue;	/* ΥХåե°Ƥqueue */
   struct p2IoFilter_info *info;	/* ΥХåե°ƤFilter */
   int id;					/* ΥХåեμ(buffer_types) */
@@ -100,6 +105,10 @@ struct p2IoFilter_info
   unsigned long sys_start_sector;	/* P2ΥƥΰƬֹ [ٱ] */
   unsigned long usr_start_sector;	/* P2Υ桼ΰƬֹ [ٱ] */
   spinlock_t fifo_lock;	/* ¹FIFO˴ؤlock */
+  unsigned long exec_fifo_max_depth; /* AṲ֤ޤexec_fifoˤĤʤΤ */
+  unsigned long max_merge_sectors; /* 1request˥ޡ(ñ̡0ʤ¤ʤ) */
+  unsigned long exec_pinned;	/* ȯAUδ¡ˤϳޤʤ */
+  int exec_pin_valid;		/* exec_pinnedͭ */
   struct delayproc_info_s *dpinfo; /* ٱ [ٱ] */
   dev_t dev; /* ǥХֹ [ٱ] */
 };
@@ -107,6 +116,10 @@ struct p2IoFilter_info
 /* bioreadǤäȤˤϡBIO_RWӥåȤƤ */
 #define BIO_READ_DIR(bio) ((bio->bi_rw & (1UL << BIO_RW)) ? 0 : 1)
 
+/* exec_fifo줿requestδ¤ elevator_private2 ˻ */
+#define RQ_DEADLINE(rq) ((unsigned long)(rq)->elevator_private2)
+#define RQ_SET_DEADLINE(rq, dl) ((rq)->elevator_private2 = (void *)(dl))
+
 
 /* ץȥ */
 static void p2IoFilter_update_timelimit (struct p2IoFilter_buffer *buffer);
@@ -146,6 +159,23 @@ static void *p2IoFilter_init_queue (struct request_queue * q);
 static void p2IoFilter_exit_queue (elevator_t * e);
 
 
+/* sysfsͤɤ߽ */
+static ssize_t
+p2IoFilter_var_show (unsigned int var, char *page)
+{
+	return sprintf (page, "%u\n", var);
+}
+
+static ssize_t
+p2IoFilter_var_store (unsigned int *var, const char *page, size_t count)
+{
+	char *p = (char *) page;
+
+	*var = simple_strtoul (p, &p, 10);
+	return count;
+}
+
+
 /* -------------- ٱϢؿ -------------- */
 #if defined(CONFIG_DELAYPROC)
 
@@ -707,21 +737,6 @@ p2IoFilter_flush_delayproc_buffer (struct p2IoFilter_buffer *buffer)
  * sysfs parts below -->
  */
 
-static ssize_t
-p2IoFilter_var_show (unsigned int var, char *page)
-{
-	return sprintf (page, "%d\n", var);
-}
-
-static ssize_t
-p2IoFilter_var_store (unsigned int *var, const char *page, size_t count)
-{
-	char *p = (char *) page;
-
-	*var = simple_strtoul (p, &p, 10);
-	return count;
-}
-
 #define SHOW_FUNCTION(__FUNC, __VAR)				\
 static ssize_t __FUNC(elevator_t *e, char *page)			\
 {									\
@@ -752,12 +767,190 @@ STORE_FUNCTION(p2IoFilter_nr_sys_store, &info->dpinfo->params.nr_sys);
 STORE_FUNCTION(p2IoFilter_nr_usr_store, &info->dpinfo->params.nr_usr);
 #undef STORE_FUNCTION
 
+/*
+ * <-- sysfs parts end
+ */
+
+
+#else /* ! CONFIG_DELAYPROC */
+
+# define BUF_IS_DELAYPROC(buf) (0)
+# define RQ_IS_DELAYPROC(rq) (0)
+# define BIO_IS_DELAYPROC(bio) (0)
+
+static inline int
+p2IoFilter_flush_delayproc_buffer(struct p2IoFilter_buffer *buffer) {return 0;}
+
+#endif /* CONFIG_DELAYPROC */
+/* ----------------------------------------------- [ٱ] */
+
+
+/*
+ * sysfs parts (geometry / timeouts) below -->
+ * ɤ头ȤĴ򡢥ͥʤˤʤΤΡ
+ * ͤѹqueue_lockäƤʤ˥ХåեȤϤȤ
+ */
+
+/* ƥХåեΥॢȻ(ms) */
+#define TMOUT_SHOW_FUNCTION(__FUNC, __ID)				\
+static ssize_t __FUNC(elevator_t *e, char *page)			\
+{									\
+	struct p2IoFilter_info *info = e->elevator_data;			\
+	return p2IoFilter_var_show(jiffies_to_msecs(info->buffers[__ID].max_wait_time), (page)); \
+}
+TMOUT_SHOW_FUNCTION(p2IoFilter_fat_timeout_ms_show, P2BF_FAT);
+TMOUT_SHOW_FUNCTION(p2IoFilter_sys_timeout_ms_show, P2BF_SYS);
+TMOUT_SHOW_FUNCTION(p2IoFilter_usr1_timeout_ms_show, P2BF_USR1);
+TMOUT_SHOW_FUNCTION(p2IoFilter_usr2_timeout_ms_show, P2BF_USR2);
+#undef TMOUT_SHOW_FUNCTION
+
+#define TMOUT_STORE_FUNCTION(__FUNC, __ID)				\
+static ssize_t __FUNC(elevator_t *e, const char *page, size_t count)	\
+{									\
+	struct p2IoFilter_info *info = e->elevator_data;			\
+	struct p2IoFilter_buffer *buffer = &info->buffers[__ID];		\
+	unsigned int __data = 0;						\
+	int ret = p2IoFilter_var_store(&__data, (page), count);		\
+	if (__data == 0)							\
+		return -EINVAL;							\
+	spin_lock_irq(buffer->queue->queue_lock);				\
+	buffer->max_wait_time = msecs_to_jiffies(__data);			\
+	spin_unlock_irq(buffer->queue->queue_lock);				\
+	return ret;							\
+}
+TMOUT_STORE_FUNCTION(p2IoFilter_fat_timeout_ms_store, P2BF_FAT);
+TMOUT_STORE_FUNCTION(p2IoFilter_sys_timeout_ms_store, P2BF_SYS);
+TMOUT_STORE_FUNCTION(p2IoFilter_usr1_timeout_ms_store, P2BF_USR1);
+TMOUT_STORE_FUNCTION(p2IoFilter_usr2_timeout_ms_store, P2BF_USR2);
+#undef TMOUT_STORE_FUNCTION
+
+/* AUexec_fifoοޡ */
+#define GEOM_SHOW_FUNCTION(__FUNC, __VAR)				\
+static ssize_t __FUNC(elevator_t *e, char *page)			\
+{									\
+	struct p2IoFilter_info *info = e->elevator_data;			\
+	return p2IoFilter_var_show(__VAR, (page));				\
+}
+GEOM_SHOW_FUNCTION(p2IoFilter_sys_au_sectors_show, info->sys_block_sectors);
+GEOM_SHOW_FUNCTION(p2IoFilter_usr_au_sectors_show, info->usr_block_sectors);
+GEOM_SHOW_FUNCTION(p2IoFilter_exec_fifo_depth_show, info->exec_fifo_max_depth);
+GEOM_SHOW_FUNCTION(p2IoFilter_max_merge_sectors_show, info->max_merge_sectors);
+#undef GEOM_SHOW_FUNCTION
+
+/* ХåեμऴȤΡԵΥ */
+static unsigned long
+p2IoFilter_buffer_block_size (struct p2IoFilter_info *info, int id)
+{
+  switch (id)
+    {
+    case P2BF_FAT:
+      /* systemΰΤP2ɤɤFATؤΥѹ */
+      return info->sys_block_sectors
+	? info->sys_block_sectors : info->usr_block_sectors;
+
+    case P2BF_SYS:
+      /* systemΰΤP2ɤɤǥѹ */
+      return info->sys_block_sectors
+	? info->sys_block_sectors : (unsigned long)-1;
+
+    default:
+      return info->usr_block_sectors;
+    }
+}
+
+/* AUѤȤˡƥХåեΥľ
+   ΥХåեϡäƤΰAU˹碌ľ */
+static void
+p2IoFilter_update_block_sizes (struct p2IoFilter_info *info)
+{
+  int i = 0;
+
+  for (i = 0; i < P2BF_MAX_BFS; i++)
+    {
+      struct p2IoFilter_buffer *buffer = &info->buffers[i];
+
+      if (test_bit (P2BF_ACTIVE, &buffer->flags))
+	{
+	  p2IoFilter_set_block_params (info, buffer->start, &buffer->start,
+				       &buffer->block_size);
+	}
+      else
+	{
+	  buffer->block_size = p2IoFilter_buffer_block_size (info, i);
+	}
+    }
+}
+
+/* AU__VALIDʤͤդʤ */
+#define AU_STORE_FUNCTION(__FUNC, __PTR, __VALID)			\
+static ssize_t __FUNC(elevator_t *e, const char *page, size_t count)	\
+{									\
+	struct p2IoFilter_info *info = e->elevator_data;			\
+	struct request_queue *q = info->buffers[0].queue;		\
+	unsigned int __data = 0;						\
+	int ret = p2IoFilter_var_store(&__data, (page), count);		\
+	if (!(__VALID))							\
+		return -EINVAL;							\
+	spin_lock_irq(q->queue_lock);					\
+	*(__PTR) = __data;						\
+	p2IoFilter_update_block_sizes(info);				\
+	spin_unlock_irq(q->queue_lock);					\
+	return ret;							\
+}
+/* systemΰ褬ʤ(sys_boundary0)ɤǤ0륫ɤǤ0ʳ */
+AU_STORE_FUNCTION(p2IoFilter_sys_au_sectors_store, &info->sys_block_sectors,
+		  (__data != 0) == (info->sys_boundary != 0));
+AU_STORE_FUNCTION(p2IoFilter_usr_au_sectors_store, &info->usr_block_sectors,
+		  __data != 0);
+#undef AU_STORE_FUNCTION
+
+/* __MIN̤ͤϼդʤ */
+#define GEOM_STORE_FUNCTION(__FUNC, __PTR, __MIN)			\
+static ssize_t __FUNC(elevator_t *e, const char *page, size_t count)	\
+{									\
+	struct p2IoFilter_info *info = e->elevator_data;			\
+	struct request_queue *q = info->buffers[0].queue;		\
+	unsigned int __data = 0;						\
+	int ret = p2IoFilter_var_store(&__data, (page), count);		\
+	if (__data < (__MIN))						\
+		return -EINVAL;							\
+	spin_lock_irq(q->queue_lock);					\
+	*(__PTR) = __data;						\
+	spin_unlock_irq(q->queue_lock);					\
+	return ret;							\
+}
+GEOM_STORE_FUNCTION(p2IoFilter_exec_fifo_depth_store, &info->exec_fifo_max_depth, 1);
+GEOM_STORE_FUNCTION(p2IoFilter_max_merge_sectors_store, &info->max_merge_sectors, 0);
+#undef GEOM_STORE_FUNCTION
+
+/* ХåեȤΥ󥿡11Хåե
+   "̾ ޡ ॢȲ 񤭽Ф" Ф */
+static ssize_t
+p2IoFilter_buffer_stats_show (elevator_t *e, char *page)
+{
+  static const char *names[P2BF_MAX_BFS] = { "fat", "sys", "usr1", "usr2" };
+  struct p2IoFilter_info *info = e->elevator_data;
+  ssize_t len = 0;
+  int i = 0;
+
+  for (i = 0; i < P2BF_MAX_BFS; i++)
+    {
+      struct p2IoFilter_buffer *buffer = &info->buffers[i];
+
+      len += sprintf (page + len, "%s %lu %lu %lu\n", names[i],
+		      buffer->nr_merges, buffer->nr_timeouts, buffer->nr_forced);
+    }
+
+  return len;
+}
+
 #define P2IOFILTER_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, p2IoFilter_##name##_show, p2IoFilter_##name##_store)
 #define P2IOFILTER_ATTR_RO(name) \
 	__ATTR(name, S_IRUGO, p2IoFilter_##name##_show, NULL)
 
 static struct elv_fs_entry p2IoFilter_attrs[] = {
+#if defined(CONFIG_DELAYPROC)
 	P2IOFILTER_ATTR_RO(stat),
 	P2IOFILTER_ATTR_RO(type),
 	P2IOFILTER_ATTR_RO(bufcnt),
@@ -765,6 +958,16 @@ static struct elv_fs_entry p2IoFilter_attrs[] = {
 	P2IOFILTER_ATTR(size_usr),
 	P2IOFILTER_ATTR(nr_sys),
 	P2IOFILTER_ATTR(nr_usr),
+#endif /* CONFIG_DELAYPROC */
+	P2IOFILTER_ATTR(fat_timeout_ms),
+	P2IOFILTER_ATTR(sys_timeout_ms),
+	P2IOFILTER_ATTR(usr1_timeout_ms),
+	P2IOFILTER_ATTR(usr2_timeout_ms),
+	P2IOFILTER_ATTR(sys_au_sectors),
+	P2IOFILTER_ATTR(usr_au_sectors),
+	P2IOFILTER_ATTR(exec_fifo_depth),
+	P2IOFILTER_ATTR(max_merge_sectors),
+	P2IOFILTER_ATTR_RO(buffer_stats),
 	__ATTR_NULL
 };
 /*
@@ -772,18 +975,78 @@ static struct elv_fs_entry p2IoFilter_attrs[] = {
  */
 
 
-#else /* ! CONFIG_DELAYPROC */
+/* request°Хåե򡢼ΰ褫 */
+static struct p2IoFilter_buffer *
+p2IoFilter_rq_buffer (struct p2IoFilter_info *info, struct request *rq)
+{
+  /* FATʤ顢METAե饰ΩäƤ */
+  if (rq_is_fat (rq))
+    {
+      return &info->buffers[P2BF_FAT];
+    }
 
-# define BUF_IS_DELAYPROC(buf) (0)
-# define RQ_IS_DELAYPROC(rq) (0)
-# define BIO_IS_DELAYPROC(bio) (0)
+  /* ƥΰ褫桼ΰ褫Ƚ */
+  if (rq->sector < info->sys_boundary)
+    {
+      return &info->buffers[P2BF_SYS];
+    }
 
-static inline int
-p2IoFilter_flush_delayproc_buffer(struct p2IoFilter_buffer *buffer) {return 0;}
+  /* RTե饰ΩäƤСUSR2ѥХåե */
+  return rq_is_rt (rq) ? &info->buffers[P2BF_USR2] : &info->buffers[P2BF_USR1];
+}
 
-#endif /* CONFIG_DELAYPROC */
-/* ----------------------------------------------- [ٱ] */
+/* requestδ¤롣
+   RTbioϽ񤭹¦Ǵ¤ĤƤΤǡκǤᤤΤȤ
+   ¤ΤĤƤʤΤϡ˽°ХåեΥॢȤ­Ρ
+   bufferNULLΤȤϡrequestμΰ褫°Хåե */
+static unsigned long
+p2IoFilter_rq_deadline (struct p2IoFilter_info *info,
+			struct p2IoFilter_buffer *buffer, struct request *rq)
+{
+  struct bio *bio = NULL;
+  unsigned long deadline = 0;
+
+  __rq_for_each_bio (bio, rq)
+    {
+      if (bio->bi_deadline
+	  && (deadline == 0 || time_before (bio->bi_deadline, deadline)))
+	{
+	  deadline = bio->bi_deadline;
+	}
+    }
+
+  if (deadline != 0)
+    {
+      return deadline;
+    }
+
+  /* READԤͳʤΤǡǴڤ찷 */
+  if (rq_data_dir (rq) == READ)
+    {
+      return rq->start_time;
+    }
+
+  /* sysfsѹ줿ॢȤ褦ˡХåեͤȤ */
+  if (buffer == NULL)
+    {
+      buffer = p2IoFilter_rq_buffer (info, rq);
+    }
 
+  return rq->start_time + buffer->max_wait_time;
+}
+
+/* Хåեδ¤򡢿ärequestδ¤ǹ */
+static inline void
+p2IoFilter_update_deadline (struct p2IoFilter_buffer *buffer,
+			    struct request *rq, int first)
+{
+  unsigned long deadline = p2IoFilter_rq_deadline (buffer->info, buffer, rq);
+
+  if (first || time_before (deadline, buffer->deadline))
+    {
+      buffer->deadline = deadline;
+    }
+}
 
 static void
 p2IoFilter_update_timelimit (struct p2IoFilter_buffer *buffer)
@@ -936,8 +1199,15 @@ static inline void
 p2IoFilter_prepare_exec (struct p2IoFilter_info *info, struct request *rq)
 {
   struct p2IoFilter_buffer *buffer = rq->elevator_private;
+  struct list_head *pos = NULL;
+  unsigned long deadline = 0;
   PTRACE();
 	
+  /* ƱХåեФrequestƱ¤ˤ롣
+     ƤAUñ̤ΤޤȤޤ꤬exec_fifoʤ */
+  deadline = (buffer != NULL)
+    ? buffer->deadline : p2IoFilter_rq_deadline (info, NULL, rq);
+
   if (buffer != NULL)
     {
       /* ȴơexec_fifoդؤ */
@@ -962,7 +1232,27 @@ p2IoFilter_prepare_exec (struct p2IoFilter_info *info, struct request *rq)
       //printk("%lu\n",info->exec_fifo_depth);
     }
 
-  list_add_tail (&rq->queuelist, &info->exec_fifo);
+  RQ_SET_DEADLINE (rq, deadline);
+
+  /* ¤ᤤ¤٤롣Ʊ¤ʤˡ
+     ȯAUλĤˤʤ */
+  pos = info->exec_fifo.next;
+  if (info->exec_pin_valid)
+    {
+      while (pos != &info->exec_fifo
+	     && RQ_DEADLINE (rq_entry_fifo (pos)) == info->exec_pinned)
+	{
+	  pos = pos->next;
+	}
+    }
+
+  while (pos != &info->exec_fifo
+	 && !time_after (RQ_DEADLINE (rq_entry_fifo (pos)), deadline))
+    {
+      pos = pos->next;
+    }
+
+  list_add_tail (&rq->queuelist, pos);
   
   return;
 }
@@ -1040,39 +1330,16 @@ p2IoFilter_update_buffer (struct p2IoFilter_info *info,
 			  struct request *rq)
 {
   struct request *_alias = NULL;
+  int first = 0;
   PTRACE();
 	
   /* Ǥ˽°ХåեȽƤʤ
      =¸bufferɤФȯˤν򤹤 */
   if (buffer == NULL)
     {
-      /* FATʤ顢METAե饰ΩäƤ */
-      if (rq_is_fat (rq))
-	{
-	  buffer = &info->buffers[P2BF_FAT];
-	}
-      else
-	  {
-		  /* ƥΰ褫桼ΰ褫Ƚ */
-		  if (rq->sector < info->sys_boundary)
-		  {
-			  /* ƥΰѤΥХåե */
-			  buffer = &info->buffers[P2BF_SYS];
-		  }
-		  else
-		  {
-			  /* RTե饰ΩäƤСUSR2ѥХåե */
-			  if (rq_is_rt (rq))
-			  {
-				  buffer = &info->buffers[P2BF_USR2];
-			  }
-			  else
-			  {
-				  buffer = &info->buffers[P2BF_USR1];
-			  }
-		  }
-		  PDEBUG(" Select buf%d\n", buffer->id);
-	  }
+      /* FAT/ƥΰ/桼ΰ(RTݤ)ǽ°Хåե */
+      buffer = p2IoFilter_rq_buffer (info, rq);
+      PDEBUG(" Select buf%d\n", buffer->id);
 
       /* 褿ʳrqbufferޤäΤǡ
          ¸bufferƤ˴rq򤹤 */
@@ -1090,6 +1357,10 @@ p2IoFilter_update_buffer (struct p2IoFilter_info *info,
   /* privateΰ˽°ХåեؤΥݥ󥿤Ͽ */
   rq->elevator_private = buffer;
 
+  /* ΥХåեȤϡ¤⤽requestΤΤϤ */
+  first = (buffer->buffer.rb_node == NULL) ? 1 : 0;
+  p2IoFilter_update_deadline (buffer, rq, first);
+
 RETRY:
 
   /* Хåեrqͤù */
@@ -1212,6 +1483,11 @@ p2IoFilter_merged_request (struct request_queue * q, struct request *req, int ty
       elv_rb_add (&buffer->buffer, req);
     }
 
+  buffer->nr_merges++;
+
+  /* ޡ줿bioδ¤ᤱСХåեδ¤ */
+  p2IoFilter_update_deadline (buffer, req, 0);
+
   /* ǽ֤򹹿 */
   p2IoFilter_update_timelimit (buffer);
 
@@ -1305,6 +1581,13 @@ p2IoFilter_allow_merge (struct request_queue * q, struct request *req,
       goto FAIL;
     }
 
+  /* ޡ¤Ķʤ */
+  if (buffer->info->max_merge_sectors
+      && (req->nr_sectors + bi_sectors) > buffer->info->max_merge_sectors)
+    {
+      goto FAIL;
+    }
+
   /* ХåޡǽĴ */
   if ((req->sector + req->nr_sectors) == bio->bi_sector)
     {
@@ -1362,6 +1645,10 @@ p2IoFilter_do_dispatch_request(struct request_queue *q)
   /* Ƭrequestexec_fifoȴ */
   rq_fifo_clear (req);
 
+  /* requestƱޤȤޤλĤϡ夫褿Τɤۤʤ */
+  info->exec_pinned = RQ_DEADLINE (req);
+  info->exec_pin_valid = 1;
+
   if(rq_data_dir(req)==WRITE)
     {
       //printk("%lu-(%lu)>",info->exec_fifo_depth, req->nr_sectors);
@@ -1369,6 +1656,19 @@ p2IoFilter_do_dispatch_request(struct request_queue *q)
       //printk("%lu\n",info->exec_fifo_depth);
     }
 
+#if defined(CONFIG_RESERVOIR_STATS)
+  /* reservoirפǡelevatorȥǥХǤλ֤ʬ뤿λ */
+  {
+    struct bio *bio = NULL;
+    u64 now = ktime_to_ns (ktime_get ());
+
+    __rq_for_each_bio (bio, req)
+      {
+	bio->bi_rt_dispatched = now;
+      }
+  }
+#endif
+
   /* ǥХɥqueueϤ */
   elv_dispatch_add_tail (q, req);
 
@@ -1397,6 +1697,11 @@ p2IoFilter_dispatch_requests (struct request_queue * q, int force)
 	  || test_and_clear_bit (P2BF_TMOUT,
 				 &info->buffers[i].flags) /* ॢȤȯƤ */ )
 	{
+	  if (force && test_bit (P2BF_ACTIVE, &info->buffers[i].flags))
+	    {
+	      info->buffers[i].nr_forced++;
+	    }
+
 	  /* αХåեƤǤФ */
 	  p2IoFilter_flush_buffered_rq (&info->buffers[i]);
 	}
@@ -1643,6 +1948,7 @@ p2IoFilter_time_expired (unsigned long data)
 		
       /* ॢȤȯȤΤ餻ե饰ΩƤ */
       set_bit (P2BF_TMOUT, &buffer->flags);
+      buffer->nr_timeouts++;
 
 
       if(buffer->id == P2BF_USR2)
@@ -1712,7 +2018,7 @@ p2IoFilter_ready_queue (struct request_queue * q)
       /* USERХåեäݡ
 	 ⤷ʻ֤ǤФˤξϡ
 	 exec_fifoο򸫤ơޤ꿼褦ʤԤ */
-      int max_depth = EXEC_FIFO_MAX_DEPTH;
+      int max_depth = info->exec_fifo_max_depth;
 
       if(p2IoFilter_check_total_size(buf_usr) && max_depth!=0)
 	{
@@ -1779,6 +2085,7 @@ p2IoFilter_force_dispatch (struct request_queue * q, int area)
 
 	  if(test_bit(P2BF_ACTIVE, &buffer->flags))
 	  {
+		  buffer->nr_forced++;
 		  set_bit(P2BF_TMOUT, &buffer->flags);
 		  del_timer_sync (&buffer->unplug_timer);
 		  queue_work (info->unplug_works, &buffer->unplug_work);
@@ -1833,30 +2140,21 @@ p2IoFilter_init_buffers (struct request_queue * q,
       switch (i)
 	{
 	case P2BF_FAT:
-	  /* systemΰΤP2ɤɤFATؤΥѹ */
-	  io_buffer->block_size =
-	    info->sys_block_sectors ? info->sys_block_sectors : info->
-	    usr_block_sectors;
 	  io_buffer->max_wait_time = FAT_TMOUT;
 	  break;
 
 	case P2BF_SYS:
-		/* systemΰΤP2ɤɤǥѹ */
-	  io_buffer->block_size =
-	    info->sys_block_sectors ? info->sys_block_sectors : (unsigned long)-1;
-	  io_buffer->max_wait_time = SYS_TMOUT;
-	  break;
-
 	case P2BF_USR1:
-	  io_buffer->block_size = info->usr_block_sectors;
-	  io_buffer->max_wait_time = SYS_TMOUT;  /* SYSΰƱͤ */
+	  io_buffer->max_wait_time = SYS_TMOUT;  /* USR1SYSΰƱͤ */
 	  break;
 	  
 	default:
-	  io_buffer->block_size = info->usr_block_sectors;
 	  io_buffer->max_wait_time = DEF_TMOUT;
 	}
 
+      /* AU */
+      io_buffer->block_size = p2IoFilter_buffer_block_size (info, i);
+
       /* lockν */
       spin_lock_init (&io_buffer->buffer_lock);
 
@@ -1895,6 +2193,10 @@ p2IoFilter_init_queue (struct request_queue * q)
   /* ¹FIFOν */
   INIT_LIST_HEAD (&info->exec_fifo);
   info->exec_fifo_depth = 0;
+  info->exec_fifo_max_depth = EXEC_FIFO_MAX_DEPTH;
+  info->max_merge_sectors = 0;
+  info->exec_pinned = 0;
+  info->exec_pin_valid = 0;
   spin_lock_init (&info->fifo_lock);
   
   /* ॢѤworkqueueν */
@@ -2019,9 +2321,7 @@ static struct elevator_type iosched_p2IoFilter = {
 	  .elevator_force_delayproc_fn = p2IoFilter_force_delayproc,
 #endif /* CONFIG_DELAYPROC */
 	  },
-#if defined(CONFIG_DELAYPROC)
   .elevator_attrs =	p2IoFilter_attrs,
-#endif /* CONFIG_DELAYPROC */
   .elevator_name = "p2IoFilter",
   .elevator_owner = THIS_MODULE,
 };
@@ -26,6 +26,7 @@
 #include <linux/module.h>
 #include <linux/mm.h>
 #include <linux/cdev.h>
+#include <linux/scatterlist.h>
 #include <asm/io.h>
 #include <asm/uaccess.h>
 #include <linux/scullp.h>
@@ -166,6 +167,40 @@ ssize_t scullp_write(struct file *filp, const char *buf, size_t count,
     return count;
 }
 
+/* Number of the buffers actually set up (DM mode uses 3 of them)	*/
+static int scullp_valid_bufs(ScullP_Dev *dev)
+{
+	int num = 0;
+
+	while(num < dev->buf_num && dev->dmabuf[num])
+		num++;
+	return num;
+}
+
+/* Fill sgl[] with the buffers, for drivers DMAing into them directly.
+   Returns the number of entries filled.	*/
+int scullp_get_sglist(struct scatterlist *sgl, int nents)
+{
+	ScullP_Dev *dev = &scullp_dev;
+	int num, lpc;
+
+	if(!sgl || nents <= 0)
+		return -EINVAL;
+
+	num = scullp_valid_bufs(dev);
+	if(num > nents)
+		num = nents;
+	if(num == 0)
+		return 0;
+
+	sg_init_table(sgl, num);
+	for(lpc = 0; lpc < num; lpc++)
+		sg_set_buf(&sgl[lpc], dev->dmabuf[lpc], dev->buf_size_chunk);
+
+	return num;
+}
+EXPORT_SYMBOL(scullp_get_sglist);
+
 /* ioctl() implementation	*/
 int scullp_ioctl(struct inode *inode, struct file *filp,
                  unsigned int cmd, unsigned long arg)
@@ -175,7 +210,9 @@ int scullp_ioctl(struct inode *inode, struct file *filp,
 #if ! defined(CONFIG_BUFFER_DM) /* XXX */
 	int lpc;
 #endif /* ! CONFIG_BUFFER_DM */ /* XXX */
+	int lpc2;
     ScullP_IOC_GETBUFLIST bl;
+    ScullP_IOC_GETSGLIST sl;
 
     switch(cmd){
     case IOC_SCULLP_GETBUFLIST:
@@ -219,6 +256,21 @@ int scullp_ioctl(struct inode *inode, struct file *filp,
         }
         return 0;
 
+    case IOC_SCULLP_GETSGLIST:
+	memset(&sl, 0, sizeof(sl));
+	sl.valid_buf_num = scullp_valid_bufs(dev);
+	for(lpc2 = 0; lpc2 < sl.valid_buf_num; lpc2++){
+	  sl.sg_list[lpc2].bus_addr = virt_to_bus(dev->dmabuf[lpc2]);
+	  sl.sg_list[lpc2].length = dev->buf_size_chunk;
+	  sl.sg_list[lpc2].offset = dev->buf_size_chunk * lpc2;
+	}
+
+        if(copy_to_user ((void *)arg, &sl, sizeof(sl))){
+            printk("scullp : scullp_ioctl : copy_to_user %d error\n", (int)sizeof(sl));
+            return -EFAULT;
+        }
+        return 0;
+
     default:
         printk("invalid ioctl code(%d)", cmd);
         return -ENOTTY;
@@ -261,11 +313,54 @@ loff_t scullp_llseek(struct file *filp, loff_t off, int whence)
     return newpos;
 }
  
+/* mmap() implementation.
+   The buffers are laid out back to back, buffer #n at n * buf_size_chunk.
+   They stay cacheable like the kernel's own mapping of them, unless the
+   device was opened with O_SYNC.	*/
+int scullp_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	ScullP_Dev *dev = filp->private_data;
+	unsigned long off = vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long addr = vma->vm_start;
+	unsigned long left = vma->vm_end - vma->vm_start;
+	int num = scullp_valid_bufs(dev);
+
+	if(off + left > dev->buf_size_chunk * num || off + left < off){
+		printk("scullp : scullp_mmap : Requested area is out of range (%lx+%lx)\n", off, left);
+		return -EINVAL;
+	}
+
+	if(filp->f_flags & O_SYNC)
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	vma->vm_flags |= VM_RESERVED;
+
+	/* The buffers are not contiguous with each other: map piecewise */
+	while(left){
+		int chunk_num = off / dev->buf_size_chunk;
+		unsigned long buf_off = off % dev->buf_size_chunk;
+		unsigned long len = dev->buf_size_chunk - buf_off;
+		unsigned long pfn = virt_to_phys(dev->dmabuf[chunk_num] + buf_off) >> PAGE_SHIFT;
+
+		if(len > left)
+			len = left;
+		if(remap_pfn_range(vma, addr, pfn, len, vma->vm_page_prot)){
+			printk("scullp : scullp_mmap : remap_pfn_range error\n");
+			return -EAGAIN;
+		}
+		addr += len;
+		off += len;
+		left -= len;
+	}
+
+	return 0;
+}
+
 struct file_operations scullp_fops = {
     llseek:	scullp_llseek,
     read:	scullp_read,
     write:	scullp_write,
     ioctl:	scullp_ioctl,
+    mmap:	scullp_mmap,
     open:	scullp_open,
     release: scullp_release,
 };
@@ -326,6 +421,7 @@ int scullp_init(void)
 #else /* ! CONFIG_BUFFER_DM */ /* XXX */
 
 	scullp_dev.buf_num = DMABUF_NUM;
+	scullp_dev.buf_size_chunk = DMABUF_SIZE_CHUNK;
 	scullp_dev.buf_size = DMABUF_SIZE_CHUNK;
 
 	/* allocate kernel memories 	*/
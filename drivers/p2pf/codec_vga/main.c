@@ -13,6 +13,8 @@
 #include <linux/mm.h>
 #include <linux/tty.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/bitmap.h>
 #include <linux/ioctl.h>
 #include <linux/ioport.h> /* request_mem_region, release_mem_region */
 #include <linux/kthread.h>                   /* kthread_run,... */
@@ -39,7 +41,7 @@ typedef unsigned long ui32_t;
 #include <asm/dmac-ioctl.h>
 extern int MPC83xxDmacDirectMode(int, ui32_t, ui32_t, ui32_t, ui32_t);
 
-#define CODEC_VGA_VER "0.07"
+#define CODEC_VGA_VER "0.08"
 
 
 /*
@@ -50,6 +52,7 @@ struct codec_vga_fb_par{
     int devno;                  /* device number = 0,1,... */
 	void* virt_addr;           // FB virtual address
     struct cvga_ioc_fb_mode mode;
+    int damage;                 /* damage tracking is enabled */
 };
 
 
@@ -105,6 +108,11 @@ struct codec_vga_param {
 
     int dma_ch;
 
+    /* damage tracking */
+    spinlock_t damage_lock;
+    int plane_src[CVGA_PLANE_NUM]; /* FB devno which plane holds, -1=unknown */
+    unsigned long plane_dirty[CVGA_PLANE_NUM][BITS_TO_LONGS(CVGA_Y_RES)]; /* lines differ from FB */
+
 } param;
 
 /* driver base name */
@@ -124,6 +132,12 @@ static const __u16 init_v_phase = 0;
 /* Virtual addressof VGA buffer plane */
 #define VGA_PLANE_ADDR(no)      ((void*)(param.vgabuff_addr + (no)*CVGA_VRAM_SIZE))
 
+/* byte length of one line */
+#define CVGA_LINE_LENGTH        (CVGA_X_RES * CVGA_BYTES_PER_PIXEL)
+
+/* damaged lines closer than this are sent by one transfer */
+#define CVGA_DAMAGE_MERGE_GAP   16
+
 /* virtual address of CODEC-FPGA VGA registers */
 #define VGA_REG_ADDR(off)   ((void*)(param.reg_addr + off))
 
@@ -395,13 +409,13 @@ static void trans_cpu_wq(struct work_struct *work)
 /*
  *  trans local FB ==> VGA buff plane (DMA)
  */
-static int fb_to_vga_dma(const struct fb_info *const info, const __u32 plane)
+static int fb_to_vga_dma(const struct fb_info *const info, const __u32 plane,
+                         const unsigned long offset, const ssize_t size)
 {
 	int ret = 0;
-	ssize_t size = CVGA_SCREEN_SIZE;
     const struct codec_vga_fb_par *par = (const struct codec_vga_fb_par *const)info->par;
-	void *src = (void *)virt_to_bus(par->virt_addr);
-	void *dst = VGA_PLANE_PHYADR(plane);
+	void *src = (void *)virt_to_bus(par->virt_addr) + offset;
+	void *dst = VGA_PLANE_PHYADR(plane) + offset;
 
     /* trans local FB ==> VGA buff plane */
 	ret = MPC83xxDmacDirectMode(param.dma_ch, (unsigned long)src, (unsigned long)dst, size, DMAC_WRITE);
@@ -414,13 +428,14 @@ static int fb_to_vga_dma(const struct fb_info *const info, const __u32 plane)
 /*
  *  trans local FB ==> VGA buff plane (CPU)
  */
-static int fb_to_vga_cpu(const struct fb_info *const info, const __u32 plane)
+static int fb_to_vga_cpu(const struct fb_info *const info, const __u32 plane,
+                         const unsigned long offset, const ssize_t size)
 {
 	int ret = 0;
     const struct codec_vga_fb_par *par = (const struct codec_vga_fb_par *const)info->par;
-	param.data_cpu.src = (volatile unsigned long *)par->virt_addr;
-	param.data_cpu.dst = (volatile unsigned long *)VGA_PLANE_ADDR(plane);
-	param.data_cpu.num = (CVGA_SCREEN_SIZE+3)/sizeof(unsigned long);
+	param.data_cpu.src = (volatile unsigned long *)(par->virt_addr + offset);
+	param.data_cpu.dst = (volatile unsigned long *)(VGA_PLANE_ADDR(plane) + offset);
+	param.data_cpu.num = (size+3)/sizeof(unsigned long);
 
     /* trans local FB ==> VGA buff plane */
     schedule_work(&param.work_cpu);
@@ -432,6 +447,110 @@ static int fb_to_vga_cpu(const struct fb_info *const info, const __u32 plane)
 }
 
 
+/*
+ *  mark lines of local FB as damaged in every plane holding the FB
+ */
+static void fb_damage(const int devno, const __u32 ypos, __u32 height)
+{
+    int n;
+    __u32 y;
+
+    if(ypos>=CVGA_Y_RES)
+        return;
+    if(height > CVGA_Y_RES - ypos)
+        height = CVGA_Y_RES - ypos;
+
+    spin_lock(&param.damage_lock);
+    for(n=0; n<CVGA_PLANE_NUM; n++){
+        if(param.plane_src[n]!=devno)
+            continue;
+        for(y=ypos; y<ypos+height; y++)
+            __set_bit(y, param.plane_dirty[n]);
+    }
+    spin_unlock(&param.damage_lock);
+}
+
+/*
+ *  forget contents of planes holding local FB
+ *   (next transfer to them is done in whole screen)
+ */
+static void fb_damage_reset(const int devno)
+{
+    int n;
+
+    spin_lock(&param.damage_lock);
+    for(n=0; n<CVGA_PLANE_NUM; n++){
+        if(param.plane_src[n]==devno)
+            param.plane_src[n] = -1;
+    }
+    spin_unlock(&param.damage_lock);
+}
+
+/*
+ *  trans local FB ==> VGA buff plane
+ *   With damage tracking, only damaged lines since the last transfer
+ *   to this plane are sent. Near runs of lines are merged into one
+ *   transfer.
+ */
+static int fb_to_vga(const struct fb_info *const info, const __u32 plane)
+{
+	int ret = 0;
+    const struct codec_vga_fb_par *par = (const struct codec_vga_fb_par *const)info->par;
+    unsigned long dirty[BITS_TO_LONGS(CVGA_Y_RES)];
+    unsigned int start, end, next;
+
+    spin_lock(&param.damage_lock);
+
+    /* whole screen */
+    if(!par->damage || param.plane_src[plane]!=par->devno){
+        param.plane_src[plane] = par->devno;
+        bitmap_zero(param.plane_dirty[plane], CVGA_Y_RES);
+        spin_unlock(&param.damage_lock);
+        ret = param.flag_cpu_transfer
+            ? fb_to_vga_cpu(info, plane, 0, CVGA_SCREEN_SIZE)
+            : fb_to_vga_dma(info, plane, 0, CVGA_SCREEN_SIZE);
+        goto exit;
+    }
+
+    /* take damaged lines */
+    bitmap_copy(dirty, param.plane_dirty[plane], CVGA_Y_RES);
+    bitmap_zero(param.plane_dirty[plane], CVGA_Y_RES);
+    spin_unlock(&param.damage_lock);
+
+    start = find_first_bit(dirty, CVGA_Y_RES);
+    while(start<CVGA_Y_RES){
+
+        /* merge runs of lines */
+        end = find_next_zero_bit(dirty, CVGA_Y_RES, start);
+        for(;;){
+            next = find_next_bit(dirty, CVGA_Y_RES, end);
+            if(next>=CVGA_Y_RES || next-end>CVGA_DAMAGE_MERGE_GAP)
+                break;
+            end = find_next_zero_bit(dirty, CVGA_Y_RES, next);
+        }
+
+        _DEBUG("damage: FB#%d => plane#%d line %d-%d\n", par->devno, plane, start, end-1);
+        ret = param.flag_cpu_transfer
+            ? fb_to_vga_cpu(info, plane, start*CVGA_LINE_LENGTH, (end-start)*CVGA_LINE_LENGTH)
+            : fb_to_vga_dma(info, plane, start*CVGA_LINE_LENGTH, (end-start)*CVGA_LINE_LENGTH);
+        if(ret)
+            break;
+
+        start = next;
+    }
+
+ exit:
+    /* contents of plane is unknown */
+    if(ret){
+        spin_lock(&param.damage_lock);
+        param.plane_src[plane] = -1;
+        spin_unlock(&param.damage_lock);
+    }
+
+	return ret;
+}
+
+
 /*
  *  trans local FB <== VGA buff plane (DMA)
  */
@@ -629,7 +748,7 @@ static int cycdmac_kthread(void *data)
             /* local FB ==> VGA buffer plane */
             _DEBUG("Start dmac in kthread: FB#%d => plane%#d(vpare#%d)\n",
                    devno, plane, vpair);
-            if(param.flag_cpu_transfer?fb_to_vga_cpu(info,plane):fb_to_vga_dma(info,plane)){
+            if(fb_to_vga(info,plane)){
                 _ERR("unable to dmac in kthread: FB#%d => plane#%d(vpare#%d)\n",
                      devno, plane, vpair);
                 up(&param.sem_dmac);
@@ -761,7 +880,7 @@ static int codec_vga_fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned l
 
             /* local FB ==> VGA buffer plane */
             _DEBUG("start dmac : FB#%d => plane%#d(vpare#%d)\n",devno,plane,vpair);
-            ret = param.flag_cpu_transfer?fb_to_vga_cpu(info,plane):fb_to_vga_dma(info,plane);
+            ret = fb_to_vga(info,plane);
             if(ret){
                 _ERR("unable to dmac : FB#%d => plane#%d(vpare#%d)\n",devno,plane,vpair);
                 up(&param.sem_dmac);
@@ -820,6 +939,10 @@ static int codec_vga_fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned l
             /* local VGA ==> FB buffer plane */
             _DEBUG("start dmac : FB#%d => plane%#d(vpare#%d)\n",devno,plane,vpair);
             ret = param.flag_cpu_transfer?vga_to_fb_cpu(info,plane):vga_to_fb_dma(info,plane);
+
+            /* local FB is changed in whole screen */
+            fb_damage_reset(devno);
+
             if(ret){
                 _ERR("unable to dmac : FB#%d => plane#%d(vpare#%d)\n",devno,plane,vpair);
                 up(&param.sem_dmac);
@@ -894,6 +1017,42 @@ static int codec_vga_fb_ioctl(struct fb_info *info, unsigned int cmd, unsigned l
         }
         break;
 
+    case CVGA_IOC_FB_DAMAGE:
+        _DEBUG("ioctl(CVGA_IOC_FB_DAMAGE) is called\n");
+        {
+            struct cvga_ioc_fb_damage damage;
+
+            /* get parameter from arguments */
+            if (copy_from_user((void*)&damage, (const void __user *)arg,
+                               sizeof(struct cvga_ioc_fb_damage))) {
+                _ERR("failed copy_from_user()\n");
+                ret = -EFAULT;
+                goto exit;
+            }
+
+            /* get semaphore */
+            if(down_interruptible(&param.sem)){
+                ret = -ERESTARTSYS;
+                goto exit;
+            }
+
+            if(damage.height==0){
+                /* damage tracking off */
+                par->damage = 0;
+            }else{
+                /* planes may miss changes before tracking */
+                if(!par->damage){
+                    fb_damage_reset(devno);
+                    par->damage = 1;
+                }
+                fb_damage(devno, damage.ypos, damage.height);
+            }
+
+            /* release semaphore */
+            up(&param.sem);
+        }
+        break;
+
     case CVGA_IOC_FB_GETMODE:
         _DEBUG("ioctl(CVGA_IOC_FB_GETMODE) is called\n");
         {
@@ -1634,6 +1793,13 @@ static int __init codec_vga_probe(struct platform_device *dev)
     init_MUTEX(&param.sem);
     init_MUTEX(&param.sem_dmac);
 
+    /*
+     * initial damage tracking
+     */
+    spin_lock_init(&param.damage_lock);
+    for(n=0; n<CVGA_PLANE_NUM; n++)
+        param.plane_src[n] = -1;
+
     /*
      * initial queue head
      */
@@ -3,7 +3,7 @@
  */
 /*****************************************************************************
  *****************************************************************************/
-#define DM_VERSION "3.06" /* 2009/07/09 */
+#define DM_VERSION "3.07" /* 2010/10/17 */
 
 #if defined(CONFIG_MODVERSIONS) && ! defined(MODVERSIONS)
 #include <linux/modversions.h>
@@ -20,6 +20,8 @@
 #include <asm/page.h>
 #include <linux/proc_fs.h> /* for proc */
 #include <linux/semaphore.h> /* for semaphore */
+#include <linux/list.h>
+#include <linux/bitmap.h>
 #include <asm/io.h>  /* for virt_to_bus */
 
 #include <linux/dmdrv.h>
@@ -55,45 +57,39 @@ static int	dm_malloc_count;	/* counter for aligned blocks */
 
 /*** page administration ***/
 static char 	*dm_pages[DM_PAGE_NUM];	/* table for page administration */
-static int	dm_current_page;	/* current handling page */
-static int	dm_allocated;		/* number of blocks aligned in a page */
 
 /*** block administaration ***/
 typedef struct dm_blockinfo_tag {
 	long    offset;                  /* offset address (from the top of DM) */
-	struct  dm_blockinfo_tag  *next; /* "free list" */
-	int     num;                     /* number of continuous blocks */
+	struct  list_head list;          /* link in "free list" (top of free blocks) */
+	int     num;                     /* number of continuous blocks
+                                            allocated: n-j at the j th block,
+                                            free: n at the top and the last block */
 	int     allocation_flag;         /* already allocated or not ?
                                              allocated:1, not allocated:0  by Y.Takano */
 } dm_blockinfo;
 
-/*** for searching free blocks ***/
-static int	book_mark;		/* next starting position of search (0-511) */
-
 /*** table for block administration ***/
 static dm_blockinfo dm_blockinfo_tbl[DM_BLOCKUNIT_NUM];
 
-/*** "free list table" */
-static dm_blockinfo *dm_freelist[DM_FREELIST_NUM];
+/*** "free list table"
+     continuous free blocks are linked by their size.
+     free blocks never cross the page boundary, and neighbors are
+     coalesced when they are freed. */
+static struct list_head dm_freelist[DM_FREELIST_NUM];
 
 /*** current depth of the "free list" */
 static int dm_freelist_count[DM_FREELIST_NUM];
 
-/*** max depth of the "free list" */
-static int dm_freelist_limit[DM_FREELIST_NUM]
-//   ={128,64,42,32,25,21,18,16,14,12,11,10, 9, 9, 8, 8, 7, 7, 6, 6};
-//   ={ 32, 3, 3, 3, 3, 3, 3, 3, 3, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}; //040227
-     ={  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}; //070613 for fragment problem on 16G ClipCopy
-     //  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15 16 17 18 19 20more
+/*** "free list" which is not empty */
+static DECLARE_BITMAP(dm_freelist_map, DM_FREELIST_NUM);
 
 static int doDM_INIT(void);
 static int doDM_RESET(void);
 
 static int doDM_EXIT(void);
 
-static dm_blockinfo *alloc_newblock(int n);
 static dm_blockinfo *search_freelist(int n);
-static dm_blockinfo *search_freeblock(int n);
 
 int dm_read_proc(char *buf, char **start, off_t offset, int count,
 		 int *eof, void *data);
@@ -359,6 +355,47 @@ static int doDM_EXIT()
 	return 0;
 }
 
+/*****************************************************************************
+ << FREE LIST OPERATIONS >>
+ *****************************************************************************/
+/* index of "free list" for n blocks */
+static inline int freelist_index(int n)
+{
+	return (n < DM_FREELIST_NUM) ? n - 1 : DM_FREELIST_NUM - 1;
+}
+
+/* connect n free blocks from the i th to the "free list" */
+static void link_freeblock(int i, int n)
+{
+	dm_blockinfo *ptr = dm_blockinfo_tbl + i;
+	int m = freelist_index(n);
+
+	/* size at the top and the last block (for coalescing) */
+	ptr->num = n;
+	dm_blockinfo_tbl[i + n - 1].num = n;
+
+	list_add(&ptr->list, &dm_freelist[m]);
+	dm_freelist_count[m] ++; /* increse the depth counter */
+	__set_bit(m, dm_freelist_map);
+}
+
+/* disconnect free blocks from the i th from the "free list" */
+static void unlink_freeblock(int i)
+{
+	dm_blockinfo *ptr = dm_blockinfo_tbl + i;
+	int n = ptr->num;
+	int m = freelist_index(n);
+
+	list_del_init(&ptr->list);
+	dm_freelist_count[m] --; /* decrement the depth of the list */
+	if(dm_freelist_count[m] == 0){
+		__clear_bit(m, dm_freelist_map);
+	}
+
+	ptr->num = 0;
+	dm_blockinfo_tbl[i + n - 1].num = 0;
+}
+
 /*****************************************************************************
  << INITIALIZING THE ALLOCATION INFORMATION >>
  *****************************************************************************/
@@ -369,23 +406,27 @@ static int doDM_RESET()
 
 	/* initializing tables */
 	memset(dm_blockinfo_tbl, 0, sizeof(dm_blockinfo_tbl));
-	memset(dm_freelist, 0, sizeof(dm_freelist));
 	memset(dm_freelist_count, 0, sizeof(dm_freelist_count));
+	bitmap_zero(dm_freelist_map, DM_FREELIST_NUM);
+	for(i = 0; i < DM_FREELIST_NUM; i++){
+		INIT_LIST_HEAD(&dm_freelist[i]);
+	}
 
 	/* set offset values in block administration data */
 	for(i = 0; i < DM_BLOCKUNIT_NUM; i++){
 		ptr = dm_blockinfo_tbl + i;
 		ptr->offset = i << DM_BLOCKUNIT_SIZE_SHIFT;
+		INIT_LIST_HEAD(&ptr->list);
+	}
+
+	/* each page is a free block */
+	for(i = 0; i < DM_BLOCKUNIT_NUM; i += DM_PAGE_BLOCKUNIT_NUM){
+		link_freeblock(i, min_t(int, DM_PAGE_BLOCKUNIT_NUM, DM_BLOCKUNIT_NUM - i));
 	}
 
 	/* initialize allocation data */
-	dm_current_page	= 0;
-	dm_allocated	= 0;
 	dm_malloc_count	= 0;
 
-	/* initialize the start position for search */
-	book_mark = DM_BLOCKUNIT_NUM / 2; /* from the half position of DM */
-
 	return 0;
 }
 
@@ -408,21 +449,20 @@ int doDM_MALLOC(dm_ioctl_parm *parm)
 	/* get number of required blocks */
 	n = size >> DM_BLOCKUNIT_SIZE_SHIFT;
 
+	/* blocks can't cross the page boundary */
+	if(n <= 0 || n > DM_PAGE_BLOCKUNIT_NUM){
+		parm->offset = -1;
+		printk(KERN_ERR "[DM] %s invalid size=%lx\n", __FUNCTION__, size);
+		return (-EINVAL);
+	}
+
 	/* find from "free list" */
 	ptr = search_freelist(n);
 	if(ptr == NULL){
-		/* finding from "free list" failed, so execute fast search */
-		ptr = alloc_newblock(n);
-		if(ptr == NULL){
-			/* fast search failed, find from whole fo DM */
-			ptr = search_freeblock(n);
-			if(ptr == NULL){
-				/* All failed */
-				parm->offset = -1;
-				printk(KERN_ERR "[DM] %s failed!\n", __FUNCTION__);
-				return (-ENOMEM);
-			}
-		}
+		/* failed */
+		parm->offset = -1;
+		printk(KERN_ERR "[DM] %s failed!\n", __FUNCTION__);
+		return (-ENOMEM);
 	}
 
 	/* in case you got space to allocate ... */
@@ -438,169 +478,58 @@ int doDM_MALLOC(dm_ioctl_parm *parm)
 }
 /*****************************************************************************
  << FREE LIST SEARCH >>
+   The smallest list which is not empty and has enough size is taken
+   from the bitmap. In the list for unprepared size, best fit is used.
  *****************************************************************************/
 static dm_blockinfo *search_freelist(int n)
 {
-	dm_blockinfo *ptr, *ptrsft, *prev;
-	int j;
+	dm_blockinfo *ptr, *ptrsft;
+	int m, i, j, len;
 
-	if (n < DM_FREELIST_NUM){
-		/* prepared size ? */
-		if(dm_freelist[n-1] != NULL){
-			/* found in free list */
-			ptr = dm_freelist[n-1];
-			dm_freelist[n-1] = ptr->next;
-			dm_freelist_count[n-1] --; /* decrement the depth of the list */
-			/* update the information of n th list */
-			for(j = 0; j < n; j++){
-				ptrsft = ptr + j;
-				/* ptrsft->offset = (i + j) * DM_BLOCKUNIT_SIZE; */
-				/* ptrsft->num  = n - j; */
-				ptrsft->next = NULL;
-				/* ptrsft->page = dm_current_page; */
-				ptrsft->allocation_flag = 1;
-			}
-		} else {
-			/* search failed */
-			ptr = NULL;
-		}
+	/* list of enough size */
+	m = find_next_bit(dm_freelist_map, DM_FREELIST_NUM, freelist_index(n));
+	if(m >= DM_FREELIST_NUM){
+		/* search failed */
+		return NULL;
+	}
 
+	ptr = NULL;
+	if(m < DM_FREELIST_NUM - 1){
+		/* prepared size: every entry has enough size */
+		ptr = list_entry(dm_freelist[m].next, dm_blockinfo, list);
 	} else {
 		/* required size exceeds the prepared one */
-	        ptr = dm_freelist[DM_FREELIST_NUM-1]; /* list for unprepared size */
-		prev = NULL;
-		
-		while(ptr != NULL){
-		        /* if(ptr->num >= n) break; */
-			if(ptr->num == n) break;
-			prev = ptr;
-			ptr = ptr->next;
+		list_for_each_entry(ptrsft, &dm_freelist[m], list){
+			if(ptrsft->num < n)
+				continue;
+			if(ptr == NULL || ptrsft->num < ptr->num)
+				ptr = ptrsft;
+			if(ptr->num == n)
+				break;
 		}
-		if(ptr != NULL){
-			/* found in free list */
-			if(prev == NULL){
-				dm_freelist[DM_FREELIST_NUM-1] = ptr->next;
-			} else {
-				prev->next = ptr->next;
-			}
-			
-			dm_freelist_count[DM_FREELIST_NUM-1] --; /* decrement the depth of the list */
-
-			/* update the information of n th list */
-			for(j = 0; j < n; j++){
-				ptrsft = ptr + j;
-				/* ptrsft->offset = (i + j) * DM_BLOCKUNIT_SIZE; */
-				/* ptrsft->num  = n - j; */
-				ptrsft->next = NULL;
-				/* ptrsft->page = dm_current_page; */
-				ptrsft->allocation_flag = 1;
-			}
-		} else {
-			/* search in free list failed */
-			ptr = NULL;
-		}
-	}
-	return (ptr);
-}
-
-/*****************************************************************************
- << ALLOCATION OF NEW BLOCKS (fast search) >>
- *****************************************************************************/
-static dm_blockinfo *alloc_newblock(int n)
-{
-	dm_blockinfo *ptr;
-	dm_blockinfo *ptrsft;
-	int i,j;
-	
-	/* cases except (0 < size <= DM_PAGE_SIZE) are blocked in library layer.
-	  if(n > DM_PAGE_BLOCKUNIT_NUM){
-		return NULL;
-	}
-	*/
-
-	if(n > DM_PAGE_BLOCKUNIT_NUM - dm_allocated){
-		/* we can't find enogh space, go next page */
-		if(dm_current_page+1 >= DM_PAGE_NUM){
-			/* no "next page" */
-			return(NULL);
-		}else{
-			/* set "next page" */
-			dm_current_page++; 
-			dm_allocated = 0;
+		if(ptr == NULL){
+			/* search failed */
+			return NULL;
 		}
 	}
 
-	/* allocate new blocks */
-	i = (dm_allocated + DM_PAGE_BLOCKUNIT_NUM * dm_current_page);
-	ptr = dm_blockinfo_tbl + i;
+	i = ptr - dm_blockinfo_tbl;
+	len = ptr->num;
 
-	/* update search pointer */
-	dm_allocated += n;
+	/* take blocks from the top, and return the rest to the list */
+	unlink_freeblock(i);
+	if(len > n){
+		link_freeblock(i + n, len - n);
+	}
 
 	/* set information for each blocks */
 	for(j = 0; j < n; j++){
-		ptrsft = dm_blockinfo_tbl + i + j;
-		/* ptrsft = dm_blockinfo_tbl[i + j]??????;*/
-		/* ptrsft->offset = (i + j) * DM_BLOCKUNIT_SIZE; */
+		ptrsft = ptr + j;
 		ptrsft->num  = n - j;
-		ptrsft->next = NULL;
-		/* ptrsft->page = dm_current_page; */
 		ptrsft->allocation_flag = 1;
 	}
 
-	return(ptr); /* return the address of the top block */
-}
-
-/*****************************************************************************
- << SEARCHING IN WHOLE OF DM >>
- *****************************************************************************/
-static dm_blockinfo *search_freeblock(int n)
-{
-  	dm_blockinfo *ptr;
-	dm_blockinfo *ptrsft;
-	int j;
-	int blknum;
-	int cont;
-
-	cont = 0; /* continuance counter */
-	ptr = NULL;
-
-	for(j = 0; j < DM_BLOCKUNIT_NUM; j++){
-	  /* whole search (start position stored in book_mark) */
-		blknum = (book_mark + j) % DM_BLOCKUNIT_NUM;
-
-		/* page boundary */
-		if(blknum % DM_PAGE_BLOCKUNIT_NUM == 0){
-			cont = 0; 
-		}
-
-		/* look up block information table */
-		ptr = dm_blockinfo_tbl + blknum;
-
-		/* empty block and not stored in free list ? */
-		if((ptr->allocation_flag == 0)&&(ptr->num == 0)){ 
-			cont ++;
-			if(cont == n){ /* found required blocks */
-			        book_mark = blknum + 1; /* prepare for next search */
-				ptr = dm_blockinfo_tbl + blknum - n + 1; /* get the top of the continuous blocks */
-
-				/*  set information for each blocks */
-				for(j = 0; j < n; j++){
-					ptrsft = ptr + j;
-					/* ptrsft->offset = (i + j) * DM_BLOCKUNIT_SIZE; */
-					ptrsft->num  = n - j;
-					ptrsft->next = NULL;
-					/* ptrsft->page = dm_current_page; */
-					ptrsft->allocation_flag = 1;
-				}
-				return(ptr); /* return the top of the blocks */
-			}
-		}else{
-			cont = 0;
-		}
-	}
-
-	return(NULL); /* search failed */
+	return (ptr);
 }
 
 /*****************************************************************************
@@ -611,6 +540,7 @@ int doDM_FREE(dm_ioctl_parm *parm)
 	long offset;
 	int n, m;
 	int i, j;
+	int top, end;
 	dm_blockinfo *ptr;
 	dm_blockinfo *ptrsft;
 
@@ -635,6 +565,14 @@ int doDM_FREE(dm_ioctl_parm *parm)
 	  return -EINVAL;
 	}
 
+	/* not the top of an allocation ? -> abort
+	   (the last block of every allocation has num == 1) */
+	if(i > 0 && dm_blockinfo_tbl[i - 1].allocation_flag
+	   && dm_blockinfo_tbl[i - 1].num != 1){
+		printk(KERN_ERR "[DM] doDM_FREE not top of allocation i=%x,offset=%x\n",i,(int)offset);
+		return -EINVAL;
+	}
+
 	/* get size from block information */
 	n = ptr->num;
 
@@ -647,41 +585,33 @@ int doDM_FREE(dm_ioctl_parm *parm)
 	}
 
 	/* clean up information about indicated blocks */
-    for(j = 0; j < n; j++){
+	for(j = 0; j < n; j++){
 		ptrsft = dm_blockinfo_tbl + i + j;
-		/* ptrsft->offset = (i + j) * DM_BLOCKUNIT_SIZE; */
-		/* ptrsft->num  = 0; */
-		ptrsft->next = NULL;
-		/* ptrsft->page = 0; */
+		ptrsft->num  = 0;
 		ptrsft->allocation_flag = 0;
 	}
 
-	/* gather the continuous blocks with unprepared depth */
-	if(n > DM_FREELIST_NUM){
-		m = DM_FREELIST_NUM; /* m=(int)n */
-	}else{
-		m = n;
+	/* range of the page */
+	top = i & ~(DM_PAGE_BLOCKUNIT_NUM - 1);
+	end = min_t(int, top + DM_PAGE_BLOCKUNIT_NUM, DM_BLOCKUNIT_NUM);
+
+	/* coalesce with the next free blocks */
+	if(i + n < end && dm_blockinfo_tbl[i + n].allocation_flag == 0){
+		m = dm_blockinfo_tbl[i + n].num;
+		unlink_freeblock(i + n);
+		n += m;
 	}
 
-	/* connect it if the depth of the list is less than limit */
-	if(dm_freelist_count[m-1] < dm_freelist_limit[m-1]){
-		ptr->next = dm_freelist[m-1];
-		dm_freelist[m-1] = ptr;
-		dm_freelist_count[m-1] ++; /* increse the depth counter */
-	}else{
-	/* when the current depth exceeds the limit,
-	   don't connect, and initalize "num".
-	   (num=0 when it is  not stored in the list) */
-    	for(j = 0; j < n; j++){
-			ptrsft = dm_blockinfo_tbl + i + j;
-			/* ptrsft->offset = (i + j) * DM_BLOCKUNIT_SIZE; */
-			ptrsft->num  = 0;
-			/* ptrsft->next = NULL; */
-			/* ptrsft->page = 0; */
-			/* ptrsft->allocation_flag = 0; */
-		}
+	/* coalesce with the previous free blocks */
+	if(i > top && dm_blockinfo_tbl[i - 1].allocation_flag == 0){
+		m = dm_blockinfo_tbl[i - 1].num;
+		unlink_freeblock(i - m);
+		i -= m;
+		n += m;
 	}
 
+	link_freeblock(i, n);
+
 	return 0;
 }
 
@@ -744,11 +674,26 @@ int dm_read_proc(char *buf, char **start, off_t offset, int length,
 	int len = 0;
 	int j;
 	dm_blockinfo *ptr;
+	int free_blocks = 0, free_lists = 0, largest = 0;
+
+	down(&sem);
 
+	/* fragmentation */
+	for(j = 0; j < DM_FREELIST_NUM; j++){
+		list_for_each_entry(ptr, &dm_freelist[j], list){
+			free_blocks += ptr->num;
+			free_lists ++;
+			if(ptr->num > largest)
+				largest = ptr->num;
+		}
+	}
 
 	len += sprintf(buf + len, "dm_malloc_count: %d\n", dm_malloc_count);
-	len += sprintf(buf + len, "dm_current_page: %d\n", dm_current_page);
-	len += sprintf(buf + len, "dm_allocated: %d\n", dm_allocated);
+	len += sprintf(buf + len, "dm_free_blocks: %d\n", free_blocks);
+	len += sprintf(buf + len, "dm_free_lists: %d\n", free_lists);
+	len += sprintf(buf + len, "dm_largest_free: %d\n", largest);
+	len += sprintf(buf + len, "dm_fragmentation: %d%%\n",
+		       free_blocks ? 100 - (largest * 100 / free_blocks) : 0);
 
 	for(j = 0; j < DM_PAGE_NUM; j++){
 		len += sprintf(buf + len, "dm_pages[%d]: logic adr=%08x, phy adr=%08x\n",
@@ -762,12 +707,12 @@ int dm_read_proc(char *buf, char **start, off_t offset, int length,
 
 
 	len += sprintf(buf + len, "dm_blockinfo_tbl: \n");
-	len += sprintf(buf + len, "[blk][offset][num][next][flg]\n");
+	len += sprintf(buf + len, "[blk][offset][num][flg]\n");
 	for(j = 0; j < DM_BLOCKUNIT_NUM; j++){
 		ptr = dm_blockinfo_tbl + j;
-			len += sprintf(buf + len, "%04d %08x %04d %08x %01d\n",
+			len += sprintf(buf + len, "%04d %08x %04d %01d\n",
 		           j, (unsigned int)ptr->offset, ptr->num,
-		           (unsigned int)ptr->next, ptr->allocation_flag);
+		           ptr->allocation_flag);
 
 		pos = begin + len;
 		if(pos<offset){
@@ -780,6 +725,8 @@ int dm_read_proc(char *buf, char **start, off_t offset, int length,
 	*eof = 1;
 
 done:
+	up(&sem);
+
 	*start=buf+(offset-begin);
 	len-=(offset-begin);
 	if(len>length)
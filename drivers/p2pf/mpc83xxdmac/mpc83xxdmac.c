@@ -17,6 +17,12 @@
 #include <linux/device.h>
 #include <linux/ioctl.h>
 #include <linux/interrupt.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/scatterlist.h>
+#include <linux/completion.h>
+#include <linux/poll.h>
 
 #include <asm/irq.h>
 #include <asm/mmu.h>
@@ -38,6 +44,7 @@ int MPC83xxDmacClose(struct inode *pINode, struct file *pFile);
 ssize_t MPC83xxDmacRead(struct file *filp, char *buf, size_t count, loff_t *offset);
 ssize_t MPC83xxDmacWrite(struct file *filp, const char *buf, size_t count, loff_t *offset);
 loff_t MPC83xxDmacSeek(struct file *filp, loff_t offset, int origin);
+unsigned int MPC83xxDmacPoll(struct file *filp, poll_table *wait);
 static irqreturn_t MPC83xxDmacInterrupt ( int irq, void *dev_id);
 int MPC83xxDmacDirectMode(
 	int dma_ch,unsigned int src, unsigned int dest,
@@ -82,6 +89,9 @@ static spinlock_t use_lock[MPC83XXDMA_CHNUM];
 /* DMA complation flag */
 static int in_dma[MPC83XXDMA_CHNUM];
 
+/* Direct mode owns the channel (set/cleared under chain_lock only) */
+static int direct_owner[MPC83XXDMA_CHNUM];
+
 /* DMA lock */
 static spinlock_t dma_lock[MPC83XXDMA_CHNUM];
 
@@ -94,6 +104,20 @@ static int dma_status[MPC83XXDMA_CHNUM];
 /* Timer handers */
 static struct timer_list mpc83xxdmac_timer[MPC83XXDMA_CHNUM];
 
+/* Chain mode: queued and running transfers */
+static struct list_head chain_queue[MPC83XXDMA_CHNUM];
+static MPC83xxDmacJob *chain_cur[MPC83XXDMA_CHNUM];
+
+/* Chain mode lock (chain_queue, chain_cur, direct_owner, user_done) */
+static spinlock_t chain_lock[MPC83XXDMA_CHNUM];
+
+/* Channel idle / user transfer done wait queues */
+static wait_queue_head_t chain_wq[MPC83XXDMA_CHNUM];
+
+/* Finished user transfers and the number not yet reaped */
+static struct list_head user_done[MPC83XXDMA_CHNUM];
+static int user_pending[MPC83XXDMA_CHNUM];
+
 /* Character device structure */
 struct cdev *MPC83xxDmacDev;
 
@@ -112,6 +136,7 @@ static struct file_operations MPC83xxDmacOperations= {
 	read	:	MPC83xxDmacRead,
 	write	:	MPC83xxDmacWrite,
 	llseek	:	MPC83xxDmacSeek,
+	poll	:	MPC83xxDmacPoll,
 };
 
 
@@ -171,6 +196,415 @@ static void *get_dma_space(size_t *entry_size)
 }
 
 
+/*
+ *  Chain mode
+ *
+ *    A transfer is described by a scatterlist on the memory side and
+ *    one contiguous device address. Each entry becomes one descriptor,
+ *    and the channel walks the whole list without CPU help. Transfers
+ *    are queued per channel and completion is reported from
+ *    MPC83xxDmacInterrupt through the submitter's callback.
+ */
+static void MPC83xxDmacSyncSg(struct scatterlist *sgl, int nents, int direction)
+{
+  struct scatterlist *sg;
+  int i;
+
+  for_each_sg(sgl, sg, nents, i){
+    void *vaddr = kmap(sg_page(sg));
+    dma_cache_sync(NULL, vaddr + sg->offset, sg->length, direction);
+    kunmap(sg_page(sg));
+  }
+}
+
+
+/* Start the next queued chain. chain_lock must be held. */
+static void MPC83xxDmacStartChain(int dma_ch)
+{
+  MPC83xxDmacJob *job;
+  unsigned int mode = DMAMR_EOTIE_INT|DMAMR_TEM_ERROR|DMAMR_CTM_CHAINING;
+
+  /* Channel is busy in direct mode or chain mode */
+  if(direct_owner[dma_ch] || chain_cur[dma_ch] || list_empty(&chain_queue[dma_ch]))
+    return;
+
+  job = list_entry(chain_queue[dma_ch].next, MPC83xxDmacJob, list);
+  list_del(&job->list);
+  chain_cur[dma_ch] = job;
+
+  DbgPrint(("[%s] ch=%d desc=%p nr=%d\n", __FUNCTION__, dma_ch, job->desc, job->nr_desc));
+
+  /* Channel start is triggered by the 0->1 transition of CS */
+  iowrite32( mode, baseaddr + MPC83xxDmaModeReg[dma_ch]);
+  iowrite32( __pa(job->desc) | DMACDAR_SNEN, baseaddr + MPC83xxDmaCurrentDescAddressReg[dma_ch]);
+
+  mod_timer(&mpc83xxdmac_timer[dma_ch], jiffies + MPC83XXDMAC_TIMEOUT);
+
+  iowrite32( mode|DMAMR_CS, baseaddr + MPC83xxDmaModeReg[dma_ch]);
+}
+
+
+/* Complete the running chain and start the next one. */
+static void MPC83xxDmacFinishChain(int dma_ch, int status)
+{
+  MPC83xxDmacJob *job;
+  unsigned long flags;
+
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  job = chain_cur[dma_ch];
+  chain_cur[dma_ch] = NULL;
+  MPC83xxDmacStartChain(dma_ch);
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+
+  /* Direct mode may be waiting for this channel */
+  wake_up(&chain_wq[dma_ch]);
+
+  if(job == NULL)
+    return;
+
+  if(status < 0)
+    printk(KERN_ERR "[%s:%d] ch%d chain transfer failed (%d)\n", __FUNCTION__, __LINE__, dma_ch, status);
+
+  if(job->callback)
+    job->callback(job->arg, status);
+
+  kfree(job->desc_buf);
+  kfree(job);
+}
+
+
+/* Direct mode is done with the channel; let queued chains run. */
+static void MPC83xxDmacReleaseDirect(int dma_ch)
+{
+  unsigned long flags;
+
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  direct_owner[dma_ch] = 0;
+  MPC83xxDmacStartChain(dma_ch);
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+
+  wake_up(&chain_wq[dma_ch]);
+}
+
+
+/******************************************************************************
+ *** FUNCTION	: MPC83xxDmacSubmitChain
+ *** INPUT	: dma_ch   : DMA channel
+ ***		  sg/nents : memory side of the transfer
+ ***		  dev_addr : device (bus) address
+ ***		  command  : DMAC_READ (device -> memory) or DMAC_WRITE
+ ***		  callback : called with arg and status on completion
+ *** OUTPUT	:
+ *** RETURN	:  0       : queued
+ ***		:  -EINVAL : invalid parameter
+ ***		:  -ENOMEM : No Memory
+ *** NOTE	: Queue a chain mode transfer. Returns without waiting.
+ ***		  Must be called from process context.
+ ******************************************************************************/
+int MPC83xxDmacSubmitChain(int dma_ch, struct scatterlist *sgl, int nents,
+			   unsigned int dev_addr, unsigned int command,
+			   MPC83xxDmacCallback callback, void *arg)
+{
+  MPC83xxDmacJob *job;
+  struct scatterlist *sg;
+  unsigned long flags;
+  int ret_val = 0;
+  int i;
+
+  if(dma_ch < 0 || dma_ch >= MPC83XXDMA_CHNUM || (USE_CH & (1 << dma_ch)) == 0 || nents <= 0){
+    printk(KERN_ERR "[%s:%d] Invalid parameter\n", __FUNCTION__, __LINE__);
+    return -EINVAL;
+  }
+
+  job = kmalloc(sizeof(MPC83xxDmacJob), GFP_KERNEL);
+  if(!job){
+    printk(KERN_ERR "[%s:%d] cannot get job\n", __FUNCTION__, __LINE__);
+    return -ENOMEM;
+  }
+
+  job->desc_buf = kmalloc(sizeof(MPC83xxDmaDesc) * nents + MPC83XXDMAC_DESC_ALIGN - 1, GFP_KERNEL);
+  if(!job->desc_buf){
+    printk(KERN_ERR "[%s:%d] cannot get descriptors\n", __FUNCTION__, __LINE__);
+    kfree(job);
+    return -ENOMEM;
+  }
+  job->desc = (MPC83xxDmaDesc *)ALIGN((unsigned long)job->desc_buf, MPC83XXDMAC_DESC_ALIGN);
+  job->nr_desc = nents;
+  job->callback = callback;
+  job->arg = arg;
+
+#if defined(CONFIG_ZION_PCI)
+  if(command == DMAC_READ){
+    ret_val = ZION_check_addr_and_pci_cache_clear(dev_addr);
+    if(ret_val < 0){
+      printk(KERN_ERR "[%s:%d] ZION_pci_cache_clear Failed.\n", __FUNCTION__, __LINE__);
+      goto FREE;
+    }
+  }
+#endif /* CONFIG_ZION_PCI */
+
+  MPC83xxDmacSyncSg(sgl, nents, (command == DMAC_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+
+  /* Build descriptors */
+  for_each_sg(sgl, sg, nents, i){
+    MPC83xxDmaDesc *desc = &job->desc[i];
+    unsigned int mem_addr = (unsigned int)sg_phys(sg);
+
+    if(sg->length == 0 || sg->length > MPC83XXDMAC_DMAC_MAX_SIZE){
+      printk(KERN_ERR "[%s:%d] Invalid Size.\n", __FUNCTION__, __LINE__);
+      ret_val = -EINVAL;
+      goto FREE;
+    }
+
+    memset(desc, 0, sizeof(MPC83xxDmaDesc));
+
+    if(command == DMAC_READ){
+      desc->src_addr = cpu_to_le32(dev_addr);
+      desc->dest_addr = cpu_to_le32(mem_addr);
+    }
+    else{
+      desc->src_addr = cpu_to_le32(mem_addr);
+      desc->dest_addr = cpu_to_le32(dev_addr);
+    }
+    desc->count = cpu_to_le32(sg->length);
+
+    if(i == nents - 1)
+      desc->next_desc = cpu_to_le32(DMANDAR_EOTD);
+    else
+      desc->next_desc = cpu_to_le32((unsigned int)__pa(&job->desc[i + 1]) | DMANDAR_SNEN);
+
+    dev_addr += sg->length;
+  }
+
+  dma_cache_sync(NULL, job->desc, sizeof(MPC83xxDmaDesc) * nents, DMA_TO_DEVICE);
+
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  list_add_tail(&job->list, &chain_queue[dma_ch]);
+  MPC83xxDmacStartChain(dma_ch);
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+
+  return 0;
+
+ FREE:
+  kfree(job->desc_buf);
+  kfree(job);
+
+  return ret_val;
+}
+EXPORT_SYMBOL(MPC83xxDmacSubmitChain);
+
+
+/*
+ *  Chain mode for user buffers
+ *
+ *    The user pages are pinned and handed to the channel directly,
+ *    so no bounce buffer or copy is needed.
+ */
+static MPC83xxDmacUserJob *MPC83xxDmacUserMap(int dma_ch, unsigned long uaddr,
+					      size_t size, unsigned int command)
+{
+  MPC83xxDmacUserJob *ujob;
+  unsigned long first = uaddr >> PAGE_SHIFT;
+  unsigned long last = (uaddr + size - 1) >> PAGE_SHIFT;
+  int nr_pages = last - first + 1;
+  unsigned int offset = uaddr & ~PAGE_MASK;
+  int got, i;
+
+  if(size == 0 || size > MPC83XXDMAC_DMAC_MAX_SIZE)
+    return NULL;
+
+  ujob = kzalloc(sizeof(MPC83xxDmacUserJob), GFP_KERNEL);
+  if(!ujob)
+    return NULL;
+
+  ujob->pages = kmalloc(sizeof(struct page *) * nr_pages, GFP_KERNEL);
+  ujob->sg = kmalloc(sizeof(struct scatterlist) * nr_pages, GFP_KERNEL);
+  if(!ujob->pages || !ujob->sg)
+    goto FREE;
+
+  down_read(&current->mm->mmap_sem);
+  got = get_user_pages(current, current->mm, uaddr & PAGE_MASK, nr_pages,
+		       (command == DMAC_READ), 0, ujob->pages, NULL);
+  up_read(&current->mm->mmap_sem);
+
+  if(got != nr_pages){
+    DbgPrint(("[%s] get_user_pages %d/%d\n", __FUNCTION__, got, nr_pages));
+    for(i = 0; i < got; i++)
+      page_cache_release(ujob->pages[i]);
+    goto FREE;
+  }
+
+  sg_init_table(ujob->sg, nr_pages);
+  for(i = 0; i < nr_pages; i++){
+    unsigned int len = min_t(size_t, PAGE_SIZE - offset, size);
+
+    sg_set_page(&ujob->sg[i], ujob->pages[i], len, offset);
+    size -= len;
+    offset = 0;
+  }
+
+  ujob->dma_ch = dma_ch;
+  ujob->command = command;
+  ujob->nr_pages = nr_pages;
+
+  return ujob;
+
+ FREE:
+  kfree(ujob->sg);
+  kfree(ujob->pages);
+  kfree(ujob);
+
+  return NULL;
+}
+
+
+static void MPC83xxDmacUserRelease(MPC83xxDmacUserJob *ujob)
+{
+  int i;
+
+  for(i = 0; i < ujob->nr_pages; i++){
+    if(ujob->command == DMAC_READ)
+      set_page_dirty_lock(ujob->pages[i]);
+    page_cache_release(ujob->pages[i]);
+  }
+
+  kfree(ujob->sg);
+  kfree(ujob->pages);
+  kfree(ujob);
+}
+
+
+static void MPC83xxDmacUserDone(void *arg, int status)
+{
+  MPC83xxDmacUserJob *ujob = (MPC83xxDmacUserJob *)arg;
+  int dma_ch = ujob->dma_ch;
+  unsigned long flags;
+
+  ujob->status = status;
+
+  /* Synchronous read()/write() */
+  if(ujob->done){
+    complete(ujob->done);
+    return;
+  }
+
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  list_add_tail(&ujob->list, &user_done[dma_ch]);
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+
+  wake_up(&chain_wq[dma_ch]);
+}
+
+
+/* Transfer a pinned user buffer and wait for it. */
+static int MPC83xxDmacUserSync(MPC83xxDmacUserJob *ujob, unsigned int dev_addr)
+{
+  DECLARE_COMPLETION_ONSTACK(done);
+  int ret_val;
+
+  ujob->done = &done;
+
+  ret_val = MPC83xxDmacSubmitChain(ujob->dma_ch, ujob->sg, ujob->nr_pages,
+				   dev_addr, ujob->command, MPC83xxDmacUserDone, ujob);
+  if(ret_val == 0){
+    wait_for_completion(&done);
+    ret_val = ujob->status;
+  }
+
+  MPC83xxDmacUserRelease(ujob);
+
+  return ret_val;
+}
+
+
+/* Take one finished user transfer. */
+static int MPC83xxDmacUserReap(int dma_ch, int nonblock, DmaChainResult *result)
+{
+  MPC83xxDmacUserJob *ujob;
+  unsigned long flags;
+
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+
+  while(list_empty(&user_done[dma_ch])){
+    if(user_pending[dma_ch] == 0){
+      spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+      return -EINVAL;
+    }
+    spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+
+    if(nonblock)
+      return -EAGAIN;
+
+    if(wait_event_interruptible(chain_wq[dma_ch], !list_empty(&user_done[dma_ch])))
+      return -ERESTARTSYS;
+
+    spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  }
+
+  ujob = list_entry(user_done[dma_ch].next, MPC83xxDmacUserJob, list);
+  list_del(&ujob->list);
+  user_pending[dma_ch]--;
+
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+
+  result->tag = ujob->tag;
+  result->status = ujob->status;
+
+  MPC83xxDmacUserRelease(ujob);
+
+  return 0;
+}
+
+
+/* Wait for every outstanding user transfer and drop the results. */
+static void MPC83xxDmacUserDrain(int dma_ch)
+{
+  MPC83xxDmacUserJob *ujob;
+  unsigned long flags;
+
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+
+  while(user_pending[dma_ch]){
+    while(list_empty(&user_done[dma_ch])){
+      spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+      wait_event(chain_wq[dma_ch], !list_empty(&user_done[dma_ch]));
+      spin_lock_irqsave(&chain_lock[dma_ch], flags);
+    }
+
+    ujob = list_entry(user_done[dma_ch].next, MPC83xxDmacUserJob, list);
+    list_del(&ujob->list);
+    user_pending[dma_ch]--;
+
+    spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+    MPC83xxDmacUserRelease(ujob);
+    spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  }
+
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+}
+
+
+/******************************************************************************
+ *** FUNCTION	: MPC83xxDmacPoll
+ *** INPUT	:
+ *** OUTPUT	:
+ *** RETURN	: POLLIN : a chain transfer has finished
+ *** NOTE	: Device poll
+ ******************************************************************************/
+unsigned int MPC83xxDmacPoll(struct file *filp, poll_table *wait)
+{
+  unsigned int minor = MINOR(filp->f_dentry->d_inode->i_rdev);
+  unsigned int mask = 0;
+
+  poll_wait(filp, &chain_wq[minor], wait);
+
+  if(!list_empty(&user_done[minor]))
+    mask |= POLLIN | POLLRDNORM;
+
+  return mask;
+}
+
+
 /******************************************************************************
  *** FUNCTION	: init_module
  *** INPUT	:
@@ -234,6 +668,7 @@ int init_module(void)
   for(i = 0; i < MPC83XXDMA_CHNUM; i++){
     in_use[i] = 0;
     in_dma[i] = 0;
+    direct_owner[i] = 0;
     dma_status[i] = 0;
     
     spin_lock_init(&use_lock[i]);
@@ -242,6 +677,14 @@ int init_module(void)
     /* Initializing wait queue */
     init_waitqueue_head(&mpc83xxdmac_wq[i]);
     
+    /* Initializing chain mode */
+    INIT_LIST_HEAD(&chain_queue[i]);
+    chain_cur[i] = NULL;
+    spin_lock_init(&chain_lock[i]);
+    init_waitqueue_head(&chain_wq[i]);
+    INIT_LIST_HEAD(&user_done[i]);
+    user_pending[i] = 0;
+    
     /* Initializing timer */
     init_timer(&mpc83xxdmac_timer[i]);
     mpc83xxdmac_timer[i].data = (unsigned long)i;
@@ -407,6 +850,13 @@ int MPC83xxDmacClose(struct inode *pINode, struct file *pFile)
     return -EINVAL;
   }      
   
+  spin_unlock(&use_lock[dma_ch]);
+  
+  /* Wait for chain transfers still using the user pages */
+  MPC83xxDmacUserDrain(dma_ch);
+  
+  spin_lock(&use_lock[dma_ch]);
+  
   /* Not in use. */
   in_use[dma_ch] = 0;
   
@@ -429,6 +879,10 @@ int MPC83xxDmacIoctl(struct inode *pINode, struct file *pFile, unsigned int cmd,
 {
   int ret = 0;
   DmaStruct param;
+  DmaChainStruct chain;
+  DmaChainResult result;
+  MPC83xxDmacUserJob *ujob;
+  unsigned long flags;
   unsigned int minor = MINOR( pINode -> i_rdev);
   
   DbgPrint(("[%s] arg=%x\n",__FUNCTION__,(unsigned int)arg));
@@ -458,6 +912,59 @@ int MPC83xxDmacIoctl(struct inode *pINode, struct file *pFile, unsigned int cmd,
     
     return 0;
     
+  case IOCTL_DMAC_CHAIN_DMA:
+    /* DMA Transfer in Chain mode, returns without waiting */
+    if (copy_from_user(&chain, (DmaChainStruct *)arg, sizeof(DmaChainStruct))) {
+      return -EFAULT;
+    }
+    
+    if(chain.size == 0 || chain.size > MPC83XXDMAC_DMAC_MAX_SIZE
+       || (chain.command != DMAC_READ && chain.command != DMAC_WRITE)){
+      return -EINVAL;
+    }
+    
+    spin_lock_irqsave(&chain_lock[minor], flags);
+    if(user_pending[minor] >= MPC83XXDMAC_CHAIN_MAX_JOBS){
+      spin_unlock_irqrestore(&chain_lock[minor], flags);
+      return -EAGAIN;
+    }
+    user_pending[minor]++;
+    spin_unlock_irqrestore(&chain_lock[minor], flags);
+    
+    ujob = MPC83xxDmacUserMap(minor, chain.user_addr, chain.size, chain.command);
+    if(!ujob){
+      ret = -EFAULT;
+      goto CHAIN_CANCEL;
+    }
+    ujob->tag = chain.tag;
+    
+    ret = MPC83xxDmacSubmitChain(minor, ujob->sg, ujob->nr_pages, chain.dev_addr,
+				 chain.command, MPC83xxDmacUserDone, ujob);
+    if(ret < 0){
+      MPC83xxDmacUserRelease(ujob);
+      goto CHAIN_CANCEL;
+    }
+    
+    return 0;
+    
+  CHAIN_CANCEL:
+    spin_lock_irqsave(&chain_lock[minor], flags);
+    user_pending[minor]--;
+    spin_unlock_irqrestore(&chain_lock[minor], flags);
+    return ret;
+    
+  case IOCTL_DMAC_CHAIN_WAIT:
+    /* Wait for a Chain mode transfer */
+    ret = MPC83xxDmacUserReap(minor, (pFile->f_flags & O_NONBLOCK), &result);
+    if(ret < 0)
+      return ret;
+    
+    if (copy_to_user((DmaChainResult *)arg, &result, sizeof(DmaChainResult))) {
+      return -EFAULT;
+    }
+    
+    return 0;
+    
   default:
     return -EINVAL;		
   }
@@ -477,8 +984,21 @@ ssize_t MPC83xxDmacRead(struct file *filp, char *buf, size_t count, loff_t *offs
 {
   size_t read_size = 0;
   unsigned int minor = MINOR(filp->f_dentry->d_inode->i_rdev);
+  MPC83xxDmacUserJob *ujob;
   ssize_t ret_val;
   
+  /* Transfer into the user pages directly if they can be pinned */
+  ujob = MPC83xxDmacUserMap(minor, (unsigned long)buf, count, DMAC_READ);
+  if(ujob){
+    ret_val = MPC83xxDmacUserSync(ujob, (unsigned int)*offset);
+    if(ret_val < 0){
+      printk(KERN_ERR "[%s:%d] cannot transfer\n", __FUNCTION__, __LINE__);
+      return -EIO;
+    }
+    *offset += count;
+    return count;
+  }
+  
   while(count){
     size_t buf_size, net_size;
     void *kbuf;
@@ -541,8 +1061,21 @@ ssize_t MPC83xxDmacWrite(struct file *filp, const char *buf, size_t count, loff_
 {
   size_t written_size = 0;
   unsigned int minor = MINOR(filp->f_dentry->d_inode->i_rdev);
+  MPC83xxDmacUserJob *ujob;
   ssize_t ret_val;
   
+  /* Transfer from the user pages directly if they can be pinned */
+  ujob = MPC83xxDmacUserMap(minor, (unsigned long)buf, count, DMAC_WRITE);
+  if(ujob){
+    ret_val = MPC83xxDmacUserSync(ujob, (unsigned int)*offset);
+    if(ret_val < 0){
+      printk(KERN_ERR "[%s:%d] cannot transfer\n", __FUNCTION__, __LINE__);
+      return -EIO;
+    }
+    *offset += count;
+    return count;
+  }
+  
   while(count){
     size_t buf_size, net_size;
     void *kbuf;
@@ -633,6 +1166,7 @@ int MPC83xxDmacDirectMode(
 { 
   //  int counter=0;
   int ret_val = 0;
+  unsigned long flags;
   
   DbgPrint(("[%s] ch=%d src_addr=0x%08x dest_addr=0x%08x size=0x%08x command=%d\n"
 	    ,__FUNCTION__
@@ -642,9 +1176,21 @@ int MPC83xxDmacDirectMode(
 	    ,(unsigned int)size
 	    ,(unsigned int)command ));
   
-  if(dma_ch > MPC83XXDMA_CHNUM)
+  if(dma_ch >= MPC83XXDMA_CHNUM)
     return -1;
   
+  /*
+   * Wait for chain mode transfers and take the channel
+   */
+  spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  while(chain_cur[dma_ch] || direct_owner[dma_ch]){
+    spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+    wait_event(chain_wq[dma_ch], (chain_cur[dma_ch]==NULL && direct_owner[dma_ch]==0));
+    spin_lock_irqsave(&chain_lock[dma_ch], flags);
+  }
+  direct_owner[dma_ch] = 1;
+  spin_unlock_irqrestore(&chain_lock[dma_ch], flags);
+  
   spin_lock(&dma_lock[dma_ch]);
   
   /*
@@ -654,6 +1200,7 @@ int MPC83xxDmacDirectMode(
   if((ioread32(baseaddr + MPC83xxDmaStatusReg[dma_ch]) && DMASR_CB) != 0){
     printk(KERN_ERR "[%s:%d] DMA ch%d is busy!\n", __FUNCTION__, __LINE__, dma_ch);
     spin_unlock(&dma_lock[dma_ch]);
+    MPC83xxDmacReleaseDirect(dma_ch);
     return -EBUSY;
   }
   
@@ -668,6 +1215,8 @@ int MPC83xxDmacDirectMode(
     if(ret_val<0)
       {
 	printk(KERN_ERR "[%s:%d] ZION_pci_cache_clear Failed.\n", __FUNCTION__, __LINE__);
+	spin_unlock(&dma_lock[dma_ch]);
+	MPC83xxDmacReleaseDirect(dma_ch);
 	return ret_val;
       }
 #endif /* CONFIG_ZION_PCI */
@@ -697,8 +1246,8 @@ int MPC83xxDmacDirectMode(
   /*
    * Start DMA
    */
-  in_dma[dma_ch] = 1;
   dma_status[dma_ch] = MPC83XXDMAC_DMA_NONE; /* Clear DMA status */
+  in_dma[dma_ch] = 1;
 
   /* Start timer */
   if (mpc83xxdmac_timer[dma_ch].function){
@@ -751,6 +1300,9 @@ int MPC83xxDmacDirectMode(
 
   spin_unlock(&dma_lock[dma_ch]);
 
+  /* Let queued chain mode transfers run */
+  MPC83xxDmacReleaseDirect(dma_ch);
+
   return ret_val;
 }
 
@@ -794,6 +1346,12 @@ static irqreturn_t MPC83xxDmacInterrupt (int irq, void *dev_id)
   DbgPrint(("[%s] Clear DMA interrupt status.\n", __FUNCTION__));
   iowrite32( DMASR_EOCDI|DMASR_EOSI, baseaddr + MPC83xxDmaStatusReg[dma_ch]);
   
+  /* Chain mode transfer */
+  if(!direct_owner[dma_ch] && chain_cur[dma_ch]){
+    MPC83xxDmacFinishChain(dma_ch, (dmasr&DMASR_TE) ? -EIO : 0);
+    return IRQ_RETVAL(IRQ_HANDLED);
+  }
+  
   /* DMA flag */
   in_dma[dma_ch] = 0;
   
@@ -828,6 +1386,14 @@ static void MPC83xxDmacTimeout (unsigned long arg)
 
   /* FIXME: cannot stop interrupt. */
 
+  /* Chain mode transfer: stop the channel and give up the chain */
+  if(!direct_owner[dma_ch] && chain_cur[dma_ch]){
+    printk(KERN_ERR "[%s:%d] DMA ch%d chain timeout!\n", __FUNCTION__, __LINE__, dma_ch);
+    iowrite32( 0, baseaddr + MPC83xxDmaModeReg[dma_ch]);
+    MPC83xxDmacFinishChain(dma_ch, -ETIMEDOUT);
+    return;
+  }
+
   /* Set DMA status */
   dma_status[dma_ch] = MPC83XXDMAC_DMA_TIMEOUT;
 
@@ -836,6 +1402,9 @@ static void MPC83xxDmacTimeout (unsigned long arg)
 
   DbgPrint(("[%s] DMAC %d Timeout!\n",__FUNCTION__,dma_ch));
 
+  /* Stop the channel before the direct mode caller releases it */
+  iowrite32( 0, baseaddr + MPC83xxDmaModeReg[dma_ch]);
+
   /* DMA flag */
   in_dma[dma_ch] = 0;
 
@@ -19,7 +19,7 @@
 
 #define MPC83XX_IRQ_DMA 71
 
-#define	VERSION	"0.6"
+#define	VERSION	"0.7"
 
 
 /*
@@ -41,6 +41,7 @@ enum MPC83XXDMAC_DEFAULT_ENUM {
   MPC83XXDMAC_TIMEOUT = (3*HZ), /* MPC83xx DMAC timeout */
   MPC83XXDMA_CHNUM = 4,         /* MPC83xx DMAC channel number */
   MPC83XXDMAC_PAGE_ORDER = (CONFIG_MPC83XXDMAC_PAGE_ORDER), /* MPC83xx DMAC buffer size */
+  MPC83XXDMAC_CHAIN_MAX_JOBS = 16, /* outstanding chain transfers per user */
 };
 
 
@@ -123,6 +124,51 @@ enum MPC83XXDMAC_DEFAULT_ENUM {
 #define DMACDAR_EOSI_EN     0x00000008
 #define DMACDAR_EOSI_DIS    0x00000000
 
+/* Next Descriptor Address bits [Chain mode] */
+#define DMANDAR_SNEN        0x00000010
+#define DMANDAR_EOTD        0x00000001  /* end of descriptor list */
+
+/*
+ *  DMA descriptor [Chain mode]
+ *    32byte aligned, little endian.
+ *    Upper words of each address are not used on MPC83xx.
+ */
+typedef struct _MPC83xxDmaDesc {
+  unsigned int src_addr;
+  unsigned int src_addr_hi;
+  unsigned int dest_addr;
+  unsigned int dest_addr_hi;
+  unsigned int next_desc;
+  unsigned int next_desc_hi;
+  unsigned int count;
+  unsigned int reserved;
+} MPC83xxDmaDesc;
+
+#define MPC83XXDMAC_DESC_ALIGN 32
+
+/* Queued chain mode transfer */
+typedef struct _MPC83xxDmacJob {
+  struct list_head list;
+  void *desc_buf;               /* kmalloc'ed area */
+  MPC83xxDmaDesc *desc;         /* aligned descriptors in desc_buf */
+  int nr_desc;
+  MPC83xxDmacCallback callback;
+  void *arg;
+} MPC83xxDmacJob;
+
+/* Chain mode transfer on a pinned user buffer */
+typedef struct _MPC83xxDmacUserJob {
+  struct list_head list;
+  int dma_ch;
+  unsigned int command;
+  unsigned int tag;
+  int status;
+  int nr_pages;
+  struct page **pages;
+  struct scatterlist *sg;
+  struct completion *done;      /* set for synchronous read()/write() */
+} MPC83xxDmacUserJob;
+
 
 /* DMA Mode Register */
 unsigned int MPC83xxDmaModeReg[MPC83XXDMA_CHNUM] = {
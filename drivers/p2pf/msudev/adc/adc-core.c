@@ -20,6 +20,12 @@
 #endif  /* CONFIG_MSUDEV_ADC_PROC */
 #include <linux/sched.h>
 #include <linux/semaphore.h>      /* semaphore */
+#include <linux/wait.h>         /* wait queue */
+#include <linux/poll.h>         /* poll */
+#include <linux/workqueue.h>    /* delayed work */
+#include <linux/vmalloc.h>      /* vmalloc_user */
+#include <linux/mm.h>           /* remap_vmalloc_range */
+#include <linux/time.h>         /* do_gettimeofday */
 #include <asm/atomic.h>         /* atomic_t */
 #include <asm/uaccess.h>        /* copy_from_user/copy_to_user */
 
@@ -54,6 +60,21 @@ static struct proc_dir_entry *proc_entry=NULL;
 /* file operations */
 static struct msudev_adc_ops *adc_ops=NULL;
 
+/* streaming mode */
+#define NR_STREAM_BUFF  256
+static struct {
+    struct p2msudev_adc_ring *ring; /* shared with user space by mmap() */
+    unsigned long size_ring;        /* size of ring [byte] */
+    unsigned long rp;               /* read pointer for read() */
+    unsigned long chan_mask;        /* sampled channels */
+    unsigned long period;           /* sampling period [jiffies] */
+    unsigned long next;             /* jiffies of next scan */
+    unsigned long nr_late;          /* scans started behind time */
+    int running;
+    struct delayed_work work;
+    wait_queue_head_t wait_queue;
+} stream;
+
 
 /*******************************************************************************
  ** functions for  /proc entry
@@ -90,6 +111,11 @@ static int procfunc_read(char *buff, char **start, off_t offset, int count, int
             len += sprintf(buff+len, "ADC(%d) = 0x%08lX\n", chan,value);
         }
     }
+    len += sprintf(buff+len, "stream: %s mask=0x%02lX period=%lu[jiffies]\n",
+                   stream.running?"running":"stopped", stream.chan_mask, stream.period);
+    len += sprintf(buff+len, "stream: scans=%lu buffered=%lu overrun=%lu late=%lu\n",
+                   stream.ring->wp, stream.ring->wp - stream.rp,
+                   stream.ring->overrun, stream.nr_late);
 
  exit:
     /* semaphore up */
@@ -137,6 +163,124 @@ static void remove_proc(void)
 
 #endif  /* CONFIG_MSUDEV_ADC_PROC */
 
+/*******************************************************************************
+ **  functions for streaming mode
+ ******************************************************************************/
+
+/*
+ * scan the channels once and store it to the ring
+ */
+static void stream_scan(void)
+{
+    struct p2msudev_adc_ring *ring = stream.ring;
+    struct p2msudev_adc_sample *sample = &ring->sample[ring->wp % ring->size];
+    unsigned long value[P2MSUDEV_ADC_MAX_CHAN];
+    int chan, retval=0;
+
+    if(adc_ops->scan){
+        retval = adc_ops->scan(adc_ops, stream.chan_mask, value);
+    } else {
+        for(chan=0; chan<P2MSUDEV_ADC_MAX_CHAN && retval>=0; chan++){
+            if(stream.chan_mask & (1UL<<chan))
+                retval = adc_ops->get_value(adc_ops, chan, &value[chan]);
+        }
+    }
+    if(retval<0){
+        _ERR("scan failed: retval=%d\n", retval);
+        return;
+    }
+
+    sample->seq = ring->wp;
+    sample->chan_mask = stream.chan_mask;
+    sample->jiffies = jiffies;
+    do_gettimeofday(&sample->tv);
+    for(chan=0; chan<P2MSUDEV_ADC_MAX_CHAN; chan++)
+        sample->value[chan] = (stream.chan_mask & (1UL<<chan)) ? value[chan] : 0;
+
+    /* publish the sample before moving wp for mmap readers */
+    smp_wmb();
+    ring->wp++;
+
+    /* the oldest sample is lost for read() */
+    if(ring->wp - stream.rp > ring->size){
+        stream.rp = ring->wp - ring->size;
+        ring->overrun++;
+    }
+}
+
+/*
+ * periodic work of streaming mode
+ */
+static void stream_work(struct work_struct *work)
+{
+    long delay;
+
+    down(&sema);
+
+    if(!stream.running){
+        up(&sema);
+        return;
+    }
+
+    stream_scan();
+
+    /* schedule by absolute time, so that the period does not drift */
+    stream.next += stream.period;
+    delay = (long)(stream.next - jiffies);
+    if(delay<0){
+        stream.nr_late++;
+        stream.next = jiffies;
+        delay = 0;
+    }
+    schedule_delayed_work(&stream.work, delay);
+
+    up(&sema);
+
+    wake_up_interruptible(&stream.wait_queue);
+}
+
+/*
+ * stop streaming (call without sema)
+ */
+static void stream_stop(void)
+{
+    down(&sema);
+    stream.running = 0;
+    up(&sema);
+    cancel_delayed_work_sync(&stream.work);
+    wake_up_interruptible(&stream.wait_queue);
+}
+
+/*
+ * allocate ring buffer
+ */
+static int stream_init(void)
+{
+    stream.size_ring = PAGE_ALIGN(sizeof(struct p2msudev_adc_ring)
+                                  + NR_STREAM_BUFF * sizeof(struct p2msudev_adc_sample));
+    stream.ring = vmalloc_user(stream.size_ring);
+    if(!stream.ring){
+        _ERR("can't allocate stream buffer\n");
+        return -ENOMEM;
+    }
+    stream.ring->size = NR_STREAM_BUFF;
+    INIT_DELAYED_WORK(&stream.work, stream_work);
+    init_waitqueue_head(&stream.wait_queue);
+    return 0;
+}
+
+/*
+ * free ring buffer
+ */
+static void stream_cleanup(void)
+{
+    if(stream.ring){
+        stream_stop();
+        vfree(stream.ring);
+        stream.ring = NULL;
+    }
+}
+
 /*******************************************************************************
  **  functions for ioctl sub-command
  ******************************************************************************/
@@ -231,6 +375,79 @@ static int ioc_adc_reset_check(unsigned int cmd)
     return retval;
 }
 
+/*
+ * ioctl(P2MSUDEV_IOC_ADC_STREAM_START)
+ */
+static int ioc_adc_stream_start(unsigned int cmd, unsigned long arg)
+{
+    struct p2msudev_ioc_adc_stream param;
+    unsigned int nr_chan;
+
+    /* check direction */
+    if(_IOC_DIR(cmd)!=_IOC_WRITE){
+        _ERR("Invalid direction: %d\n", _IOC_DIR(cmd));
+        return -ENOTTY;
+    }
+
+    /* check capability */
+    if(!capable(CAP_SYS_RAWIO))
+        return -EPERM;
+
+    if(copy_from_user(&param, (void __user *)arg, sizeof(param)))
+        return -EFAULT;
+
+    /* check parameters */
+    nr_chan = adc_ops->nr_chan(adc_ops);
+    if(nr_chan>P2MSUDEV_ADC_MAX_CHAN)
+        nr_chan = P2MSUDEV_ADC_MAX_CHAN;
+    if(!param.chan_mask || (param.chan_mask & ~((1UL<<nr_chan)-1))){
+        _ERR("invalid channel mask = 0x%lx\n", param.chan_mask);
+        return -EINVAL;
+    }
+    if(!param.period_ms){
+        _ERR("invalid period = %lu[msec]\n", param.period_ms);
+        return -EINVAL;
+    }
+    if(!adc_ops->scan && !adc_ops->get_value)
+        return -ENODEV;
+
+    /* (re)start: samples not read yet are discarded, wp keeps counting */
+    stream.chan_mask = param.chan_mask;
+    stream.period = msecs_to_jiffies(param.period_ms);
+    if(!stream.period)
+        stream.period = 1;
+    stream.rp = stream.ring->wp;
+    stream.nr_late = 0;
+    stream.next = jiffies;
+    stream.running = 1;
+    schedule_delayed_work(&stream.work, 0);
+
+    return 0;
+}
+
+/*
+ * ioctl(P2MSUDEV_IOC_ADC_STREAM_STOP)
+ */
+static int ioc_adc_stream_stop(unsigned int cmd)
+{
+    /* check direction */
+    if(_IOC_DIR(cmd)!=_IOC_NONE){
+        _ERR("Invalid direction: %d\n", _IOC_DIR(cmd));
+        return -ENOTTY;
+    }
+
+    /* check capability */
+    if(!capable(CAP_SYS_RAWIO))
+        return -EPERM;
+
+    /* a pending scan finds it stopped, since it runs under sema */
+    stream.running = 0;
+    cancel_delayed_work(&stream.work);
+    wake_up_interruptible(&stream.wait_queue);
+
+    return 0;
+}
+
 
 /*******************************************************************************
  **  file_operations function & structure
@@ -250,10 +467,83 @@ static int release_method(struct inode *inode, struct file *filep)
 {
     _DEBUG("proccess %i (%s) going to close the device (%d:%d)\n", 
            current->pid, current->comm, imajor(inode), iminor(inode));
-    atomic_dec(&open_count);
+    if(atomic_dec_and_test(&open_count))
+        stream_stop();
     return 0;
 }
 
+/* read method: returns whole samples of streaming mode */
+static ssize_t read_method(struct file *filep, char __user *buf, size_t count, loff_t *pos)
+{
+    struct p2msudev_adc_ring *ring = stream.ring;
+    const size_t size = sizeof(struct p2msudev_adc_sample);
+    ssize_t retval=0;
+
+    if(count<size)
+        return -EINVAL;
+
+    /* semaphore down */
+    if(down_interruptible(&sema))
+        return -ERESTARTSYS;
+
+    /* wait for samples */
+    while(ring->wp==stream.rp){
+        up(&sema);
+        if(!stream.running)
+            return 0;
+        if(filep->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if(wait_event_interruptible(stream.wait_queue,
+                                    ring->wp!=stream.rp || !stream.running))
+            return -ERESTARTSYS;
+        if(down_interruptible(&sema))
+            return -ERESTARTSYS;
+    }
+
+    /* copy */
+    while(count>=size && stream.rp!=ring->wp){
+        if(copy_to_user(buf+retval, &ring->sample[stream.rp % ring->size], size)){
+            if(!retval)
+                retval = -EFAULT;
+            break;
+        }
+        stream.rp++;
+        retval += size;
+        count -= size;
+    }
+
+    /* semaphore up */
+    up(&sema);
+
+    return retval;
+}
+
+/* poll method */
+static unsigned int poll_method(struct file *filep, poll_table *wait)
+{
+    unsigned int mask=0;
+
+    poll_wait(filep, &stream.wait_queue, wait);
+
+    if(stream.ring->wp!=stream.rp)
+        mask |= POLLIN | POLLRDNORM;
+    else if(!stream.running)
+        mask |= POLLHUP;
+
+    return mask;
+}
+
+/* mmap method: the ring of streaming mode, read-only */
+static int mmap_method(struct file *filep, struct vm_area_struct *vma)
+{
+    if(vma->vm_flags & VM_WRITE)
+        return -EPERM;
+    if(vma->vm_pgoff || vma->vm_end - vma->vm_start > stream.size_ring)
+        return -EINVAL;
+    vma->vm_flags &= ~VM_MAYWRITE;
+    return remap_vmalloc_range(vma, stream.ring, 0);
+}
+
 /* ioctl method */
 static int ioctl_method(struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg)
 {
@@ -277,6 +567,12 @@ static int ioctl_method(struct inode *inode, struct file *filp, unsigned int cmd
     case NR_P2MSUDEV_IOC_ADC_RESET_CHECK:
         ret=ioc_adc_reset_check(cmd);
         break;
+    case NR_P2MSUDEV_IOC_ADC_STREAM_START:
+        ret=ioc_adc_stream_start(cmd,arg);
+        break;
+    case NR_P2MSUDEV_IOC_ADC_STREAM_STOP:
+        ret=ioc_adc_stream_stop(cmd);
+        break;
     default:
         if(adc_ops->ioctl)
             ret = adc_ops->ioctl(adc_ops,cmd,arg);
@@ -295,6 +591,9 @@ static struct file_operations msudev_adc_fops = {
     owner:      THIS_MODULE,
     open:       open_method,
     release:    release_method,
+    read:       read_method,
+    poll:       poll_method,
+    mmap:       mmap_method,
     ioctl:      ioctl_method,
 };
 
@@ -327,6 +626,10 @@ static int __init msudev_adc_init (void)
         goto fail;
     }
 
+    /* streaming mode */
+    if((retval=stream_init())<0)
+        goto fail;
+
 #ifdef CONFIG_MSUDEV_ADC_PROC
     /* create /proc entry */
     if((retval=create_proc())<0)
@@ -380,6 +683,9 @@ fail:
 
     if(retval<0){
 
+        /* free stream buffer */
+        stream_cleanup();
+
         /* clean-up lower level driver */
         if(adc_ops){
             if(adc_ops->cleanup_adc)
@@ -410,6 +716,9 @@ module_init(msudev_adc_init);
  */
 static void __exit msudev_adc_cleanup(void)
 {
+    /* stop streaming */
+    stream_cleanup();
+
     /* clean-up lower level driver */
     if(adc_ops){
         if(adc_ops->cleanup_adc)
@@ -60,6 +60,20 @@ static int get_value(struct msudev_adc_ops *ops, int chan, unsigned long *p_valu
     return 0;
 }
 
+/* get values at once */
+static int scan(struct msudev_adc_ops *ops, unsigned long chan_mask, unsigned long *value)
+{
+    struct adc_param *ap = (struct adc_param *)ops->data;
+    int chan;
+    if(chan_mask & ~((1UL<<ap->nr_chan)-1))
+        return -EINVAL;
+    for(chan=0; chan<ap->nr_chan; chan++){
+        if(chan_mask & (1UL<<chan))
+            value[chan] = ap->flag_reset?0:ap->dummy_chan[chan];
+    }
+    return 0;
+}
+
 /* reset cntrol */
 static int do_reset(struct msudev_adc_ops *ops, int reset_on)
 {
@@ -96,6 +110,7 @@ static struct msudev_adc_ops adc_ops = {
     .init_adc    = init_adc,
     .cleanup_adc = cleanup_adc,
     .get_value  = get_value,
+    .scan       = scan,
     .do_reset   = do_reset,
     .check_reset = check_reset,
     .nr_chan = nr_chan,
@@ -150,6 +150,28 @@ static int get_value(struct msudev_adc_ops *ops, int chan, unsigned long *p_valu
     return 0;
 }
 
+/* get values at once */
+static int scan(struct msudev_adc_ops *ops, unsigned long chan_mask, unsigned long *value)
+{
+    struct adc_param *ap = (struct adc_param *)ops->data;
+    unsigned long flags;
+    int chan;
+
+    if(chan_mask & ~((1UL<<ap->nr_chan)-1)){
+        _ERR("invalid channel mask = 0x%lx\n",chan_mask);
+        return -EINVAL;
+    }
+
+    spin_lock_irqsave(&ap->lock,flags);
+    for(chan=0; chan<ap->nr_chan; chan++){
+        if(chan_mask & (1UL<<chan))
+            value[chan] = in_be16((u16*)&(ap->regs->port[chan])) & MASK_PORT_VALUE;
+    }
+    spin_unlock_irqrestore(&ap->lock,flags);
+
+    return 0;
+}
+
 /* reset cntrol */
 static int do_reset(struct msudev_adc_ops *ops, int reset_on)
 {
@@ -195,6 +217,7 @@ static struct msudev_adc_ops adc_ops = {
     .init_adc    = init_adc,
     .cleanup_adc = cleanup_adc,
     .get_value  = get_value,
+    .scan       = scan,
     .do_reset   = do_reset,
     .check_reset = check_reset,
     .nr_chan = nr_chan,
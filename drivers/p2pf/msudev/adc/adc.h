@@ -19,6 +19,9 @@ struct msudev_adc_ops {
     /* get value */
     int (*get_value)(struct msudev_adc_ops *ops, int chan, unsigned long *p_value);
 
+    /* get values of channels in chan_mask at once (value[] is indexed by channel) */
+    int (*scan)(struct msudev_adc_ops *ops, unsigned long chan_mask, unsigned long *value);
+
     /* reset cntrol */
     int (*do_reset)(struct msudev_adc_ops *ops, int reset_on);
 
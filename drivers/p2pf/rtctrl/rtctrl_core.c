@@ -38,8 +38,7 @@ enum DELAYPROC_DIRTY_ENUM {
 
 enum DELAYPROC_CONST_ENUM {
   DELAYPROC_NRWRITE	= ((4<<20) >> 9),	/* 4MB [sector] */
-  DELAYPROC_WAITTIME	= (HZ >> 2),		/* 250msec */
-  DELAYPROC_TIMEOUT	= (40),			/* 10sec */
+  DELAYPROC_TIMEOUT	= (10 * HZ),		/* 10sec */
   DELAYPROC_MAXLOOP	= (20),			/* the max number of retry */
 };
 
@@ -907,12 +906,62 @@ inline unsigned short get_delayproc_buf_cnt( struct delayproc_info_s *dpinfo )
 }
 
 
+/* Check whether the requests waited by wait_delayproc_req() are done. */
+static inline int delayproc_req_done( struct delayproc_info_s *dpinfo, unsigned char type )
+{
+  unsigned long irq_flg = 0L;
+  int done = 0;
+
+  spin_lock_irqsave( &dpinfo->main->lock, irq_flg ); /* Lock--> */
+  if ( DELAYPROC_TYPE_SYSSYNC != type ) {
+    done = (0 == dpinfo->nr_rq);
+  } else {
+    /* SyncSystemDelayProc waits on dirent requests only. */
+    done = (0 == dpinfo->nr_dirent);
+  }
+  spin_unlock_irqrestore( &dpinfo->main->lock, irq_flg ); /* <--Unlock */
+
+  return (done);
+}
+
+
+/* Account a wait time of wait_delayproc_req(). */
+static inline void delayproc_account_wait( struct delayproc_info_s *dpinfo, unsigned long start, int timedout )
+{
+  unsigned long elapsed = jiffies - start;
+  unsigned long irq_flg = 0L;
+
+  spin_lock_irqsave( &dpinfo->lock, irq_flg ); /* Lock--> */
+  dpinfo->wait_nr++;
+  if ( timedout ) dpinfo->wait_timeout++;
+  dpinfo->wait_last = elapsed;
+  if ( elapsed > dpinfo->wait_max ) dpinfo->wait_max = elapsed;
+  dpinfo->wait_total += elapsed;
+  spin_unlock_irqrestore( &dpinfo->lock, irq_flg ); /* <--Unlock */
+}
+
+
+/* Clear request list for waiting (called with main->lock held).
+   Unlink each request so that a later del_delayproc_req_waitlist() sees it unlinked. */
+static inline void delayproc_clr_req_waitlist( struct delayproc_info_s *dpinfo )
+{
+  struct request *req = NULL, *next = NULL;
+
+  list_for_each_entry_safe( req, next, &dpinfo->rq_list, waitlist ) {
+    list_del_init( &req->waitlist );
+  }
+  dpinfo->nr_rq = 0;
+  dpinfo->nr_dirent = 0;
+}
+
+
 /* Wait on delayproc requests (arg: delayproc info). */
 void wait_delayproc_req( struct delayproc_info_s *dpinfo )
 {
   unsigned char type = 0;
-  unsigned long count = 0;
-  unsigned long timeout = DELAYPROC_WAITTIME;
+  unsigned long start = jiffies;
+  unsigned long irq_flg = 0L;
+  long timeout = DELAYPROC_TIMEOUT;
   PTRACE( " timeout=%ld", timeout );
 
   /* for TEST */
@@ -927,45 +976,17 @@ void wait_delayproc_req( struct delayproc_info_s *dpinfo )
   /* Get type. */
   type = get_delayproc_type( dpinfo );
 
-  /* Check waitlist. */
-  if ( DELAYPROC_TYPE_SYSSYNC != type ) {
-    while ( !list_empty(&dpinfo->rq_list) ) {
-      timeout = schedule_timeout( timeout );
-      if ( timeout ) continue;
-      count++;
-      if ( count > DELAYPROC_TIMEOUT ) { /* About 10sec */
-	goto TIMEOUT;
-      }
-      /* Reset timer. */
-      timeout = DELAYPROC_WAITTIME;
-    }
-  } else {
-    /* Wait SyncSystemDelayProc. */
-    struct list_head *head = &dpinfo->rq_list;
-    struct list_head *walk = NULL;
-    list_for_each( walk, head ) {
-      struct request *rq = list_entry( walk, struct request, waitlist );
-      if ( rq_is_dirent(rq) ) {
-	timeout = schedule_timeout( timeout );
-	if ( !timeout ) {
-	  count++;
-	  if ( count > DELAYPROC_TIMEOUT ) { /* About 10sec */
-	    goto TIMEOUT;
-	  }
-
-	  /* Reset timer. */
-	  timeout = DELAYPROC_WAITTIME;
-	}
-	PDEBUG("Rewind waitlist\n");
-	walk = head; /* Rewind list. */
-      } else {
-	PDEBUG( " ## NOT DIRENT rq found!\n" );
-      }
-    }
+  /* Wait until del_delayproc_req_waitlist() completes the waitlist.
+   *  SyncSystemDelayProc waits on dirent requests only. */
+  timeout = wait_event_timeout( dpinfo->rq_wait,
+				delayproc_req_done(dpinfo, type), timeout );
+  if ( !timeout ) {
+    goto TIMEOUT;
   }
 
   /* Wake up. */
   PDEBUG( "### WAKEUP! rq_list is empty. ###\n" );
+  delayproc_account_wait( dpinfo, start, 0 );
 
   /* Check dirty and RT_ON, and change status and type.
    *  NOTICE: ExecDelayProc only. Otherwise, it's called at sync_delayproc(). */
@@ -978,10 +999,14 @@ void wait_delayproc_req( struct delayproc_info_s *dpinfo )
   return;
 
  TIMEOUT:
-  PERROR( "%s TIMEOUT!!(%ld-%u)\n", __FUNCTION__, count, jiffies_to_msecs(jiffies) );
+  PERROR( "%s TIMEOUT!!(%u-%u)\n", __FUNCTION__,
+	  jiffies_to_msecs(jiffies - start), jiffies_to_msecs(jiffies) );
+  delayproc_account_wait( dpinfo, start, 1 );
 
   /* Clear wait list and status. */
-  INIT_LIST_HEAD( &dpinfo->rq_list );
+  spin_lock_irqsave( &dpinfo->main->lock, irq_flg ); /* Lock--> */
+  delayproc_clr_req_waitlist( dpinfo );
+  spin_unlock_irqrestore( &dpinfo->main->lock, irq_flg ); /* <--Unlock */
   if ( DELAYPROC_TYPE_NORMAL == type ) {
     delayproc_change_status( dpinfo->main, MAJOR(dpinfo->rdev) );
   }
@@ -1320,6 +1345,8 @@ inline void add_delayproc_req_waitlist( struct delayproc_info_s *dpinfo, struct
   /* Add a delayproc request. */
   spin_lock_irqsave( &dpinfo->main->lock, irq_flg ); /* Lock--> */
   list_add_tail( &req->waitlist, &dpinfo->rq_list );
+  dpinfo->nr_rq++;
+  if ( rq_is_dirent(req) ) dpinfo->nr_dirent++;
   spin_unlock_irqrestore( &dpinfo->main->lock, irq_flg ); /* <--Unlock */
 
   PTRACE( " sector=%X", (unsigned int)req->sector );
@@ -1333,6 +1360,7 @@ inline void add_delayproc_req_waitlist( struct delayproc_info_s *dpinfo, struct
 inline void del_delayproc_req_waitlist( struct delayproc_info_s *dpinfo, struct request *req )
 {
   unsigned long irq_flg = 0L;
+  int done = 0;
 
   /* Check arguments. */
   if ( unlikely(NULL == dpinfo || NULL == req) ) {
@@ -1343,9 +1371,21 @@ inline void del_delayproc_req_waitlist( struct delayproc_info_s *dpinfo, struct
 
   /* Delete a delayproc request. */
   spin_lock_irqsave( &dpinfo->main->lock, irq_flg ); /* Lock--> */
-  list_del( &req->waitlist );
+  /* The request may be unlinked already by a timeout. */
+  if ( !list_empty( &req->waitlist ) ) {
+    list_del_init( &req->waitlist );
+    dpinfo->nr_rq--;
+    done = (0 == dpinfo->nr_rq);
+    if ( rq_is_dirent(req) ) {
+      dpinfo->nr_dirent--;
+      done |= (0 == dpinfo->nr_dirent);
+    }
+  }
   spin_unlock_irqrestore( &dpinfo->main->lock, irq_flg ); /* <--Unlock */
 
+  /* Wake up wait_delayproc_req(). */
+  if ( done ) wake_up( &dpinfo->rq_wait );
+
   delayproc_print_req_waitlist( &dpinfo->rq_list ); /* for DEBUG */
 
   return;
@@ -1921,8 +1961,13 @@ inline void clr_all_delayproc_params( unsigned int major )
 
   /* Clear all devices' dpinfo->params. */
   list_for_each_entry( walk, &DP_DEVLIST(maininfo), dev_list ) {
+    unsigned long irq_flg = 0L;
+
     delayproc_clr_params( walk );
-    INIT_LIST_HEAD( &(walk->rq_list) );
+    spin_lock_irqsave( &maininfo->lock, irq_flg ); /* Lock--> */
+    delayproc_clr_req_waitlist( walk );
+    spin_unlock_irqrestore( &maininfo->lock, irq_flg ); /* <--Unlock */
+    wake_up( &walk->rq_wait );
   }
 
   /* Wakeup pccardmgr. */
@@ -2008,6 +2053,13 @@ static int delayproc_read_proc( char *buf, char **start, off_t offset, int lengt
 #if defined(CONFIG_DELAYPROC_WRITE_ORDER)
     len += sprintf( buf+len, " order:\t%d\n", walk->order );
 #endif /* CONFIG_DELAYPROC_WRITE_ORDER */
+    len += sprintf( buf+len, " nr_rq:\t%u\n", walk->nr_rq );
+    len += sprintf( buf+len, " wait_nr:\t%lu\n", walk->wait_nr );
+    len += sprintf( buf+len, " wait_timeout:\t%lu\n", walk->wait_timeout );
+    len += sprintf( buf+len, " wait_last:\t%u[ms]\n", jiffies_to_msecs(walk->wait_last) );
+    len += sprintf( buf+len, " wait_max:\t%u[ms]\n", jiffies_to_msecs(walk->wait_max) );
+    len += sprintf( buf+len, " wait_avg:\t%u[ms]\n", walk->wait_nr ?
+		    jiffies_to_msecs(walk->wait_total / walk->wait_nr) : 0 );
   }
 
   return (len);
@@ -2123,6 +2175,7 @@ int init_delayproc_info( struct delayproc_info_s **pdpinfo, dev_t rdev, dp_excep
   (*pdpinfo)->pdev = delayproc_rdev2pdev( rdev );
   INIT_LIST_HEAD( &((*pdpinfo)->dev_list) );
   INIT_LIST_HEAD( &((*pdpinfo)->rq_list ) );
+  init_waitqueue_head( &((*pdpinfo)->rq_wait) );
   (*pdpinfo)->main = maininfo;
   spin_lock_init( &((*pdpinfo)->lock) );
   INIT_WORK( &((*pdpinfo)->delayprocd), delayprocd );
@@ -26,11 +26,16 @@
 #include <linux/interrupt.h>    /* mark_bh(),... */
 #include <linux/workqueue.h>    /* workqueue */
 #include <linux/dma-mapping.h>
+#include <linux/prefetch.h>     /* prefetch() */
+#include <linux/jiffies.h>
 #include <asm/atomic.h>         /* atomic_t */
 #include <asm/bitops.h>         /* set_bit(),clr_bit(),... */
 #include <asm/io.h>             /* memcpy_* */
 #include <asm/uaccess.h>        /* copy_from_user/copy_to_user */
 #include <linux/p2verify.h>
+#ifdef CONFIG_P2VERIFY_DMA
+#include <asm/dmac-ioctl.h>
+#endif /* CONFIG_P2VERIFY_DMA */
 
 #include "verify_debug.h"
 #include "verify.h"
@@ -73,6 +78,9 @@ static unsigned long v_cnt;
 /* error data */
 static unsigned short serr, derr;
 
+/* time of last comparison */
+static unsigned long start_jiffies, end_jiffies;
+
 #ifdef CONFIG_P2VERIFY_PROC
 /* proc entry */
 static struct proc_dir_entry *proc_entry=NULL;
@@ -96,6 +104,16 @@ static int reg_start=0, reg_stop;
 static int reg_err=0;
 static int addrtype=0;
 
+#ifdef CONFIG_P2VERIFY_DMA
+extern int MPC83xxDmacDirectMode(int dma_ch, unsigned int src, unsigned int dest,
+                                 unsigned int size, unsigned int command);
+
+/* cacheable buffers to read io memory by DMAC */
+#define VERIFY_DMA_ORDER    4
+#define VERIFY_DMA_SIZE     (PAGE_SIZE<<VERIFY_DMA_ORDER)
+static unsigned long *dma_sbuf=NULL, *dma_dbuf=NULL;
+#endif /* CONFIG_P2VERIFY_DMA */
+
 static void verify_handler(unsigned long data);
 DECLARE_TASKLET(tasklet_handler,verify_handler,0);
 static void verify_task(struct work_struct *work);
@@ -143,43 +161,110 @@ static void verify_handler(unsigned long data)
 }
 
 
+/*
+ * compare by cache line (8 words)
+ *  return byte length of the equal part
+ */
+static unsigned long compare_words(const unsigned long *sa, const unsigned long *da,
+                                   const unsigned long len)
+{
+    register const unsigned long *s = sa;
+    register const unsigned long *d = da;
+    const unsigned long *end = sa + len/sizeof(unsigned long);
+
+    while(s<end){
+        prefetch(s+16);
+        prefetch(d+16);
+        if(unlikely((s[0]^d[0])|(s[1]^d[1])|(s[2]^d[2])|(s[3]^d[3])
+                    |(s[4]^d[4])|(s[5]^d[5])|(s[6]^d[6])|(s[7]^d[7])))
+            break;
+        s += 8;
+        d += 8;
+    }
+
+    /* find the word in the line */
+    while(s<end && *s==*d){
+        s++;
+        d++;
+    }
+
+    return (unsigned long)(s-sa)*sizeof(unsigned long);
+}
+
+#ifdef CONFIG_P2VERIFY_DMA
+/*
+ * compare io memory in cacheable buffers
+ *  return byte length of the equal part
+ */
+static unsigned long compare_dma(const unsigned long __iomem *sa, const unsigned long __iomem *da,
+                                 const unsigned long src, const unsigned long dst,
+                                 const unsigned long len)
+{
+    unsigned long off, n, m;
+
+    for(off=0; off<len; off+=n){
+
+        n = min(len-off, (unsigned long)VERIFY_DMA_SIZE);
+
+        if(MPC83xxDmacDirectMode(CONFIG_P2VERIFY_DMA_CH, src+off, virt_to_bus(dma_sbuf), n, DMAC_READ)
+           || MPC83xxDmacDirectMode(CONFIG_P2VERIFY_DMA_CH, dst+off, virt_to_bus(dma_dbuf), n, DMAC_READ)){
+            /* DMAC failed: compare by CPU */
+            m = compare_words((const unsigned long *)(sa+off/sizeof(unsigned long)),
+                              (const unsigned long *)(da+off/sizeof(unsigned long)), n);
+        } else
+            m = compare_words(dma_sbuf, dma_dbuf, n);
+
+        if(m<n)
+            return off+m;
+    }
+
+    return len;
+}
+#endif /* CONFIG_P2VERIFY_DMA */
+
 /*
  * task  for verify
  */
 static void verify_task(struct work_struct *work)
 {
     static const int blk_num = 1024;
-    static const int max = blk_size/4;
     register unsigned long __iomem *sa;
     register unsigned long __iomem *da;
-    register int m,n;
+    unsigned long len, n;
 
     /* aborted ? */
     if(reg_stop)
         goto done;
 
-    sa = reg_saddr + reg_cnt/4;
-    da = reg_daddr + reg_cnt/4;
-    for(m=0; m<blk_num; m++){
+    /* done ? */
+    if(reg_cnt>=reg_len)
+        goto done;
 
-        /* done ? */
-        if(reg_cnt>=reg_len)
-            goto done;
+    sa = reg_saddr + reg_cnt/sizeof(unsigned long);
+    da = reg_daddr + reg_cnt/sizeof(unsigned long);
+    len = min(reg_len-reg_cnt, (unsigned long)(blk_num*blk_size));
 
-/*         /\* ivalidate cache *\/ */
-/*         __dma_sync(sa,blk_size,DMA_FROM_DEVICE); */
-/*         __dma_sync(da,blk_size,DMA_FROM_DEVICE); */
+/*     /\* ivalidate cache *\/ */
+/*     __dma_sync(sa,blk_size,DMA_FROM_DEVICE); */
+/*     __dma_sync(da,blk_size,DMA_FROM_DEVICE); */
 
-        /* compare */
-        for(n=0; n<max; n++){
+    /* compare */
+#ifdef CONFIG_P2VERIFY_DMA
+    if(addrtype==P2VERIFY_ADDRTYPE_IOMEM && NULL!=dma_sbuf && NULL!=dma_dbuf)
+        n = compare_dma(sa, da, phy_saddr+reg_cnt, phy_daddr+reg_cnt, len);
+    else
+#endif /* CONFIG_P2VERIFY_DMA */
+        n = compare_words((const unsigned long *)sa, (const unsigned long *)da, len);
 
-            if(unlikely(*sa++ != *da++)){
-                sa--;
-                da--;
-                goto fail;
-            }
-            reg_cnt += 4;
-        }
+    reg_cnt += n;
+
+    /* progress */
+    v_cnt = reg_cnt;
+
+    if(unlikely(n<len)){
+        sa += n/sizeof(unsigned long);
+        da += n/sizeof(unsigned long);
+        goto fail;
     }
 
     /* re-schedule */
@@ -212,6 +297,7 @@ static void verify_task(struct work_struct *work)
  done:
 
  /*    _INFO("end=%ld\n",jiffies); */
+    end_jiffies = jiffies;
 
     reg_stop = 0;
     reg_start = 0;
@@ -227,7 +313,9 @@ static void do_start(void)
 {
     if(!reg_start){
         reg_cnt = 0;
+        v_cnt = 0;
         reg_err = 0;
+        start_jiffies = end_jiffies = jiffies;
         reg_start = 1;
         reg_stop = 0;
         schedule_work(&work_verify);
@@ -269,6 +357,16 @@ static int init_verify_task(void)
  */
 static void cleanup_verify_task(void)
 {
+#ifdef CONFIG_P2VERIFY_DMA
+    if(dma_sbuf){
+        free_pages((unsigned long)dma_sbuf, VERIFY_DMA_ORDER);
+        dma_sbuf = NULL;
+    }
+    if(dma_dbuf){
+        free_pages((unsigned long)dma_dbuf, VERIFY_DMA_ORDER);
+        dma_dbuf = NULL;
+    }
+#endif /* CONFIG_P2VERIFY_DMA */
 }
 
 /*******************************************************************************
@@ -346,6 +444,14 @@ static int procfunc_read(char *buff, char **start, off_t offset, int count, int
     len += sprintf(buff+len, "\tlast error data (src)= %04X\n", serr);
     len += sprintf(buff+len, "\tlast error data (dst)= %04X\n", derr);
     len += sprintf(buff+len, "\tlast error result    = %s\n", result?"NG":"OK");
+    {
+        unsigned int msec = jiffies_to_msecs(((state==ST_P2VERIFY_BUSY)?jiffies:end_jiffies) - start_jiffies);
+        len += sprintf(buff+len, "\tprogress             = %lu%%\n",
+                       reg_len ? (unsigned long)(((unsigned long long)v_cnt*100)/reg_len) : 0UL);
+        len += sprintf(buff+len, "\telapsed time         = %u msec\n", msec);
+        len += sprintf(buff+len, "\tthroughput           = %lu KB/s\n",
+                       msec ? (unsigned long)(((unsigned long long)v_cnt*1000/1024)/msec) : 0UL);
+    }
 
     /* semaphore up */
     up(&sema);
@@ -900,6 +1006,14 @@ static int __init p2verify_init (void)
     /* state */
     state = ST_P2VERIFY_IDLE;
 
+#ifdef CONFIG_P2VERIFY_DMA
+    /* buffers for DMAC */
+    dma_sbuf = (unsigned long *)__get_free_pages(GFP_KERNEL|__GFP_DMA, VERIFY_DMA_ORDER);
+    dma_dbuf = (unsigned long *)__get_free_pages(GFP_KERNEL|__GFP_DMA, VERIFY_DMA_ORDER);
+    if(NULL==dma_sbuf || NULL==dma_dbuf)
+        _WARN("can't allocate buffers for DMAC, compare io memory by CPU\n");
+#endif /* CONFIG_P2VERIFY_DMA */
+
     /* set zero to handle */
     atomic_set(&handle, 0);
 
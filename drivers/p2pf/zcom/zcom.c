@@ -7,6 +7,9 @@
 #include <linux/pci.h>
 #include <linux/poll.h>
 #include <linux/proc_fs.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <asm/uaccess.h>
 
 #include "zcom.h"
 
@@ -36,6 +39,18 @@ u32 zcom_time()
 	return (jiffies - zcom_time_base);
 }
 
+static void log_packet(zion_packet_t *packet, u8 flags, u32 rx_time)
+{
+	zcom_packet_entry_t entry;
+
+	memset(&entry, 0, sizeof(entry));
+	memcpy(&entry.packet, packet, sizeof(zion_packet_t));
+	entry.flags = flags;
+	entry.rx_time = rx_time;
+
+	add_packet_log(&entry);
+}
+
 static int clear_recv_queue(zcom_dev_t *dev)
 {
 	unsigned long flag;
@@ -117,6 +132,7 @@ static int zcom_release(struct inode *inode, struct file *file)
 	int port;
 	zcom_dev_t *dev;
 	unsigned long flag;
+	struct zcom_ring *ring;
 
 	PRINT_FUNC;
 
@@ -137,11 +153,17 @@ static int zcom_release(struct inode *inode, struct file *file)
 	}
 
 	dev->status = ZCOM_CLOSE;
+	ring = dev->ring;
+	dev->ring = NULL;
 
 	spin_unlock_irqrestore(&dev->lock, flag);
 
 	clear_recv_queue(dev);
 
+	/* the last munmap() has been done, release is not called before */
+	if(ring)
+		vfree(ring);
+
 	return 0;
 }
 
@@ -156,7 +178,11 @@ static unsigned int zcom_poll(struct file *file, struct poll_table_struct *poll_
 
 	poll_wait(file, &dev->rx_wq, poll_table);
 
-	if(!list_empty(&dev->rx_q)){
+	if(dev->ring){
+		if(dev->ring->hdr.rx_head != dev->ring->hdr.rx_tail)
+			mask |= (POLLIN|POLLRDNORM);
+	}
+	else if(!list_empty(&dev->rx_q)){
 		mask |= (POLLIN|POLLRDNORM);
 	}
 
@@ -167,10 +193,9 @@ static unsigned int zcom_poll(struct file *file, struct poll_table_struct *poll_
 
 static ssize_t zcom_write(struct file *file, const char *buffer, size_t count, loff_t *offset)
 {
-	int ret;
-	zcom_packet_entry_t *entry;
-	int i;
-	int num;
+	zion_packet_t packets[ZCOM_BATCH];
+	int i, n, sent;
+	int num, done;
 	zcom_dev_t *dev;
 	const char *ptr;
 
@@ -179,62 +204,41 @@ static ssize_t zcom_write(struct file *file, const char *buffer, size_t count, l
 	dev = (zcom_dev_t *)file->private_data;
 	ptr = buffer;
 	num = count/ZCOM_PACKET_SIZE;
-
-	for(i = 0; i < num; i++){
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 		entry = alloc_packet_entry(); */
-		entry = alloc_tx_packet_entry();
-		if(!entry){
-			PERROR("alloc_packet_entry() failed");
-			ZCOM_ATOMIC_INC(dev->log.err);
-			return -ENOMEM;
+	done = 0;
+
+	/* up to ZCOM_BATCH packets per doorbell */
+	while(done < num){
+		n = min(num - done, ZCOM_BATCH);
+		for(i = 0; i < n; i++){
+			packets[i].port = dev->id;
+			packets[i].flags = 0;
+			packets[i].id = dev->tx_id++;
+			if(copy_from_user(packets[i].data, ptr + i*ZCOM_PACKET_SIZE, ZCOM_PACKET_SIZE)){
+				ZCOM_ATOMIC_INC(dev->log.err);
+				return done ? ZCOM_PACKET_SIZE*done : -EFAULT;
+			}
 		}
 
-		entry->packet.port = dev->id;
-		entry->packet.flags = 0;
-		entry->flags = ZCOM_SND_FLAG;
-
-		memcpy(entry->packet.data, ptr, ZCOM_PACKET_SIZE);
+		sent = zion_write_packets(dev->zion, packets, n);
+		for(i = 0; i < sent; i++){
+			ZCOM_ATOMIC_INC(dev->log.snd);
+			log_packet(&packets[i], ZCOM_SND_FLAG, 0);
+		}
+		if(sent > 0)
+			ZCOM_ATOMIC_INC(dev->log.tx_batch);
 
-		ptr += ZCOM_PACKET_SIZE;
+		done += sent;
+		ptr  += sent*ZCOM_PACKET_SIZE;
 
-		ret = zion_write_packet(dev->zion, &entry->packet);
-		if(ret == -EAGAIN){
+		if(sent < n){
 			PWARNING("zion send queue full");
-			entry->flags |= ZCOM_DRP_FLAG;
-
 			ZCOM_ATOMIC_INC(dev->log.drp);
-
-			add_packet_log(entry);
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 			free_packet_entry(entry); */
-			free_tx_packet_entry(entry);
-
-			return i*ZCOM_PACKET_SIZE;
-		}
-		else if (ret < 0){
-			PERROR("zion_write_packet() error(%d)", ret);
-			entry->flags |= ZCOM_ERR_FLAG;
-
-			ZCOM_ATOMIC_INC(dev->log.err);
-
-			add_packet_log(entry);
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 			free_packet_entry(entry); */
-			free_tx_packet_entry(entry);
-
-			return ret;
+			log_packet(&packets[sent], ZCOM_SND_FLAG|ZCOM_DRP_FLAG, 0);
+			break;
 		}
-
-		ZCOM_ATOMIC_INC(dev->log.snd);
-
-		add_packet_log(entry);
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 		free_packet_entry(entry); */
-		free_tx_packet_entry(entry);
 	}
 
-	return ZCOM_PACKET_SIZE*i;
+	return ZCOM_PACKET_SIZE*done;
 }
 
 static ssize_t zcom_read(struct file *file, char *buffer, size_t count, loff_t *offset)
@@ -254,6 +258,11 @@ static ssize_t zcom_read(struct file *file, char *buffer, size_t count, loff_t *
 		return -EINVAL;
 	}
 
+	/* a mapped port receives through its ring only */
+	if(dev->ring){
+		return -EBUSY;
+	}
+
 	if(list_empty(&dev->rx_q)){
 /*
 		if((file->f_flags&O_NONBLOCK) == 0){
@@ -317,9 +326,141 @@ static ssize_t zcom_read(struct file *file, char *buffer, size_t count, loff_t *
 	return ZCOM_PACKET_SIZE*i;
 }
 
+/*
+ * Push the packets user space has put in the TX ring, ZCOM_BATCH per
+ * doorbell.  Called with dev->lock held.
+ */
+static int zcom_ring_tx(zcom_dev_t *dev)
+{
+	struct zcom_ring *ring = dev->ring;
+	zion_packet_t packets[ZCOM_BATCH];
+	u32 head, tail;
+	int i, n, sent;
+	int total = 0;
+
+	head = ring->hdr.tx_head;
+	tail = ring->hdr.tx_tail;
+	rmb();
+
+	if(head - tail > ZCOM_RING_DEPTH){
+		PERROR("zcom%d:tx ring broken(head=%u, tail=%u)", dev->id, head, tail);
+		return -EINVAL;
+	}
+
+	while(tail != head){
+		n = min_t(u32, head - tail, ZCOM_BATCH);
+		for(i = 0; i < n; i++){
+			packets[i].port = dev->id;
+			packets[i].flags = 0;
+			packets[i].id = dev->tx_id++;
+			memcpy(packets[i].data, ring->tx[(tail + i) & (ZCOM_RING_DEPTH - 1)], ZCOM_PACKET_SIZE);
+		}
+
+		sent = zion_write_packets(dev->zion, packets, n);
+		for(i = 0; i < sent; i++){
+			dev->log.snd++;
+			log_packet(&packets[i], ZCOM_SND_FLAG, 0);
+		}
+		if(sent > 0)
+			dev->log.tx_batch++;
+
+		tail  += sent;
+		total += sent;
+
+		/* ZION queue full : the rest waits for the next kick */
+		if(sent < n)
+			break;
+	}
+
+	ring->hdr.tx_tail = tail;
+
+	return total;
+}
+
+/* Called with dev->lock held */
+static int zcom_ring_put(zcom_dev_t *dev, zion_packet_t *packet)
+{
+	struct zcom_ring *ring = dev->ring;
+	u32 head;
+
+	head = ring->hdr.rx_head;
+	if(head - ring->hdr.rx_tail >= ZCOM_RING_DEPTH){
+		ring->hdr.rx_drop++;
+		return -ENOSPC;
+	}
+
+	memcpy(ring->rx[head & (ZCOM_RING_DEPTH - 1)], packet->data, ZCOM_PACKET_SIZE);
+	wmb();
+	ring->hdr.rx_head = head + 1;
+
+	return 0;
+}
+
 static int zcom_ioctl(struct inode *inode, struct file *filp, unsigned int cmd, unsigned long arg)
 {
+	zcom_dev_t *dev = (zcom_dev_t *)filp->private_data;
+	unsigned long flag;
+	int ret;
+
+	PRINT_FUNC;
+
+	switch(cmd){
+	case ZCOM_IOC_TX_KICK:
+		spin_lock_irqsave(&dev->lock, flag);
+		if(dev->ring)
+			ret = zcom_ring_tx(dev);
+		else
+			ret = -EINVAL;
+		spin_unlock_irqrestore(&dev->lock, flag);
+		break;
+
+	default:
+		ret = 0;
+		break;
+	}
+
+	return ret;
+}
+
+static int zcom_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	zcom_dev_t *dev = (zcom_dev_t *)file->private_data;
+	struct zcom_ring *ring;
+	unsigned long flag;
+	int ret;
+
 	PRINT_FUNC;
+
+	if(vma->vm_pgoff != 0 ||
+	   vma->vm_end - vma->vm_start > PAGE_ALIGN(sizeof(struct zcom_ring))){
+		PERROR("zcom%d:invalid mmap range", dev->id);
+		return -EINVAL;
+	}
+
+	if(!dev->ring){
+		ring = vmalloc_user(PAGE_ALIGN(sizeof(struct zcom_ring)));
+		if(!ring){
+			PERROR("vmalloc_user() failed");
+			return -ENOMEM;
+		}
+
+		spin_lock_irqsave(&dev->lock, flag);
+		if(dev->ring){
+			spin_unlock_irqrestore(&dev->lock, flag);
+			vfree(ring);
+		}
+		else {
+			dev->ring = ring;
+			spin_unlock_irqrestore(&dev->lock, flag);
+		}
+	}
+
+	ret = remap_vmalloc_range(vma, dev->ring, 0);
+	if(ret < 0){
+		PERROR("remap_vmalloc_range() failed(%d)", ret);
+		return ret;
+	}
+
 	return 0;
 }
 
@@ -329,66 +470,108 @@ static struct file_operations fops = {
 	.read		= zcom_read,
 	.write		= zcom_write,
 	.poll		= zcom_poll,
-	.ioctl		= zcom_ioctl
+	.ioctl		= zcom_ioctl,
+	.mmap		= zcom_mmap,
 };
 
-void zcom_recv_handler(unsigned long arg)
+static int zcom_recv_packet(zcom_dev_t *dev, zion_packet_t *packet, u32 rx_time)
 {
 	int ret;
 	unsigned long flag;
 	zcom_packet_entry_t *entry;
-	zcom_dev_t *dev = NULL;
-	int port;
 
-	PRINT_FUNC;
-	PASSERT(zion_recv_empty(zion));
+	if(dev->status != ZCOM_OPEN){
+		log_packet(packet, ZCOM_RCV_FLAG|ZCOM_DRP_FLAG, rx_time);
+		return -ENODEV;
+	}
 
-	while(!zion_recv_empty(zion)){
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 		entry = alloc_packet_entry(); */
-		entry = alloc_rx_packet_entry();
-		if(entry == NULL){
-			PALERT("alloc_packet_entry() failed");
-			return;
-		}
-		ret = zion_read_packet(zion, &entry->packet);
-		entry->rx_time = zcom_time();
-		entry->flags = ZCOM_RCV_FLAG;
+	spin_lock_irqsave(&dev->lock, flag);
+	if(dev->ring){
+		ret = zcom_ring_put(dev, packet);
+		if(ret == 0)
+			dev->log.rcv++;
+		else
+			dev->log.drp++;
+		spin_unlock_irqrestore(&dev->lock, flag);
 
-		if (ret < 0){
-			entry->flags |= ZCOM_ERR_FLAG;
-			add_packet_log(entry);
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 			free_packet_entry(entry); */
-			free_rx_packet_entry(entry);
-			PERROR("zion_read_packet() failed(%d)", ret);
-			return;
-		}
-		if (ret == 0){
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 			free_packet_entry(entry); */
-			free_rx_packet_entry(entry);
-			break;
+		log_packet(packet, ZCOM_RCV_FLAG|(ret ? ZCOM_DRP_FLAG : 0), rx_time);
+		return ret;
+	}
+	spin_unlock_irqrestore(&dev->lock, flag);
+
+	/* 2011/3/9, Modified by Panasonic (SAV) */
+/* 	entry = alloc_packet_entry(); */
+	entry = alloc_rx_packet_entry();
+	if(entry == NULL){
+		PALERT("alloc_packet_entry() failed");
+		return -ENOMEM;
+	}
+	memcpy(&entry->packet, packet, sizeof(zion_packet_t));
+	entry->rx_time = rx_time;
+	entry->flags = ZCOM_RCV_FLAG|ZCOM_PND_FLAG;
+
+	spin_lock_irqsave(&dev->lock, flag);
+	list_add_tail(&entry->list, &dev->rx_q);
+	dev->rx_count++;
+	dev->log.rcv++;
+	spin_unlock_irqrestore(&dev->lock, flag);
+
+	return 0;
+}
+
+/*
+ * RX tasklet.  The ZION interrupt stays masked from zcom_event() until
+ * the queue has been drained here, ZCOM_BATCH packets per read pointer
+ * update, and every port is woken once per pass instead of per packet.
+ */
+void zcom_recv_handler(unsigned long arg)
+{
+	zion_packet_t packets[ZCOM_BATCH];
+	zcom_dev_t *dev;
+	u32 rx_time;
+	u32 wake = 0;
+	unsigned long flag;
+	int i, n, port;
+
+	PRINT_FUNC;
+
+	do {
+		n = zion_read_packets(zion, packets, ZCOM_BATCH);
+		rx_time = zcom_time();
+
+		for(i = 0; i < n; i++){
+			port = packets[i].port;
+			if(port >= ZCOM_N_DEV){
+				PERROR("invalid port(%d)", port);
+				log_packet(&packets[i], ZCOM_RCV_FLAG|ZCOM_ERR_FLAG, rx_time);
+				continue;
+			}
+			if(zcom_recv_packet(&zcom_dev[port], &packets[i], rx_time) == 0)
+				wake |= (1 << port);
 		}
+	} while(n == ZCOM_BATCH);
 
-		port = entry->packet.port;
+	for(port = 0; port < ZCOM_N_DEV; port++){
 		dev = &zcom_dev[port];
-		if(dev->status == ZCOM_OPEN){
-			entry->flags |= ZCOM_PND_FLAG;
-			spin_lock_irqsave(&dev->lock, flag);
-			list_add_tail(&entry->list, &dev->rx_q);
-			dev->rx_count++;
-			dev->log.rcv++;
-			spin_unlock_irqrestore(&dev->lock, flag);
+
+		if(wake & (1 << port)){
+			dev->log.rx_batch++;
 			wake_up_interruptible(&dev->rx_wq);
 		}
-		else {
-			entry->flags |= ZCOM_DRP_FLAG;
-			add_packet_log(entry);
-        /* 2011/3/9, Modified by Panasonic (SAV) */
-/* 			free_packet_entry(entry); */
-			free_rx_packet_entry(entry);
-		}
+
+		/* retry ring packets that found the ZION queue full */
+		spin_lock_irqsave(&dev->lock, flag);
+		if(dev->ring && dev->ring->hdr.tx_head != dev->ring->hdr.tx_tail)
+			zcom_ring_tx(dev);
+		spin_unlock_irqrestore(&dev->lock, flag);
+	}
+
+	zion_irq_enable(zion);
+
+	/* a packet may have arrived after the last read with the IRQ masked */
+	if(!zion_recv_empty(zion)){
+		zion_irq_disable(zion);
+		tasklet_schedule(&zcom_recv_tasklet);
 	}
 }
 
@@ -397,6 +580,8 @@ DECLARE_TASKLET(zcom_recv_tasklet, zcom_recv_handler, 0);
 irqreturn_t zcom_event(int irq, void *arg)
 {
 	if(zion_is_irq(zion)){
+		/* coalesce : masked until the tasklet has drained the queue */
+		zion_irq_disable(zion);
 		tasklet_schedule(&zcom_recv_tasklet);
 		zion_irq_clear(zion);
 	}
@@ -462,6 +647,23 @@ static int read_procfs_port(char *buf, char **start, off_t offset, int count, in
 			dev->log.drp,
 			dev->log.err);
 
+	len += snprintf(buf + len, count - len,
+			"zcom%d:batch count(doorbell/wakeup) %d/%d\n",
+			dev->id,
+			dev->log.tx_batch,
+			dev->log.rx_batch);
+
+	if(dev->ring){
+		len += snprintf(buf + len, count - len,
+				"zcom%d:ring tx %u/%u rx %u/%u drop %u\n",
+				dev->id,
+				dev->ring->hdr.tx_head,
+				dev->ring->hdr.tx_tail,
+				dev->ring->hdr.rx_head,
+				dev->ring->hdr.rx_tail,
+				dev->ring->hdr.rx_drop);
+	}
+
 	len += snprintf(buf + len, count - len,
 			"zcom%d:recv  delay time(max/ave) %lu/%lu\n",
 			dev->id,
@@ -3,7 +3,9 @@
 #ifndef _ZCOM_H
 #define _ZCOM_H
 
-#define ZCOM_VERSION	"zcom version 1.0.2"
+#include <linux/zcom.h>
+
+#define ZCOM_VERSION	"zcom version 1.0.3"
 
 #define ZCOM_MAJOR	122
 #define ZCOM_MINOR	0
@@ -16,6 +18,9 @@
 
 #define ZCOM_PACKET_SIZE	32
 
+/* packets moved per ZION queue access (one doorbell per TX batch) */
+#define ZCOM_BATCH		8
+
 #ifdef CONFIG_ZCOM_TX_BUFFER_NUM
 #define ZCOM_N_TX_PACKET_BUFFER	CONFIG_ZCOM_TX_BUFFER_NUM
 #else  /* ! CONFIG_ZCOM_TX_BUFFER_NUM */
@@ -117,6 +122,9 @@ struct port_log{
 
 	unsigned long delay_max;
 	unsigned long delay;
+
+	u32 tx_batch;	/* doorbells rung */
+	u32 rx_batch;	/* wake-ups after an RX drain */
 };
 
 typedef struct{
@@ -133,6 +141,9 @@ typedef struct{
 
 	zion_dev_t *zion;
 	struct port_log log;
+
+	struct zcom_ring *ring;		/* mmap()ed packet ring, or NULL */
+	u16 tx_id;
 } zcom_dev_t;
 
 typedef struct{
@@ -149,6 +160,8 @@ extern int zion_irq_clear(zion_dev_t *dev);
 extern int zion_is_irq(zion_dev_t *dev);
 extern int zion_write_packet(zion_dev_t *dev, zion_packet_t *packet);
 extern int zion_read_packet(zion_dev_t *dev, zion_packet_t *packet);
+extern int zion_write_packets(zion_dev_t *dev, zion_packet_t *packets, int num);
+extern int zion_read_packets(zion_dev_t *dev, zion_packet_t *packets, int num);
 
 static inline int zion_recv_empty(zion_dev_t *dev)
 {
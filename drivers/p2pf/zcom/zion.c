@@ -180,7 +180,12 @@ int zion_exit(void)
 	return 0;
 }
 
-int zion_write_packet(zion_dev_t *dev, zion_packet_t *packet)
+/*
+ * Copy up to "num" packets into the ZION TX queue and ring the doorbell
+ * once for the whole batch.  Returns the number of packets queued, which
+ * is short when the queue fills up.
+ */
+int zion_write_packets(zion_dev_t *dev, zion_packet_t *packets, int num)
 {
 	volatile u16 write, read;
 	volatile u16 d16;
@@ -188,7 +193,8 @@ int zion_write_packet(zion_dev_t *dev, zion_packet_t *packet)
 
 	u16 next;
 	unsigned long flag;
-	zion_packet_t *ptr;
+	zion_packet_t *ptr, *packet;
+	int i;
 
 	PRINT_FUNC;
 
@@ -203,52 +209,75 @@ int zion_write_packet(zion_dev_t *dev, zion_packet_t *packet)
 
 //	PINFO("read=%d, write=%d", read, write);
 
-	ptr = dev->tx_q.buffer;
-	ptr += write;
-	packet->tx_time = zcom_time();
-	packet->flags |= ZION_OWNER_SH_FLAG;
+	for(i = 0; i < num; i++){
+		next  = write + 1;
+		if(next >= dev->tx_q.depth){
+			next = 0;
+		}
+		if(read == next){
+			PWARNING("TX queue full");
+			break;
+		}
 
-	ptr->port  = packet->port;
-	ptr->flags = packet->flags;
+		packet = &packets[i];
+		ptr = dev->tx_q.buffer;
+		ptr += write;
+		packet->tx_time = zcom_time();
+		packet->flags |= ZION_OWNER_SH_FLAG;
+
+		ptr->port  = packet->port;
+		ptr->flags = packet->flags;
 
-	SWAP16(&d16, &packet->id);
-	ptr->id = d16;
+		SWAP16(&d16, &packet->id);
+		ptr->id = d16;
 
-	SWAP32(&d32, &packet->tx_time);
-	ptr->tx_time = d32;
+		SWAP32(&d32, &packet->tx_time);
+		ptr->tx_time = d32;
 
-	memcpy(ptr->data, packet->data, ZCOM_PACKET_SIZE);
+		memcpy(ptr->data, packet->data, ZCOM_PACKET_SIZE);
 
-	next  = write + 1;
-	if(next >= dev->tx_q.depth){
-		next = 0;
+		write = next;
 	}
-	if(read == next){
-		PWARNING("TX queue warning");
+
+	if(i > 0){
+		/* publish the whole batch with a single write pointer update */
+		wmb();
+		SWAP16(&d16, &write);
+		dev->tx_q.header->write_ptr=d16;
 	}
-	SWAP16(&d16, &next);
-	dev->tx_q.header->write_ptr=d16;
 
 	spin_unlock_irqrestore(&dev->lock, flag);
 
+	if(i > 0){
 #ifdef ZCOM_LOOPBACK
-	tasklet_schedule(&loopback_tasklet);
+		tasklet_schedule(&loopback_tasklet);
 #endif // ZCOM_LOOPBACK
 
-	zion_irq_send(dev);
+		zion_irq_send(dev);
+	}
 
-	return 0;
+	return i;
 }
 
-int zion_read_packet(zion_dev_t *dev, zion_packet_t *packet)
+int zion_write_packet(zion_dev_t *dev, zion_packet_t *packet)
+{
+	return (zion_write_packets(dev, packet, 1) == 1) ? 0 : -EAGAIN;
+}
+
+/*
+ * Copy up to "num" packets out of the ZION RX queue, releasing the
+ * slots with a single read pointer update.  Returns the number of
+ * packets read.
+ */
+int zion_read_packets(zion_dev_t *dev, zion_packet_t *packets, int num)
 {
 	volatile u16 read, write;
-	u16 next;
 	u16 d16;
 	u32 d32;
 
 	unsigned long flag;
-	zion_packet_t *ptr;
+	zion_packet_t *ptr, *packet;
+	int i;
 
 	PRINT_FUNC;
 
@@ -260,35 +289,45 @@ int zion_read_packet(zion_dev_t *dev, zion_packet_t *packet)
 	d16 = dev->rx_q.header->write_ptr;
 	SWAP16(&write, &d16);
 
-	if(read == write){
-		PDEBUG("packet empty");
-		spin_unlock_irqrestore(&dev->lock, flag);
-		return 0;
-	}
+	for(i = 0; i < num && read != write; i++){
+		packet = &packets[i];
+		ptr = dev->rx_q.buffer;
+		ptr += read;
 
-	ptr = dev->rx_q.buffer;
-	ptr += read;
+		packet->port = ptr->port;
+		packet->flags = ptr->flags;
 
-	packet->port = ptr->port;
-	packet->flags = ptr->flags;
+		d16 = ptr->id;
+		SWAP16(&packet->id, &d16);
 
-	d16 = ptr->id;
-	SWAP16(&packet->id, &d16);
+		d32 = ptr->tx_time;
+		SWAP32(&packet->tx_time, &d32);
 
-	d32 = ptr->tx_time;
-	SWAP32(&packet->tx_time, &d32);
+		memcpy(packet->data, ptr->data, ZCOM_PACKET_SIZE);
 
-	memcpy(packet->data, ptr->data, ZCOM_PACKET_SIZE);
+		read++;
+		if(read >= dev->rx_q.depth){
+			read = 0;
+		}
+	}
 
-	next = read + 1;
-	if(next >= dev->rx_q.depth){
-		next = 0;
+	if(i > 0){
+		mb();
+		SWAP16(&d16, &read);
+		dev->rx_q.header->read_ptr = d16;
 	}
-	SWAP16(&d16, &next);
-	dev->rx_q.header->read_ptr = d16;
 
 	spin_unlock_irqrestore(&dev->lock, flag);
 
+	return i;
+}
+
+int zion_read_packet(zion_dev_t *dev, zion_packet_t *packet)
+{
+	if(zion_read_packets(dev, packet, 1) == 0){
+		PDEBUG("packet empty");
+		return 0;
+	}
 	return sizeof(zion_packet_t);
 }
 
@@ -304,15 +343,33 @@ int zion_irq_clear(zion_dev_t *dev)
 
 int zion_irq_enable(zion_dev_t *dev)
 {
+	u16 reg;
+	unsigned long flag;
+
 	PRINT_FUNC;
 
+	spin_lock_irqsave(&dev->lock, flag);
+	reg = mbus_read16(INTB_MSK_REG);
+	reg |= PCIINT1;
+	mbus_write16(reg, INTB_MSK_REG);
+	spin_unlock_irqrestore(&dev->lock, flag);
+
 	return 0;
 }
 
 int zion_irq_disable(zion_dev_t *dev)
 {
+	u16 reg;
+	unsigned long flag;
+
 	PRINT_FUNC;
 
+	spin_lock_irqsave(&dev->lock, flag);
+	reg = mbus_read16(INTB_MSK_REG);
+	reg &= ~PCIINT1;
+	mbus_write16(reg, INTB_MSK_REG);
+	spin_unlock_irqrestore(&dev->lock, flag);
+
 	return 0;
 }
 
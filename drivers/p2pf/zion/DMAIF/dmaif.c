@@ -826,6 +826,10 @@ zion_dmaif_event(zion_params_t * params, int bit,
 		
 		/* Memorize it ! */
 		params->interrupt_bits.DMA_INT[ch] |= int_status;
+		/* Record it (DMA done, sync frame and buffer switch) */
+		if ( int_status ) {
+			zion_post_event( params, bit, ((u32)ch << 16) | int_status );
+		}
 
 		/* for DEBUG */
 /* 		PDEBUG( "CH%d int_status: 0x%04X, mask: 0x%04X\n", */
@@ -214,6 +214,8 @@ void zion_dvcif_event(zion_params_t *zion_params, int bit,
   int_status = mbus_readw(MBUS_ADDR(zion_params, DV_Interrupt_Status));
   /* Memorize it ! */
   zion_params->interrupt_bits.DVC_INT |= int_status;
+  /* Record it (RecFrame/PbFrame are the frame pulses) */
+  zion_post_event(zion_params, bit, int_status);
 
   if(int_status & RecFrame)
     {
@@ -38,8 +38,57 @@
 #include <linux/vmalloc.h>
 
 #include <linux/zion.h>
+#include <linux/moduleparam.h>
+#include <linux/pagemap.h>
 #include "zion_pci_regs.h"
 
+#ifndef CONFIG_ZION_SUPPRESS_MASTER_ACTION
+/* Pre-allocated DMA buffer for each NEO channel, reused by every transfer.
+   A round of a bounced transfer is limited to the pool, so large transfers
+   take more rounds than with allocation at transfer time. */
+static int dma_pool_kb = 128;
+module_param(dma_pool_kb, int, S_IRUGO);
+MODULE_PARM_DESC(dma_pool_kb, "DMA buffer pool per NEO channel in KB (0: allocate at transfer time)");
+
+/* DMA directly from/to aligned user buffers instead of bouncing */
+static int dma_direct = 1;
+
+/* Direct mapping needs the page array of every channel. Before the device
+   is set up, initialize_zion_pci_private_space() clears it instead. */
+static int dma_direct_set(const char *val, struct kernel_param *kp)
+{
+  zion_params_t *params = find_zion(0);
+  struct kernel_param tmp = *kp;
+  int on = 0;
+  int ret;
+  int ch;
+
+  tmp.arg = &on;
+  ret = param_set_int(val, &tmp);
+  if(ret)
+    {
+      return ret;
+    }
+
+  if(on && params!=NULL && ZION_PCI_PARAM(params)!=NULL)
+    {
+      for(ch=0; ch<NEO_DMA_CH; ch++)
+	{
+	  if(ZION_PCI_PARAM(params)->dma_params[ch].pages==NULL)
+	    {
+	      return -ENOMEM;
+	    }
+	}
+    }
+
+  dma_direct = on;
+
+  return 0;
+}
+module_param_call(dma_direct, dma_direct_set, param_get_int, &dma_direct, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(dma_direct, "Map aligned user buffers for NEO DMA (0: always copy)");
+#endif /* CONFIG_ZION_SUPPRESS_MASTER_ACTION */
+
 
 int ZION_pci_cache_clear(void)
 {
@@ -430,23 +479,59 @@ static int release_dma_entry(zion_params_t *params, int ch)
 
   for(i=0; i<entries; i++)
     {
-      free_pages((unsigned long)(dma_entries[i].data), get_order(dma_entries[i].size));
+      if(dma_entries[i].flags & NEO_DMA_ENT_USER)
+	{
+	  if(dma_entries[i].flags & NEO_DMA_ENT_DIRTY)
+	    set_page_dirty_lock(dma_entries[i].page);
+	  page_cache_release(dma_entries[i].page);
+	}
+      else if(!(dma_entries[i].flags & NEO_DMA_ENT_POOL))
+	{
+	  free_pages((unsigned long)(dma_entries[i].data), get_order(dma_entries[i].size));
+	}
+      dma_entries[i].flags = 0;
+      dma_entries[i].page = NULL;
     }
 
   ZION_PCI_PARAM(params)->dma_params[ch].entries = 0;
 
-  up(&(ZION_PCI_PARAM(params)->dma_params[ch].dma_sem));
-
   return 0;
 }
 
 static int make_sg_table(zion_params_t *params, int ch, unsigned long *size)
 {
+  neo_dma_params_t *dma_params = &(ZION_PCI_PARAM(params)->dma_params[ch]);
   unsigned long left_size = *size;
   unsigned long net_size;
   unsigned long entry_size=DMA_MAX_ENTRY_SIZE;
   void *mem_space;
   int ret=0;
+  int i;
+
+  /* Pre-allocated buffers : whatever does not fit goes to the next round */
+  if(dma_params->pool_entries)
+    {
+      for(i=0; i<dma_params->pool_entries && left_size; i++)
+	{
+	  net_size = min(entry_size, left_size);
+
+	  ret = add_sg_table(params, ch, dma_params->pool[i], entry_size, net_size);
+	  if(ret<0)
+	    {
+	      ret = 0;
+	      break;
+	    }
+	  dma_params->dma_entries[dma_params->entries-1].flags = NEO_DMA_ENT_POOL;
+
+	  left_size -= net_size;
+	}
+
+      terminate_sg_table(params, ch);
+
+      *size = left_size;
+
+      return ret;
+    }
 
   while(left_size)
     {
@@ -487,10 +572,125 @@ static int make_sg_table(zion_params_t *params, int ch, unsigned long *size)
   return ret;
 }
 
+/*
+ * Build the SG table straight on the pages of a user buffer, one entry
+ * per page.  Fails (and the caller bounces through make_sg_table())
+ * when a page cannot be handed to the device as is.
+ */
+static int map_user_sg_table(zion_params_t *params, int ch, const u8 *buf, unsigned long *size, int cmd)
+{
+  neo_dma_params_t *dma_params = &(ZION_PCI_PARAM(params)->dma_params[ch]);
+  unsigned long uaddr = (unsigned long)buf;
+  unsigned long left_size = *size;
+  unsigned long offset, net_size;
+  int nr_pages, got;
+  int i, ret=0;
+
+  nr_pages = ((uaddr & ~PAGE_MASK) + left_size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  nr_pages = min(nr_pages, (int)NEO_MAX_ENTRIES);
+
+  down_read(&current->mm->mmap_sem);
+  got = get_user_pages(current, current->mm, uaddr & PAGE_MASK, nr_pages,
+		       (cmd == ZION_DMA_READ), 0, dma_params->pages, NULL);
+  up_read(&current->mm->mmap_sem);
+
+  if(got <= 0)
+    {
+      return -EFAULT;
+    }
+
+  for(i=0; i<got; i++)
+    {
+      if(PageHighMem(dma_params->pages[i]))
+	{
+	  ret = -EINVAL;
+	  break;
+	}
+    }
+
+  if(ret)
+    {
+      for(i=0; i<got; i++)
+	page_cache_release(dma_params->pages[i]);
+      return ret;
+    }
+
+  offset = uaddr & ~PAGE_MASK;
+  for(i=0; i<got; i++)
+    {
+      if(left_size == 0)
+	{
+	  page_cache_release(dma_params->pages[i]);
+	  continue;
+	}
+
+      net_size = min(PAGE_SIZE - offset, left_size);
+
+      add_sg_table(params, ch, page_address(dma_params->pages[i]) + offset, net_size, net_size);
+      dma_params->dma_entries[dma_params->entries-1].page = dma_params->pages[i];
+      dma_params->dma_entries[dma_params->entries-1].flags =
+	NEO_DMA_ENT_USER | ((cmd == ZION_DMA_READ) ? NEO_DMA_ENT_DIRTY : 0);
+
+      left_size -= net_size;
+      offset = 0;
+    }
+
+  terminate_sg_table(params, ch);
+
+  *size = left_size;
+
+  return 0;
+}
+
+/* Run one round of the SG table and wait for it */
+static int neo_dma_run(zion_params_t *params, int ch, int cmd, unsigned long sdram_addr)
+{
+  int ret;
+
+  /* Set Registers and Set Timeout */
+  ret = neo_dma_prepare(params, ch, cmd, sdram_addr);
+  if(ret)
+    {
+      return ret;
+    }
+
+  disable_irq(params->dev->irq);
+
+  /* DMA Run */
+  pci_write_config_word(params->dev, NEO_PCI_DMA_COMMAND(ch),
+			((cmd==ZION_DMA_WRITE) ? NEO_IO_DERECTION_WRITE : NEO_IO_DERECTION_READ)
+			|NEO_DMA_RUN|NEO_DMA_OPEN);
+
+  /* Run Timer */
+  ZION_PCI_PARAM(params)->dma_params[ch].timer.expires = jiffies + NEO_DMA_TIMEOUT;
+  add_timer(&(ZION_PCI_PARAM(params)->dma_params[ch].timer));
+
+  enable_irq(params->dev->irq);
+
+  /* Sleep */
+  wait_event(ZION_PCI_PARAM(params)->dma_params[ch].neo_dma_wait_queue,
+	     ZION_PCI_PARAM(params)->dma_params[ch].condition != ZION_PCI_INT_DISPATCH_PENDING);
+
+  /* DMA End */
+  if(ZION_PCI_PARAM(params)->dma_params[ch].condition == ZION_PCI_INT_DISPATCH_TIMEOUT)
+    {
+      return -ETIME;
+    }
+
+  return 0;
+}
+
+/* Whether a user buffer can be given to the device without bouncing */
+static inline int neo_dma_direct_ok(const void *buf, unsigned long size, int sw)
+{
+  return (dma_direct && ZION_PCI_DMA_USER == sw &&
+	  size >= PAGE_SIZE && !((unsigned long)buf % 4));
+}
+
 unsigned long neo_sdram_dma_write
 (zion_params_t *params, unsigned long offset_addr, const char *data, unsigned long size, int ch, int sw)
 {
-  unsigned long left_size;
+  unsigned long left_size, round_left, round_size;
   unsigned long upper = 0, lower = 0;
   int ret;
   u8 *buf = (u8 *)data;
@@ -527,70 +727,61 @@ unsigned long neo_sdram_dma_write
   /* Initalize SG table etc. */
   init_dma_ch(params,ch);
 
- DMA_WRITE:
-
-  ret = make_sg_table(params, ch, &left_size);
-
-  if(ret)
+  while(left_size)
     {
-      size=0;
-      left_size = 0;
-      goto WRITE_RELEASE;
-    }
-
-  if(ZION_PCI_DMA_USER == sw)
-	  neo_copy_from_user(params, ch, buf);
-  else
-	  neo_copy_from_fb(params, ch, buf);
+      round_left = left_size;
 
-  /* Set Registers and Set Timeout */
-  neo_dma_prepare(params, ch, ZION_DMA_WRITE, (lower+offset_addr) );
+      ret = -EINVAL;
+      if(neo_dma_direct_ok(buf, left_size, sw))
+	{
+	  ret = map_user_sg_table(params, ch, buf, &round_left, ZION_DMA_WRITE);
+	}
 
-  disable_irq(params->dev->irq);
+      if(ret)
+	{
+	  round_left = left_size;
+	  ret = make_sg_table(params, ch, &round_left);
+	  if(ret)
+	    {
+	      size = 0;
+	      break;
+	    }
 
-  /* DMA Run */
-  pci_write_config_word(params->dev, NEO_PCI_DMA_COMMAND(ch), 
-			NEO_IO_DERECTION_WRITE|NEO_DMA_RUN|NEO_DMA_OPEN);
+	  if(ZION_PCI_DMA_USER == sw)
+	    neo_copy_from_user(params, ch, buf);
+	  else
+	    neo_copy_from_fb(params, ch, buf);
+	}
 
-  /* Run Timer */
-  ZION_PCI_PARAM(params)->dma_params[ch].timer.expires = jiffies + NEO_DMA_TIMEOUT;
-  add_timer(&(ZION_PCI_PARAM(params)->dma_params[ch].timer));
+      round_size = left_size - round_left;
 
-  enable_irq(params->dev->irq);
-  
-  /* Sleep */
-  wait_event(ZION_PCI_PARAM(params)->dma_params[ch].neo_dma_wait_queue,
-	     ZION_PCI_PARAM(params)->dma_params[ch].condition != ZION_PCI_INT_DISPATCH_PENDING);
-  
-  /* DMA End */
-  if(ZION_PCI_PARAM(params)->dma_params[ch].condition == ZION_PCI_INT_DISPATCH_TIMEOUT)
-    {
-      PERROR("NEO DMA Write Timeout.\n");
-      size = 0;
-      left_size = 0;
-      goto WRITE_RELEASE;
-    }
+      ret = neo_dma_run(params, ch, ZION_DMA_WRITE, lower + offset_addr + (size - left_size));
 
- WRITE_RELEASE:
+      release_dma_entry(params, ch);
 
-    release_dma_entry(params, ch);
+      if(ret)
+	{
+	  PERROR("NEO DMA Write Timeout.\n");
+	  size = 0;
+	  break;
+	}
 
-  if(left_size)
-    {
-      buf += (size-left_size);
-      goto  DMA_WRITE;
+      buf += round_size;
+      left_size -= round_size;
     }
 
+  release_dma_entry(params, ch);
+  up(&(ZION_PCI_PARAM(params)->dma_params[ch].dma_sem));
+
   return size;
 }
 
 static unsigned long neo_sdram_dma_read
 (zion_params_t *params, unsigned long offset_addr, void *data, unsigned long size, int ch)
 {
-  unsigned long left_size;
-  unsigned long entry_size;
+  unsigned long left_size, round_left, round_size;
   unsigned long upper, lower;
-  int ret;
+  int ret, direct;
   u8 *buf = (u8 *)data;
 
   /* check DWORD Alignment */
@@ -626,61 +817,47 @@ static unsigned long neo_sdram_dma_read
   /* Initalize SG table etc. */
   init_dma_ch(params,ch);
 
- DMA_READ:
-
-  entry_size = DMA_MAX_ENTRY_SIZE;
-
-  ret = make_sg_table(params, ch, &left_size);
-
-  if(ret)
+  while(left_size)
     {
-      size=0;
-      left_size = 0;
-      goto READ_RELEASE;
-    }
+      round_left = left_size;
 
-  /* Set Registers and Set Timeout */
-  neo_dma_prepare(params, ch, ZION_DMA_READ, (lower+offset_addr));
+      direct = 0;
+      if(neo_dma_direct_ok(buf, left_size, ZION_PCI_DMA_USER))
+	{
+	  direct = !map_user_sg_table(params, ch, buf, &round_left, ZION_DMA_READ);
+	}
 
-  disable_irq(params->dev->irq);
+      if(!direct)
+	{
+	  round_left = left_size;
+	  ret = make_sg_table(params, ch, &round_left);
+	  if(ret)
+	    {
+	      size = 0;
+	      break;
+	    }
+	}
 
-  /* DMA Run */
-  pci_write_config_word(params->dev, NEO_PCI_DMA_COMMAND(ch), 
-			NEO_IO_DERECTION_READ|NEO_DMA_RUN|NEO_DMA_OPEN);
+      round_size = left_size - round_left;
 
-  /* Run Timer */
-  ZION_PCI_PARAM(params)->dma_params[ch].timer.expires = jiffies + NEO_DMA_TIMEOUT;
-  add_timer(&(ZION_PCI_PARAM(params)->dma_params[ch].timer));
+      ret = neo_dma_run(params, ch, ZION_DMA_READ, lower + offset_addr + (size - left_size));
+      if(ret == -ETIME)
+	{
+	  PERROR("ZION DMA READ Timeout.\n");
+	}
 
-  enable_irq(params->dev->irq);
-  
-  /* Sleep */
-  wait_event(ZION_PCI_PARAM(params)->dma_params[ch].neo_dma_wait_queue,
-	     ZION_PCI_PARAM(params)->dma_params[ch].condition != ZION_PCI_INT_DISPATCH_PENDING);
-  
-  /* DMA End */
-  if(ZION_PCI_PARAM(params)->dma_params[ch].condition == ZION_PCI_INT_DISPATCH_TIMEOUT)
-    {
-      PERROR("ZION DMA READ Timeout.\n");
-/*
-      size = 0;
-      left_size = 0;
-      goto READ_RELEASE;
-*/
-    }
+      /* Copy data to User Space */
+      if(!direct)
+	neo_copy_to_user(params, ch, buf);
 
-  /* Copy data to User Space */
-  neo_copy_to_user(params, ch, buf);
+      release_dma_entry(params, ch);
 
- READ_RELEASE:
+      buf += round_size;
+      left_size -= round_size;
+    }
 
   release_dma_entry(params, ch);
-
-  if(left_size)
-    {
-      buf += (size-left_size);
-      goto  DMA_READ;
-    }
+  up(&(ZION_PCI_PARAM(params)->dma_params[ch].dma_sem));
 
   return size;
 }
@@ -1320,6 +1497,38 @@ static int initialize_zion_pci_private_space(zion_pci_params_t *zion_pci_params)
       init_MUTEX(&(zion_pci_params->dma_params[counter].dma_sem));
     }
 
+#ifndef CONFIG_ZION_SUPPRESS_MASTER_ACTION
+  /* Allocated once here, while memory is not fragmented yet */
+  for(counter=0; counter< NEO_DMA_CH; counter++)
+    {
+      neo_dma_params_t *dma_params = &(zion_pci_params->dma_params[counter]);
+      int nr_pool = min((dma_pool_kb * 1024) / DMA_MAX_ENTRY_SIZE, NEO_DMA_POOL_MAX);
+
+      dma_params->pages = kmalloc(sizeof(struct page *) * NEO_MAX_ENTRIES, GFP_KERNEL);
+
+      while(dma_params->pool_entries < nr_pool)
+	{
+	  void *ptr = (void *)__get_dma_pages(GFP_KERNEL, get_order(DMA_MAX_ENTRY_SIZE));
+	  if(ptr==NULL)
+	    {
+	      PERROR("DMA pool of ch%d : only %d of %d buffers.\n",
+		     counter, dma_params->pool_entries, nr_pool);
+	      break;
+	    }
+	  dma_params->pool[dma_params->pool_entries++] = ptr;
+	}
+    }
+
+  /* without the page array, never try direct mapping */
+  for(counter=0; counter< NEO_DMA_CH; counter++)
+    {
+      if(zion_pci_params->dma_params[counter].pages==NULL)
+	{
+	  dma_direct = 0;
+	}
+    }
+#endif /* CONFIG_ZION_SUPPRESS_MASTER_ACTION */
+
   return 0;
 }
 
@@ -1334,8 +1543,17 @@ static void free_zion_pci_private_space(zion_pci_params_t *zion_pci_params)
 
   for(counter=0; counter< NEO_DMA_CH; counter++)
     {
-      if(zion_pci_params->dma_params[counter].dma_chain!=NULL)
-	kfree((void *)(zion_pci_params->dma_params[counter].dma_chain));
+      neo_dma_params_t *dma_params = &(zion_pci_params->dma_params[counter]);
+      int i;
+
+      if(dma_params->dma_chain!=NULL)
+	kfree((void *)(dma_params->dma_chain));
+
+      for(i=0; i<dma_params->pool_entries; i++)
+	free_pages((unsigned long)(dma_params->pool[i]), get_order(DMA_MAX_ENTRY_SIZE));
+
+      if(dma_params->pages!=NULL)
+	kfree(dma_params->pages);
     }
 
   kfree((void *)zion_pci_params);
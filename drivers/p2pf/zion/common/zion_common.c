@@ -361,6 +361,10 @@ static int zion_common_ioctl(zion_params_t *zion_params,
 
       break;
 
+    case ZION_READ_EVENTS:
+
+      return zion_read_events(zion_params, (struct ZION_Event_Buf *)arg);  /* zion_interrupt.c */
+
     case ZION_SET_TIMEOUT:
 
       zion_params->wait_timeout = arg;  /* by jiffies */
@@ -174,6 +174,7 @@ int init_zion(void)
   /* initialize parameters */
   memset((void *)&zion_params,0,sizeof(zion_params_t));
   init_waitqueue_head(&(zion_params.zion_wait_queue));
+  zion_init_interrupt(&zion_params);
   zion_params.wait_timeout = ZION_DEFAULT_TIMEOUT;
 
   /* having ZION ? */
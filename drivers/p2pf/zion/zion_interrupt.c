@@ -33,14 +33,17 @@
 #include <linux/init.h>
 #include <linux/proc_fs.h>
 #include <linux/bitops.h>
+#include <linux/ktime.h>
 
 #include <linux/zion.h>
 #include "zion_regs.h"
 
 
-LIST_HEAD(zion_wait_interrupt_list);
 spinlock_t zion_wait_list_lock = SPIN_LOCK_UNLOCKED;
 
+#define ZION_EVENT_RING_MASK (ZION_EVENT_RING_SIZE-1)
+#define ZION_EVENT_BATCH     (16)
+
 int zion_enable_mbus_interrupt(zion_params_t *zion_params, int bit, zion_event_handler_t handler)
 {
   u16 tmp_16;
@@ -134,6 +137,70 @@ static int survey_interrupt_bits(zion_params_t *zion_params)
   return 0;
 } 
 
+/** Event Ring **/
+
+void zion_init_interrupt(zion_params_t *zion_params)
+{
+  int i;
+
+  for(i=0; i<ZION_NR_EVENT_SRC; i++)
+    {
+      init_waitqueue_head(&(zion_params->event_wait_queue[i]));
+    }
+
+  zion_params->event_head = 0;
+  zion_params->int_generation = 0;
+  zion_params->force_generation = 0;
+}
+
+/* Record an event of src. Called only from int_zion_event() and the
+   event handlers it calls, so there is a single producer. */
+void zion_post_event(zion_params_t *zion_params, int src, u32 status)
+{
+  u32 head = zion_params->event_head;
+  struct ZION_Event *event = &(zion_params->event_ring[head & ZION_EVENT_RING_MASK]);
+
+  event->seq = head;
+  event->src = src;
+  event->pci_status = zion_params->event_pci_status;
+  event->status = status;
+  event->timestamp = zion_params->event_time;
+
+  /* Publish the entry before the head */
+  smp_wmb();
+  zion_params->event_head = head + 1;
+
+  /* Order the head store against the waitqueue check, so a waiter that
+     has just queued itself either sees the new head or is woken */
+  smp_mb();
+  if(waitqueue_active(&(zion_params->event_wait_queue[src])))
+    {
+      wake_up(&(zion_params->event_wait_queue[src]));
+    }
+}
+
+static inline void zion_dispatch_event(zion_params_t *zion_params, int src,
+				       int irq, void *dev_id, u16 int_status, u32 status)
+{
+  u32 head = zion_params->event_head;
+
+  if(zion_params->interrupt_array[src])
+    {
+      /* Don't forget to memorize Interrupt Status in each modules */
+      (zion_params->interrupt_array[src])(zion_params, src, irq, dev_id, int_status);
+    }
+  else
+    {
+      PERROR("Event Handler is Not Registered! (%d)\n", src);
+    }
+
+  /* Record a plain event unless the handler posted its own */
+  if(zion_params->event_head == head)
+    {
+      zion_post_event(zion_params, src, status);
+    }
+}
+
 irqreturn_t int_zion_event(int irq, void *dev_id)
 {	
   u16 int_status = 0;
@@ -152,9 +219,13 @@ irqreturn_t int_zion_event(int irq, void *dev_id)
   /* Memorize it */
   zion_params->interrupt_bits.PCI_INT |= int_status;
 
+  /* One timestamp for all events of this interrupt */
+  zion_params->event_pci_status = int_status;
+  zion_params->event_time = ktime_to_ns(ktime_get());
+
   if(int_status & NEO_BACKEND_INT_REQ)
     {
-      u16 mbus_int_status, check_flag;
+      u16 mbus_int_status, pending;
       int i;
 
       /* Read Interrupt Status B */
@@ -162,45 +233,29 @@ irqreturn_t int_zion_event(int irq, void *dev_id)
       /* Memorize it */
       zion_params->interrupt_bits.NEO_INT |= mbus_int_status;
 
+      pending = mbus_int_status;
+
 #ifdef CONFIG_ZCOM
       if(mbus_int_status == (1<< UpInt1))
 	{
 	  goto CHECK_THREADS;  /* Do Nothing if ZCOM Driver is Supported. */
 	}
+      pending &= ~(((u16)1)<<UpInt1);
 #endif  /* CONFIG_ZCOM */
 
-      for(i=0; i<16; i++)
+      /* Visit the raised bits only */
+      while(pending)
 	{
-	  check_flag = ((u16)1)<<i;
+	  i = ffs(pending) - 1;
+	  pending &= ~(((u16)1)<<i);
 
-#ifdef CONFIG_ZCOM
-	  if(i==UpInt1)
-	    {
-	      continue;
-	    }
-#endif  /* CONFIG_ZCOM */
-
-	  if(check_flag & mbus_int_status)
-	    {
-	      if(zion_params->interrupt_array[i])
-		{
-		  /* Don't forget to memorize Interrupt Status in each modules */
-		  (zion_params->interrupt_array[i])(zion_params, i, irq, dev_id, int_status);
-		}
-	      else
-		{
-		  PERROR("Event Handler is Not Registered! (%04X)\n", check_flag);
-		}
-	    }
+	  zion_dispatch_event(zion_params, i, irq, dev_id, int_status, mbus_int_status);
 	}
       zion_backend_pci_int_clear(zion_params);
     }
   else if (int_status & NEO_DMA_DONE_MASK)
     {
-      if(zion_params->interrupt_array[Pciif_Int])
-	{
-	  (zion_params->interrupt_array[Pciif_Int])(zion_params, Pciif_Int, irq, dev_id, int_status);
-	}   
+      zion_dispatch_event(zion_params, Pciif_Int, irq, dev_id, int_status, int_status);
     }
 
 #ifdef CONFIG_ZCOM
@@ -214,17 +269,10 @@ irqreturn_t int_zion_event(int irq, void *dev_id)
     {
       if( survey_interrupt_bits(zion_params) )
 	{
-	  struct list_head *walk;
-	  zion_wait_nameplate_t *nameplate;
-
-	  list_for_each(walk, &zion_wait_interrupt_list)
-	    {
-	      nameplate = list_entry(walk, zion_wait_nameplate_t, task_list);
-
-	      nameplate->status_flags |= ZION_WAKEUP;
-	      memcpy(&(nameplate->interrupt_bits), &(zion_params->interrupt_bits),
-		     sizeof(struct ZION_Interrupt_Bits));
-	    }
+	  /* Waiters pick the bits up themselves */
+	  memcpy(&(zion_params->delivered_bits), &(zion_params->interrupt_bits),
+		 sizeof(struct ZION_Interrupt_Bits));
+	  zion_params->int_generation++;
 
 	  memset(&(zion_params->interrupt_bits), 0, sizeof(struct ZION_Interrupt_Bits));
 	  wake_up(&(zion_params->zion_wait_queue));
@@ -242,88 +290,231 @@ irqreturn_t int_zion_event(int irq, void *dev_id)
 
 /** Interrupt Waiting Routine **/
 
-static void zion_wait_interrupt_timeout(unsigned long arg)
+void zion_goto_bed(zion_params_t *zion_params, struct ZION_Interrupt_Bits *zion_interrupt_bits)
 {
-  zion_wait_nameplate_t *nameplate = (zion_wait_nameplate_t *)arg;
   unsigned long flags;
+  unsigned long generation, force_generation;
+  long remain;
+  int delivered, forced;
+
+  spin_lock_irqsave(&zion_wait_list_lock, flags);
+  generation = zion_params->int_generation;
+  force_generation = zion_params->force_generation;
+  spin_unlock_irqrestore(&zion_wait_list_lock, flags);
+
+  remain = wait_event_timeout( zion_params->zion_wait_queue,
+			       (generation != zion_params->int_generation
+				|| force_generation != zion_params->force_generation),
+			       zion_params->wait_timeout );
 
   spin_lock_irqsave(&zion_wait_list_lock, flags);
 
-  nameplate->status_flags |= (ZION_WAKEUP|ZION_TIMEOUT_WAKEUP);
+  delivered = (generation != zion_params->int_generation);
+  forced = (force_generation != zion_params->force_generation);
 
-  wake_up(&(nameplate->zion_params->zion_wait_queue));
+  if(delivered)
+    {
+      memcpy(zion_interrupt_bits, &(zion_params->delivered_bits), sizeof(struct ZION_Interrupt_Bits));
+    }
+  else
+    {
+      memset(zion_interrupt_bits, 0, sizeof(struct ZION_Interrupt_Bits));
+    }
 
   spin_unlock_irqrestore(&zion_wait_list_lock, flags);
-  
+
+  if(forced)
+    {
+      zion_interrupt_bits->PCI_INT |= ZION_WAKEUP_FORCED;
+    }
+
+  if(!remain && !delivered && !forced)
+    {
+      zion_interrupt_bits->PCI_INT |= ZION_WAKEUP_TIMEOUT;
+    }
+
   return;
 }
 
-void zion_goto_bed(zion_params_t *zion_params, struct ZION_Interrupt_Bits *zion_interrupt_bits)
+void zion_rout_them_up(zion_params_t *zion_params)
 {
-  zion_wait_nameplate_t nameplate;
   unsigned long flags;
 
-  nameplate.pid = current->pid;
-  nameplate.zion_params = zion_params;
-  nameplate.status_flags = 0;
-  memset(&(nameplate.interrupt_bits),0, sizeof(struct ZION_Interrupt_Bits));
-  init_timer(&(nameplate.timer));
-
   spin_lock_irqsave(&zion_wait_list_lock, flags);
-  list_add_tail(&(nameplate.task_list), &zion_wait_interrupt_list);
+
+  zion_params->force_generation++;
+  wake_up(&(zion_params->zion_wait_queue));
+
   spin_unlock_irqrestore(&zion_wait_list_lock, flags);
 
-  nameplate.timer.function = zion_wait_interrupt_timeout;
-  nameplate.timer.data = (unsigned long)&nameplate;
-  nameplate.timer.expires = jiffies + zion_params->wait_timeout;
+  return;
+}
 
-  add_timer(&(nameplate.timer));
-  
-  wait_event( zion_params->zion_wait_queue, (nameplate.status_flags & ZION_WAKEUP) );
+/* Is there an event of src_mask in [seq, head) ? */
+static int zion_event_pending(zion_params_t *zion_params, u32 src_mask, u32 seq)
+{
+  u32 head = zion_params->event_head;
 
-  spin_lock_irqsave(&zion_wait_list_lock, flags);
-  list_del(&(nameplate.task_list));
-  spin_unlock_irqrestore(&zion_wait_list_lock, flags);
+  smp_rmb();
 
-  if(!(nameplate.status_flags & ZION_TIMEOUT_WAKEUP))
+  if(head - seq > ZION_EVENT_RING_SIZE - 1)
     {
-      del_timer_sync(&(nameplate.timer));
+      return 1;  /* overrun: report it */
     }
 
-  memcpy(zion_interrupt_bits, &(nameplate.interrupt_bits), sizeof(struct ZION_Interrupt_Bits));
+  for(; seq != head; seq++)
+    {
+      if(src_mask & (1 << zion_params->event_ring[seq & ZION_EVENT_RING_MASK].src))
+	{
+	  return 1;
+	}
+    }
+
+  return 0;
+}
+
+/* Sleep on the queues of the sources in src_mask only */
+static long zion_wait_events(zion_params_t *zion_params, u32 src_mask, u32 seq, long timeout)
+{
+  wait_queue_t wait[ZION_NR_EVENT_SRC];
+  int src;
 
-  if(nameplate.status_flags & ZION_FORCE_WAKEUP)
+  for(src=0; src<ZION_NR_EVENT_SRC; src++)
     {
-      zion_interrupt_bits->PCI_INT |= ZION_WAKEUP_FORCED;
+      if(src_mask & (1 << src))
+	{
+	  init_waitqueue_entry(&wait[src], current);
+	  add_wait_queue(&(zion_params->event_wait_queue[src]), &wait[src]);
+	}
     }
 
-  if(nameplate.status_flags & ZION_TIMEOUT_WAKEUP)
+  for(;;)
     {
-      zion_interrupt_bits->PCI_INT |= ZION_WAKEUP_TIMEOUT;
+      set_current_state(TASK_INTERRUPTIBLE);
+
+      if(zion_event_pending(zion_params, src_mask, seq) || !timeout)
+	{
+	  break;
+	}
+
+      if(signal_pending(current))
+	{
+	  timeout = -ERESTARTSYS;
+	  break;
+	}
+
+      timeout = schedule_timeout(timeout);
     }
 
-  return;
+  set_current_state(TASK_RUNNING);
+
+  for(src=0; src<ZION_NR_EVENT_SRC; src++)
+    {
+      if(src_mask & (1 << src))
+	{
+	  remove_wait_queue(&(zion_params->event_wait_queue[src]), &wait[src]);
+	}
+    }
+
+  return timeout;
 }
 
-void zion_rout_them_up(zion_params_t *zion_params)
+/* ZION_READ_EVENTS: copy the events of src_mask from seq on, waiting
+   up to wait_timeout if there is none. Lock-free against the producer:
+   an entry is valid only if it was not overwritten while being copied. */
+int zion_read_events(zion_params_t *zion_params, struct ZION_Event_Buf *user_buf)
 {
-  unsigned long flags;
-  struct list_head *walk;
-  zion_wait_nameplate_t *nameplate;
+  struct ZION_Event_Buf buf;
+  struct ZION_Event batch[ZION_EVENT_BATCH];
+  u32 head, seq, count = 0, lost = 0;
+  int nr = 0;
+  long ret;
 
-  spin_lock_irqsave(&zion_wait_list_lock, flags);
+  if(copy_from_user(&buf, user_buf, sizeof(struct ZION_Event_Buf)))
+    {
+      return -EFAULT;
+    }
 
-  list_for_each(walk, &zion_wait_interrupt_list)
+  buf.src_mask &= (1 << ZION_NR_EVENT_SRC) - 1;
+  if(!buf.src_mask || !buf.count)
     {
-      nameplate = list_entry(walk, zion_wait_nameplate_t, task_list);
-      nameplate->status_flags |= (ZION_WAKEUP|ZION_FORCE_WAKEUP);
+      return -EINVAL;
     }
 
-  wake_up(&(zion_params->zion_wait_queue));
+  seq = buf.seq;
+  if((s32)(zion_params->event_head - seq) < 0)
+    {
+      seq = zion_params->event_head;  /* from the future: start from now */
+    }
 
-  spin_unlock_irqrestore(&zion_wait_list_lock, flags);
+  ret = zion_wait_events(zion_params, buf.src_mask, seq, zion_params->wait_timeout);
+  if(ret < 0)
+    {
+      return ret;
+    }
 
-  return;
+  head = zion_params->event_head;
+  smp_rmb();
+
+  while(seq != head && count + nr < buf.count)
+    {
+      struct ZION_Event *event = &batch[nr];
+
+      if(head - seq > ZION_EVENT_RING_SIZE - 1)
+	{
+	  lost += head - seq - (ZION_EVENT_RING_SIZE - 1);
+	  seq = head - (ZION_EVENT_RING_SIZE - 1);
+	  continue;
+	}
+
+      memcpy(event, &(zion_params->event_ring[seq & ZION_EVENT_RING_MASK]), sizeof(struct ZION_Event));
+
+      /* Overwritten while copying ? */
+      smp_rmb();
+      if(zion_params->event_head - seq > ZION_EVENT_RING_SIZE - 1)
+	{
+	  head = zion_params->event_head;
+	  smp_rmb();
+	  continue;
+	}
+
+      seq++;
+
+      if(!(buf.src_mask & (1 << event->src)))
+	{
+	  continue;
+	}
+
+      if(++nr == ZION_EVENT_BATCH)
+	{
+	  if(copy_to_user(buf.events + count, batch, nr * sizeof(struct ZION_Event)))
+	    {
+	      return -EFAULT;
+	    }
+	  count += nr;
+	  nr = 0;
+	}
+    }
+
+  if(nr)
+    {
+      if(copy_to_user(buf.events + count, batch, nr * sizeof(struct ZION_Event)))
+	{
+	  return -EFAULT;
+	}
+      count += nr;
+    }
+
+  buf.seq = seq;
+  buf.count = count;
+  buf.lost = lost;
+
+  if(copy_to_user(user_buf, &buf, sizeof(struct ZION_Event_Buf)))
+    {
+      return -EFAULT;
+    }
+
+  return 0;
 }
 
 void zion_set_enable_bits(zion_params_t *zion_params, struct ZION_Interrupt_Bits *zion_interrupt)
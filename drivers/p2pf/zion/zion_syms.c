@@ -32,6 +32,7 @@ EXPORT_SYMBOL(zion_disable_mbus_interrupt);
 EXPORT_SYMBOL(zion_mbus_int_clear);
 EXPORT_SYMBOL(zion_pci_dma_int_clear);
 EXPORT_SYMBOL(zion_backend_pci_int_clear);
+EXPORT_SYMBOL(zion_post_event);
 
 #ifdef CONFIG_ZION_PCI
 EXPORT_SYMBOL(ZION_pci_cache_clear);
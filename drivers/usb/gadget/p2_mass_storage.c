@@ -63,6 +63,10 @@
 #include <linux/freezer.h>
 #include <linux/utsname.h>
 #include <linux/poll.h>
+#include <linux/bio.h>
+#include <linux/mutex.h>
+
+#include <asm/unaligned.h>
 
 #include <linux/usb/ch9.h>
 #include <linux/usb/gadget.h>
@@ -371,6 +375,9 @@ extern void ms_ep_complete(struct usb_ep *ep, struct usb_request *req);
 extern struct usb_request *ms_in_ep_start(struct usb_ep *ep, int gfp_flags);
 extern struct usb_request *ms_out_ep_start(struct usb_ep *ep, int gfp_flags);
 extern void free_ep_req(struct usb_ep *ep, struct usb_request *req);
+#ifdef CONFIG_P2USB_FAST_PATH
+static int ms_fast_claim(struct usb_request *req);
+#endif
 
 static u8 CurrentState;
 static u8 PreviousState;
@@ -982,6 +989,11 @@ void ep_normal_completion(struct usb_ep *ep, struct usb_request *req)
 	switch (CurrentState) {
 	case CBW_READY:
 		P2DEBUG("CBW_READY\n");
+#ifdef CONFIG_P2USB_FAST_PATH
+		/* READ(10)/WRITE(10) to a bound LUN never reach user space */
+		if (ms_fast_claim(req))
+			break;
+#endif
 		CurrentState = CBW_DONE;
 		CurrentSerialNumber++;
 
@@ -1334,6 +1346,608 @@ struct usb_request *ms_out_ep_start(struct usb_ep *ep, int gfp_flags)
 	return req;
 }   
 
+#ifdef CONFIG_P2USB_FAST_PATH
+/*
+ * In-kernel data path for READ(10)/WRITE(10).
+ *
+ * A LUN bound to a card block device by P2USB_SET_FAST_LUN has its
+ * READ(10)/WRITE(10) CBWs served here instead of going through the
+ * GET_DATA/SET_DATA round-trips.  The transfer is cut into
+ * P2USB_FAST_BUFSIZE chunks spread over P2USB_FAST_BUFFERS buffers,
+ * so the card I/O of one chunk overlaps the bus transfer of the others.
+ * Everything else (vendor commands, INQUIRY, length mismatches, ...)
+ * still goes to user space, which also stays the owner of the sense
+ * data except right after a failed fast command.
+ * User space must unbind a LUN before touching its media itself.
+ */
+#define SCSI_REQUEST_SENSE      0x03
+#define SCSI_READ_10            0x28
+#define SCSI_WRITE_10           0x2A
+
+#define P2USB_FAST_BUFFERS      CONFIG_P2USB_FAST_BUFFERS
+#define P2USB_FAST_BUFSIZE      (CONFIG_P2USB_FAST_BUFSIZE_KB * 1024)
+
+/* sense key / additional sense code reported after a failed command */
+#define FAST_SENSE(key, asc)    (((key) << 8) | (asc))
+#define FAST_SENSE_NOT_READY    FAST_SENSE(0x02, 0x3A)  /* medium not present */
+#define FAST_SENSE_READ_ERROR   FAST_SENSE(0x03, 0x11)  /* unrecovered read error */
+#define FAST_SENSE_WRITE_ERROR  FAST_SENSE(0x03, 0x0C)  /* write error */
+
+/* CSW status	*/
+#define FAST_CSW_GOOD           0x00
+#define FAST_CSW_FAILED         0x01
+#define FAST_CSW_PHASE_ERROR    0x02
+
+struct ms_fast_lun {
+	struct block_device *bdev;
+	sector_t nr_blocks;
+	unsigned int blksize;
+	int rdonly;
+	u16 sense;
+};
+
+struct ms_fast_buf {
+	void *buf;
+	struct usb_request *req;
+	unsigned int length;	/* queued length, 0 when idle	*/
+	volatile int busy;		/* queued on the endpoint		*/
+	int status;
+	unsigned int actual;
+};
+
+static struct {
+	struct task_struct *thread;
+	wait_queue_head_t wait;
+	spinlock_t lock;		/* lun[] against ms_fast_claim()	*/
+	struct mutex mutex;		/* lun[].bdev against the thread	*/
+	int busy;				/* a claimed CBW is being served	*/
+	struct p2usb_cbw cbw;
+	struct p2usb_csw *csw;
+	struct ms_fast_lun lun[P2USB_LUN + 1];
+	struct ms_fast_buf bufs[P2USB_FAST_BUFFERS];
+} FastPath;
+
+/*
+ * Called from ep_normal_completion() with StoreDev->lock held for
+ * every CBW.  Returns 1 if the fast path takes the command.
+ */
+static int ms_fast_claim(struct usb_request *req)
+{
+	struct p2usb_cbw *cbw = (struct p2usb_cbw *)req->buf;
+	struct ms_fast_lun *lun;
+	u32 length, lba, count;
+	u8 op = cbw->cb[0];
+	int ret = 0;
+
+	if (req->actual != CBW_SIZE || FastPath.busy)
+		return 0;
+	if (le32_to_cpu(cbw->signature) != CBW_VALID_SIGNATURE || cbw->lun > P2USB_LUN)
+		return 0;
+	length = le32_to_cpu(cbw->data_transfer_length);
+
+	spin_lock(&FastPath.lock);
+	lun = &FastPath.lun[cbw->lun];
+	if (!lun->bdev)
+		goto out;
+
+	switch (op) {
+	case SCSI_REQUEST_SENSE:
+		/* only the sense of our own failures, the rest is user space's */
+		if (!lun->sense || !(cbw->flags & 0x80) || length == 0)
+			goto out;
+		break;
+
+	case SCSI_READ_10:
+	case SCSI_WRITE_10:
+		lun->sense = 0;
+		if (cbw->cb_length < 10 || !(cbw->flags & 0x80) != (op == SCSI_WRITE_10))
+			goto out;
+		if (op == SCSI_WRITE_10 && lun->rdonly)
+			goto out;
+		lba = get_unaligned_be32(&cbw->cb[2]);
+		count = get_unaligned_be16(&cbw->cb[7]);
+		if (count == 0 || (u64)count * lun->blksize != length)
+			goto out;
+		if ((u64)lba + count > lun->nr_blocks)
+			goto out;
+		break;
+
+	default:
+		lun->sense = 0;
+		goto out;
+	}
+
+	memcpy(&FastPath.cbw, cbw, CBW_SIZE);
+	FastPath.busy = 1;
+	wake_up(&FastPath.wait);
+	ret = 1;
+out:
+	spin_unlock(&FastPath.lock);
+	return ret;
+}
+
+static void ms_fast_complete(struct usb_ep *ep, struct usb_request *req)
+{
+	struct ms_fast_buf *b = (struct ms_fast_buf *)req->context;
+
+	b->status = req->status;
+	b->actual = req->actual;
+	smp_wmb();
+	b->busy = 0;
+	wake_up(&FastPath.wait);
+}
+
+static int ms_fast_queue(struct usb_ep *ep, struct ms_fast_buf *b, unsigned int length)
+{
+	unsigned long flags;
+	int ret = -ESHUTDOWN;
+
+	spin_lock_irqsave(&StoreDev->lock, flags);
+	if (StoreDev->config) {
+		b->req->buf = b->buf;
+		b->req->length = length;
+		b->length = length;
+		b->status = 0;
+		b->actual = 0;
+		b->busy = 1;
+		ret = usb_ep_queue(ep, b->req, GFP_ATOMIC);
+		if (ret) {
+			P2ERROR("fast path : usb_ep_queue() failed with status=%d\n", ret);
+			b->busy = 0;
+			b->length = 0;
+			ret = -ESHUTDOWN;
+		}
+	}
+	spin_unlock_irqrestore(&StoreDev->lock, flags);
+	return ret;
+}
+
+/* Wait for a queued buffer, -ESHUTDOWN if the bus transfer failed */
+static int ms_fast_reap(struct ms_fast_buf *b)
+{
+	wait_event(FastPath.wait, !b->busy);
+	smp_rmb();
+	return b->status ? -ESHUTDOWN : 0;
+}
+
+/* Reap every queued buffer, cancelling them first if asked to */
+static int ms_fast_drain(struct usb_ep *ep, int cancel, u32 *done)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < P2USB_FAST_BUFFERS; i++) {
+		struct ms_fast_buf *b = &FastPath.bufs[i];
+
+		if (!b->length)
+			continue;
+		if (cancel && b->busy)
+			usb_ep_dequeue(ep, b->req);
+		if (ms_fast_reap(b))
+			ret = -ESHUTDOWN;
+		else if (done)
+			*done += b->actual;
+		b->length = 0;
+	}
+	return ret;
+}
+
+static void ms_fast_bio_end(struct bio *bio, int error)
+{
+	if (error)
+		clear_bit(BIO_UPTODATE, &bio->bi_flags);
+	complete((struct completion *)bio->bi_private);
+}
+
+/* Synchronous card I/O on a page aligned buffer */
+static int ms_fast_bio(int rw, struct block_device *bdev, sector_t sector,
+					   void *buf, unsigned int length)
+{
+	struct completion done;
+	struct bio *bio;
+	int ret = 0;
+
+	while (length && !ret) {
+		bio = bio_alloc(GFP_NOIO, (length + PAGE_SIZE - 1) >> PAGE_SHIFT);
+		if (!bio)
+			return -ENOMEM;
+		bio->bi_bdev = bdev;
+		bio->bi_sector = sector;
+		bio->bi_end_io = ms_fast_bio_end;
+		bio->bi_private = &done;
+
+		/* the queue limits may cut the chunk into several bios */
+		while (length) {
+			unsigned int n = min_t(unsigned int, length, PAGE_SIZE);
+
+			if (bio_add_page(bio, virt_to_page(buf), n, 0) < n)
+				break;
+			buf += n;
+			length -= n;
+			sector += n >> 9;
+		}
+		if (!bio->bi_size) {
+			bio_put(bio);
+			return -EIO;
+		}
+
+		init_completion(&done);
+		submit_bio(rw, bio);
+		wait_for_completion(&done);
+		if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+			ret = -EIO;
+		bio_put(bio);
+	}
+	return ret;
+}
+
+/*
+ * READ(10): card -> buffer -> bulk-in.  The card read of the next chunk
+ * runs while the previous chunks are still on the bus.
+ */
+static int ms_fast_read(struct usb_ep *ep, struct ms_fast_lun *lun,
+						sector_t sector, u32 length, u32 *done)
+{
+	int i = 0, ret = 0;
+
+	while (length) {
+		struct ms_fast_buf *b = &FastPath.bufs[i];
+		unsigned int n = min_t(u32, length, P2USB_FAST_BUFSIZE);
+
+		if (b->length) {
+			if ((ret = ms_fast_reap(b)))
+				break;
+			*done += b->actual;
+			b->length = 0;
+		}
+		if ((ret = ms_fast_bio(READ, lun->bdev, sector, b->buf, n)))
+			break;
+		if ((ret = ms_fast_queue(ep, b, n)))
+			break;
+
+		sector += n >> 9;
+		length -= n;
+		i = (i + 1) % P2USB_FAST_BUFFERS;
+	}
+
+	/* a card error still lets the chunks already queued go out */
+	if (ms_fast_drain(ep, ret == -ESHUTDOWN, done))
+		ret = -ESHUTDOWN;
+	return ret;
+}
+
+/*
+ * WRITE(10): bulk-out -> buffer -> card.  Up to P2USB_FAST_BUFFERS
+ * chunks are received while one is being written.  After a card error
+ * the rest of the data is still accepted but dropped, so the host gets
+ * its CSW without a stall.
+ */
+static int ms_fast_write(struct usb_ep *ep, struct ms_fast_lun *lun,
+						 sector_t sector, u32 length, u32 *done)
+{
+	u32 left = length;
+	int i, ret = 0, failed = 0;
+
+	for (i = 0; i < P2USB_FAST_BUFFERS && left; i++) {
+		unsigned int n = min_t(u32, left, P2USB_FAST_BUFSIZE);
+
+		if ((ret = ms_fast_queue(ep, &FastPath.bufs[i], n)))
+			goto cancel;
+		left -= n;
+	}
+
+	for (i = 0; length; i = (i + 1) % P2USB_FAST_BUFFERS) {
+		struct ms_fast_buf *b = &FastPath.bufs[i];
+		unsigned int n;
+
+		if ((ret = ms_fast_reap(b)))
+			goto cancel;
+		if (b->actual != b->length) {
+			P2ERROR("fast path : short write data %d/%d\n", b->actual, b->length);
+			ret = -EPIPE;
+			goto cancel;
+		}
+		if (!failed) {
+			if (ms_fast_bio(WRITE, lun->bdev, sector, b->buf, b->actual))
+				failed = 1;
+			else
+				*done += b->actual;
+		}
+		sector += b->actual >> 9;
+		length -= b->actual;
+		b->length = 0;
+
+		if (left) {
+			n = min_t(u32, left, P2USB_FAST_BUFSIZE);
+			if ((ret = ms_fast_queue(ep, b, n)))
+				goto cancel;
+			left -= n;
+		}
+	}
+	return failed ? -EIO : 0;
+
+cancel:
+	if (ms_fast_drain(ep, 1, NULL))
+		ret = -ESHUTDOWN;
+	return ret;
+}
+
+/* REQUEST SENSE for the failure of the previous fast command */
+static int ms_fast_sense(struct usb_ep *ep, struct ms_fast_lun *lun, u32 length, u32 *done)
+{
+	u8 *sense = (u8 *)FastPath.bufs[0].buf;
+	unsigned int n = min_t(u32, min_t(u32, length, FastPath.cbw.cb[4]), 18);
+	int ret;
+
+	memset(sense, 0, 18);
+	sense[0] = 0x70;				/* current error, fixed format	*/
+	sense[2] = lun->sense >> 8;		/* sense key					*/
+	sense[7] = 10;					/* additional length			*/
+	sense[12] = lun->sense & 0xFF;	/* additional sense code		*/
+	lun->sense = 0;
+
+	if (n == 0)
+		return 0;
+	if ((ret = ms_fast_queue(ep, &FastPath.bufs[0], n)))
+		return ret;
+	return ms_fast_drain(ep, 0, done);
+}
+
+static void ms_fast_csw_complete(struct usb_ep *ep, struct usb_request *req)
+{
+	if (req->status)
+		P2ERROR("fast path : CSW failed (%d)\n", req->status);
+	usb_ep_free_request(ep, req);
+}
+
+/*
+ * Send the CSW and start waiting for the next CBW, as SET_READY_CSW
+ * does for the user space path but without reporting to user space.
+ */
+static void ms_fast_finish(u8 status, u32 residue)
+{
+	struct p2usb_csw *csw = FastPath.csw;
+	struct usb_request *req;
+	struct p2_ms_req *ms_req;
+	unsigned long flags;
+
+	csw->signature = cpu_to_le32(CSW_VALID_SIGNATURE);
+	csw->tag = FastPath.cbw.tag;
+	csw->data_residue = cpu_to_le32(residue);
+	csw->status = status;
+
+	spin_lock_irqsave(&StoreDev->lock, flags);
+	if (!StoreDev->config)
+		goto out;
+
+	req = alloc_ep_req(StoreDev->in_ep, CSW_SIZE, (void *)csw);
+	if (!req) {
+		P2ERROR("fast path : Couldn't allocate CSW request\n");
+		goto out;
+	}
+	req->complete = ms_fast_csw_complete;
+	if (usb_ep_queue(StoreDev->in_ep, req, GFP_ATOMIC)) {
+		P2ERROR("fast path : usb_ep_queue() failed (CSW)\n");
+		usb_ep_free_request(StoreDev->in_ep, req);
+		goto out;
+	}
+
+	CurrentState = CBW_READY;
+	if (!ms_out_ep_start(StoreDev->out_ep, GFP_ATOMIC)) {
+		P2ERROR("ms_out_ep_start() : Failed (fast path)\n");
+		ms_req = kzalloc(sizeof *ms_req, GFP_ATOMIC);
+		if (ms_req) {
+			ep_set_state(ms_req, (P2USB_CBW_BIT | P2USB_ERR_BIT), 0, CBW_REQUEST_ERROR, 0);
+			list_add_tail(&ms_req->list_ms_dev, &todo_list);
+		}else {
+			P2ERROR("Couldn't not allocate StatusQueue (fast path)\n");
+			StatusQueueError = P2USB_CBW_BIT | P2USB_ERR_BIT;
+		}
+		wake_up_interruptible(&WaitQueue);
+	}
+out:
+	FastPath.busy = 0;
+	spin_unlock_irqrestore(&StoreDev->lock, flags);
+}
+
+static void ms_fast_execute(void)
+{
+	struct p2usb_cbw *cbw = &FastPath.cbw;
+	struct ms_fast_lun *lun = &FastPath.lun[cbw->lun];
+	u32 length = le32_to_cpu(cbw->data_transfer_length);
+	int dir_in = cbw->flags & 0x80;
+	struct usb_ep *ep;
+	sector_t sector;
+	unsigned long flags;
+	u32 done = 0;
+	u8 status = FAST_CSW_GOOD;
+	int i, ret;
+
+	spin_lock_irqsave(&StoreDev->lock, flags);
+	ep = StoreDev->config ? (dir_in ? StoreDev->in_ep : StoreDev->out_ep) : NULL;
+	spin_unlock_irqrestore(&StoreDev->lock, flags);
+	if (!ep)
+		goto gone;
+
+	for (i = 0; i < P2USB_FAST_BUFFERS; i++) {
+		struct ms_fast_buf *b = &FastPath.bufs[i];
+
+		b->req = usb_ep_alloc_request(ep, GFP_KERNEL);
+		if (!b->req) {
+			P2ERROR("fast path : Couldn't allocate request\n");
+			ret = -ENOMEM;
+			goto free;
+		}
+		b->req->complete = ms_fast_complete;
+		b->req->context = b;
+		b->req->zero = 0;
+		b->req->short_not_ok = 0;
+		b->req->no_interrupt = 0;
+		b->length = 0;
+	}
+
+	if (!lun->bdev) {
+		/* unbound between the CBW and now */
+		lun->sense = FAST_SENSE_NOT_READY;
+		ret = -ENODEV;
+	}else if (cbw->cb[0] == SCSI_REQUEST_SENSE) {
+		ret = ms_fast_sense(ep, lun, length, &done);
+	}else {
+		sector = (sector_t)get_unaligned_be32(&cbw->cb[2]) * (lun->blksize >> 9);
+		if (dir_in)
+			ret = ms_fast_read(ep, lun, sector, length, &done);
+		else
+			ret = ms_fast_write(ep, lun, sector, length, &done);
+		if (ret == -EIO)
+			lun->sense = dir_in ? FAST_SENSE_READ_ERROR : FAST_SENSE_WRITE_ERROR;
+	}
+
+free:
+	for (i = 0; i < P2USB_FAST_BUFFERS; i++) {
+		if (FastPath.bufs[i].req)
+			usb_ep_free_request(ep, FastPath.bufs[i].req);
+		FastPath.bufs[i].req = NULL;
+	}
+	if (ret == -ESHUTDOWN)
+		goto gone;
+
+	if (ret == -EPIPE) {
+		status = FAST_CSW_PHASE_ERROR;
+	}else if (ret) {
+		status = FAST_CSW_FAILED;
+		/* end a data-in phase cut short with a stall, as user space does */
+		if (dir_in && done < length)
+			usb_ep_set_halt(ep);
+		if (!dir_in && !done && ret != -EIO)
+			usb_ep_set_halt(ep);
+	}
+	ms_fast_finish(status, length - done);
+	return;
+
+gone:
+	/* disconnected : the enable path restarts the CBW request */
+	spin_lock_irqsave(&StoreDev->lock, flags);
+	FastPath.busy = 0;
+	spin_unlock_irqrestore(&StoreDev->lock, flags);
+}
+
+static int ms_fast_thread(void *arg)
+{
+	while (!kthread_should_stop()) {
+		wait_event(FastPath.wait, FastPath.busy || kthread_should_stop());
+		if (!FastPath.busy)
+			continue;
+
+		mutex_lock(&FastPath.mutex);
+		ms_fast_execute();
+		mutex_unlock(&FastPath.mutex);
+	}
+	return 0;
+}
+
+/* ioctl(xx, SET_FAST_LUN, xx) : bind/unbind a LUN to a card block device */
+static int ms_fast_set_lun(unsigned long arg)
+{
+	P2USB_FAST_LUN_STRUCT param;
+	struct block_device *bdev = NULL, *old;
+	struct ms_fast_lun *lun;
+	unsigned int blksize = 0;
+	sector_t nr_blocks = 0;
+
+	if (copy_from_user(&param, (void *)arg, sizeof(P2USB_FAST_LUN_STRUCT))) {
+		P2ERROR("SET_FAST_LUN failed : copy_from_user()\n");
+		return -EFAULT;
+	}
+	if (param.Lun > P2USB_LUN) {
+		P2ERROR("SET_FAST_LUN failed : Invalid LUN (%d)\n", param.Lun);
+		return -EINVAL;
+	}
+
+	if (param.Device) {
+		bdev = open_by_devnum(new_decode_dev(param.Device),
+				(param.Flags & P2USB_FAST_RDONLY) ? FMODE_READ : (FMODE_READ | FMODE_WRITE));
+		if (IS_ERR(bdev)) {
+			P2ERROR("SET_FAST_LUN failed : open_by_devnum() error %ld\n", PTR_ERR(bdev));
+			return PTR_ERR(bdev);
+		}
+		blksize = bdev_hardsect_size(bdev);
+		if (blksize & 511) {
+			P2ERROR("SET_FAST_LUN failed : block size %d\n", blksize);
+			blkdev_put(bdev);
+			return -EINVAL;
+		}
+		nr_blocks = i_size_read(bdev->bd_inode);
+		sector_div(nr_blocks, blksize);
+	}
+
+	/* wait for a command in progress on the old device */
+	mutex_lock(&FastPath.mutex);
+	lun = &FastPath.lun[param.Lun];
+	spin_lock_irq(&FastPath.lock);
+	old = lun->bdev;
+	lun->bdev = bdev;
+	lun->nr_blocks = nr_blocks;
+	lun->blksize = blksize;
+	lun->rdonly = param.Flags & P2USB_FAST_RDONLY;
+	lun->sense = 0;
+	spin_unlock_irq(&FastPath.lock);
+	mutex_unlock(&FastPath.mutex);
+
+	if (old)
+		blkdev_put(old);
+	return 0;
+}
+
+static int __init ms_fast_init(void)
+{
+	int i;
+
+	init_waitqueue_head(&FastPath.wait);
+	spin_lock_init(&FastPath.lock);
+	mutex_init(&FastPath.mutex);
+
+	/* buffers are DMA'd by the UDC and handed to the block layer by page */
+	for (i = 0; i < P2USB_FAST_BUFFERS; i++) {
+		FastPath.bufs[i].buf = (void *)__get_free_pages(GFP_KERNEL,
+									get_order(P2USB_FAST_BUFSIZE));
+		if (!FastPath.bufs[i].buf)
+			goto enomem;
+	}
+	FastPath.csw = kmalloc(sizeof(struct p2usb_csw), GFP_KERNEL);
+	if (!FastPath.csw)
+		goto enomem;
+
+	FastPath.thread = kthread_run(ms_fast_thread, NULL, "p2usb_fast");
+	if (IS_ERR(FastPath.thread)) {
+		P2ERROR("fast path : kthread_run() failed\n");
+		FastPath.thread = NULL;
+		goto enomem;
+	}
+	return 0;
+
+enomem:
+	kfree(FastPath.csw);
+	for (i = 0; i < P2USB_FAST_BUFFERS; i++) {
+		if (FastPath.bufs[i].buf)
+			free_pages((unsigned long)FastPath.bufs[i].buf, get_order(P2USB_FAST_BUFSIZE));
+	}
+	return -ENOMEM;
+}
+
+static void ms_fast_exit(void)
+{
+	int i;
+
+	kthread_stop(FastPath.thread);
+	for (i = 0; i <= P2USB_LUN; i++) {
+		if (FastPath.lun[i].bdev)
+			blkdev_put(FastPath.lun[i].bdev);
+	}
+	kfree(FastPath.csw);
+	for (i = 0; i < P2USB_FAST_BUFFERS; i++)
+		free_pages((unsigned long)FastPath.bufs[i].buf, get_order(P2USB_FAST_BUFSIZE));
+}
+#endif /* CONFIG_P2USB_FAST_PATH */
+
 /*
  * This function is called when the device is suspended.
  * It simply changes the state only. (It similar to ms_disconnect)
@@ -1826,6 +2440,12 @@ static int ms_ioctl(struct inode *inode, struct file *file,
 	struct p2_ms_req *ms_req_current = NULL;
 	struct p2_ms_req *ms_req = NULL;
 
+#ifdef CONFIG_P2USB_FAST_PATH
+	/* opening the block device may sleep : not under StoreDev->lock */
+	if (cmd == P2USB_SET_FAST_LUN)
+		return ms_fast_set_lun(arg);
+#endif
+
 	spin_lock_irqsave(&StoreDev->lock, flags);
 
 	P2DEBUG("Enter ms_ioctl : Command = %d\n", cmd);
@@ -2143,9 +2763,24 @@ static int __init init(void)
 		return -ENOMEM;
 	}
 
+#ifdef CONFIG_P2USB_FAST_PATH
+	retVal = ms_fast_init();
+	if (retVal < 0) {
+		P2ERROR("ms_fast_init() failed\n");
+		kfree(ReceiveCbwBuf);
+		kfree(SendCswBuf);
+		cdev_del( &p2_ms_dev );
+		unregister_chrdev_region( dev_num, 1 );
+		return retVal;
+	}
+#endif
+
 	retVal = usb_gadget_register_driver(&ms_driver);
 	if (retVal < 0) {
 		P2ERROR("usb_gadget_register_driver() failed\n");
+#ifdef CONFIG_P2USB_FAST_PATH
+		ms_fast_exit();
+#endif
 		kfree(ReceiveCbwBuf);
 		kfree(SendCswBuf);
 		cdev_del( &p2_ms_dev );
@@ -2170,6 +2805,11 @@ static void __exit cleanup(void)
 	/* Tell driver of link controller that we're going away */
 	usb_gadget_unregister_driver(&ms_driver);
 
+#ifdef CONFIG_P2USB_FAST_PATH
+	/* after the unregister, so no request of ours is still queued */
+	ms_fast_exit();
+#endif
+
 	if (ReceiveCbwBuf)
 		kfree(ReceiveCbwBuf);
 
@@ -23,6 +23,10 @@
 #include <linux/buffer_head.h>
 #include <linux/vfs.h>
 #include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
+#include <linux/mount.h>
 
 #include <asm/uaccess.h>
 
@@ -31,8 +35,6 @@ static const struct inode_operations cramfs_dir_inode_operations;
 static const struct file_operations cramfs_directory_operations;
 static const struct address_space_operations cramfs_aops;
 
-static DEFINE_MUTEX(read_mutex);
-
 
 /* These two macros may change in future, to provide better st_ino
    semantics. */
@@ -111,10 +113,14 @@ static void cramfs_drop_inode(struct inode *inode)
  * BLKS_PER_BUF*PAGE_CACHE_SIZE, so that the caller doesn't need to
  * worry about end-of-buffer issues even when decompressing a full
  * page cache.
+ *
+ * Each super block has its own cache of "buffers=" buffers (default
+ * CONFIG_CRAMFS_NR_BUFFERS), recycled least recently used first, so
+ * that metadata and the data of several files being read at once
+ * don't evict each other.
  */
-#define READ_BUFFERS (2)
-/* NEXT_BUFFER(): Loop over [0..(READ_BUFFERS-1)]. */
-#define NEXT_BUFFER(_ix) ((_ix) ^ 1)
+#define MIN_READ_BUFFERS	2
+#define MAX_READ_BUFFERS	64
 
 /*
  * BLKS_PER_BUF_SHIFT should be at least 2 to allow for "compressed"
@@ -125,20 +131,50 @@ static void cramfs_drop_inode(struct inode *inode)
 #define BLKS_PER_BUF		(1 << BLKS_PER_BUF_SHIFT)
 #define BUFFER_SIZE		(BLKS_PER_BUF*PAGE_CACHE_SIZE)
 
-static unsigned char read_buffers[READ_BUFFERS][BUFFER_SIZE];
-static unsigned buffer_blocknr[READ_BUFFERS];
-static struct super_block * buffer_dev[READ_BUFFERS];
-static int next_buffer;
+/*
+ * Get the pages [blocknr, blocknr+nr) of the device read in one batch
+ * through the readahead of the device mapping, instead of a page at a
+ * time.  Sequential misses, e.g. of an executable being paged in,
+ * grow the readahead window up to "readahead=" pages.
+ */
+static void cramfs_readahead(struct super_block *sb, unsigned blocknr,
+			     unsigned nr, unsigned long devsize)
+{
+	struct cramfs_sb_info *sbi = CRAMFS_SB(sb);
+	struct address_space *mapping = sb->s_bdev->bd_inode->i_mapping;
+	unsigned i;
+
+	if (!sbi->ra.ra_pages)
+		return;
+
+	for (i = 0; i < nr && blocknr + i < devsize; i++) {
+		struct page *page = find_get_page(mapping, blocknr + i);
+
+		if (!page) {
+			page_cache_sync_readahead(mapping, &sbi->ra, NULL,
+						  blocknr + i, nr - i);
+			break;
+		}
+		if (PageReadahead(page))
+			page_cache_async_readahead(mapping, &sbi->ra, NULL,
+						   page, blocknr + i, nr - i);
+		page_cache_release(page);
+	}
+}
 
 /*
  * Returns a pointer to a buffer containing at least LEN bytes of
  * filesystem starting at byte offset OFFSET into the filesystem.
+ * Must be called with read_mutex of the super block held, and the
+ * result is valid only while it is held.
  */
 static void *cramfs_read(struct super_block *sb, unsigned int offset, unsigned int len)
 {
+	struct cramfs_sb_info *sbi = CRAMFS_SB(sb);
 	struct address_space *mapping = sb->s_bdev->bd_inode->i_mapping;
 	struct page *pages[BLKS_PER_BUF];
-	unsigned i, blocknr, buffer;
+	struct cramfs_buffer *buffer;
+	unsigned i, blocknr;
 	unsigned long devsize;
 	char *data;
 
@@ -148,22 +184,28 @@ static void *cramfs_read(struct super_block *sb, unsigned int offset, unsigned i
 	offset &= PAGE_CACHE_SIZE - 1;
 
 	/* Check if an existing buffer already has the data.. */
-	for (i = 0; i < READ_BUFFERS; i++) {
+	buffer = &sbi->buffers[0];
+	for (i = 0; i < sbi->nr_buffers; i++) {
+		struct cramfs_buffer *b = &sbi->buffers[i];
 		unsigned int blk_offset;
 
-		if (buffer_dev[i] != sb)
+		/* remember the least recently used one on the way */
+		if (b->lru < buffer->lru)
+			buffer = b;
+		if (b->blocknr == -1 || blocknr < b->blocknr)
 			continue;
-		if (blocknr < buffer_blocknr[i])
-			continue;
-		blk_offset = (blocknr - buffer_blocknr[i]) << PAGE_CACHE_SHIFT;
+		blk_offset = (blocknr - b->blocknr) << PAGE_CACHE_SHIFT;
 		blk_offset += offset;
 		if (blk_offset + len > BUFFER_SIZE)
 			continue;
-		return read_buffers[i] + blk_offset;
+		b->lru = ++sbi->lru_clock;
+		return b->data + blk_offset;
 	}
 
 	devsize = mapping->host->i_size >> PAGE_CACHE_SHIFT;
 
+	cramfs_readahead(sb, blocknr, BLKS_PER_BUF, devsize);
+
 	/* Ok, read in BLKS_PER_BUF pages completely first. */
 	for (i = 0; i < BLKS_PER_BUF; i++) {
 		struct page *page = NULL;
@@ -190,12 +232,10 @@ static void *cramfs_read(struct super_block *sb, unsigned int offset, unsigned i
 		}
 	}
 
-	buffer = next_buffer;
-	next_buffer = NEXT_BUFFER(buffer);
-	buffer_blocknr[buffer] = blocknr;
-	buffer_dev[buffer] = sb;
+	buffer->blocknr = blocknr;
+	buffer->lru = ++sbi->lru_clock;
 
-	data = read_buffers[buffer];
+	data = buffer->data;
 	for (i = 0; i < BLKS_PER_BUF; i++) {
 		struct page *page = pages[i];
 		if (page) {
@@ -206,12 +246,94 @@ static void *cramfs_read(struct super_block *sb, unsigned int offset, unsigned i
 			memset(data, 0, PAGE_CACHE_SIZE);
 		data += PAGE_CACHE_SIZE;
 	}
-	return read_buffers[buffer] + offset;
+	return buffer->data + offset;
+}
+
+static void cramfs_free_sbi(struct cramfs_sb_info *sbi)
+{
+	if (sbi) {
+		vfree(sbi->buffer_data);
+		kfree(sbi->buffers);
+		kfree(sbi);
+	}
+}
+
+/*
+ * Allocate the block cache, all buffers invalid: think disk change..
+ */
+static int cramfs_alloc_buffers(struct cramfs_sb_info *sbi)
+{
+	unsigned i;
+
+	sbi->buffers = kcalloc(sbi->nr_buffers, sizeof(struct cramfs_buffer),
+			       GFP_KERNEL);
+	sbi->buffer_data = vmalloc(sbi->nr_buffers * BUFFER_SIZE);
+	if (!sbi->buffers || !sbi->buffer_data)
+		return -ENOMEM;
+
+	for (i = 0; i < sbi->nr_buffers; i++) {
+		sbi->buffers[i].blocknr = -1;
+		sbi->buffers[i].data = sbi->buffer_data + i * BUFFER_SIZE;
+	}
+	return 0;
+}
+
+enum {
+	Opt_buffers, Opt_readahead, Opt_err
+};
+
+static match_table_t tokens = {
+	{Opt_buffers, "buffers=%u"},
+	{Opt_readahead, "readahead=%u"},
+	{Opt_err, NULL}
+};
+
+static int parse_options(char *options, unsigned int *buffers,
+			 unsigned int *readahead)
+{
+	char *p;
+	substring_t args[MAX_OPT_ARGS];
+	int option;
+
+	if (!options)
+		return 1;
+
+	while ((p = strsep(&options, ",")) != NULL) {
+		int token;
+		if (!*p)
+			continue;
+
+		token = match_token(p, tokens, args);
+		switch (token) {
+		case Opt_buffers:
+			if (match_int(&args[0], &option))
+				return 0;
+			if (option < MIN_READ_BUFFERS ||
+			    option > MAX_READ_BUFFERS) {
+				printk(KERN_ERR "cramfs: buffers must be "
+				       "%d..%d\n", MIN_READ_BUFFERS,
+				       MAX_READ_BUFFERS);
+				return 0;
+			}
+			*buffers = option;
+			break;
+		case Opt_readahead:
+			if (match_int(&args[0], &option) || option < 0)
+				return 0;
+			*readahead = option;
+			break;
+		default:
+			printk(KERN_ERR "cramfs: unrecognized mount option "
+			       "\"%s\" or missing value\n", p);
+			return 0;
+		}
+	}
+	return 1;
 }
 
 static void cramfs_put_super(struct super_block *sb)
 {
-	kfree(sb->s_fs_info);
+	cramfs_free_sbi(sb->s_fs_info);
 	sb->s_fs_info = NULL;
 }
 
@@ -221,13 +343,24 @@ static int cramfs_remount(struct super_block *sb, int *flags, char *data)
 	return 0;
 }
 
+static int cramfs_show_options(struct seq_file *m, struct vfsmount *mnt)
+{
+	struct cramfs_sb_info *sbi = CRAMFS_SB(mnt->mnt_sb);
+
+	if (sbi->nr_buffers != CONFIG_CRAMFS_NR_BUFFERS)
+		seq_printf(m, ",buffers=%u", sbi->nr_buffers);
+	if (sbi->ra.ra_pages != CONFIG_CRAMFS_READAHEAD)
+		seq_printf(m, ",readahead=%u", sbi->ra.ra_pages);
+	return 0;
+}
+
 static int cramfs_fill_super(struct super_block *sb, void *data, int silent)
 {
-	int i;
 	struct cramfs_super super;
 	unsigned long root_offset;
 	struct cramfs_sb_info *sbi;
 	struct inode *root;
+	unsigned int readahead = CONFIG_CRAMFS_READAHEAD;
 
 	sb->s_flags |= MS_RDONLY;
 
@@ -236,14 +369,22 @@ static int cramfs_fill_super(struct super_block *sb, void *data, int silent)
 		return -ENOMEM;
 	sb->s_fs_info = sbi;
 
-	/* Invalidate the read buffers on mount: think disk change.. */
-	mutex_lock(&read_mutex);
-	for (i = 0; i < READ_BUFFERS; i++)
-		buffer_blocknr[i] = -1;
+	sbi->nr_buffers = CONFIG_CRAMFS_NR_BUFFERS;
+	if (!parse_options(data, &sbi->nr_buffers, &readahead))
+		goto out;
+	if (cramfs_alloc_buffers(sbi) < 0) {
+		cramfs_free_sbi(sbi);
+		sb->s_fs_info = NULL;
+		return -ENOMEM;
+	}
+	mutex_init(&sbi->read_mutex);
+	file_ra_state_init(&sbi->ra, sb->s_bdev->bd_inode->i_mapping);
+	sbi->ra.ra_pages = readahead;
 
 	/* Read the first block and get the superblock from it */
+	mutex_lock(&sbi->read_mutex);
 	memcpy(&super, cramfs_read(sb, 0, sizeof(super)), sizeof(super));
-	mutex_unlock(&read_mutex);
+	mutex_unlock(&sbi->read_mutex);
 
 	/* Do sanity checks on the superblock */
 	if (super.magic != CRAMFS_MAGIC) {
@@ -255,9 +396,9 @@ static int cramfs_fill_super(struct super_block *sb, void *data, int silent)
 		}
 
 		/* check at 512 byte offset */
-		mutex_lock(&read_mutex);
+		mutex_lock(&sbi->read_mutex);
 		memcpy(&super, cramfs_read(sb, 512, sizeof(super)), sizeof(super));
-		mutex_unlock(&read_mutex);
+		mutex_unlock(&sbi->read_mutex);
 		if (super.magic != CRAMFS_MAGIC) {
 			if (super.magic == CRAMFS_MAGIC_WEND && !silent)
 				printk(KERN_ERR "cramfs: wrong endianess\n");
@@ -272,6 +413,13 @@ static int cramfs_fill_super(struct super_block *sb, void *data, int silent)
 		printk(KERN_ERR "cramfs: unsupported filesystem features\n");
 		goto out;
 	}
+#ifndef CONFIG_CRAMFS_LZO
+	if (super.flags & CRAMFS_FLAG_LZO) {
+		printk(KERN_ERR "cramfs: LZO compression not supported "
+		       "(CONFIG_CRAMFS_LZO)\n");
+		goto out;
+	}
+#endif
 
 	/* Check that the root inode is in a sane state */
 	if (!S_ISDIR(super.root.mode)) {
@@ -312,7 +460,7 @@ static int cramfs_fill_super(struct super_block *sb, void *data, int silent)
 	}
 	return 0;
 out:
-	kfree(sbi);
+	cramfs_free_sbi(sbi);
 	sb->s_fs_info = NULL;
 	return -EINVAL;
 }
@@ -339,6 +487,7 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 {
 	struct inode *inode = filp->f_path.dentry->d_inode;
 	struct super_block *sb = inode->i_sb;
+	struct cramfs_sb_info *sbi = CRAMFS_SB(sb);
 	char *buf;
 	unsigned int offset;
 	int copied;
@@ -364,7 +513,7 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 		mode_t mode;
 		int namelen, error;
 
-		mutex_lock(&read_mutex);
+		mutex_lock(&sbi->read_mutex);
 		de = cramfs_read(sb, OFFSET(inode) + offset, sizeof(*de)+CRAMFS_MAXPATHLEN);
 		name = (char *)(de+1);
 
@@ -377,7 +526,7 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 		memcpy(buf, name, namelen);
 		ino = CRAMINO(de);
 		mode = de->mode;
-		mutex_unlock(&read_mutex);
+		mutex_unlock(&sbi->read_mutex);
 		nextoffset = offset + sizeof(*de) + namelen;
 		for (;;) {
 			if (!namelen) {
@@ -405,11 +554,12 @@ static int cramfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
  */
 static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry, struct nameidata *nd)
 {
+	struct cramfs_sb_info *sbi = CRAMFS_SB(dir->i_sb);
 	unsigned int offset = 0;
 	int sorted;
 
-	mutex_lock(&read_mutex);
-	sorted = CRAMFS_SB(dir->i_sb)->flags & CRAMFS_FLAG_SORTED_DIRS;
+	mutex_lock(&sbi->read_mutex);
+	sorted = sbi->flags & CRAMFS_FLAG_SORTED_DIRS;
 	while (offset < dir->i_size) {
 		struct cramfs_inode *de;
 		char *name;
@@ -431,7 +581,7 @@ static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry, s
 
 		for (;;) {
 			if (!namelen) {
-				mutex_unlock(&read_mutex);
+				mutex_unlock(&sbi->read_mutex);
 				return ERR_PTR(-EIO);
 			}
 			if (name[namelen-1])
@@ -445,7 +595,7 @@ static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry, s
 			continue;
 		if (!retval) {
 			struct cramfs_inode entry = *de;
-			mutex_unlock(&read_mutex);
+			mutex_unlock(&sbi->read_mutex);
 			d_add(dentry, get_cramfs_inode(dir->i_sb, &entry));
 			return NULL;
 		}
@@ -453,55 +603,112 @@ static struct dentry * cramfs_lookup(struct inode *dir, struct dentry *dentry, s
 		if (sorted)
 			break;
 	}
-	mutex_unlock(&read_mutex);
+	mutex_unlock(&sbi->read_mutex);
 	d_add(dentry, NULL);
 	return NULL;
 }
 
-static int cramfs_readpage(struct file *file, struct page * page)
+/*
+ * Decompress the block of a locked page, with read_mutex held.
+ * *start_offset is the start of the compressed block if known (the
+ * end of the block of page->index-1), or 0; it is updated to the end
+ * of this block, so that a run of pages reads one block pointer each.
+ */
+static void cramfs_fill_page(struct inode *inode, struct page *page,
+			     u32 *start_offset)
 {
-	struct inode *inode = page->mapping->host;
 	u32 maxblock, bytes_filled;
 	void *pgdata;
 
 	maxblock = (inode->i_size + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	bytes_filled = 0;
+	pgdata = kmap(page);
 	if (page->index < maxblock) {
 		struct super_block *sb = inode->i_sb;
 		u32 blkptr_offset = OFFSET(inode) + page->index*4;
-		u32 start_offset, compr_len;
-
-		start_offset = OFFSET(inode) + maxblock*4;
-		mutex_lock(&read_mutex);
-		if (page->index)
-			start_offset = *(u32 *) cramfs_read(sb, blkptr_offset-4, 4);
-		compr_len = (*(u32 *) cramfs_read(sb, blkptr_offset, 4) - start_offset);
-		mutex_unlock(&read_mutex);
-		pgdata = kmap(page);
+		u32 end_offset, compr_len;
+
+		if (!*start_offset) {
+			*start_offset = OFFSET(inode) + maxblock*4;
+			if (page->index)
+				*start_offset = *(u32 *) cramfs_read(sb, blkptr_offset-4, 4);
+		}
+		end_offset = *(u32 *) cramfs_read(sb, blkptr_offset, 4);
+		compr_len = end_offset - *start_offset;
 		if (compr_len == 0)
 			; /* hole */
 		else if (compr_len > (PAGE_CACHE_SIZE << 1))
 			printk(KERN_ERR "cramfs: bad compressed blocksize %u\n", compr_len);
+#ifdef CONFIG_CRAMFS_LZO
+		else if (CRAMFS_SB(sb)->flags & CRAMFS_FLAG_LZO) {
+			bytes_filled = cramfs_uncompress_block_lzo(pgdata,
+				 PAGE_CACHE_SIZE,
+				 cramfs_read(sb, *start_offset, compr_len),
+				 compr_len);
+		}
+#endif
 		else {
-			mutex_lock(&read_mutex);
 			bytes_filled = cramfs_uncompress_block(pgdata,
 				 PAGE_CACHE_SIZE,
-				 cramfs_read(sb, start_offset, compr_len),
+				 cramfs_read(sb, *start_offset, compr_len),
 				 compr_len);
-			mutex_unlock(&read_mutex);
 		}
-	} else
-		pgdata = kmap(page);
+		*start_offset = end_offset;
+	}
 	memset(pgdata + bytes_filled, 0, PAGE_CACHE_SIZE - bytes_filled);
 	kunmap(page);
 	flush_dcache_page(page);
 	SetPageUptodate(page);
 	unlock_page(page);
+}
+
+static int cramfs_readpage(struct file *file, struct page * page)
+{
+	struct inode *inode = page->mapping->host;
+	struct cramfs_sb_info *sbi = CRAMFS_SB(inode->i_sb);
+	u32 start_offset = 0;
+
+	mutex_lock(&sbi->read_mutex);
+	cramfs_fill_page(inode, page, &start_offset);
+	mutex_unlock(&sbi->read_mutex);
+	return 0;
+}
+
+/*
+ * Decompress a whole readahead batch under one read_mutex: consecutive
+ * blocks are stored back to back, so each page costs one block pointer
+ * and the compressed data mostly comes from the same cache buffer.
+ */
+static int cramfs_readpages(struct file *file, struct address_space *mapping,
+			    struct list_head *pages, unsigned nr_pages)
+{
+	struct inode *inode = mapping->host;
+	struct cramfs_sb_info *sbi = CRAMFS_SB(inode->i_sb);
+	pgoff_t next_index = 0;
+	u32 start_offset = 0;
+	unsigned i;
+
+	mutex_lock(&sbi->read_mutex);
+	for (i = 0; i < nr_pages; i++) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		list_del(&page->lru);
+		if (!add_to_page_cache_lru(page, mapping, page->index,
+					   GFP_KERNEL)) {
+			if (page->index != next_index)
+				start_offset = 0;
+			cramfs_fill_page(inode, page, &start_offset);
+			next_index = page->index + 1;
+		}
+		page_cache_release(page);
+	}
+	mutex_unlock(&sbi->read_mutex);
 	return 0;
 }
 
 static const struct address_space_operations cramfs_aops = {
-	.readpage = cramfs_readpage
+	.readpage = cramfs_readpage,
+	.readpages = cramfs_readpages,
 };
 
 /*
@@ -526,6 +733,7 @@ static const struct super_operations cramfs_ops = {
 	.remount_fs	= cramfs_remount,
 	.statfs		= cramfs_statfs,
 	.drop_inode	= cramfs_drop_inode,
+	.show_options	= cramfs_show_options,
 };
 
 static int cramfs_get_sb(struct file_system_type *fs_type,
@@ -10,25 +10,33 @@
  *  - cramfs_uncompress_exit() - tell me when you're done
  *  - cramfs_uncompress_block() - uncompress a block.
  *
+ * plus cramfs_uncompress_block_lzo() for CRAMFS_FLAG_LZO images, which
+ * needs neither state nor locking.
+ *
  * NOTE NOTE NOTE! The uncompression is entirely single-threaded. We
  * only have one stream, and we'll initialize it only once even if it
- * then is used by multiple filesystems.
+ * then is used by multiple filesystems.  Since every filesystem has
+ * its own read lock, the stream is serialized by stream_mutex.
  */
 
 #include <linux/kernel.h>
 #include <linux/errno.h>
 #include <linux/vmalloc.h>
 #include <linux/zlib.h>
+#include <linux/lzo.h>
 #include <linux/cramfs_fs.h>
+#include <linux/mutex.h>
 
 static z_stream stream;
 static int initialized;
+static DEFINE_MUTEX(stream_mutex);
 
 /* Returns length of decompressed data. */
 int cramfs_uncompress_block(void *dst, int dstlen, void *src, int srclen)
 {
 	int err;
 
+	mutex_lock(&stream_mutex);
 	stream.next_in = src;
 	stream.avail_in = srclen;
 
@@ -45,14 +53,34 @@ int cramfs_uncompress_block(void *dst, int dstlen, void *src, int srclen)
 	err = zlib_inflate(&stream, Z_FINISH);
 	if (err != Z_STREAM_END)
 		goto err;
-	return stream.total_out;
+	err = stream.total_out;
+	mutex_unlock(&stream_mutex);
+	return err;
 
 err:
+	mutex_unlock(&stream_mutex);
 	printk("Error %d while decompressing!\n", err);
 	printk("%p(%d)->%p(%d)\n", src, srclen, dst, dstlen);
 	return 0;
 }
 
+#ifdef CONFIG_CRAMFS_LZO
+/* Returns length of decompressed data. */
+int cramfs_uncompress_block_lzo(void *dst, int dstlen, void *src, int srclen)
+{
+	size_t len = dstlen;
+	int err;
+
+	err = lzo1x_decompress_safe(src, srclen, dst, &len);
+	if (err != LZO_E_OK) {
+		printk("Error %d while decompressing LZO block!\n", err);
+		printk("%p(%d)->%p(%d)\n", src, srclen, dst, dstlen);
+		return 0;
+	}
+	return len;
+}
+#endif
+
 int cramfs_uncompress_init(void)
 {
 	if (!initialized++) {
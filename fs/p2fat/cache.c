@@ -11,6 +11,7 @@
 #include <linux/fs.h>
 #include <linux/p2fat_fs.h>
 #include <linux/buffer_head.h>
+#include <linux/rbtree.h>
 
 /* this must be > 0. */
 #define FAT_MAX_CACHE	8
@@ -29,12 +30,24 @@ struct fat_cache_id {
 	int dcluster;
 };
 
+/* Panasonic Original */
+struct fat_extent {
+	struct rb_node rb_node;
+	int fcluster;	/* first cluster number in the file. */
+	int dcluster;	/* first cluster number on disk. */
+	int len;	/* number of contiguous clusters */
+};
+/*--------------------*/
+
 static inline int fat_max_cache(struct inode *inode)
 {
 	return FAT_MAX_CACHE;
 }
 
 static struct kmem_cache *fat_cache_cachep;
+/* Panasonic Original */
+static struct kmem_cache *fat_extent_cachep;
+/*--------------------*/
 
 static void init_once(void *foo)
 {
@@ -51,12 +64,26 @@ int __init p2fat_cache_init(void)
 				init_once);
 	if (fat_cache_cachep == NULL)
 		return -ENOMEM;
+
+	/* Panasonic Original */
+	fat_extent_cachep = kmem_cache_create("p2fat_extent",
+				sizeof(struct fat_extent),
+				0, SLAB_RECLAIM_ACCOUNT|SLAB_MEM_SPREAD,
+				NULL);
+	if (fat_extent_cachep == NULL) {
+		kmem_cache_destroy(fat_cache_cachep);
+		return -ENOMEM;
+	}
+	/*--------------------*/
 	return 0;
 }
 
 void p2fat_cache_destroy(void)
 {
 	kmem_cache_destroy(fat_cache_cachep);
+	/* Panasonic Original */
+	kmem_cache_destroy(fat_extent_cachep);
+	/*--------------------*/
 }
 
 static inline struct fat_cache *fat_cache_alloc(struct inode *inode)
@@ -70,6 +97,18 @@ static inline void fat_cache_free(struct fat_cache *cache)
 	kmem_cache_free(fat_cache_cachep, cache);
 }
 
+/* Panasonic Original */
+static inline struct fat_extent *fat_extent_alloc(void)
+{
+	return kmem_cache_alloc(fat_extent_cachep, GFP_KERNEL);
+}
+
+static inline void fat_extent_free(struct fat_extent *ext)
+{
+	kmem_cache_free(fat_extent_cachep, ext);
+}
+/*--------------------*/
+
 static inline void fat_cache_update_lru(struct inode *inode,
 					struct fat_cache *cache)
 {
@@ -193,10 +232,27 @@ static void __fat_cache_inval_inode(struct inode *inode)
 		i->cache_valid_id++;
 }
 
+/* Panasonic Original */
+static void __fat_extent_inval_inode(struct inode *inode)
+{
+	struct p2fat_inode_info *i = P2FAT_I(inode);
+	struct rb_node *n;
+
+	while ((n = rb_first(&i->i_extents)) != NULL) {
+		rb_erase(n, &i->i_extents);
+		fat_extent_free(rb_entry(n, struct fat_extent, rb_node));
+	}
+	i->nr_extents = 0;
+}
+/*--------------------*/
+
 void p2fat_cache_inval_inode(struct inode *inode)
 {
 	spin_lock(&P2FAT_I(inode)->cache_lru_lock);
 	__fat_cache_inval_inode(inode);
+	/* Panasonic Original */
+	__fat_extent_inval_inode(inode);
+	/*--------------------*/
 	spin_unlock(&P2FAT_I(inode)->cache_lru_lock);
 }
 
@@ -215,47 +271,160 @@ static inline void cache_init(struct fat_cache_id *cid, int fclus, int dclus)
 }
 
 /* Panasonic Original */
-inline static void fat_read_lookup(struct inode *inode, int cluster,int *count,int *nr)
+/*
+ * Extent map of the cluster chain for RT files.
+ *
+ * Each node maps a run of contiguous clusters (fcluster..fcluster+len-1 in
+ * the file to dcluster..dcluster+len-1 on disk).  Nodes are only created
+ * from links which have actually been read from the FAT, so appending to
+ * the chain never makes them stale.  Anything else which rewrites the
+ * chain goes through p2fat_cache_inval_inode().
+ */
+/* Find the extent with the largest fcluster <= fclus. */
+static struct fat_extent *fat_extent_find(struct inode *inode, int fclus)
 {
-	int mile;
-
-	/* Lookup milestones */
-	if(!P2FAT_I(inode)->i_cluster_milestones[0]){
-		return;  /* no milestones */
+	struct rb_node *n = P2FAT_I(inode)->i_extents.rb_node;
+	struct fat_extent *ext, *found = NULL;
+
+	while (n) {
+		ext = rb_entry(n, struct fat_extent, rb_node);
+		if (fclus < ext->fcluster)
+			n = n->rb_left;
+		else {
+			found = ext;
+			if (fclus < ext->fcluster + ext->len)
+				break;
+			n = n->rb_right;
+		}
 	}
-	else{  /* we have valid milestones */
-		mile = (cluster >> FAT_MILE_BITS);
+	return found;
+}
 
-		if(mile > FAT_MILESTONES)
-			return;
+/*
+ * Look up "cluster" in the extent map.  Returns 1 when it is mapped, and
+ * otherwise moves *fclus/*dclus forward to the end of the nearest extent
+ * before it (if that is nearer than the current position).
+ */
+static int fat_extent_lookup(struct inode *inode, int cluster,
+			     int *fclus, int *dclus)
+{
+	struct fat_extent *ext;
+	int ret = 0;
 
-		/* find nearest milestone */
-		while(!P2FAT_I(inode)->i_cluster_milestones[mile]){
-			mile--;
+	spin_lock(&P2FAT_I(inode)->cache_lru_lock);
+	ext = fat_extent_find(inode, cluster);
+	if (ext) {
+		if (cluster < ext->fcluster + ext->len) {
+			*fclus = cluster;
+			*dclus = ext->dcluster + (cluster - ext->fcluster);
+			ret = 1;
+		} else if (*fclus < ext->fcluster + ext->len - 1) {
+			*fclus = ext->fcluster + ext->len - 1;
+			*dclus = ext->dcluster + ext->len - 1;
 		}
 	}
+	spin_unlock(&P2FAT_I(inode)->cache_lru_lock);
 
-	if(*count < (mile << FAT_MILE_BITS)){
-		*count = (mile << FAT_MILE_BITS);
-		*nr = P2FAT_I(inode)->i_cluster_milestones[mile];
-	}
+	return ret;
+}
 
-	return;
+static inline int fat_extent_contiguous(struct fat_extent *ext,
+					int fclus, int dclus)
+{
+	return ext->dcluster + (fclus - ext->fcluster) == dclus;
 }
-/*--------------------*/
 
-/* Panasonic Original */
-inline static void fat_establish_milestone(struct inode *inode, int cluster, int nr)
+/* Absorb following extents which "ext" now reaches. */
+static void fat_extent_merge_next(struct inode *inode, struct fat_extent *ext)
+{
+	struct rb_node *n;
+	struct fat_extent *next;
+
+	while ((n = rb_next(&ext->rb_node)) != NULL) {
+		next = rb_entry(n, struct fat_extent, rb_node);
+		if (next->fcluster > ext->fcluster + ext->len)
+			break;
+		if (!fat_extent_contiguous(ext, next->fcluster, next->dcluster))
+			break;
+		if (next->fcluster + next->len > ext->fcluster + ext->len)
+			ext->len = next->fcluster + next->len - ext->fcluster;
+		rb_erase(n, &P2FAT_I(inode)->i_extents);
+		P2FAT_I(inode)->nr_extents--;
+		fat_extent_free(next);
+	}
+}
+
+/* Record the run fclus..fclus+len-1 -> dclus..dclus+len-1. */
+static void fat_extent_add(struct inode *inode, unsigned int id,
+			   int fclus, int dclus, int len)
 {
-	int entry = ( cluster >> FAT_MILE_BITS );
+	struct p2fat_inode_info *i = P2FAT_I(inode);
+	struct rb_node **p, *parent;
+	struct fat_extent *ext, *new;
 
-	if(entry >= FAT_MILESTONES)
+	if (fclus < 0 || len <= 0)
 		return;
 
-	/* file_cluster = cluster */
-	P2FAT_I(inode)->i_cluster_milestones[entry] = nr;
+	new = fat_extent_alloc();
 
-	return;
+	spin_lock(&i->cache_lru_lock);
+	if (id != i->cache_valid_id)
+		goto out;	/* the chain was changed while walking */
+
+	ext = fat_extent_find(inode, fclus);
+	if (ext && fclus <= ext->fcluster + ext->len
+	    && fat_extent_contiguous(ext, fclus, dclus)) {
+		/* overlaps or directly follows an existing extent */
+		if (fclus + len > ext->fcluster + ext->len)
+			ext->len = fclus + len - ext->fcluster;
+		fat_extent_merge_next(inode, ext);
+		goto out;
+	}
+	if (ext && fclus < ext->fcluster + ext->len)
+		goto out;	/* inconsistent with the map, keep the old one */
+
+	if (!new || i->nr_extents >= FAT_MAX_EXTENTS)
+		goto out;
+
+	p = &i->i_extents.rb_node;
+	parent = NULL;
+	while (*p) {
+		parent = *p;
+		ext = rb_entry(parent, struct fat_extent, rb_node);
+		if (fclus < ext->fcluster)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	new->fcluster = fclus;
+	new->dcluster = dclus;
+	new->len = len;
+	rb_link_node(&new->rb_node, parent, p);
+	rb_insert_color(&new->rb_node, &i->i_extents);
+	i->nr_extents++;
+	fat_extent_merge_next(inode, new);
+	new = NULL;
+out:
+	spin_unlock(&i->cache_lru_lock);
+	if (new)
+		fat_extent_free(new);
+}
+
+/*
+ * Walk the whole chain once so that later lookups of an RT file never
+ * have to read the FAT.
+ */
+int p2fat_cache_fill_extents(struct inode *inode)
+{
+	int fclus, dclus, ret;
+
+	if (P2FAT_I(inode)->i_start == 0)
+		return 0;
+
+	ret = p2fat_get_cluster(inode, FAT_ENT_EOF, &fclus, &dclus, 1);
+	if (ret < 0)
+		return ret;
+	return 0;
 }
 /*--------------------*/
 
@@ -266,6 +435,10 @@ int p2fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus,
 	struct p2fat_entry fatent;
 	struct fat_cache_id cid;
 	int nr;
+/* Panasonic Original */
+	unsigned int ext_id = 0;
+	int ext_fclus = -1, ext_dclus = 0, ext_len = 0;
+/*--------------------*/
 
 	BUG_ON(P2FAT_I(inode)->i_start == 0);
 
@@ -274,6 +447,17 @@ int p2fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus,
 	if (cluster == 0)
 		return 0;
 
+/* Panasonic Original */
+	if (RT) {
+		spin_lock(&P2FAT_I(inode)->cache_lru_lock);
+		ext_id = P2FAT_I(inode)->cache_valid_id;
+		spin_unlock(&P2FAT_I(inode)->cache_lru_lock);
+
+		if (fat_extent_lookup(inode, cluster, fclus, dclus))
+			return 0;
+	}
+/*--------------------*/
+
 	if (fat_cache_lookup(inode, cluster, &cid, fclus, dclus) < 0) {
 		/*
 		 * dummy, always not contiguous
@@ -283,17 +467,19 @@ int p2fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus,
 	}
 
 /* Panasonic Original */
-	if(RT)	fat_read_lookup(inode, cluster, fclus, dclus);
+	if (RT) {
+		nr = *fclus;
+		fat_extent_lookup(inode, cluster, fclus, dclus);
+		if (*fclus != nr)
+			cache_init(&cid, *fclus, *dclus);
+		ext_fclus = *fclus;
+		ext_dclus = *dclus;
+		ext_len = 1;
+	}
 /*--------------------*/
 
 	p2fatent_init(&fatent);
 	while (*fclus < cluster) {
-
-/* Panasonic Original */
-		if(RT && !(*fclus & (FAT_MILE-1)))
-			fat_establish_milestone(inode, *fclus, *dclus);
-/*--------------------*/
-
 		/* prevent the infinite loop of cluster chain */
 		if (*fclus > limit) {
 			p2fat_fs_panic(sb, "%s: detected the cluster chain loop"
@@ -314,20 +500,55 @@ int p2fat_get_cluster(struct inode *inode, int cluster, int *fclus, int *dclus,
 			goto out;
 		} else if (nr == FAT_ENT_EOF) {
 			fat_cache_add(inode, &cid);
-			goto out;
+			goto out_extent;
 		}
 		(*fclus)++;
 		*dclus = nr;
 		if (!cache_contiguous(&cid, *dclus))
 			cache_init(&cid, *fclus, *dclus);
+
+/* Panasonic Original */
+		if (RT) {
+			if (ext_dclus + ext_len == *dclus)
+				ext_len++;
+			else {
+				fat_extent_add(inode, ext_id, ext_fclus, ext_dclus, ext_len);
+				ext_fclus = *fclus;
+				ext_dclus = *dclus;
+				ext_len = 1;
+			}
+		}
+/*--------------------*/
 	}
 	nr = 0;
 	fat_cache_add(inode, &cid);
+out_extent:
+/* Panasonic Original */
+	if (RT)
+		fat_extent_add(inode, ext_id, ext_fclus, ext_dclus, ext_len);
+/*--------------------*/
 out:
 	p2fatent_brelse(&fatent);
 	return nr;
 }
 
+/* Panasonic Original */
+/* Number of clusters from "cluster" to the end of its extent (at least 1). */
+static int fat_extent_run(struct inode *inode, int cluster)
+{
+	struct fat_extent *ext;
+	int run = 1;
+
+	spin_lock(&P2FAT_I(inode)->cache_lru_lock);
+	ext = fat_extent_find(inode, cluster);
+	if (ext && cluster < ext->fcluster + ext->len)
+		run = ext->fcluster + ext->len - cluster;
+	spin_unlock(&P2FAT_I(inode)->cache_lru_lock);
+
+	return run;
+}
+/*--------------------*/
+
 static int fat_bmap_cluster(struct inode *inode, int cluster, int RT)
 {
 	struct super_block *sb = inode->i_sb;
@@ -353,7 +574,7 @@ int p2fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 	struct super_block *sb = inode->i_sb;
 	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
 	sector_t last_block;
-	int cluster, offset;
+	int cluster, offset, fclus;
 
 	*phys = 0;
 	*mapped_blocks = 0;
@@ -378,6 +599,7 @@ int p2fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 	//ꥻΥ饹ǤΥեå
 	offset  = sector & (sbi->sec_per_clus - 1);
 
+	fclus = cluster;
 	cluster = fat_bmap_cluster(inode, cluster, RT);
 	if (cluster < 0)
 		return cluster;
@@ -387,6 +609,11 @@ int p2fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 
 		//ޥåפ
 		*mapped_blocks = sbi->sec_per_clus - offset;
+
+		//RTեextentνޤϢ³ƤȤߤʤ
+		if (RT)
+			*mapped_blocks += (unsigned long)(fat_extent_run(inode, fclus) - 1)
+				<< (sbi->cluster_bits - sb->s_blocksize_bits);
 		if (*mapped_blocks > last_block - sector)
 			*mapped_blocks = last_block - sector;
 	}
@@ -10,6 +10,7 @@
 /* Panasonic Original */
 #include <linux/swap.h>		//for mark_page_accessed()
 #include <linux/writeback.h>	//for struct writeback_control
+#include <linux/vmalloc.h>	//for vmalloc()
 /*--------------------*/
 
 /* Panasonic Original */
@@ -722,6 +723,43 @@ static void fatent_remove_from_list(struct super_block *sb)
 }
 /*--------------------*/
 
+/* Panasonic Original */
+//FAT񤭽Фͽ󤹤(ͽѤߤξϲ⤷ʤ)
+// ǽ˥ƥˤʤäƤfat_flush[msec]δ֤˱줿ڡޤȤƽ񤭽Ф
+// lock_rton()ԤĤȤΤǡkeventdǤϤʤѤworkqueueư
+static void fatent_arm_flush(struct super_block *sb)
+{
+	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
+
+	if(sbi->options.fat_flush)
+		queue_delayed_work(sbi->fat_flush_wq, &sbi->fat_flush_work, msecs_to_jiffies(sbi->options.fat_flush));
+}
+/*--------------------*/
+
+/* Panasonic Original */
+//FAT񤭽Ф
+// RT_ONϥȥ꡼ߤʤ褦˽񤭽Ф
+static void fatent_flush_work(struct work_struct *work)
+{
+	struct p2fat_sb_info *sbi = container_of(work, struct p2fat_sb_info, fat_flush_work.work);
+	struct super_block *sb = sbi->sb;
+
+	if(!sb || !sbi->options.fat_flush)
+		return;
+
+	lock_rton(MAJOR(sb->s_dev));
+	if(check_rt_status(sb)){
+		if(p2fat_sync(sb) < 0){
+			printk("p2fat_sync error\n");
+		}
+	}
+	else{
+		fatent_arm_flush(sb);
+	}
+	unlock_rton(MAJOR(sb->s_dev));
+}
+/*--------------------*/
+
 /* Panasonic Original */
 static void fatent_mark_page_dirty(struct super_block *sb, struct p2fat_entry *fatent)
 {
@@ -751,6 +789,7 @@ static void fatent_mark_page_dirty(struct super_block *sb, struct p2fat_entry *f
 
 	if(!need_read){
 		mutex_unlock(&get_page_lock);
+		fatent_arm_flush(sb);
 		return;
 	}
 
@@ -773,6 +812,8 @@ static void fatent_mark_page_dirty(struct super_block *sb, struct p2fat_entry *f
 		}
 	}
 	mutex_unlock(&get_page_lock);
+
+	fatent_arm_flush(sb);
 }
 /*--------------------*/
 
@@ -987,14 +1028,112 @@ static struct fatent_operations fat32_ops = {
 };
 /*--------------------*/
 
+/* Panasonic Original */
+static inline unsigned long fatent_au_index(struct p2fat_sb_info *sbi, int entry)
+{
+	return (entry - FAT_START_ENT - sbi->data_cluster_offset) / sbi->au_clusters;
+}
+/*--------------------*/
+
+/* Panasonic Original */
+//饹ΥӥåȥޥåפAUζ򹹿
+static void fatent_free_map_update(struct p2fat_sb_info *sbi, int entry, int old, int new)
+{
+	int data_entry = entry - FAT_START_ENT - sbi->data_cluster_offset;
+
+	if(!sbi->free_map)
+		return;
+
+	if((old == FAT_ENT_FREE) == (new == FAT_ENT_FREE))
+		return;
+
+	if(new == FAT_ENT_FREE){
+		if(test_and_set_bit(entry, sbi->free_map))
+			return;
+		sbi->free_map_count++;
+		if(data_entry >= 0)
+			sbi->au_free[fatent_au_index(sbi, entry)]++;
+	}
+	else{
+		if(!test_and_clear_bit(entry, sbi->free_map))
+			return;
+		sbi->free_map_count--;
+		if(data_entry >= 0)
+			sbi->au_free[fatent_au_index(sbi, entry)]--;
+	}
+}
+/*--------------------*/
+
+/* Panasonic Original */
+//ϰϤΥ饹٤ƶɤӥåȥޥåפĴ٤
+//   : 1 ٤ƶ  0 Υ饹
+static int fatent_free_map_range_free(struct p2fat_sb_info *sbi, int head, int nr_cluster)
+{
+	unsigned long end = head + nr_cluster;
+	unsigned long au, au_end;
+
+	if(end > sbi->max_cluster)
+		end = sbi->max_cluster;
+
+	//AUñ̤ϰϤAUζȽꤹ
+	if(!(nr_cluster % sbi->au_clusters)
+	   && !((head - FAT_START_ENT - sbi->data_cluster_offset) % sbi->au_clusters)){
+		au = fatent_au_index(sbi, head);
+		au_end = au + nr_cluster / sbi->au_clusters;
+		if(au_end > sbi->au_num)
+			return 0;
+		for(; au < au_end; au++){
+			if(sbi->au_free[au] != sbi->au_clusters)
+				return 0;
+		}
+		return 1;
+	}
+
+	return find_next_zero_bit(sbi->free_map, end, head) >= end;
+}
+/*--------------------*/
+
+/* Panasonic Original */
+//ӥåȥޥåפϢ³ΰ(nr_clusterñ̤)õ
+//   :  Ƭ饹ֹ   -ENOSPC
+static int fatent_free_map_find_cont(struct p2fat_sb_info *sbi, int nr_cluster)
+{
+	unsigned long base = FAT_START_ENT + sbi->data_cluster_offset;
+	unsigned long windows, start, i, head;
+
+	if(sbi->max_cluster < base + nr_cluster)
+		return -ENOSPC;
+
+	windows = (sbi->max_cluster - base) / nr_cluster;
+	start = sbi->cont_space.prev_free / nr_cluster;
+	if(start >= windows)
+		start = 0;
+
+	for(i = 0; i < windows; i++){
+		head = base + ((start + i) % windows) * nr_cluster;
+
+		//Ƭ饹ξɤФ
+		if(!test_bit(head, sbi->free_map))
+			continue;
+
+		if(fatent_free_map_range_free(sbi, head, nr_cluster))
+			return head;
+	}
+
+	return -ENOSPC;
+}
+/*--------------------*/
+
 /* Panasonic Original */
 static void fat_ent_put(struct super_block *sb, struct p2fat_entry *fatent, int new)
 {
 	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
 	struct fatent_operations *ops = sbi->fatent_ops;
+	int old = ops->ent_get(fatent);
 
 	ops->ent_put(fatent, new);
 	fatent_mark_page_dirty(sb, fatent);
+	fatent_free_map_update(sbi, fatent->entry, old, new);
 }
 /*--------------------*/
 
@@ -1113,6 +1252,10 @@ fat_failed:
 	return error;
 }
 
+/* Panasonic Original */
+static int fatent_free_map_init(struct super_block *sb);
+/*--------------------*/
+
 // fatent.cѿν
 // sb      : ѡ֥å
 //
@@ -1122,6 +1265,7 @@ int/*void*/ p2fat_ent_access_init(struct super_block *sb)
 /*------------------*/
 {
 	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
+	int err;
 
 	mutex_init(&sbi->fat_lock);
 
@@ -1134,11 +1278,19 @@ int/*void*/ p2fat_ent_access_init(struct super_block *sb)
 	sbi->fat_pages = NULL;
 	sbi->fat_inode = NULL;
 
+	sbi->free_map = NULL;
+	sbi->au_free = NULL;
+	sbi->free_map_count = 0;
+
 	sbi->cont_space.n = 0;
 	sbi->cont_space.prev_free = 0;
 	sbi->cont_space.cont = 0;
 	sbi->cont_space.pos = 0;
 	sbi->sync_flag = 0;
+	INIT_DELAYED_WORK(&sbi->fat_flush_work, fatent_flush_work);
+	sbi->fat_flush_wq = create_singlethread_workqueue("P2FAT_FAT_Flush");
+	if(!sbi->fat_flush_wq)
+		return -ENOMEM;
 	/*--------------------*/
 
 	switch (sbi->fat_bits) {
@@ -1158,7 +1310,16 @@ int/*void*/ p2fat_ent_access_init(struct super_block *sb)
 	}
 
 	/* Panasonic Original */
-	return fatent_fat_page_init(sb);
+	err = fatent_fat_page_init(sb);
+	if(err < 0)
+		return err;
+
+	//饹Υӥåȥޥå׺(ԻFATľܥ)
+	if(fatent_free_map_init(sb) < 0){
+		printk("P2FAT: free cluster map is not available.\n");
+	}
+
+	return 0;
 	/*--------------------*/
 }
 
@@ -1273,6 +1434,88 @@ static inline int fat_ent_read_block(struct super_block *sb,
 	return ret;
 }
 
+/* Panasonic Original */
+static void fatent_free_map_exit(struct p2fat_sb_info *sbi)
+{
+	if(sbi->free_map){
+		vfree(sbi->free_map);
+		sbi->free_map = NULL;
+	}
+	if(sbi->au_free){
+		vfree(sbi->au_free);
+		sbi->au_free = NULL;
+	}
+	sbi->free_map_count = 0;
+}
+/*--------------------*/
+
+/* Panasonic Original */
+//FAT٤ɤ߹ߡ饹ΥӥåȥޥåפAUζ
+// sb      : ѡ֥å
+//
+//   :  0   -ENOMEM -EIO
+//
+// ȸ  : p2fat_ent_access_init()
+static int fatent_free_map_init(struct super_block *sb)
+{
+	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+	struct p2fat_entry fatent;
+	unsigned long map_size, data_clusters;
+	int err;
+
+	sbi->au_clusters = (sbi->options.AU_size << 19) >> sbi->cluster_bits;
+	if(!sbi->au_clusters)
+		sbi->au_clusters = 1;
+
+	data_clusters = 0;
+	if(sbi->max_cluster > FAT_START_ENT + sbi->data_cluster_offset)
+		data_clusters = sbi->max_cluster - FAT_START_ENT - sbi->data_cluster_offset;
+	sbi->au_num = (data_clusters + sbi->au_clusters - 1) / sbi->au_clusters;
+
+	map_size = BITS_TO_LONGS(sbi->max_cluster + 1) * sizeof(unsigned long);
+	sbi->free_map = vmalloc(map_size);
+	sbi->au_free = vmalloc((sbi->au_num + 1) * sizeof(unsigned int));
+	if(!sbi->free_map || !sbi->au_free){
+		fatent_free_map_exit(sbi);
+		return -ENOMEM;
+	}
+	memset(sbi->free_map, 0, map_size);
+	memset(sbi->au_free, 0, (sbi->au_num + 1) * sizeof(unsigned int));
+
+	p2fatent_init(&fatent);
+	p2fatent_set_entry(&fatent, FAT_START_ENT);
+	while (fatent.entry < sbi->max_cluster) {
+		err = fat_ent_read_block(sb, &fatent);
+		if (err){
+			printk("fat_ent_read_block(%d) error %08X\n", __LINE__, err);
+			p2fatent_brelse(&fatent);
+			fatent_free_map_exit(sbi);
+			return err;
+		}
+
+		do {
+			if (fatent.entry >= sbi->max_cluster)
+				break;
+			if (ops->ent_get(&fatent) != FAT_ENT_FREE)
+				continue;
+
+			__set_bit(fatent.entry, sbi->free_map);
+			sbi->free_map_count++;
+			if(fatent.entry >= FAT_START_ENT + sbi->data_cluster_offset)
+				sbi->au_free[fatent_au_index(sbi, fatent.entry)]++;
+		} while (fat_ent_next(sbi, &fatent));
+		cond_resched();
+	}
+	p2fatent_brelse(&fatent);
+
+	//FS Infoζ饹ʤ礬뤿֤
+	sbi->free_clusters = sbi->free_map_count;
+
+	return 0;
+}
+/*--------------------*/
+
 /* Panasonic Experiment */
 int p2fat_check_cont_space(struct super_block *sb, int cluster)
 {
@@ -1296,6 +1539,12 @@ int p2fat_check_cont_space(struct super_block *sb, int cluster)
 		return 0;
 	}
 
+	if(sbi->free_map){
+		return fatent_free_map_range_free(sbi,
+			pos * sbi->cont_space.n + FAT_START_ENT + sbi->data_cluster_offset,
+			sbi->cont_space.n);
+	}
+
 	p2fatent_init(&fatent);
 	p2fatent_set_entry(&fatent, pos * sbi->cont_space.n + FAT_START_ENT + sbi->data_cluster_offset);
 
@@ -1462,6 +1711,16 @@ int p2fat_alloc_cont_clusters(struct super_block *sb, int nr_cluster)
 	p2fatent_init(&fatent);
 	p2fatent_set_entry(&fatent, sbi->cont_space.prev_free + FAT_START_ENT + sbi->data_cluster_offset);
 
+	//ӥåȥޥåפFATɤޤϢ³ΰõ
+	if(sbi->free_map){
+		ret = fatent_free_map_find_cont(sbi, nr_cluster);
+		if(ret < 0)
+			goto OUT;
+		header = ret;
+		ret = 0;
+		goto END;
+	}
+
 	while (count < limit) {
 		//ζμΥ饹饹ʾξƬ
 		if (fatent.entry >= sbi->max_cluster)
@@ -1568,6 +1827,124 @@ OUT:
 }
 /*--------------------*/
 
+/* Panasonic Original */
+//Ϣ³饹1FATǤĤʤ(head -> head+1 -> ... -> head+nr_cluster-1)
+// Υ饹ͤѹʤ(ݻEOFΤޤ)
+// sb         : ѡ֥å
+// head       : Ƭ饹ֹ
+// nr_cluster : 饹
+//
+//   :  0   -EINVAL -EIO
+//
+// ȸ  : p2fat_update_cluster_chain() / reservoir.c
+int p2fat_ent_link_run(struct super_block *sb, int head, int nr_cluster)
+{
+	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+	struct p2fat_entry fatent;
+	int i, err;
+
+	if(nr_cluster < 2)
+		return 0;
+
+	if(head < FAT_START_ENT || head + nr_cluster > sbi->max_cluster){
+		printk("[%s:%d] invalid run (head %d, nr %d)\n", __FILE__, __LINE__, head, nr_cluster);
+		return -EINVAL;
+	}
+
+	p2fatent_init(&fatent);
+	p2fatent_set_entry(&fatent, head);
+	err = fat_ent_read_block(sb, &fatent);
+	if(err){
+		printk("fat_ent_read_block(%d) error %08X\n", __LINE__, err);
+		goto out;
+	}
+
+	for(i = 0; i < nr_cluster - 1; i++){
+		if(ops->ent_get(&fatent) == FAT_ENT_FREE){ //ݤƤʤä
+			if(sbi->free_clusters != -1)
+				sbi->free_clusters--;
+			if(p2fat_check_cont_space(sb, fatent.entry))
+				sbi->cont_space.cont--;
+		}
+
+		fat_ent_put(sb, &fatent, fatent.entry + 1);
+
+		if(!fat_ent_next(sbi, &fatent)){
+			err = fat_ent_read_block(sb, &fatent); //Υڡɤ߹
+			if(err){
+				printk("fat_ent_read_block(%d) error %08X\n", __LINE__, err);
+				goto out;
+			}
+		}
+	}
+
+out:
+	p2fatent_brelse(&fatent);
+	return err;
+}
+/*--------------------*/
+
+/* Panasonic Original */
+//Ϣ³饹1FATǶˤ
+// sb         : ѡ֥å
+// head       : Ƭ饹ֹ
+// nr_cluster : 饹
+//
+//   :  0   -EINVAL -EIO
+//
+// ȸ  : p2fat_update_cluster_chain() / reservoir.c
+int p2fat_ent_free_run(struct super_block *sb, int head, int nr_cluster)
+{
+	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
+	struct fatent_operations *ops = sbi->fatent_ops;
+	struct p2fat_entry fatent;
+	int i, err;
+
+	if(nr_cluster < 1)
+		return 0;
+
+	if(head < FAT_START_ENT || head + nr_cluster > sbi->max_cluster){
+		printk("[%s:%d] invalid run (head %d, nr %d)\n", __FILE__, __LINE__, head, nr_cluster);
+		return -EINVAL;
+	}
+
+	p2fatent_init(&fatent);
+	p2fatent_set_entry(&fatent, head);
+	err = fat_ent_read_block(sb, &fatent);
+	if(err){
+		printk("fat_ent_read_block(%d) error %08X\n", __LINE__, err);
+		goto out;
+	}
+
+	for(i = 0; i < nr_cluster; i++){
+		if(ops->ent_get(&fatent) != FAT_ENT_FREE){
+			fat_ent_put(sb, &fatent, FAT_ENT_FREE);
+
+			if(sbi->free_clusters != -1)
+				sbi->free_clusters++; //䤹
+			if(p2fat_check_cont_space(sb, fatent.entry))
+				sbi->cont_space.cont++;
+		}
+
+		if(i == nr_cluster - 1)
+			break;
+
+		if(!fat_ent_next(sbi, &fatent)){
+			err = fat_ent_read_block(sb, &fatent); //Υڡɤ߹
+			if(err){
+				printk("fat_ent_read_block(%d) error %08X\n", __LINE__, err);
+				goto out;
+			}
+		}
+	}
+
+out:
+	p2fatent_brelse(&fatent);
+	return err;
+}
+/*--------------------*/
+
 //饹ĳݤ
 // inode      : Ρ
 // clusters   : ݤ饹ֹǼ
@@ -1601,6 +1978,14 @@ int p2fat_alloc_clusters(struct inode *inode, int *cluster, int nr_cluster)
 	p2fatent_init(&prev_ent);
 	p2fatent_init(&fatent);
 	p2fatent_set_entry(&fatent, sbi->prev_free);
+
+	//ӥåȥޥåפϺǽζ饹ޤɤФ
+	if(sbi->free_map && sbi->prev_free < sbi->max_cluster){
+		unsigned long next = find_next_bit(sbi->free_map, sbi->max_cluster, sbi->prev_free);
+		if(next < sbi->max_cluster)
+			p2fatent_set_entry(&fatent, next);
+	}
+
 	while (count < sbi->max_cluster) {
 		//ζμΥ饹饹ʾξƬ
 		if (fatent.entry >= sbi->max_cluster)
@@ -1877,6 +2262,13 @@ int p2fat_count_free_clusters(struct super_block *sb)
 	if (sbi->free_clusters != -1) //ǤʬäƤȤϲ⤷ʤ
 		goto out;
 
+	//ӥåȥޥåפFATɤޤʤ
+	if (sbi->free_map) {
+		sbi->free_clusters = sbi->free_map_count;
+		sb->s_dirt = 1;
+		goto out;
+	}
+
 	free = 0;
 	p2fatent_init(&fatent); //FATν
 	p2fatent_set_entry(&fatent, FAT_START_ENT); //FATơ֥Ƭ˥å
@@ -2101,6 +2493,14 @@ void p2fat_ent_access_exit(struct super_block *sb)
 	struct list_head *walk, *tmp;
 	struct fatent_reserve_fat *fat_reserved = NULL;
 
+	//񤭽Фߤ(ʹߤͽ󤵤ʤ)
+	sbi->options.fat_flush = 0;
+	cancel_delayed_work_sync(&sbi->fat_flush_work);
+	if(sbi->fat_flush_wq){
+		destroy_workqueue(sbi->fat_flush_wq);
+		sbi->fat_flush_wq = NULL;
+	}
+
 	if(p2fat_apply_reserved_fat(sb) < 0){
 		printk("p2fat_apply_reserved_fat error\n");
 	}
@@ -2111,6 +2511,8 @@ void p2fat_ent_access_exit(struct super_block *sb)
 
 	fatent_remove_from_list(sb);
 
+	fatent_free_map_exit(sbi);
+
 	if(sbi->fat_pages){
 		for(i = 0; i < sbi->fat_pages_num; i++){
 			if(sbi->fat_pages[i].indexes){
@@ -2259,19 +2661,30 @@ out:
 }
 /*--------------------*/
 
+/* Panasonic Original */
+//饤Ȥƥå(饤Ϥ٤Ʊ˥ƥˤʤ)
+static int fatent_page_is_dirty(struct fatent_page *fat_page)
+{
+	int index = fat_page->indexes[0];
+
+	return fatent_check_exist(fat_page, index, 0)
+		&& test_bit(FAT_STATUS_DIRTY, &FAT_list[index].status);
+}
+/*--------------------*/
+
 /* Panasonic Original */
 static int __p2fat_sync(struct super_block *sb, int lock)
 {
-	int i, index;
+	int i, j, index;
+	int align, next, nr;
 	int ret = 0;
-	struct list_head *walk;
-	struct fatent_page_status *stat;
 	struct list_head list;
 	struct fatent_list *lists;
 	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
 
 	//writeñ
 	unsigned long io_pages = 1L << (sbi->fatent_align_bits - PAGE_SHIFT - FAT_IO_PAGES_BITS);
+	unsigned long nr_lists = max(io_pages, (unsigned long)FAT_WB_MAX_IO);
 
 	//do nothing in case of pdflush context.
 	if(current_is_pdflush()){
@@ -2292,7 +2705,7 @@ static int __p2fat_sync(struct super_block *sb, int lock)
 		return 0;
 	}
 
-	lists = kmalloc(io_pages * sizeof(struct fatent_list), GFP_KERNEL);
+	lists = kmalloc(nr_lists * sizeof(struct fatent_list), GFP_KERNEL);
 	if(!lists){
 		printk("kmalloc failed!\n");
 		clear_bit(ON_FAT_SYNC, &sbi->sync_flag);
@@ -2304,41 +2717,48 @@ static int __p2fat_sync(struct super_block *sb, int lock)
 		mutex_lock(&get_page_lock);
 	}
 
-	spin_lock(&dirty_fat_lock);
-RETRY:
-	list_for_each(walk, &list_dirty_fat){
-		stat = list_entry(walk, struct fatent_page_status, lru);
-
-		if(stat->sb != sb)
-			continue;
-
+	//饤ֹϢ³ƥʥ饤Ȥ
+	//ޤȤƽ񤭽Ф(FAT1/FAT2Ȥ1writepagesǽ񤭽Ф)
+	for(align = 0; align < sbi->fat_pages_num; align = next){
 		INIT_LIST_HEAD(&list);
+		nr = 0;
+		next = align + 1;
 
-		for(i = 0; i < io_pages; i++){
-			index = stat->fat_page->indexes[i];
+		spin_lock(&dirty_fat_lock);
+		for(j = align; j < sbi->fat_pages_num && nr + io_pages <= nr_lists; j++){
+			if(!fatent_page_is_dirty(&sbi->fat_pages[j]))
+				break;
 
-			//DIRTYӥåȤ򲼤DIRTYꥹȤCLEANꥹȤ˰ư
-			if(fatent_set_clean(index) < 0){
-				ret = -EIO;
-				goto END;
-			}
+			for(i = 0; i < io_pages; i++){
+				index = sbi->fat_pages[j].indexes[i];
+
+				//DIRTYӥåȤ򲼤DIRTYꥹȤCLEANꥹȤ˰ư
+				if(fatent_set_clean(index) < 0){
+					spin_unlock(&dirty_fat_lock);
+					ret = -EIO;
+					goto END;
+				}
 
-			lists[i].page_index = (stat->fat_page->align_index
-				<< (sbi->fatent_align_bits - PAGE_SHIFT)) + (i << FAT_IO_PAGES_BITS);
-			lists[i].page = &FAT_list[index];
+				lists[nr].page_index = (j << (sbi->fatent_align_bits - PAGE_SHIFT))
+					+ (i << FAT_IO_PAGES_BITS);
+				lists[nr].page = &FAT_list[index];
 
-			//񤭹ѥꥹ
-			list_add_tail(&lists[i].lru, &list);
+				//񤭹ѥꥹ
+				list_add_tail(&lists[nr].lru, &list);
+				nr++;
+			}
 		}
+		spin_unlock(&dirty_fat_lock);
 
-		fat_ent_writepages(sbi->fat_inode, &list);
+		if(!nr)
+			continue;
 
-		goto RETRY;
+		//get_page_lockݻƤ뤿񤭽ФɤФ뤳ȤϤʤ
+		fat_ent_writepages(sbi->fat_inode, &list);
+		next = j;
 	}
 
 END:
-	spin_unlock(&dirty_fat_lock);
-
 	kfree(lists);
 	
 	if(lock){
@@ -73,7 +73,6 @@ static int p2fat_file_repair(struct inode *inode, struct file *filp)
         
 	//P2FAT_I(inode)->i_touched_cluster.file_cluster=0;
 	//P2FAT_I(inode)->i_touched_cluster.disk_cluster=P2FAT_I(inode)->i_start;
-	memset(P2FAT_I(inode)->i_cluster_milestones, 0, sizeof(int)*(FAT_MILESTONES + 1));
 
 	p2fat_cache_inval_inode(inode);
 
@@ -382,6 +381,23 @@ static int p2fat_file_release(struct inode *inode, struct file *filp)
 	return ret;
 }
 
+/* Panasonic Original */
+static int p2fat_file_open(struct inode *inode, struct file *filp)
+{
+	int ret = reservoir_file_open(inode, filp);
+
+	//RTɤ߹ߤǤϥ饹éäƤ(FATɤޤʤ)
+	if(!ret && (filp->f_flags & O_REALTIME)
+	   && (filp->f_flags & O_ACCMODE) == O_RDONLY){
+		if(p2fat_cache_fill_extents(inode) < 0){
+			printk("[%s:%d] p2fat_cache_fill_extents failed\n", __FILE__, __LINE__);
+		}
+	}
+
+	return ret;
+}
+/*--------------------*/
+
 static int p2fat_fsync(struct file *filp, struct dentry *dent, int datasync)
 {
 	struct super_block *sb = dent->d_inode->i_sb;
@@ -403,7 +419,7 @@ const struct file_operations p2fat_file_operations = {
 	.aio_read	= reservoir_file_aio_read,
 	.aio_write	= reservoir_file_aio_write,
 	.mmap		= generic_file_mmap,
-	.open           = reservoir_file_open,
+	.open           = p2fat_file_open,
 	.release	= p2fat_file_release,
 	.ioctl		= p2fat_generic_ioctl,
 	.fsync		= p2fat_fsync,
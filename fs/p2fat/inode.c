@@ -350,7 +350,6 @@ static int fat_fill_inode(struct inode *inode, struct msdos_dir_entry *de)
 
 	/* Panasonic Original */
 	P2FAT_I(inode)->i_flags = 0;
-	memset(P2FAT_I(inode)->i_cluster_milestones, 0, sizeof(int)*(FAT_MILESTONES + 1));
 
 	INIT_LIST_HEAD(&P2FAT_I(inode)->i_rt_dirty);
 	/* ------------------ */
@@ -513,6 +512,7 @@ static void fat_put_super(struct super_block *sb)
 	struct p2fat_sb_info *sbi = P2FAT_SB(sb);
 
 	/* Panasonic Original */
+	reservoir_stats_unregister(sb);
 	destroy_workqueue(P2FAT_SB(sb)->rt_chain_updater_wq);
 
 	p2fat_ent_access_exit(sb);
@@ -573,6 +573,10 @@ static void init_once(void * foo)
 	ei->nr_caches = 0;
 	ei->cache_valid_id = FAT_CACHE_VALID + 1;
 	INIT_LIST_HEAD(&ei->cache_lru);
+	/* Panasonic Original */
+	ei->i_extents = RB_ROOT;
+	ei->nr_extents = 0;
+	/*--------------------*/
 	INIT_HLIST_NODE(&ei->i_fat_hash);
 	inode_init_once(&ei->vfs_inode);
 }
@@ -1046,6 +1050,10 @@ static int fat_show_options(struct seq_file *m, struct vfsmount *mnt)
 		seq_puts(m, ",showexec");
 	if (opts->sys_immutable)
 		seq_puts(m, ",sys_immutable");
+	/* Panasonic Original */
+	if (opts->fat_flush)
+		seq_printf(m, ",fat_flush=%lu", opts->fat_flush);
+	/*--------------------*/
 	if (!isvfat) {
 		if (opts->dotsOK)
 			seq_puts(m, ",dotsOK=yes");
@@ -1073,7 +1081,7 @@ enum {
 	Opt_uni_xl_no, Opt_uni_xl_yes, Opt_nonumtail_no, Opt_nonumtail_yes,
 	Opt_obsolate, Opt_flush, 
 	/* Panasonic Original */
-	Opt_fat_align, Opt_AU_size,
+	Opt_fat_align, Opt_AU_size, Opt_fat_flush,
 	/*--------------------*/
 	Opt_err,
 };
@@ -1111,6 +1119,7 @@ static match_table_t fat_tokens = {
 	/* Panasonic Original */
 	{Opt_fat_align, "fat_align=%u"},
 	{Opt_AU_size, "AU_size=%u"},
+	{Opt_fat_flush, "fat_flush=%u"},
 	/*--------------------*/
 	{Opt_err, NULL},
 };
@@ -1180,6 +1189,7 @@ static int parse_options(char *options, int is_vfat, int silent, int *debug,
 	/* Panasonic Original */
 	opts->fat_align = 0;
 	opts->AU_size = 0;
+	opts->fat_flush = 0;
 	/*--------------------*/
 
 	if (!options)
@@ -1273,6 +1283,11 @@ static int parse_options(char *options, int is_vfat, int silent, int *debug,
 				return 0;
 			opts->AU_size = option;
 			break;
+		case Opt_fat_flush:
+			if (match_int(&args[0], &option))
+				return 0;
+			opts->fat_flush = option;
+			break;
 		/*--------------------*/
 
 		/* msdos specific */
@@ -1817,6 +1832,7 @@ int __p2fat_fill_super(struct super_block *sb, void *data, int silent,
 
 	/* Panasonic Original */
 	printk("[MINOR:%d  AU:%luKB]\n", MINOR(sb->s_bdev->bd_dev), sbi->options.AU_size << 9);
+	reservoir_stats_register(sb);
 	/*--------------------*/
 
 	return 0;
@@ -163,7 +163,7 @@ static void p2fat_add_done_list(struct super_block *sb,
   return;
 }
 
-static void p2fat_update_each_cluster(struct p2fat_reservoir_private *bi_private)
+static void p2fat_update_each_cluster(struct p2fat_reservoir_private *bi_private, int chained)
 {
   struct inode *inode = bi_private->inode;
   struct super_block *sb = bi_private->sb;
@@ -175,7 +175,10 @@ static void p2fat_update_each_cluster(struct p2fat_reservoir_private *bi_private
   if(test_bit(P2FAT_DUMMY_CLUSTER, &bi_private->flags))
     {
       /* ̵̤˳ݤΰβ */
-      fat_access(sb, bi_private->disk_cluster, FAT_ENT_FREE);
+      if(!chained)
+	{
+	  fat_access(sb, bi_private->disk_cluster, FAT_ENT_FREE);
+	}
     }
   else
     {
@@ -191,7 +194,11 @@ static void p2fat_update_each_cluster(struct p2fat_reservoir_private *bi_private
 
       if(!test_and_clear_bit(P2FAT_SLAVE_BIO, &bi_private->flags) && P2FAT_I(inode)->i_pos!=0)
 	{
-	  if( (inode->i_blocks >> (P2FAT_SB(sb)->cluster_bits - 9))
+	  if(chained)
+	    {
+	      /* FAT Chain p2fat_apply_chain_run()ǤޤȤƤĤʤ */
+	    }
+	  else if( (inode->i_blocks >> (P2FAT_SB(sb)->cluster_bits - 9))
 	      == bi_private->file_cluster )  // ե˴ؤ륯饹Ĵ
 	    {
 	      /* FAT Chain Ĥʤ */
@@ -289,52 +296,210 @@ static void p2fat_update_each_cluster(struct p2fat_reservoir_private *bi_private
   return;
 }
 
+/* եˤΤޤޤĤʤ륯饹Ĵ٤ */
+static int p2fat_is_chain_tail(struct p2fat_reservoir_private *bi_private,
+			       unsigned long file_cluster)
+{
+  if(test_bit(P2FAT_DUMMY_CLUSTER, &bi_private->flags)
+     || test_bit(P2FAT_SLAVE_BIO, &bi_private->flags))
+    {
+      return 0;
+    }
+
+  if(P2FAT_I(bi_private->inode)->i_pos==0)
+    {
+      return 0;
+    }
+
+  return (bi_private->file_cluster == file_cluster);
+}
+
+/* batch椫顢head³1FATȿǤǤΤ򽸤
+   run˰ܤͤrunä饹(0ʤޤȤʤ) */
+static int p2fat_collect_chain_run(struct list_head *batch,
+				   struct p2fat_reservoir_private *head,
+				   struct list_head *run)
+{
+  struct p2fat_reservoir_private *bi_private, *tmp;
+  struct super_block *sb = head->sb;
+  int dummy = test_bit(P2FAT_DUMMY_CLUSTER, &head->flags);
+  unsigned long next_fcluster = 0;
+  unsigned long next_dcluster = head->disk_cluster + 1;
+  int count = 1;
+
+  if(!dummy)
+    {
+      struct inode *inode = head->inode;
+
+      if(!p2fat_is_chain_tail(head, inode->i_blocks >> (P2FAT_SB(sb)->cluster_bits - 9)))
+	{
+	  return 0;
+	}
+      next_fcluster = head->file_cluster + 1;
+    }
+
+  list_add_tail(&head->cluster_list, run);
+
+  list_for_each_entry_safe(bi_private, tmp, batch, cluster_list)
+    {
+      if(bi_private->sb != sb)
+	{
+	  continue;
+	}
+
+      if(dummy)
+	{
+	  if(!test_bit(P2FAT_DUMMY_CLUSTER, &bi_private->flags))
+	    {
+	      continue;
+	    }
+	  if(bi_private->disk_cluster != next_dcluster)
+	    {
+	      break;
+	    }
+	}
+      else
+	{
+	  /* ¾ΥեslavebioϤΤޤ޻Ĥ */
+	  if(bi_private->inode != head->inode
+	     || test_bit(P2FAT_DUMMY_CLUSTER, &bi_private->flags)
+	     || test_bit(P2FAT_SLAVE_BIO, &bi_private->flags))
+	    {
+	      continue;
+	    }
+	  /* ƱեϢ³ʥ饹ϸʤ */
+	  if(!p2fat_is_chain_tail(bi_private, next_fcluster)
+	     || bi_private->disk_cluster != next_dcluster)
+	    {
+	      break;
+	    }
+	  next_fcluster++;
+	}
+
+      list_move_tail(&bi_private->cluster_list, run);
+      next_dcluster++;
+      count++;
+    }
+
+  return count;
+}
+
+/* run˽᤿饹ޤȤFATȿǤ */
+static int p2fat_apply_chain_run(struct p2fat_reservoir_private *head, int count)
+{
+  struct super_block *sb = head->sb;
+  struct inode *inode = head->inode;
+  int ret;
+
+  if(test_bit(P2FAT_DUMMY_CLUSTER, &head->flags))
+    {
+      /* ̵̤˳ݤΰޤȤƲ */
+      return p2fat_ent_free_run(sb, head->disk_cluster, count);
+    }
+
+  /* runΥ饹ƱΤĤʤǤ顢եˤĤʤ */
+  ret = p2fat_ent_link_run(sb, head->disk_cluster, count);
+  if(ret)
+    {
+      return ret;
+    }
+
+  ret = p2fat_chain_add(inode, head->disk_cluster, count);
+  if(ret)
+    {
+      return ret;
+    }
+
+  P2FAT_I(inode)->mmu_private += (loff_t)count * P2FAT_SB(sb)->cluster_size;
+
+  return 0;
+}
+
+/* 1Ĥbio_privateθ򤹤 */
+static void p2fat_release_bio_private(struct super_block *sb,
+				      struct p2fat_reservoir_private *bi_private)
+{
+  unsigned long flags = 0;
+
+  spin_lock_irqsave(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
+
+  /* i/o schedulerϤǡäΤʤ
+     󥿤򸺤餷Ƥ */
+  if(bi_private->reservoir_idx>=0)
+    {
+      P2FAT_SB(sb)->rt_private_count[bi_private->reservoir_idx]--;
+    }
+
+  spin_unlock_irqrestore(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
+
+  kfree(bi_private);
+}
+
 void p2fat_update_cluster_chain(struct work_struct *work)
 {
   struct super_block *sb = container_of(work, struct p2fat_sb_info, rt_chain_updater)->sb;
-  struct p2fat_reservoir_private *bi_private;
+  struct p2fat_reservoir_private *bi_private, *tmp;
   unsigned long flags = 0;
   int i = 0;
+  LIST_HEAD(batch);
+  LIST_HEAD(run);
 
+  /* λbioޤȤƼФFATιlockƤ餪ʤ */
   spin_lock_irqsave(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
+  list_splice_init(&P2FAT_SB(sb)->rt_updated_clusters, &batch);
+  spin_unlock_irqrestore(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
 
-  while(!list_empty(&P2FAT_SB(sb)->rt_updated_clusters))
+  while(!list_empty(&batch))
     {
-      bi_private = list_entry(P2FAT_SB(sb)->rt_updated_clusters.next,
-			      struct p2fat_reservoir_private, cluster_list);
-      list_del(&bi_private->cluster_list);
-
-      /* lock򰮤äޤޤȡθ˸Ƥ write_inode ʤɤ
-	 ưʤΤǡöϤʤ */
-      spin_unlock_irqrestore(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
+      int count;
+      int chained = 0;
 
-      /* FATιȥХåΤν򤪤ʤ */
-      p2fat_update_each_cluster(bi_private);
+      bi_private = list_entry(batch.next,
+			      struct p2fat_reservoir_private, cluster_list);
+      list_del_init(&bi_private->cluster_list);
 
-      /* Ŭ٤ʼԤäƤ륿򵯤
-	 128ä˺Ϥʤ塼˥ǡ*/
-      i++;
-      if(unlikely(i==128))
+      /* Ϣ³饹ޤȤơFAT1ǹ */
+      count = p2fat_collect_chain_run(&batch, bi_private, &run);
+      if(count > 1)
 	{
-	  wake_up(&done_event);
-	  cond_resched();
-	  i=0;
+	  /* ԤȤ1饹Ĥν᤹
+	     ޤǤĤʤȥϡ1饹Ĥ
+	     p2fat_chain_add()/fat_access()ǽľ */
+	  if(p2fat_apply_chain_run(bi_private, count))
+	    {
+	      printk("%s-%d: Applying Chain Run Failed. (cluster %lu, count %d)\n",
+		     __PRETTY_FUNCTION__, __LINE__, bi_private->disk_cluster, count);
+	    }
+	  else
+	    {
+	      chained = 1;
+	    }
 	}
-
-      /* emptyåΤ˺ټɬ */
-      spin_lock_irqsave(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
-
-      /* i/o schedulerϤǡäΤʤ
-	 󥿤򸺤餷Ƥ */
-      if(bi_private->reservoir_idx>=0)
+      else if(count==0)
 	{
-	  P2FAT_SB(sb)->rt_private_count[bi_private->reservoir_idx]--;
+	  list_add_tail(&bi_private->cluster_list, &run);
 	}
 
-      kfree(bi_private);      
-    }
+      list_for_each_entry_safe(bi_private, tmp, &run, cluster_list)
+	{
+	  list_del(&bi_private->cluster_list);
 
-  spin_unlock_irqrestore(&P2FAT_SB(sb)->rt_updated_clusters_lock, flags);
+	  /* FATιȥХåΤν򤪤ʤ */
+	  p2fat_update_each_cluster(bi_private, chained);
+
+	  /* Ŭ٤ʼԤäƤ륿򵯤
+	     128ä˺Ϥʤ塼˥ǡ*/
+	  i++;
+	  if(unlikely(i==128))
+	    {
+	      wake_up(&done_event);
+	      cond_resched();
+	      i=0;
+	    }
+
+	  p2fat_release_bio_private(sb, bi_private);
+	}
+    }
 
   /* Ǹ˳μ¤ˡԤäƤ륿򵯤 */
   wake_up(&done_event);
@@ -390,7 +555,7 @@ static void p2fat_callback_write(struct bio *bio, int err)
 
   bio->bi_private = NULL;
 
-  reservoir_end_io_write(bio, err);
+  reservoir_end_io_write(sb, bio, err);
 
   return;
 }
@@ -548,6 +713,26 @@ static void p2fat_set_bio_private(struct bio *bio, struct page *page, int rw, in
   return;
 }
 
+/* 桼Хåեpageľܺܤbioϡpageե֤
+   ɤʤΤǡƤӽФ¦֤ȥ */
+static void p2fat_set_bio_user_private(struct bio *bio, struct inode *inode,
+				       unsigned long index, unsigned long size)
+{
+  struct p2fat_reservoir_private *bi_private = bio->bi_private;
+
+  if( unlikely(bi_private==NULL) )
+    {
+      return;
+    }
+
+  /* DirectϤƱλΤΤ˥Ͽ롣
+     1bio1饹ܤΤǡûǤϤʤꤹ */
+  bi_private->size = size;
+  bi_private->file_cluster = (index >> (P2FAT_SB(inode->i_sb)->cluster_bits - PAGE_CACHE_SHIFT));
+
+  return;
+}
+
 static int p2fat_get_n_blocks(struct super_block *sb,
 			      unsigned long length, unsigned long *blocks)
 {
@@ -1008,6 +1193,7 @@ struct reservoir_operations p2fat_rs_ops =
     .set_bio_callback = p2fat_set_bio_callback,
     .alloc_bio_private = p2fat_alloc_bio_private,
     .set_bio_private = p2fat_set_bio_private,
+    .set_bio_user_private = p2fat_set_bio_user_private,
     .prepare_submit = p2fat_prepare_submit,
     .wait_on_localfs = p2fat_wait_on_sync,
     .get_device_address = p2fat_get_device_address,
@@ -12,6 +12,9 @@
 #include <linux/reservoir_fs.h>
 #include <linux/mpage.h>
 #include <linux/dma-mapping.h>
+#include <linux/kthread.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 char reservoir_fs_revision[] = "$Rev: 21273 $";
 
@@ -256,26 +259,34 @@ static int reservoir_set_page_dirty(struct page *page)
   return ret;
 }
 
+/* ݤbioˡRTΰFS¦ξդ */
+static void reservoir_bio_init(struct super_block *sb, struct bio *bio,
+			       struct inode *inode, int rw)
+{
+  struct reservoir_operations *rs_ops = RS_SB(sb)->rs_ops;
+
+  set_bit(BIO_RW_RT, &bio->bi_rw);
+
+  if( likely(rs_ops->alloc_bio_private!=NULL) )
+    {
+      /* P2FSǤϡºݤˤbiožե
+	 ǡ̤ϿƤ */
+      rs_ops->alloc_bio_private(bio, sb, inode, rw);
+    }
+
+  bio->bi_private2 = NULL;
+}
+
 static struct bio *reservoir_bio_alloc(struct super_block *sb,
 				       struct inode *inode, sector_t first_sector, int rw)
 {
   struct bio *bio = NULL;
-  struct reservoir_operations *rs_ops = RS_SB(sb)->rs_ops;
 
   bio = mpage_alloc(sb->s_bdev, first_sector,
 		    bio_get_nr_vecs(sb->s_bdev), GFP_NOFS|__GFP_HIGH);
   if(bio!=NULL)
     {
-      set_bit(BIO_RW_RT, &bio->bi_rw);
-
-      if( likely(rs_ops->alloc_bio_private!=NULL) )
-	{
-	  /* P2FSǤϡºݤˤbiožե
-	     ǡ̤ϿƤ */
-	  rs_ops->alloc_bio_private(bio, sb, inode, rw);
-	}
-
-      bio->bi_private2 = NULL;
+      reservoir_bio_init(sb, bio, inode, rw);
     }
 
   return bio;
@@ -425,14 +436,489 @@ int reservoir_flush_reservoir(struct bio_reservoir *reservoir)
   return ret;
 }
 
+/* ٱɸ(us)Ķ񤭹ߤreservoir򿼤 */
+static unsigned int rt_latency_target = 100000;
+module_param(rt_latency_target, uint, 0644);
+/* reservoirοξ(ñ̤βܤޤǤ) */
+static unsigned int rt_max_depth_units = 4;
+module_param(rt_max_depth_units, uint, 0644);
+
+/* θľ򤪤ʤλbio */
+#define RS_ADAPT_WINDOW (32)
+
+/* DirectReadƱȯԤƤbioξ */
+static unsigned int drct_read_depth = 16;
+module_param(drct_read_depth, uint, 0644);
+
+/* ߤreservoirοñ̤ܿˤʤäƤ */
+static inline unsigned long reservoir_rt_depth(struct super_block *sb,
+					       unsigned long unit)
+{
+  unsigned long depth = RS_SB(sb)->rt_depth;
+
+  if(depth < unit || depth % unit)
+    {
+      return unit;
+    }
+
+  return depth;
+}
+
+/* RTϿϻ˿ξ֤ */
+static void reservoir_rt_depth_init(struct super_block *sb)
+{
+  struct reservoir_sb *rs = RS_SB(sb);
+  unsigned long unit = rs->rs_ops->get_max_bios(sb);
+  unsigned long flags = 0;
+
+  spin_lock_irqsave(&rs->rt_stat_lock, flags);
+
+  /* ƱǥХʤεϿǳؽѤ */
+  if(rs->rt_depth_unit != unit)
+    {
+      rs->rt_depth_unit = unit;
+      rs->rt_depth = unit;
+    }
+
+  rs->rt_svc_worst = 0;
+  rs->rt_win_count = 0;
+  rs->rt_win_bytes = 0;
+  rs->rt_win_time = 0;
+
+  spin_unlock_irqrestore(&rs->rt_stat_lock, flags);
+}
+
+/* פreservoirοʤrt_stat_lockäƸƤ */
+static void reservoir_rt_adapt_depth(struct reservoir_sb *rs)
+{
+  unsigned long unit = rs->rt_depth_unit;
+  unsigned long max_depth = 0;
+  unsigned long svc = 0, drain = 0;
+  u64 kbps = 0;
+
+  if(unit==0 || rs->rt_win_count==0)
+    {
+      return;
+    }
+
+  max_depth = min_t(unsigned long, unit * rt_max_depth_units, RS_MAX_DEPTH);
+  max_depth -= max_depth % unit;
+  if(max_depth < unit)
+    {
+      max_depth = unit;
+    }
+
+  if(rs->rt_win_time)
+    {
+      kbps = (u64)(rs->rt_win_bytes >> 10) * 1000000;
+      do_div(kbps, rs->rt_win_time);
+      rs->rt_throughput = (unsigned long)kbps;
+    }
+
+  /* οreservoir򥫡ɤǤФΤˤ */
+  svc = rs->rt_win_time / rs->rt_win_count;
+  drain = rs->rt_depth * svc;
+
+  if(rs->rt_svc_worst > rt_latency_target)
+    {
+      /* ٤ɡƽ񤭹ߤεͤޤۼ */
+      if(rs->rt_depth + unit <= max_depth)
+	{
+	  rs->rt_depth += unit;
+	}
+    }
+  else if(rs->rt_svc_worst < rt_latency_target / 2
+	  && drain < rt_latency_target / 2)
+    {
+      /* ®ɡٱȥޤ */
+      if(rs->rt_depth > unit)
+	{
+	  rs->rt_depth -= unit;
+	}
+    }
+
+  if(rs->rt_depth > max_depth)
+    {
+      rs->rt_depth = max_depth;
+    }
+}
+
+#if defined(CONFIG_RESERVOIR_STATS)
+/* RT񤭹ߤס/proc/fs/reservoir/<ǥХ> ǻȤ */
+
+static struct proc_dir_entry *reservoir_proc_root = NULL;
+
+static inline int reservoir_hist_slot(s64 val)
+{
+  if(val <= 0)
+    {
+      return 0;
+    }
+
+  if(val >= (1LL << (RS_HIST_SLOTS - 2)))
+    {
+      return RS_HIST_SLOTS - 1;
+    }
+
+  return fls((unsigned long)val);
+}
+
+static inline void reservoir_stats_dummy_fill(struct super_block *sb,
+					      struct page *page, unsigned long bytes)
+{
+  struct reservoir_sb *rs = RS_SB(sb);
+  struct inode *inode = page->mapping ? page->mapping->host : NULL;
+  unsigned long flags = 0;
+
+  spin_lock_irqsave(&rs->rt_stat_lock, flags);
+
+  rs->stats.dummy_fill_bytes += bytes;
+  if(inode!=NULL && inode->i_reservoir!=NULL)
+    {
+      rs->file_groups[inode->i_reservoir->file_group_idx].stats.dummy_fill_bytes += bytes;
+    }
+
+  spin_unlock_irqrestore(&rs->rt_stat_lock, flags);
+}
+
+/* reservoirǤФ1֤Ͽ */
+static void reservoir_stats_flush(struct bio_reservoir *reservoir,
+				  unsigned long nr_bios, unsigned long bytes,
+				  unsigned long dummy_bytes)
+{
+  struct reservoir_sb *rs = RS_SB(reservoir->sb);
+  struct reservoir_stats *gs = &rs->file_groups[reservoir->file_group_idx].stats;
+  int bios_slot = reservoir_hist_slot(nr_bios);
+  int res_slot = reservoir_hist_slot(ktime_us_delta(ktime_get(), reservoir->head_stamp));
+  unsigned long flags = 0;
+
+  spin_lock_irqsave(&rs->rt_stat_lock, flags);
+
+  rs->stats.flushes++;
+  rs->stats.flushed_bios += nr_bios;
+  rs->stats.flushed_bytes += bytes;
+  rs->stats.dummy_bio_bytes += dummy_bytes;
+  rs->stats.hist_flush_bios[bios_slot]++;
+  rs->stats.hist_reservoir[res_slot]++;
+
+  gs->flushes++;
+  gs->flushed_bios += nr_bios;
+  gs->flushed_bytes += bytes;
+  gs->dummy_bio_bytes += dummy_bytes;
+  gs->hist_flush_bios[bios_slot]++;
+  gs->hist_reservoir[res_slot]++;
+
+  spin_unlock_irqrestore(&rs->rt_stat_lock, flags);
+}
+
+/* 2Ĥλ(ns)κusˤƥҥȥΥåȤ */
+static inline int reservoir_hist_slot_ns(u64 from, u64 to)
+{
+  if(to <= from)
+    {
+      return 0;
+    }
+
+  return reservoir_hist_slot(div_u64(to - from, NSEC_PER_USEC));
+}
+
+/* λbioٱϿ롣rt_stat_lockäƸƤ */
+static inline void reservoir_stats_done(struct reservoir_sb *rs, struct bio *bio,
+					ktime_t now)
+{
+  u64 now_ns = ktime_to_ns(now);
+
+  rs->stats.completed_bios++;
+
+  if(bio->bi_rt_submitted)
+    {
+      rs->stats.hist_submit[reservoir_hist_slot_ns(bio->bi_rt_submitted, now_ns)]++;
+    }
+
+  /* elevatordispatchդƤСelevatorȥǥХʬ */
+  if(bio->bi_rt_submitted && bio->bi_rt_dispatched)
+    {
+      rs->stats.hist_elevator[reservoir_hist_slot_ns(bio->bi_rt_submitted,
+						     bio->bi_rt_dispatched)]++;
+      rs->stats.hist_device[reservoir_hist_slot_ns(bio->bi_rt_dispatched, now_ns)]++;
+    }
+
+  if(bio->bi_rt_queued)
+    {
+      rs->stats.hist_commit[reservoir_hist_slot_ns(bio->bi_rt_queued, now_ns)]++;
+    }
+}
+
+static void reservoir_stats_show_hist(struct seq_file *m, const char *name,
+				      unsigned long *hist)
+{
+  int i = 0;
+
+  seq_printf(m, "  %-14s", name);
+
+  for(i=0; i<RS_HIST_SLOTS; i++)
+    {
+      seq_printf(m, " %lu", hist[i]);
+    }
+
+  seq_printf(m, "\n");
+}
+
+static void reservoir_stats_show_one(struct seq_file *m, struct reservoir_stats *st)
+{
+  seq_printf(m, "  flushes        %lu\n", st->flushes);
+  seq_printf(m, "  flushed_bios   %lu\n", st->flushed_bios);
+  seq_printf(m, "  flushed_bytes  %llu\n", st->flushed_bytes);
+  seq_printf(m, "  dummy_bio      %llu\n", st->dummy_bio_bytes);
+  seq_printf(m, "  dummy_fill     %llu\n", st->dummy_fill_bytes);
+  reservoir_stats_show_hist(m, "bios/flush", st->hist_flush_bios);
+  reservoir_stats_show_hist(m, "in_reservoir", st->hist_reservoir);
+}
+
+static int reservoir_stats_show(struct seq_file *m, void *v)
+{
+  struct super_block *sb = m->private;
+  struct reservoir_sb *rs = RS_SB(sb);
+  struct reservoir_stats *st = NULL;
+  int i = 0;
+
+  /* ɽͤѤʤ褦ԡȤäƤФ */
+  st = kmalloc(sizeof(struct reservoir_stats), GFP_KERNEL);
+  if( unlikely(st==NULL) )
+    {
+      return -ENOMEM;
+    }
+
+  spin_lock_irq(&rs->rt_stat_lock);
+  *st = rs->stats;
+  spin_unlock_irq(&rs->rt_stat_lock);
+
+  seq_printf(m, "device %s\n", sb->s_id);
+  seq_printf(m, "  depth          %lu (unit %lu)\n", rs->rt_depth, rs->rt_depth_unit);
+  seq_printf(m, "  inflight       %lu\n", rs->rt_inflight);
+  seq_printf(m, "  svc_avg_us     %lu\n", rs->rt_svc_avg >> 3);
+  seq_printf(m, "  throughput_kbs %lu\n", rs->rt_throughput);
+  seq_printf(m, "  completed_bios %lu\n", st->completed_bios);
+  reservoir_stats_show_one(m, st);
+  reservoir_stats_show_hist(m, "submit_us", st->hist_submit);
+  reservoir_stats_show_hist(m, "elevator_us", st->hist_elevator);
+  reservoir_stats_show_hist(m, "device_us", st->hist_device);
+  reservoir_stats_show_hist(m, "commit_us", st->hist_commit);
+
+  for(i=0; i<MAX_GROUPS; i++)
+    {
+      spin_lock_irq(&rs->rt_stat_lock);
+      *st = rs->file_groups[i].stats;
+      spin_unlock_irq(&rs->rt_stat_lock);
+
+      if(st->flushes==0 && st->dummy_fill_bytes==0)
+	{
+	  continue;
+	}
+
+      seq_printf(m, "group %d (id %d, rt_files %d)\n", i,
+		 rs->file_groups[i].file_group,
+		 atomic_read(&rs->file_groups[i].rt_files));
+      reservoir_stats_show_one(m, st);
+    }
+
+  kfree(st);
+
+  return 0;
+}
+
+static int reservoir_stats_open(struct inode *inode, struct file *file)
+{
+  return single_open(file, reservoir_stats_show, PDE(inode)->data);
+}
+
+/* 񤭹ޤ줿פ򥯥ꥢ */
+static ssize_t reservoir_stats_write(struct file *file, const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+  struct super_block *sb = ((struct seq_file *)file->private_data)->private;
+  struct reservoir_sb *rs = RS_SB(sb);
+  int i = 0;
+
+  spin_lock_irq(&rs->rt_stat_lock);
+
+  memset(&rs->stats, 0, sizeof(struct reservoir_stats));
+  for(i=0; i<MAX_GROUPS; i++)
+    {
+      memset(&rs->file_groups[i].stats, 0, sizeof(struct reservoir_stats));
+    }
+
+  spin_unlock_irq(&rs->rt_stat_lock);
+
+  return count;
+}
+
+static const struct file_operations reservoir_stats_fops = {
+  .owner	= THIS_MODULE,
+  .open		= reservoir_stats_open,
+  .read		= seq_read,
+  .write	= reservoir_stats_write,
+  .llseek	= seq_lseek,
+  .release	= single_release,
+};
+
+int reservoir_stats_register(struct super_block *sb)
+{
+  struct proc_dir_entry *entry = NULL;
+
+  if( unlikely(reservoir_proc_root==NULL) )
+    {
+      return -ENOENT;
+    }
+
+  entry = proc_create_data(sb->s_id, S_IRUGO | S_IWUSR, reservoir_proc_root,
+			   &reservoir_stats_fops, sb);
+  if( unlikely(entry==NULL) )
+    {
+      printk("%s-%d: Creating Proc Entry Failed. (%s)\n",
+	     __PRETTY_FUNCTION__, __LINE__, sb->s_id);
+      return -ENOMEM;
+    }
+
+  RS_SB(sb)->proc_entry = entry;
+
+  return 0;
+}
+
+void reservoir_stats_unregister(struct super_block *sb)
+{
+  if(RS_SB(sb)->proc_entry==NULL)
+    {
+      return;
+    }
+
+  remove_proc_entry(sb->s_id, reservoir_proc_root);
+  RS_SB(sb)->proc_entry = NULL;
+}
+
+static int __init reservoir_stats_init(void)
+{
+  reservoir_proc_root = proc_mkdir("fs/reservoir", NULL);
+  if( unlikely(reservoir_proc_root==NULL) )
+    {
+      printk("%s-%d: Creating /proc/fs/reservoir Failed.\n",
+	     __PRETTY_FUNCTION__, __LINE__);
+    }
+
+  return 0;
+}
+fs_initcall(reservoir_stats_init);
+
+#else /* !CONFIG_RESERVOIR_STATS */
+
+static inline void reservoir_stats_dummy_fill(struct super_block *sb,
+					      struct page *page, unsigned long bytes)
+{
+}
+
+#endif /* CONFIG_RESERVOIR_STATS */
+
+void reservoir_rt_io_start(struct super_block *sb, struct bio *bio)
+{
+  struct reservoir_sb *rs = RS_SB(sb);
+  unsigned long flags = 0;
+
+  spin_lock_irqsave(&rs->rt_stat_lock, flags);
+
+  if(rs->rt_inflight++ == 0)
+    {
+      rs->rt_busy_since = ktime_get();
+    }
+
+  /* ٱɸͤޤǤ˽񤭽äƤۤȤ¤ĤƤ
+     I/O塼Ϥδ¤ᤤΤȯԤ */
+  bio->bi_deadline = jiffies + usecs_to_jiffies(rt_latency_target);
+  if( unlikely(bio->bi_deadline==0) )
+    {
+      bio->bi_deadline = 1;
+    }
+
+#if defined(CONFIG_RESERVOIR_STATS)
+  bio->bi_rt_submitted = ktime_to_ns(ktime_get());
+#endif
+
+  spin_unlock_irqrestore(&rs->rt_stat_lock, flags);
+}
+
+/* 񤭹ߴλ˽֤Ͽ */
+static void reservoir_rt_io_done(struct super_block *sb, struct bio *bio)
+{
+  struct reservoir_sb *rs = RS_SB(sb);
+  unsigned long flags = 0;
+  unsigned long bytes = 0;
+  ktime_t now, start;
+  s64 svc = 0;
+  int i = 0;
+
+  for(i=0; i<bio->bi_vcnt; i++)
+    {
+      bytes += bio->bi_io_vec[i].bv_len;
+    }
+
+  spin_lock_irqsave(&rs->rt_stat_lock, flags);
+
+  if( unlikely(rs->rt_inflight==0) )
+    {
+      goto UNLOCK;
+    }
+
+  /* ǥХưϤ᤿bioäȤ */
+  now = ktime_get();
+  start = (ktime_to_ns(rs->rt_last_done) > ktime_to_ns(rs->rt_busy_since))
+    ? rs->rt_last_done : rs->rt_busy_since;
+  svc = ktime_us_delta(now, start);
+  if(svc < 0)
+    {
+      svc = 0;
+    }
+
+  rs->rt_last_done = now;
+  rs->rt_inflight--;
+
+  rs->rt_svc_avg = rs->rt_svc_avg - (rs->rt_svc_avg >> 3) + (unsigned long)svc;
+  if((unsigned long)svc > rs->rt_svc_worst)
+    {
+      rs->rt_svc_worst = (unsigned long)svc;
+    }
+
+#if defined(CONFIG_RESERVOIR_STATS)
+  reservoir_stats_done(rs, bio, now);
+#endif
+
+  rs->rt_win_count++;
+  rs->rt_win_bytes += bytes;
+  rs->rt_win_time += (unsigned long)svc;
+
+  if(rs->rt_win_count >= RS_ADAPT_WINDOW)
+    {
+      reservoir_rt_adapt_depth(rs);
+
+      rs->rt_svc_worst = 0;
+      rs->rt_win_count = 0;
+      rs->rt_win_bytes = 0;
+      rs->rt_win_time = 0;
+    }
+
+ UNLOCK:
+  spin_unlock_irqrestore(&rs->rt_stat_lock, flags);
+}
+
 static int reservoir_rt_flush_reservoir(struct bio_reservoir *reservoir,
 					struct reservoir_operations *rs_ops)
 {
   struct bio *bio_walk = reservoir->bio_head;
   int ret = 0;
-  unsigned long max_length = rs_ops->get_max_bios(reservoir->sb);
+  unsigned long unit = rs_ops->get_max_bios(reservoir->sb);
   struct request_queue *q = NULL;
   unsigned long deadline_time = 0;
+#if defined(CONFIG_RESERVOIR_STATS)
+  unsigned long nr_bios = 0, bytes = 0, dummy_bytes = 0;
+#endif
 
   /* ʤʤ餵äȴ */
   if(bio_walk == NULL)
@@ -464,40 +950,52 @@ static int reservoir_rt_flush_reservoir(struct bio_reservoir *reservoir,
 	}
     }
 
-  /* Ǥ˳ݤƤ륯饹ʤå */
-  if(reservoir->suspended_cls[reservoir->cls_ptr]==0)
-    {
-      reservoir->cls_ptr = 0;
-      ret = rs_ops->get_n_blocks(reservoir->sb, reservoir->max_length,
-				 reservoir->suspended_cls);
-      if( unlikely(ret) )
-	{
-	  /* Ϣ³ߤĤʤäΤǡ
-	     ҤȤĤĽ񤭽ФƤ */
-	  return reservoir_flush_reservoir(reservoir);
-	}
-    }
-
-  /* ޤä饹bioͿreservoirǤФ */
+  /* ޤä饹bioͿreservoirǤФ
+     reservoirñ̤꿼ϡñ̤Ȥ˳ݤʤ */
   bio_walk=reservoir->bio_head;
 
   while( bio_walk!=NULL )
     {
       struct bio *cur_bio = bio_walk;
 
-      BUG_ON(reservoir->suspended_cls[reservoir->cls_ptr]==0);
+      /* Ǥ˳ݤƤ륯饹ʤå */
+      if(reservoir->cls_ptr >= unit
+	 || reservoir->suspended_cls[reservoir->cls_ptr]==0)
+	{
+	  reservoir->cls_ptr = 0;
+	  ret = rs_ops->get_n_blocks(reservoir->sb, unit,
+				     reservoir->suspended_cls);
+	  if( unlikely(ret) )
+	    {
+	      /* Ϣ³ߤĤʤäΤǡ
+		 ĤҤȤĤĽ񤭽ФƤ */
+	      return reservoir_flush_reservoir(reservoir);
+	    }
+	}
 
       cur_bio->bi_sector = reservoir->suspended_cls[reservoir->cls_ptr];
       bio_walk = cur_bio->bi_next;
       reservoir->cls_ptr++;
       cur_bio->bi_next = NULL;
 
+      reservoir->bio_head = bio_walk;
+      reservoir->cur_length--;
+
       /* SequencialɤȽǤ */
       if(test_bit(RT_SEQ, &RS_SB(reservoir->sb)->rt_flags))
 	{
 	  set_bit(BIO_RW_SEQ, &cur_bio->bi_rw);
 	}
 
+#if defined(CONFIG_RESERVOIR_STATS)
+      nr_bios++;
+      bytes += cur_bio->bi_size;
+      if(test_bit(BIO_RW_DUMMY, &cur_bio->bi_rw))
+	{
+	  dummy_bytes += cur_bio->bi_size;
+	}
+#endif
+
       if( likely(rs_ops->set_bio_callback!=NULL) )
 	{
 	  /* biožλȤΥХåؿϿƤ */
@@ -510,57 +1008,278 @@ static int reservoir_rt_flush_reservoir(struct bio_reservoir *reservoir,
       submit_rt_bio(WRITE, reservoir->sb, cur_bio);
     }
 
-  reservoir->bio_head = NULL;
-  reservoir->bio_tail = NULL;
-  reservoir->cur_length = 0;
+  reservoir->bio_head = NULL;
+  reservoir->bio_tail = NULL;
+  reservoir->cur_length = 0;
+
+#if defined(CONFIG_RESERVOIR_STATS)
+  reservoir_stats_flush(reservoir, nr_bios, bytes, dummy_bytes);
+#endif
+
+  if(reservoir->cls_ptr >= unit)
+    {
+      /* 줤äѤǤФ */
+      BUG_ON(reservoir->cls_ptr > unit);
+      memset(reservoir->suspended_cls, 0,
+	     sizeof(unsigned long)*RS_MAX_BIOS);
+      reservoir->cls_ptr = 0;
+    }
+
+  /* ǤФñ̤ζˤ褦
+     max_lengthꤷʤƤ */
+  reservoir->max_length = reservoir_rt_depth(reservoir->sb, unit) - reservoir->cls_ptr;
+
+  return ret;
+}
+
+/* reservoirbioĤʤդˤʤäǤФ
+   reservoir_lock֤ǸƤ֤ */
+static int __reservoir_enqueue_bio(struct bio_reservoir *reservoir, struct bio *bio,
+				   struct reservoir_operations *rs_ops)
+{
+  int ret = 0;
+
+  if(reservoir->bio_head==NULL)
+    {
+      reservoir->bio_head = bio;
+#if defined(CONFIG_RESERVOIR_STATS)
+      reservoir->head_stamp = ktime_get();
+#endif
+    }
+
+  if(reservoir->bio_tail!=NULL)
+    {
+      reservoir->bio_tail->bi_next = bio;
+    }
+
+  reservoir->bio_tail = bio;
+  reservoir->cur_length++;
+
+  if(atomic_read(&reservoir->rt_count)
+     && reservoir->cur_length >= reservoir->max_length)
+    {
+      ret = reservoir_rt_flush_reservoir(reservoir,rs_ops);
+    }
+
+  return ret;
+}
+
+/* handoff塼bioѤࡣ
+   񤭹¦reservoir_lock餺ˤ̤ */
+static inline void reservoir_handoff_push(struct bio_reservoir *reservoir,
+					  struct bio *bio)
+{
+  struct bio *head = NULL;
+
+  do
+    {
+      head = ACCESS_ONCE(reservoir->handoff_list);
+      bio->bi_next = head;
+    }
+  while(cmpxchg(&reservoir->handoff_list, head, bio) != head);
+}
+
+/* handoff塼Ѥޤ줿bioѤޤ줿reservoirذܤ
+   reservoir_lock֤ǸƤ֤ */
+static int reservoir_drain_handoff(struct bio_reservoir *reservoir,
+				   struct reservoir_operations *rs_ops)
+{
+  struct bio *list = xchg(&reservoir->handoff_list, NULL);
+  struct bio *rev = NULL;
+  int ret = 0;
+
+  /* LIFOѤޤƤΤǵսˤ */
+  while(list!=NULL)
+    {
+      struct bio *next = list->bi_next;
+
+      list->bi_next = rev;
+      rev = list;
+      list = next;
+    }
+
+  while(rev!=NULL)
+    {
+      struct bio *bio = rev;
+      int ret_val = 0;
+
+      rev = bio->bi_next;
+      bio->bi_next = NULL;
+
+      ret_val = __reservoir_enqueue_bio(reservoir, bio, rs_ops);
+      if(ret_val && ret==0)
+	{
+	  ret = ret_val;
+	}
+    }
+
+  return ret;
+}
+
+/* reservoirίޤäƤΤƽ񤭽Ф */
+static int reservoir_flush_all(struct bio_reservoir *reservoir,
+			       struct reservoir_operations *rs_ops)
+{
+  int ret = 0, ret_val = 0;
+
+  mutex_lock(&reservoir->reservoir_lock);
+
+  ret = reservoir_drain_handoff(reservoir, rs_ops);
+  ret_val = reservoir_rt_flush_reservoir(reservoir, rs_ops);
+  if(ret_val)
+    {
+      ret = ret_val;
+    }
+
+  mutex_unlock(&reservoir->reservoir_lock);
+
+  return ret;
+}
+
+/* file_groupȤbioåΡ
+   񤭹¦i_mutexϻreservoirǤФΤǡ
+   reservoir_lockʳreservoiräƤΤˤʤ */
+static int reservoir_submit_thread(void *data)
+{
+  struct reservoir_file_group *group = data;
+  struct reservoir_operations *rs_ops = RS_SB(group->reservoir[0].sb)->rs_ops;
+
+  while(1)
+    {
+      int i = 0;
+
+      wait_event_interruptible(group->submit_wait,
+			       group->submit_pending || kthread_should_stop());
+
+      for(i=0; i<MAX_RESERVOIRS; i++)
+	{
+	  struct bio_reservoir *reservoir = &group->reservoir[i];
+	  int ret = 0;
+
+	  if(!test_and_clear_bit(i, &group->submit_pending))
+	    {
+	      continue;
+	    }
+
+	  mutex_lock(&reservoir->reservoir_lock);
+	  ret = reservoir_drain_handoff(reservoir, rs_ops);
+	  mutex_unlock(&reservoir->reservoir_lock);
+
+	  /* 顼ϼbioѤ񤭹¦fsync/close֤ */
+	  if(ret)
+	    {
+	      cmpxchg(&reservoir->handoff_err, 0, ret);
+	    }
+	}
+
+      /* ׵᤬Ƥ⡢Ѥ߻ĤʤʤޤǤϲ */
+      if(kthread_should_stop() && group->submit_pending==0)
+	{
+	  break;
+	}
+    }
+
+  return 0;
+}
+
+static void reservoir_start_submit_thread(struct super_block *sb, int group_idx)
+{
+  struct reservoir_file_group *group = &RS_SB(sb)->file_groups[group_idx];
+  struct task_struct *task = NULL;
+
+  if(group->submit_task!=NULL)
+    {
+      return;
+    }
+
+  task = kthread_run(reservoir_submit_thread, group, "rsrvr-%s/%d",
+		     sb->s_id, group_idx);
+  if( unlikely(IS_ERR(task)) )
+    {
+      /* åɤʤƤ⡢񤭹¦ƱŪΤưϤ */
+      printk("%s-%d: Creating Submit Thread Failed. (%ld)\n",
+	     __PRETTY_FUNCTION__, __LINE__, PTR_ERR(task));
+      return;
+    }
+
+  group->submit_task = task;
+}
+
+static void reservoir_stop_submit_thread(struct super_block *sb, int group_idx)
+{
+  struct reservoir_file_group *group = &RS_SB(sb)->file_groups[group_idx];
+  struct task_struct *task = group->submit_task;
+  int i = 0;
 
-  if(reservoir->cls_ptr == max_length)
+  if(task==NULL)
     {
-      /* 줤äѤǤФ */
-      memset(reservoir->suspended_cls, 0,
-	     sizeof(unsigned long)*RS_MAX_BIOS);
-      reservoir->max_length = max_length;
-      reservoir->cls_ptr = 0;
+      return;
     }
-  else
+
+  /* ʹߤƱŪˤʤ碌롣
+     񤭹¦submit_locksubmit_task򸫤ƤhandoffѤΤǡ
+     ȴhandoffѤޤ뤳ȤϤʤ */
+  spin_lock(&group->submit_lock);
+  group->submit_task = NULL;
+  spin_unlock(&group->submit_lock);
+
+  /* handoff˻ĤäƤ֤ǤФƤ饹åɤϽλ */
+  kthread_stop(task);
+
+  /* åɤ٤ư˻ߤ뤳Ȥ⤢Τǡ
+     ĤäƤ֤ϤƱŪǤФ */
+  for(i=0; i<MAX_RESERVOIRS; i++)
     {
-      /* ݤ饹˻Ĥ꤬Ȥϡ
-	 max_length򤽤λĤ̤ꤷʤƤ */
-      BUG_ON(reservoir->cls_ptr > max_length);
-      reservoir->max_length = max_length - reservoir->cls_ptr;
-    }
+      struct bio_reservoir *reservoir = &group->reservoir[i];
+      int ret = 0;
 
-  return ret;
+      mutex_lock(&reservoir->reservoir_lock);
+      ret = reservoir_drain_handoff(reservoir, RS_SB(sb)->rs_ops);
+      mutex_unlock(&reservoir->reservoir_lock);
+
+      if(ret)
+	{
+	  cmpxchg(&reservoir->handoff_err, 0, ret);
+	}
+    }
 }
 
 static int reservoir_submit_bio(struct super_block *sb,
 				struct bio *bio, struct bio_reservoir *reservoir,
 				struct reservoir_operations *rs_ops)
 {
-  int ret = 0;
+  struct reservoir_file_group *group = &RS_SB(sb)->file_groups[reservoir->file_group_idx];
+  int ret = 0, ret_val = 0;
 
   /* 餤ǤĴ٤ȤʤΤǡ */
-  BUG_ON(RS_MAX_BIOS < reservoir->max_length);
+  BUG_ON(RS_MAX_DEPTH < reservoir->max_length);
 
-  mutex_lock(&reservoir->reservoir_lock);
+#if defined(CONFIG_RESERVOIR_STATS)
+  /* write()Ϥ줿 */
+  bio->bi_rt_queued = ktime_to_ns(ktime_get());
+#endif
 
-  if(reservoir->bio_head==NULL)
+  /* åɤưƤС塼Ѥǵ */
+  spin_lock(&group->submit_lock);
+  if(group->submit_task!=NULL && atomic_read(&reservoir->rt_count))
     {
-      reservoir->bio_head = bio;
-    }
+      reservoir_handoff_push(reservoir, bio);
+      set_bit(reservoir - group->reservoir, &group->submit_pending);
+      spin_unlock(&group->submit_lock);
 
-  if(reservoir->bio_tail!=NULL)
-    {
-      reservoir->bio_tail->bi_next = bio;
+      wake_up(&group->submit_wait);
+
+      return xchg(&reservoir->handoff_err, 0);
     }
+  spin_unlock(&group->submit_lock);
 
-  reservoir->bio_tail = bio;
-  reservoir->cur_length++;
+  mutex_lock(&reservoir->reservoir_lock);
 
-  if(atomic_read(&reservoir->rt_count)
-     && reservoir->cur_length >= reservoir->max_length)
+  ret = reservoir_drain_handoff(reservoir, rs_ops);
+  ret_val = __reservoir_enqueue_bio(reservoir, bio, rs_ops);
+  if(ret_val)
     {
-      ret = reservoir_rt_flush_reservoir(reservoir,rs_ops);
+      ret = ret_val;
     }
 
   mutex_unlock(&reservoir->reservoir_lock);
@@ -568,6 +1287,31 @@ static int reservoir_submit_bio(struct super_block *sb,
   return ret;
 }
 
+/* io_serializefile_groupν񤭹ߤߤ */
+static void reservoir_serialize_all(struct super_block *sb)
+{
+  int i = 0;
+
+  mutex_lock(&RS_SB(sb)->io_serialize);
+
+  for(i=0; i<MAX_GROUPS; i++)
+    {
+      mutex_lock_nested(&RS_SB(sb)->file_groups[i].group_serialize, i);
+    }
+}
+
+static void reservoir_unserialize_all(struct super_block *sb)
+{
+  int i = 0;
+
+  for(i=MAX_GROUPS-1; i>=0; i--)
+    {
+      mutex_unlock(&RS_SB(sb)->file_groups[i].group_serialize);
+    }
+
+  mutex_unlock(&RS_SB(sb)->io_serialize);
+}
+
 static int reservoir_bio_add_page(struct bio *bio, struct page *page,
 				  struct inode *inode, int rw)
 {
@@ -1389,7 +2133,7 @@ static int reservoir_remove_inode_member(struct inode *inode, int rt)
 {
   struct bio_reservoir *reservoir = inode->i_reservoir;
   struct super_block *sb = inode->i_sb;
-  int ret = 0;
+  int ret = 0, ret_val = 0;
 
   /* ɤˤ°Ƥʤinode˸ƤФΤϤ */
   BUG_ON(reservoir==NULL);
@@ -1417,11 +2161,18 @@ static int reservoir_remove_inode_member(struct inode *inode, int rt)
 
 	  //printk("%s: Last Operation (%d)...\n", __FUNCTION__, reservoir->file_group_idx);
 
+	  mutex_lock(&reservoir->reservoir_lock);
+
+	  /* åɤϤ֤reservoirذܤ */
+	  ret = reservoir_drain_handoff(reservoir, RS_SB(sb)->rs_ops);
+
 	  if( (reservoir->cur_length!=0)
 	      ||(reservoir->suspended_cls[reservoir->cls_ptr]!=0) )
 	    {
+	      unsigned long unit = RS_SB(sb)->rs_ops->get_max_bios(sb);
+	      unsigned long used = (reservoir->cls_ptr + reservoir->cur_length) % unit;
 	      int i = 0;
-	      int bio_wanted = reservoir->max_length - reservoir->cur_length;
+	      int bio_wanted = used ? (unit - used) : 0;
 
 	      for(i=0; i<bio_wanted; i++)
 		{
@@ -1437,12 +2188,18 @@ static int reservoir_remove_inode_member(struct inode *inode, int rt)
 		    }
 		  //printk(".");
 
-		  reservoir_submit_bio(sb, bio, reservoir, RS_SB(sb)->rs_ops);
+		  __reservoir_enqueue_bio(reservoir, bio, RS_SB(sb)->rs_ops);
 		}
 
+	      /* reservoirñ̤꿼Ȥϡ
+		 ᤿ǤǤФʤΤŪǤФ */
+	      reservoir_rt_flush_reservoir(reservoir, RS_SB(sb)->rs_ops);
+
 	      //printk("  done (max=%d)\n", (int)reservoir->max_length);
 	    }
 
+	  mutex_unlock(&reservoir->reservoir_lock);
+
 	  /* 塼οɸ᤹ */
 	  reservoir->max_length = RS_SB(sb)->rs_ops->get_max_bios(sb);
 	}
@@ -1456,6 +2213,9 @@ static int reservoir_remove_inode_member(struct inode *inode, int rt)
 	  //int i = 0;
 
 	  // printk("%s: Last Operation - 2\n", __FUNCTION__);
+
+	  /* file_groupåɤߤ */
+	  reservoir_stop_submit_thread(sb, reservoir->file_group_idx);
 	  
 	  /* ;ʬʳݤ֤dummy bio */
 
@@ -1489,6 +2249,13 @@ static int reservoir_remove_inode_member(struct inode *inode, int rt)
 	  //printk("  ...done\n");
 	}
 
+      /* åɤǵ顼closeǤ֤ */
+      ret_val = xchg(&reservoir->handoff_err, 0);
+      if(ret_val && ret==0)
+	{
+	  ret = ret_val;
+	}
+
       atomic_dec(&(RS_SB(sb)->rt_total_files));
     }
 
@@ -1556,14 +2323,18 @@ static int reservoir_add_inode_member(struct bio_reservoir *reservoir,
 	    {
 	      RS_SB(sb)->file_groups[reservoir->file_group_idx]
 		.reservoir[i].max_length
-		= RS_SB(sb)->rs_ops->get_max_bios(sb);
+		= reservoir_rt_depth(sb, RS_SB(sb)->rs_ops->get_max_bios(sb));
 	    }
 
+	  /* file_groupåɤ򵯤Ƥ */
+	  reservoir_start_submit_thread(sb, reservoir->file_group_idx);
 	}
 
       /* ǥХǺǽRTϿǧ */
       if( atomic_inc_return(&(RS_SB(sb)->rt_total_files)) == 1 )
 	{
+	  reservoir_rt_depth_init(sb);
+
 	  if( likely( (RS_SB(sb)->rs_ops->begin_rt_writing!=NULL) ) )
 	    {
 	      /* ǽϿʤ顢begin_rt_write᥽åɤƤ */
@@ -1634,6 +2405,8 @@ static int reservoir_fill_dummy_entry_for_page(struct page *page,
 
       drct->total_size += fill_size;
       drct->dummy_size += fill_size;
+
+      reservoir_stats_dummy_fill(sb, page, fill_size);
     }
 
   kunmap(page);
@@ -1836,7 +2609,7 @@ static int reservoir_stretch_queue(struct inode *inode, struct file *filp, u32 s
       return -EINVAL;
     }
 
-  if( unlikely(normal_depth * stretch > RS_MAX_BIOS) )
+  if( unlikely(normal_depth * stretch > RS_MAX_DEPTH) )
     {
       printk("%s-%d: Too Large Stretch Param (%u)\n", __PRETTY_FUNCTION__, __LINE__, stretch);    
       return -EINVAL;
@@ -2011,6 +2784,41 @@ static int reservoir_set_fileid(struct inode *inode, struct file *filp, struct r
   
 }
 
+/* O_DIRECTRT񤭹ߤǥ桼Хåեľbio˺ܤ뤫ꤹ롣
+   write()Ͻ񤭹ߴλԤΤǡƤӽФ¦
+   fsync()ޤǥХåեݻ뤳Ȥ«ͭˤ */
+static int reservoir_set_upage(struct inode *inode, struct file *filp, unsigned long on)
+{
+  int ret = 0;
+
+  mutex_lock(&inode->i_mutex);
+
+  /* O_DIRECTǽ񤭹Ѥ˳RTեʳǤϻȤʤ */
+  if( (filp->f_flags & O_ACCMODE)==O_RDONLY
+      || !(filp->f_flags & O_DIRECT) || !(filp->f_flags & O_REALTIME)
+      || test_bit(RS_PCIDRCT, &inode->i_rsrvr_flags) )
+    {
+      printk("%s-%d : Invalid Call.\n", __FUNCTION__, __LINE__);
+      ret = -EINVAL;
+      goto UNLOCK_FIN;
+    }
+
+  if(on)
+    {
+      set_bit(RS_UPAGE, &inode->i_rsrvr_flags);
+    }
+  else
+    {
+      clear_bit(RS_UPAGE, &inode->i_rsrvr_flags);
+    }
+
+ UNLOCK_FIN:
+
+  mutex_unlock(&inode->i_mutex);
+
+  return ret;
+}
+
 int reservoir_file_open(struct inode *inode, struct file *filp)
 {
   struct super_block *sb = inode->i_sb;
@@ -2142,7 +2950,7 @@ int reservoir_file_release(struct inode *inode, struct file *filp)
       goto UNLOCK_FIN;
     }
 
-  mutex_lock(&RS_SB(sb)->io_serialize);
+  reservoir_serialize_all(sb);
 
   /* ȿǤƤʤ񤭤ȿ 
      饹ФȾüʤ֤Υڡ */
@@ -2165,10 +2973,17 @@ int reservoir_file_release(struct inode *inode, struct file *filp)
  
       if(inode->i_rsrvr_rt_count==1)
 	{
+	  int ret_val = 0;
+
 	  /* Ǹcloseä硢°Ƥreservoirȴ */
 	  mutex_lock(&RS_SB(inode->i_sb)->rt_files_lock);
-	  reservoir_remove_inode_member(inode, rt);
+	  ret_val = reservoir_remove_inode_member(inode, rt);
 	  mutex_unlock(&RS_SB(inode->i_sb)->rt_files_lock);
+
+	  if(ret_val && ret==0)
+	    {
+	      ret = ret_val;
+	    }
 	}
     }
   else
@@ -2208,7 +3023,7 @@ int reservoir_file_release(struct inode *inode, struct file *filp)
 	   * ǤϹԤʤ鷺FSǤ褦ѹ */
     }
 
-  mutex_unlock(&RS_SB(sb)->io_serialize);
+  reservoir_unserialize_all(sb);
 
  UNLOCK_FIN:
 
@@ -2219,6 +3034,7 @@ int reservoir_file_release(struct inode *inode, struct file *filp)
 	  if(inode->i_rsrvr_rt_count==0)
 	  {
 		  clear_bit(RS_RT, &inode->i_rsrvr_flags);
+		  clear_bit(RS_UPAGE, &inode->i_rsrvr_flags);
 	  }
   }
 
@@ -2287,6 +3103,12 @@ int reservoir_file_ioctl(struct inode *inode, struct file *filp,
 	ret =  reservoir_set_fileid(inode, filp, &id);
 	break;
       }
+    case RSFS_SET_UPAGE:
+      {
+	/* 桼Хåեľܽ񤭹ߤͭ/̵ڤ괹 */
+	ret = reservoir_set_upage(inode, filp, arg);
+	break;
+      }
     default:
       {
 	printk("%s-%d : Invalid Call.\n", __FUNCTION__, __LINE__);
@@ -2309,7 +3131,7 @@ int reservoir_rt_fsync(struct inode *inode)
   /* RTξϡƤRTե򴬤źˤư */
 
   /* 񤭹ǤĤʤ褦˥֥å */
-  mutex_lock(&RS_SB(sb)->io_serialize);
+  reservoir_serialize_all(sb);
 
   /* reservoirơ
      Ǹbio򶡵뤹Τνsync¹Ԥ */
@@ -2348,7 +3170,14 @@ int reservoir_rt_fsync(struct inode *inode)
 	  reservoir_pad_and_commit_tail(inode);
 
 	  /* ReservoirƤƽ񤭽Ф */
-	  ret_val = reservoir_rt_flush_reservoir(reservoir, RS_SB(sb)->rs_ops);
+	  ret_val = reservoir_flush_all(reservoir, RS_SB(sb)->rs_ops);
+	  if(ret_val)
+	    {
+	      ret = ret_val;
+	    }
+
+	  /* åɤǵ顼⤳֤ */
+	  ret_val = xchg(&reservoir->handoff_err, 0);
 	  if(ret_val)
 	    {
 	      ret = ret_val;
@@ -2362,7 +3191,7 @@ int reservoir_rt_fsync(struct inode *inode)
   /* 󥷥writeե饰򲼤 */
   clear_bit(RT_SEQ, &RS_SB(sb)->rt_flags);
 
-  mutex_unlock(&RS_SB(sb)->io_serialize);
+  reservoir_unserialize_all(sb);
 
   /* ν񤭽Ф */
   if(sb->s_op->write_super)
@@ -2372,6 +3201,111 @@ int reservoir_rt_fsync(struct inode *inode)
   return ret;
 }
 
+/* O_DIRECTǳ졢RSFS_SET_UPAGEͭˤ줿RTեν񤭹ߤǡ
+   桼ХåեpageꤷƤΤޤbio˺ܤ롣
+   1饹֤ޤȤưԡ򤪤ʤʤ
+   bioreservoirѤޤǴλԤʤΤǡ
+   桼Хåեfsync()ޤǺѤƤϤʤ
+    : 񤭹Хȿ0ʤ饳ԡǤν񤭹ߤ᤹ */
+static ssize_t reservoir_write_user_cluster(struct inode *inode,
+					    unsigned long addr, loff_t pos)
+{
+  struct super_block *sb = inode->i_sb;
+  struct reservoir_operations *rs_ops = RS_SB(sb)->rs_ops;
+  unsigned long rs_block_size = RS_SB(sb)->rs_block_size;
+  unsigned long index = pos >> PAGE_CACHE_SHIFT;
+  size_t bytes = rs_block_size << PAGE_CACHE_SHIFT;
+  struct page **pages = NULL;
+  struct bio *bio = NULL;
+  int nr_pages = 0;
+  int i = 0;
+  ssize_t ret = 0;
+
+  /* 1饹1bio˼ޤʤǤϻȤʤ */
+  if( unlikely(rs_ops->set_bio_user_private==NULL
+	       || bio_get_nr_vecs(sb->s_bdev) < rs_block_size) )
+    {
+      return 0;
+    }
+
+  /* Ƭ饹FS¦촹оݤˤʤΤǡ
+     ɤꥳԡǽ */
+  if(index==0)
+    {
+      return 0;
+    }
+
+  pages = kmalloc(sizeof(struct page *) * rs_block_size, GFP_KERNEL);
+  if( unlikely(pages==NULL) )
+    {
+      return 0;
+    }
+
+  down_read(&current->mm->mmap_sem);
+  nr_pages = get_user_pages(current, current->mm, addr, rs_block_size,
+			    0, 0, pages, NULL);
+  up_read(&current->mm->mmap_sem);
+
+  if( unlikely(nr_pages != rs_block_size) )
+    {
+      goto RELEASE;
+    }
+
+  /* FS¦ξϡpageܤäΤΤƤդ */
+  bio = mpage_alloc(sb->s_bdev, 0, bio_get_nr_vecs(sb->s_bdev), GFP_NOFS|__GFP_HIGH);
+  if( unlikely(bio==NULL) )
+    {
+      printk("%s-%d: Getting BIO Failed.\n", __PRETTY_FUNCTION__, __LINE__);
+      goto RELEASE;
+    }
+
+  for(i=0; i<nr_pages; i++)
+    {
+      flush_dcache_page(pages[i]);
+
+      if( unlikely(bio_add_page(bio, pages[i], PAGE_CACHE_SIZE, 0) != PAGE_CACHE_SIZE) )
+	{
+	  /* ܤ꤭ʤbioΤƤơԡǤν񤭹ߤ᤹
+	     i_size䥭åˤϤޤäƤʤ */
+	  bio_put(bio);
+	  goto RELEASE;
+	}
+    }
+
+  /* pageλȤbioλ˲ */
+  nr_pages = 0;
+
+  reservoir_bio_init(sb, bio, inode, WRITE);
+  set_bit(BIO_USER_MAPPED, &bio->bi_flags);
+
+  rs_ops->set_bio_user_private(bio, inode, index, bio->bi_size);
+
+  /* ƱϰϤ˸Ťå夬ĤäƤΤƤ */
+  invalidate_mapping_pages(inode->i_mapping, index, index + rs_block_size - 1);
+
+  if(pos + bytes > inode->i_size)
+    {
+      i_size_write(inode, pos + bytes);
+    }
+
+  ret = reservoir_submit_bio(sb, bio, inode->i_reservoir, rs_ops);
+  if(ret==0)
+    {
+      ret = bytes;
+    }
+
+ RELEASE:
+
+  for(i=0; i<nr_pages; i++)
+    {
+      page_cache_release(pages[i]);
+    }
+
+  kfree(pages);
+
+  return ret;
+}
+
 static ssize_t __reservoir_file_aio_write(struct kiocb *iocb,
 					  const struct iovec *iov,
 					  unsigned long nr_segs,
@@ -2387,6 +3321,8 @@ static ssize_t __reservoir_file_aio_write(struct kiocb *iocb,
   int drct = test_bit(RS_PCIDRCT, &inode->i_rsrvr_flags);
   int overwrite = 0;
   unsigned long rs_block_size = RS_SB(inode->i_sb)->rs_block_size;
+  int upage = (filp->f_flags & O_DIRECT) && !drct
+    && test_bit(RS_UPAGE, &inode->i_rsrvr_flags);
   struct iov_iter iter;
 
   iov_iter_init(&iter, iov, nr_segs, count, 0);
@@ -2401,6 +3337,36 @@ static ssize_t __reservoir_file_aio_write(struct kiocb *iocb,
       struct page *page = NULL;
       void *fsdata = NULL;
 
+      /* եΥ饹顢ڡˤä
+	 桼Хåե1饹ʾ񤯾ϥԡʤ */
+      if(upage && offset==0 && (index % rs_block_size)==0
+	 && pos==i_size_read(inode))
+	{
+	  unsigned long addr = (unsigned long)iter.iov->iov_base + iter.iov_offset;
+	  size_t seg_left = iter.iov->iov_len - iter.iov_offset;
+	  ssize_t done = 0;
+
+	  if( !(addr & (PAGE_CACHE_SIZE - 1))
+	      && seg_left >= (rs_block_size << PAGE_CACHE_SHIFT) )
+	    {
+	      done = reservoir_write_user_cluster(inode, addr, pos);
+	      if(done < 0)
+		{
+		  status = done;
+		  break;
+		}
+
+	      if(done > 0)
+		{
+		  iov_iter_advance(&iter, done);
+		  pos += done;
+		  written += done;
+		  cond_resched();
+		  continue;
+		}
+	    }
+	}
+
       /* 񤭹ξͤbytesݤ */
       bytes = min(bytes, iov_iter_count(&iter));
 
@@ -2524,6 +3490,7 @@ ssize_t reservoir_file_aio_write(struct kiocb *iocb,
   unsigned long seg = 0;
   int rt = test_bit(RS_RT, &inode->i_rsrvr_flags);
   int drct = test_bit(RS_PCIDRCT, &inode->i_rsrvr_flags);
+  struct reservoir_file_group *group = NULL;
 
   /* RTreservoirͳˤƥ֥å񤭹ߤ٤
      ˡͤ뤬ǤRTgenericͳˤ롣
@@ -2539,6 +3506,9 @@ ssize_t reservoir_file_aio_write(struct kiocb *iocb,
 
   mutex_lock(&inode->i_mutex);
 
+  group = &RS_SB(sb)->file_groups[inode->i_reservoir ?
+				  inode->i_reservoir->file_group_idx : DEFAULT_GROUP];
+
   for(seg = 0; seg < nr_segs; seg++)
     {
       const struct iovec *iv = &iov[seg]; /* Discard static status ! */
@@ -2606,11 +3576,13 @@ ssize_t reservoir_file_aio_write(struct kiocb *iocb,
      ޤΤȤϥȥȤƤ */
   //file_update_time(file);
 
-  mutex_lock(&RS_SB(sb)->io_serialize);
+  /* ľ󲽤Ʊfile_groupν񤭹ƱΤˤȤɤᡢ
+     ̤file_groupؤν񤭹ߤ¹Ԥƿʤ */
+  mutex_lock(&group->group_serialize);
   /* WriteưΤƤӽФ */
   written = __reservoir_file_aio_write(iocb, iov, nr_segs,
 				       pos, ppos, count);
-  mutex_unlock(&RS_SB(sb)->io_serialize);
+  mutex_unlock(&group->group_serialize);
 
  OUT:
 
@@ -2960,11 +3932,17 @@ int reservoir_writepages(struct address_space *mapping,
   return 0;
 }
 
-int reservoir_end_io_write(struct bio *bio, int err)
+int reservoir_end_io_write(struct super_block *sb, struct bio *bio, int err)
 {
   if(bio->bi_size)
     return 1;
 
+  /* ֤ϿreservoirοȿǤ */
+  if(!test_bit(BIO_RW_SLAVE, &bio->bi_rw))
+    {
+      reservoir_rt_io_done(sb, bio);
+    }
+
   if(test_and_clear_bit(BIO_RW_DUMMY, &bio->bi_rw))
     {
       /* ߡ饹ξϡpageäñ */
@@ -2978,6 +3956,16 @@ int reservoir_end_io_write(struct bio *bio, int err)
 	  bvec++;
 	}
     }
+  /* 桼ХåեľܺܤƤϡ򳰤 */
+  else if(bio_flagged(bio, BIO_USER_MAPPED))
+    {
+      int i = 0;
+
+      for(i=0; i<bio->bi_vcnt; i++)
+	{
+	  page_cache_release(bio->bi_io_vec[i].bv_page);
+	}
+    }
   /* DIRECTΤȤϡäpage
      ݽƤΤǡäᡣ */
   else if(!test_and_clear_bit(BIO_RW_DRCT, &bio->bi_rw))
@@ -3166,9 +4154,9 @@ loff_t reservoir_llseek(struct file *filp, loff_t offset, int whence)
 	     񤭽Ф¸PageؤκԽ褦ˤ
 	     ñˤʤǽ⤢뤬Kernel2.4Ȥ
 	     ߴΤˤ롣 */
-	  mutex_lock(&RS_SB(sb)->io_serialize);
+	  reservoir_serialize_all(sb);
 	  reservoir_pad_and_commit_tail(inode);
-	  mutex_unlock(&RS_SB(sb)->io_serialize);
+	  reservoir_unserialize_all(sb);
 
 	  /* եΥݥư */
 	  filp->f_pos = offset;
@@ -3185,13 +4173,15 @@ loff_t reservoir_llseek(struct file *filp, loff_t offset, int whence)
 /******************* Direct Read δؿ *******************/
 
 static int submit_and_list_read_bio(struct bio *bio, struct super_block *sb,
-				    struct bio **last_bio)
+				    struct bio **first_bio, struct bio **last_bio)
 {
   struct reservoir_operations *rs_ops = RS_SB(sb)->rs_ops;
 
   /* BIOؤΥݥ */
   if(*last_bio)
     (*last_bio)->bi_private2 = (void *)bio;
+  else
+    *first_bio = bio;
 
   *last_bio = bio;
 
@@ -3209,6 +4199,72 @@ static int submit_and_list_read_bio(struct bio *bio, struct super_block *sb,
   return 0;
 }
 
+/* ȯԺѤߥꥹȤƬbioδλԤäƲ */
+static int wait_and_put_read_bio(struct bio **first_bio, struct bio **last_bio)
+{
+  struct bio *bio = *first_bio;
+  int ret = 0;
+
+  wait_on_bit(&bio->bi_rw, BIO_RW_DRCT,
+	      reservoir_io_wait, TASK_UNINTERRUPTIBLE);
+
+  *first_bio = (struct bio *)bio->bi_private2;
+  bio->bi_private2 = NULL;
+  if(*first_bio==NULL)
+    {
+      *last_bio = NULL;
+    }
+
+  if(!test_bit(BIO_UPTODATE, &bio->bi_flags))
+    {
+      printk("%s-%d: Invalid BIO State\n", __FUNCTION__, __LINE__);
+      ret = -EIO;
+    }
+
+  bio_put(bio);
+
+  return ret;
+}
+
+/* posϤޤʪŪϢ³ϰϤᡢposΥֹ֤
+   ᤿ϰϤäƤget_blockϸƤФʤ */
+static int drct_read_map(struct inode *inode, loff_t pos, size_t count,
+			 struct buffer_head *bh, sector_t *map_iblock,
+			 sector_t *sector)
+{
+  struct super_block *sb = inode->i_sb;
+  sector_t iblock = pos >> sb->s_blocksize_bits;
+  int err = 0;
+
+  if( buffer_mapped(bh) && iblock >= *map_iblock
+      && iblock < *map_iblock + (bh->b_size >> sb->s_blocksize_bits) )
+    {
+      *sector = bh->b_blocknr + (iblock - *map_iblock);
+      return 0;
+    }
+
+  /* ɤ߹߻ĤΤ֤ޤȤƥޥåפ */
+  bh->b_state = 0;
+  bh->b_size = ( (pos & (sb->s_blocksize - 1)) + count + sb->s_blocksize - 1 )
+    & ~((size_t)sb->s_blocksize - 1);
+
+  err = RS_SB(sb)->rs_ops->get_block(inode, iblock, bh, 0);
+  if( unlikely(err) )
+    {
+      return err;
+    }
+
+  if( unlikely(!buffer_mapped(bh)) )
+    {
+      return -EIO;
+    }
+
+  *map_iblock = iblock;
+  *sector = bh->b_blocknr;
+
+  return 0;
+}
+
 ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov,
 			       unsigned long nr_segs, loff_t pos)
 {
@@ -3228,7 +4284,7 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
   loff_t cluster_offset = 0; /* žϰ֤Υ饹⥪եå */
   loff_t sector_offset = 0; /* žϰ֤Υ⥪եå */
   struct buffer_head bh;
-  sector_t iblock = 0;
+  sector_t map_iblock = 0;
   struct bio *bio = NULL;
   unsigned long cluster_size = RS_SB(sb)->rs_block_size * PAGE_CACHE_SIZE;
   loff_t *ppos = &iocb->ki_pos;
@@ -3238,6 +4294,10 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
   size_t bio_max_size = bdev_get_queue(sb->s_bdev)->max_sectors << sb->s_blocksize_bits;
   unsigned long device_addr = RS_SB(sb)->rs_ops->get_device_address(sb);
   unsigned long verbous_read = 0;
+  unsigned int inflight = 0;
+  unsigned int depth = max(drct_read_depth, 1U);
+
+  bh.b_state = 0;
 
   /* եۤɤ߹⤦ȤƤ顢
      ʤˤ⤻֤ */
@@ -3299,14 +4359,12 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
     dummy_addr = rs_ops->get_addr_for_dummy_read(sb);
 
   /* Ƭֹ */
-  iblock = pos >> sb->s_blocksize_bits;
-  err = rs_ops->get_block(inode, iblock, &bh, 0);
+  err = drct_read_map(inode, pos, count, &bh, &map_iblock, &cur_sector);
   if( unlikely(err) )
     {
       printk("%s-%d: Getting Sector Number Failed.\n", __PRETTY_FUNCTION__, __LINE__);
       goto OUT;
     }
-  cur_sector = bh.b_blocknr;
 
   /* 񤭹֤߰Υ⥪եåȤ */
   sector_offset = pos & ( sb->s_blocksize - 1 );
@@ -3322,7 +4380,7 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
       dummy_tail = 0;
     }
 
-  bio = first_bio = reservoir_bio_alloc(sb, inode, cur_sector, READ);
+  bio = reservoir_bio_alloc(sb, inode, cur_sector, READ);
   if( unlikely(bio == NULL) )
     {
       printk("%s-%d: Getting BIO Failed.\n", __PRETTY_FUNCTION__, __LINE__);
@@ -3363,19 +4421,36 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
 
     RETRY:
 
-      /* ΤޤbioɲäƤΤĴ٤ */
-      iblock = pos >> sb->s_blocksize_bits;
-      err = rs_ops->get_block(inode, iblock, &bh, 0);
+      /* ΤޤbioɲäƤΤĴ٤롣
+	 Ϣ³ϰϤϤޤȤƥޥåפƤΤǡ
+	 get_blockƤ֤ΤϰϤڤܤˤʤ */
+      err = drct_read_map(inode, pos, count, &bh, &map_iblock, &cur_sector);
       if( unlikely(err) )
 	{
 	  printk("%s-%d: Getting Sector Number Failed.\n", __PRETTY_FUNCTION__, __LINE__);
 	  break;
 	}
-      cur_sector = bh.b_blocknr;
 
       if( ( bio->bi_sector + (bio->bi_size >> sb->s_blocksize_bits) ) != cur_sector )
 	{
-	  submit_and_list_read_bio(bio, sb, &last_bio);
+	  submit_and_list_read_bio(bio, sb, &first_bio, &last_bio);
+	  inflight++;
+	  bio = NULL;
+
+	  /* ȯԤʤ褦ˡŤΤ鴰λԤġ
+	     δ֤³biožƤ */
+	  while(inflight >= depth)
+	    {
+	      if(wait_and_put_read_bio(&first_bio, &last_bio))
+		err = -EIO;
+	      inflight--;
+	    }
+
+	  if( unlikely(err) )
+	    {
+	      break;
+	    }
+
 	  bio = reservoir_bio_alloc(sb, inode, cur_sector, READ);
 	  if( unlikely(bio==NULL) )
 	    {
@@ -3449,7 +4524,23 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
 			( bio_max_size < (bio->bi_size + sector_transfer_size) ) ) )
 	    {
 	      /* ϡbioʤ */
-	      submit_and_list_read_bio(bio, sb, &last_bio);
+	      submit_and_list_read_bio(bio, sb, &first_bio, &last_bio);
+	      inflight++;
+
+	      while(inflight >= depth)
+		{
+		  if(wait_and_put_read_bio(&first_bio, &last_bio))
+		    err = -EIO;
+		  inflight--;
+		}
+
+	      bio = NULL;
+	      if( unlikely(err) )
+		{
+		  done = 1;
+		  break;
+		}
+
 	      bio = reservoir_bio_alloc(sb, inode, cur_sector, READ);
 	      if(bio==NULL)
 		{
@@ -3540,10 +4631,13 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
       cond_resched();
     }
 
-  /* ǥ顼äƤȤ̵̤ʤȤ򤷤ʤ褦 */
+  /* ǥ顼äƤȤ̵̤ʤȤ򤷤ʤ褦ˡ
+     ȯԺѤߤbiožʤΤǡλԤʤФʤʤ */
   if(unlikely(err))
   {
-	  goto OUT;
+	  if(bio)
+	    bio_put(bio);
+	  goto WAIT;
   }
 
   /* Υߡž᤬ɬפä */
@@ -3577,27 +4671,16 @@ ssize_t generic_file_pci_direct_read(struct kiocb *iocb, const struct iovec *iov
   /* ǸΤҤȤĤޤ i/o scheduler Ϥ */
   if( likely(bio) )
     {
-      submit_and_list_read_bio(bio, sb, &last_bio);
+      submit_and_list_read_bio(bio, sb, &first_bio, &last_bio);
     }
 
+ WAIT:
+
   /* ƤȤϡi/o νλԤޤ礦 */
-  bio = first_bio;
-  while(bio)
+  while(first_bio)
     {
-      struct bio *bio_wait = bio;
-
-      wait_on_bit(&bio->bi_rw, BIO_RW_DRCT,
-		  reservoir_io_wait, TASK_UNINTERRUPTIBLE);
-      bio = (struct bio *)bio_wait->bi_private2;
-      bio_wait->bi_private2 = NULL;
-
-      if(!test_bit(BIO_UPTODATE, &bio_wait->bi_flags))
-	{
-	  printk("%s-%d: Invalid BIO State\n", __FUNCTION__, __LINE__);
-	  err = -EIO;
-	}
-
-      bio_put(bio_wait);
+      if(wait_and_put_read_bio(&first_bio, &last_bio))
+	err = -EIO;
     }
 
  OUT:
@@ -3632,7 +4715,7 @@ ssize_t reservoir_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
       return 0;
     }
 
-  mutex_lock(&RS_SB(sb)->io_serialize);
+  reservoir_serialize_all(sb);
 
   /* ե */
   tail = pos + count;
@@ -3676,7 +4759,7 @@ ssize_t reservoir_file_aio_read(struct kiocb *iocb, const struct iovec *iov,
     }
 
  UNLOCK_OUT:
-  mutex_unlock(&RS_SB(sb)->io_serialize);
+  reservoir_unserialize_all(sb);
 
   return ret;
 }
@@ -102,6 +102,11 @@ static struct super_block *alloc_super(struct file_system_type *type)
 			
 		    s->rsrvr_sb.file_groups[i].file_group = DEFAULT_GROUP;
 		    atomic_set(&s->rsrvr_sb.file_groups[i].rt_files, 0);
+		    s->rsrvr_sb.file_groups[i].submit_task = NULL;
+		    spin_lock_init(&s->rsrvr_sb.file_groups[i].submit_lock);
+		    init_waitqueue_head(&s->rsrvr_sb.file_groups[i].submit_wait);
+		    s->rsrvr_sb.file_groups[i].submit_pending = 0;
+		    mutex_init(&s->rsrvr_sb.file_groups[i].group_serialize);
 			
 		    for(j=0; j<MAX_RESERVOIRS; j++)
 			{
@@ -119,6 +124,8 @@ static struct super_block *alloc_super(struct file_system_type *type)
 				reservoir->max_length = 1;
 				reservoir->cur_length = 0;
 				reservoir->file_group_idx = DEFAULT_GROUP;
+				reservoir->handoff_list = NULL;
+				reservoir->handoff_err = 0;
 			}
 		}
 		
@@ -130,6 +137,18 @@ static struct super_block *alloc_super(struct file_system_type *type)
 		mutex_init(&s->rsrvr_sb.io_serialize);
 		mutex_init(&s->rsrvr_sb.meta_serialize);
 		s->rsrvr_sb.rs_ops = NULL;
+		spin_lock_init(&s->rsrvr_sb.rt_stat_lock);
+		s->rsrvr_sb.rt_inflight = 0;
+		s->rsrvr_sb.rt_busy_since = ktime_set(0, 0);
+		s->rsrvr_sb.rt_last_done = ktime_set(0, 0);
+		s->rsrvr_sb.rt_svc_avg = 0;
+		s->rsrvr_sb.rt_svc_worst = 0;
+		s->rsrvr_sb.rt_win_count = 0;
+		s->rsrvr_sb.rt_win_bytes = 0;
+		s->rsrvr_sb.rt_win_time = 0;
+		s->rsrvr_sb.rt_throughput = 0;
+		s->rsrvr_sb.rt_depth_unit = 0;
+		s->rsrvr_sb.rt_depth = 0;
 /* <-- end of init sequence for Reservoir Filesystems */
 	}
 out:
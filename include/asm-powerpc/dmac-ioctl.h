@@ -7,6 +7,8 @@
 #define DMAC_IOC_MAGIC 'd'
 
 #define IOCTL_DMAC_DIRECT_DMA   _IO(DMAC_IOC_MAGIC, 1)
+#define IOCTL_DMAC_CHAIN_DMA    _IOW(DMAC_IOC_MAGIC, 2, DmaChainStruct)
+#define IOCTL_DMAC_CHAIN_WAIT   _IOR(DMAC_IOC_MAGIC, 3, DmaChainResult)
 
 #define DMAC_READ	0
 #define DMAC_WRITE	1
@@ -18,3 +20,31 @@ typedef struct _DmaStruct {
 	unsigned int command;
 } DmaStruct;
 
+/*
+ * Chain mode transfer between a user buffer and a device address.
+ * The user pages are pinned until IOCTL_DMAC_CHAIN_WAIT returns
+ * the result of the transfer (poll() reports POLLIN when one is ready).
+ */
+typedef struct _DmaChainStruct {
+	unsigned long user_addr; /* user buffer address */
+	unsigned int dev_addr;   /* device (bus) address */
+	unsigned int size;
+	unsigned int command;    /* DMAC_READ : device -> user buffer */
+	unsigned int tag;        /* returned by IOCTL_DMAC_CHAIN_WAIT */
+} DmaChainStruct;
+
+typedef struct _DmaChainResult {
+	unsigned int tag;
+	int status;              /* 0 or -errno */
+} DmaChainResult;
+
+#ifdef __KERNEL__
+struct scatterlist;
+
+/* Completion callback. Called from interrupt context. */
+typedef void (*MPC83xxDmacCallback)(void *arg, int status);
+
+extern int MPC83xxDmacSubmitChain(int dma_ch, struct scatterlist *sg, int nents,
+				  unsigned int dev_addr, unsigned int command,
+				  MPC83xxDmacCallback callback, void *arg);
+#endif /* __KERNEL__ */
@@ -119,6 +119,12 @@ struct bio {
 #endif
 
 	void			*bi_private2; /* Added by Panasonic for RT */
+	unsigned long		bi_deadline;  /* Added by Panasonic for RT (jiffies, 0 = none) */
+#if defined(CONFIG_RESERVOIR_STATS)
+	u64			bi_rt_queued;	/* Added by Panasonic for RT stats */
+	u64			bi_rt_submitted;
+	u64			bi_rt_dispatched;
+#endif
 
 	bio_destructor_t	*bi_destructor;	/* destructor */
 };
@@ -61,6 +61,16 @@ struct cvga_ioc_fb_mode {
     unsigned long  remain;
 }; 
 
+/**
+ *  ioctl(CVGA_IOC_FB_DAMAGE)
+ *   Lines [ypos, ypos+height) of local FB are changed.
+ *   After the first call, only damaged lines are transfered to
+ *   VGA buffer planes. height=0 turns damage tracking off.
+ */
+struct cvga_ioc_fb_damage {
+    __u32  ypos, height;
+};
+
 /**
  *  ioctl(CVGA_IOC_VGA_PHASE)
  */
@@ -116,6 +126,7 @@ struct cvga_ioc_sprite_data {
 #define CVGA_IOC_FB_EGRUP       _IO(CVGA_IOC_MAGIC, 0x01)
 #define CVGA_IOC_FB_SETMODE     _IOW(CVGA_IOC_MAGIC, 0x02, struct cvga_ioc_fb_mode)
 #define CVGA_IOC_FB_GETMODE     _IOR(CVGA_IOC_MAGIC, 0x03, struct cvga_ioc_fb_mode)
+#define CVGA_IOC_FB_DAMAGE      _IOW(CVGA_IOC_MAGIC, 0x04, struct cvga_ioc_fb_damage)
 #define CVGA_IOC_VGA_SWITCH     _IO(CVGA_IOC_MAGIC, 0x10)
 #define CVGA_IOC_VGA_CHANGE     _IO(CVGA_IOC_MAGIC, 0x11)
 #define CVGA_IOC_VGA_MUTE       _IO(CVGA_IOC_MAGIC, 0x12)
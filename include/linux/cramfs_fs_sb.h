@@ -1,6 +1,18 @@
 #ifndef _CRAMFS_FS_SB
 #define _CRAMFS_FS_SB
 
+#include <linux/fs.h>
+#include <linux/mutex.h>
+
+/*
+ * one buffer of the cramfs block cache
+ */
+struct cramfs_buffer {
+			unsigned int blocknr;	/* first block, -1 if unused */
+			unsigned long lru;	/* stamp of the last use */
+			unsigned char *data;
+};
+
 /*
  * cramfs super-block data in memory
  */
@@ -10,6 +22,16 @@ struct cramfs_sb_info {
 			unsigned long blocks;
 			unsigned long files;
 			unsigned long flags;
+
+			/* block cache, protected by read_mutex */
+			struct mutex read_mutex;
+			unsigned int nr_buffers;
+			struct cramfs_buffer *buffers;
+			unsigned char *buffer_data;
+			unsigned long lru_clock;
+
+			/* readahead of the device, protected by read_mutex */
+			struct file_ra_state ra;
 };
 
 static inline struct cramfs_sb_info *CRAMFS_SB(struct super_block *sb)
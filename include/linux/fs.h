@@ -708,7 +708,7 @@ struct inode {
 };
 
 /* Added by Panasonic for i_rsrvr_flags --> */
-enum _i_rsrvr_flags {RS_RT, RS_PCIDRCT, RS_SUSPENDED, RS_MI};
+enum _i_rsrvr_flags {RS_RT, RS_PCIDRCT, RS_SUSPENDED, RS_MI, RS_UPAGE};
 #define inode_is_rt(inode)    (test_bit(RS_RT, &inode->i_rsrvr_flags))
 #define inode_is_drct(inode)  (test_bit(RS_DRCT, &inode->i_rsrvr_flags))
 /* <-- Added by Panasonic for i_rsrvr_flags */
@@ -14,6 +14,7 @@
 #define P2USB_SET_STATE        3
 #define P2USB_SET_SERIAL       4
 #define P2USB_SET_PRODUCT_ID   5
+#define P2USB_SET_FAST_LUN     6
 
 #define P2USB_MAX_SERIAL	40
 
@@ -25,6 +26,9 @@
 #define P2USB_WRONG_PARAM 1
 #define P2USB_WRONG_STATE 2
 
+/* P2USB_SET_FAST_LUN flags	*/
+#define P2USB_FAST_RDONLY 0x01
+
 /* ineternal macros		*/
 #define P2USB_STALL       0x01
 #define P2USB_DO_TRANSFER 0x02
@@ -117,4 +121,11 @@ typedef struct {
     int len;
     const char *str;
 } P2USB_SET_SERIAL_STRUCT, *PP2USB_SET_SERIAL_STRUCT;
+
+/* used to ioctl(xx, SET_FAST_LUN, xx)	*/
+typedef struct _P2USB_FAST_LUN_STRUCT{
+    __u32 Lun;          /* LUN to bind (0 - P2USB_LUN) */
+    __u32 Device;       /* dev_t of the card block device, 0 to unbind */
+    __u32 Flags;        /* P2USB_FAST_RDONLY */
+}P2USB_FAST_LUN_STRUCT, *PP2USB_FAST_LUN_STRUCT;
 #endif /* __P2_MASS_STORAGE_H__ */
@@ -293,6 +293,7 @@ struct fat_end_notify{
 #include <linux/fs.h>
 #include <linux/mutex.h>
 #include <linux/magic.h>
+#include <linux/rbtree.h>
 
 #include <linux/reservoir_fs.h>
 #include <p2/spd_ioctl.h>
@@ -329,6 +330,7 @@ struct p2fat_mount_options {
 	/* Panasonic Original */
 	unsigned long  fat_align; /* Alignment */
 	unsigned long  AU_size;	  /* AU_size */
+	unsigned long  fat_flush; /* FAT flush interval [msec] (0 = off) */
 	/*--------------------*/
 };
 
@@ -357,6 +359,7 @@ struct fat_cont_space{
 #define FAT_SPACE_SIZE		(6L << 20)			//FAT֤(6MB)
 #define FAT_TOTAL_PAGES		(FAT_SPACE_SIZE >> PAGE_SHIFT)	//FAT֤Υڡ
 #define FAT_LIST_NUM		(FAT_TOTAL_PAGES >> FAT_IO_PAGES_BITS) //FATꥹȤǿ
+#define FAT_WB_MAX_IO		64				//٤˽񤭽ФFATꥹȤκ(4MB)
 
 struct p2fat_cluster_t{
   unsigned long file_cluster;
@@ -419,8 +422,17 @@ struct p2fat_sb_info {
   spinlock_t rt_updated_clusters_lock;    //嵭ѿ˴ؤå
   unsigned long rt_private_count[MAX_RESERVOIRS];   //i/o schedulerϤäbioο
 
+  unsigned long *free_map;                //饹Υӥåȥޥå(ӥå=1Ƕ)
+  unsigned int *au_free;                  //AUζ饹
+  unsigned long au_clusters;              //1AUΥ饹
+  unsigned long au_num;                   //ǡΰAU
+  unsigned long free_map_count;           //free_mapζ饹
+
   struct super_block *sb;                 //ƤȤʤsuper_block
 
+  struct delayed_work fat_flush_work;     //FAT񤭽Фѥ
+  struct workqueue_struct *fat_flush_wq;  //嵭workqueue
+
 /*--------------------*/
 
 	int fatent_shift;
@@ -433,11 +445,8 @@ struct p2fat_sb_info {
 #define FAT_CACHE_VALID	0	/* special case for valid cache */
 
 /* Panasonic Original */
-/** milestones per 8192 **/
-#define FAT_MILE_BITS		8
-#define FAT_MILE		256
-/*** 131072 clusters = 4GB ***/
-#define FAT_MILESTONES		( 131072 >> FAT_MILE_BITS )
+/** upper limit of extents per inode **/
+#define FAT_MAX_EXTENTS		2048
 
 #define FAT_SUSPENDED_INODE	1	/* Υȥ񤭽Фʤ */
 #define FAT_RM_RESERVED		2	/* 񤭥͡ˤʤ */
@@ -464,7 +473,8 @@ struct p2fat_inode_info {
 
 	/* Panasonic Original */
 	unsigned long i_flags;
- 	int i_cluster_milestones[FAT_MILESTONES + 1];   /* milestones of disk_cluster per FAT_MILE */
+	struct rb_root i_extents;	/* fcluster -> dcluster runs (protected by cache_lru_lock) */
+	int nr_extents;
 	struct list_head i_rt_dirty;    /* hash by i_location */
 	struct buffer_head *suspended_bh;   /* bh ponter for reflection delay */
  	/*--------------------*/
@@ -539,6 +549,9 @@ extern int p2fat_get_cluster(struct inode *inode, int cluster,
 			   int *fclus, int *dclus, /*Pana Add*/int RT/**/);
 extern int p2fat_bmap(struct inode *inode, sector_t sector, sector_t *phys,
 		    unsigned long *mapped_blocks, /*Pana Add*/int RT/**/);
+/* Panasonic Original */
+extern int p2fat_cache_fill_extents(struct inode *inode);
+/*--------------------*/
 
 /* p2fat/dir.c */
 extern const struct file_operations p2fat_dir_operations;
@@ -647,6 +660,8 @@ extern int p2fat_sync_nolock(struct super_block *);
 extern int p2fat_cont_search(struct inode *, struct file *, struct fat_ioctl_space *);
 extern int p2fat_alloc_cont_clusters(struct super_block *, int);
 extern int p2fat_check_cont_space(struct super_block *, int);
+extern int p2fat_ent_link_run(struct super_block *, int, int);
+extern int p2fat_ent_free_run(struct super_block *, int, int);
 extern int p2fat_mem_init(void);
 extern void p2fat_free_mem(void);
 /*--------------------*/
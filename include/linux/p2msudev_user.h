@@ -25,6 +25,32 @@ struct p2msudev_ioc_keyev_info {
     struct timeval  tv;
 }; 
 
+/* for ioctl(P2MSUDEV_IOC_ADC_STREAM_START) */
+struct p2msudev_ioc_adc_stream {
+    unsigned long   chan_mask;  /* channels to sample (bit = channel) */
+    unsigned long   period_ms;  /* sampling period [msec] */
+};
+
+/* one scan of the ADC streaming mode, got by read() or mmap() */
+#define P2MSUDEV_ADC_MAX_CHAN   8
+struct p2msudev_adc_sample {
+    unsigned long   seq;        /* scan sequence number */
+    unsigned long   chan_mask;  /* valid channels in value[] */
+    unsigned long   jiffies;
+    struct timeval  tv;
+    unsigned long   value[P2MSUDEV_ADC_MAX_CHAN]; /* indexed by channel */
+};
+
+/* ring buffer of the ADC streaming mode, mmap()ed read-only at offset 0.
+   sample[seq % size] holds the scan "seq"; seq < wp are valid. */
+struct p2msudev_adc_ring {
+    volatile unsigned long wp;      /* number of scans written */
+    unsigned long   size;           /* number of entries in sample[] */
+    volatile unsigned long overrun; /* scans lost for read() */
+    unsigned long   reserved[5];
+    struct p2msudev_adc_sample sample[0];
+};
+
 /* for ioctl(P2MSUDEV_IOC_LED_GETVAL) ot ioctl(P2MSUDEV_IOC_LED_SETVAL) */
 struct p2msudev_ioc_led_ctrl {
 	unsigned char  no;
@@ -52,9 +78,13 @@ struct p2msudev_ioc_buzzer_ctrl {
 #define NR_P2MSUDEV_IOC_ADC_READ        0x00
 #define NR_P2MSUDEV_IOC_ADC_RESET       0x01
 #define NR_P2MSUDEV_IOC_ADC_RESET_CHECK 0x02   
+#define NR_P2MSUDEV_IOC_ADC_STREAM_START 0x03
+#define NR_P2MSUDEV_IOC_ADC_STREAM_STOP 0x04
 #define P2MSUDEV_IOC_ADC_READ           _IO(P2MSUDEV_IOC_MAGIC, NR_P2MSUDEV_IOC_ADC_READ)
 #define P2MSUDEV_IOC_ADC_RESET          _IO(P2MSUDEV_IOC_MAGIC, NR_P2MSUDEV_IOC_ADC_RESET)
 #define P2MSUDEV_IOC_ADC_RESET_CHECK    _IO(P2MSUDEV_IOC_MAGIC, NR_P2MSUDEV_IOC_ADC_RESET_CHECK)
+#define P2MSUDEV_IOC_ADC_STREAM_START   _IOW(P2MSUDEV_IOC_MAGIC, NR_P2MSUDEV_IOC_ADC_STREAM_START, struct p2msudev_ioc_adc_stream)
+#define P2MSUDEV_IOC_ADC_STREAM_STOP    _IO(P2MSUDEV_IOC_MAGIC, NR_P2MSUDEV_IOC_ADC_STREAM_STOP)
 
 /* KEYEV */
 #define NR_P2MSUDEV_IOC_KEYEV_CTRL         0x10
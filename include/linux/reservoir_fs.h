@@ -12,6 +12,10 @@
 #define RSFS_SET_GROUP     _IOW(0x82, 1, struct reservoir_file_ids)
 #define RSFS_STRETCH_QUEUE _IOW(0x82, 2, unsigned long)
 #define RSFS_SET_FILEID    _IOW(0x82, 3, struct reservoir_file_id)
+/* O_DIRECTǳRTեǡ桼Хåեpageľbio˺ܤ(0ʳͭ)
+   ͭˤ硢write()Ͻ񤭹ߴλԤΤǡ
+   ϤХåեfsync()ޤǽ񤭴ƤƤ⤤ʤ */
+#define RSFS_SET_UPAGE     _IOW(0x82, 4, unsigned long)
 
 struct reservoir_file_ids
 {
@@ -44,12 +48,20 @@ struct reservoir_file_id
 
 #define RS_SB(sb)  (&(sb->rsrvr_sb))
 
+extern void reservoir_rt_io_start(struct super_block *sb, struct bio *bio);
+
 static inline void submit_rt_bio(int rw, struct super_block *sb, struct bio *bio)
 {
   sector_t start_sector = bio->bi_sector;
+  unsigned long deadline = 0;
   int bytes_done = 0;
   struct reservoir_operations *rs_ops = RS_SB(sb)->rs_ops;
 
+  /* 񤭹ߤν֤פ뤿ᡢȯԿƤ */
+  if(rw==WRITE)
+    reservoir_rt_io_start(sb, bio);
+  deadline = bio->bi_deadline;
+
   do
     {
       struct bio *cur_bio = bio;
@@ -62,6 +74,7 @@ static inline void submit_rt_bio(int rw, struct super_block *sb, struct bio *bio
 	{
 	  set_bit(BIO_RW_SLAVE, &cur_bio->bi_rw);
 	  cur_bio->bi_sector = start_sector + ( bytes_done / 512 );
+	  cur_bio->bi_deadline = deadline;
 	}
 
       /* bioΤΥХȥեåȤ׻ */
@@ -122,7 +135,7 @@ extern int reservoir_write_end(struct file *file, struct address_space *mapping,
 			       struct page *page, void *fsdata);
 extern int reservoir_writepages(struct address_space *mapping,
 				struct writeback_control *wbc);
-extern int reservoir_end_io_write(struct bio *bio, int err);
+extern int reservoir_end_io_write(struct super_block *sb, struct bio *bio, int err);
 extern int reservoir_end_io_read(struct bio *bio, int err);
 extern struct bio *reservoir_dummy_bio_alloc(struct super_block *sb);
 extern int reservoir_fsync(struct file *filp, struct dentry *dent, int datasync);
@@ -137,6 +150,13 @@ extern ssize_t reservoir_file_aio_read(struct kiocb *iocb, const struct iovec *i
 extern int reservoir_clear_inodes(struct super_block *sb);
 extern size_t reservoir_filemap_copy_from_user(struct page *page, struct iov_iter *iter, 
 					       unsigned long offset, unsigned bytes, int drct);
+#if defined(CONFIG_RESERVOIR_STATS)
+extern int reservoir_stats_register(struct super_block *sb);
+extern void reservoir_stats_unregister(struct super_block *sb);
+#else
+static inline int reservoir_stats_register(struct super_block *sb) { return 0; }
+static inline void reservoir_stats_unregister(struct super_block *sb) { }
+#endif
 #endif /* __KERNEL__ */
 
 #endif /* _RESERVOIR_FS_H_ */
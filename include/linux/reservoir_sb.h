@@ -6,6 +6,8 @@
 #include <asm/atomic.h>
 #include <linux/types.h>
 #include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
 
 #include <linux/drct_trans_page.h>
 
@@ -20,8 +22,10 @@ struct file;
 struct inode;
 struct buffer_head;
 struct page;
+struct proc_dir_entry;
 struct iovec;
 struct kiocb;
+struct task_struct;
 
 struct reservoir_operations
 {
@@ -33,6 +37,7 @@ struct reservoir_operations
   void (*set_bio_callback)(struct bio *, struct super_block *sb, int rw, int rt);
   void (*alloc_bio_private)(struct bio*, struct super_block *sb, struct inode *, int rw);
   void (*set_bio_private)(struct bio *, struct page *page, int rw, int rt);
+  void (*set_bio_user_private)(struct bio *, struct inode *, unsigned long index, unsigned long size);
   void (*prepare_submit)(struct bio *, struct super_block *sb, int rw);
   void (*wait_on_localfs)(struct super_block *sb, int);
   unsigned long (*get_device_address)(struct super_block *);
@@ -45,6 +50,29 @@ struct reservoir_operations
 
 /* reservoirbio */
 #define RS_MAX_BIOS (32)
+/* ٱ˱ƿФreservoirοξ(bio) */
+#define RS_MAX_DEPTH (128)
+
+#if defined(CONFIG_RESERVOIR_STATS)
+/* ѥҥȥΥåȿåi2^(i-1)2^i us */
+#define RS_HIST_SLOTS (24)
+
+struct reservoir_stats
+{
+  unsigned long flushes;
+  unsigned long flushed_bios;
+  unsigned long long flushed_bytes;
+  unsigned long long dummy_bio_bytes;   // dummy bio᤿֤
+  unsigned long long dummy_fill_bytes;  // ڡdummyȥ᤿֤
+  unsigned long completed_bios;
+  unsigned long hist_flush_bios[RS_HIST_SLOTS];  // 1ǤФbio(log2)
+  unsigned long hist_reservoir[RS_HIST_SLOTS];   // reservoirίޤäƤ
+  unsigned long hist_submit[RS_HIST_SLOTS];      // submitλ
+  unsigned long hist_elevator[RS_HIST_SLOTS];    // submitelevatordispatch
+  unsigned long hist_device[RS_HIST_SLOTS];      // dispatchλ
+  unsigned long hist_commit[RS_HIST_SLOTS];      // write()λ
+};
+#endif /* CONFIG_RESERVOIR_STATS */
 
 struct bio_reservoir
 {
@@ -67,6 +95,14 @@ struct bio_reservoir
   int file_group_idx;
 
   struct mutex reservoir_lock;
+
+  /* 񤭹¦åɤؤμϤ(åե꡼, LIFO) */
+  struct bio *handoff_list;
+  int handoff_err;
+
+#if defined(CONFIG_RESERVOIR_STATS)
+  ktime_t head_stamp;   // Ƭbioä
+#endif
 };
 
 struct reservoir_file_group
@@ -75,6 +111,17 @@ struct reservoir_file_group
 
   struct bio_reservoir reservoir[MAX_RESERVOIRS]; 
   atomic_t rt_files;
+
+  /* file_groupȤbioå */
+  struct task_struct *submit_task;
+  spinlock_t submit_lock;           // submit_taskγǧhandoffؤѤ߹ߤ
+  wait_queue_head_t submit_wait;
+  unsigned long submit_pending;     // handoffѤޤ줿reservoirΥӥå
+  struct mutex group_serialize;     // Ʊfile_groupν񤭹ߤľ
+
+#if defined(CONFIG_RESERVOIR_STATS)
+  struct reservoir_stats stats;
+#endif
 };
 
 struct reservoir_sb
@@ -93,6 +140,25 @@ struct reservoir_sb
   atomic_t rt_total_files;
 
   struct reservoir_operations *rs_ops; 
+
+  /* 񤭹ߴλٱ䤫reservoirο */
+  spinlock_t rt_stat_lock;
+  unsigned long rt_inflight;
+  ktime_t rt_busy_since;
+  ktime_t rt_last_done;
+  unsigned long rt_svc_avg;      // bio1ܤν֤ΰưʿ(us, 8)
+  unsigned long rt_svc_worst;    // ߤǤκ(us)
+  unsigned long rt_win_count;
+  unsigned long rt_win_bytes;
+  unsigned long rt_win_time;     // us
+  unsigned long rt_throughput;   // KB/s
+  unsigned long rt_depth_unit;   // ñ(get_max_bios)
+  unsigned long rt_depth;        // ߤreservoirο(bio)
+
+#if defined(CONFIG_RESERVOIR_STATS)
+  struct reservoir_stats stats;  // rt_stat_lockݸ
+  struct proc_dir_entry *proc_entry;
+#endif
 };
 
 /* for rt_flags */
@@ -82,7 +82,7 @@ enum DELAYPROC_STATUS_ENUM { /* delayproc status numbers */
 
 /* version numbers */
 #define RTCTRL_DRV_VERSION	"2.1.0"
-#define RTCTRL_CORE_VERSION	"2.2.0"
+#define RTCTRL_CORE_VERSION	"2.3.0"
 
 enum RTCTRL_CONST_ENUM {
   RTCTRL_MAJOR		= 63,		/* RT-Ctrl driver's device number */
@@ -146,12 +146,20 @@ struct delayproc_info_s
   dev_t pdev;				/* device number(partition) */
   struct list_head dev_list;		/* the list of a device */
   struct list_head rq_list;		/* the list of request for waiting */
+  unsigned int nr_rq;			/* the number of requests in rq_list */
+  unsigned int nr_dirent;		/* the number of dirent requests in rq_list */
+  wait_queue_head_t rq_wait;		/* wait queue for rq_list completion */
   unsigned short buf_cnt;		/* buffering counts */
   struct request_queue *q;		/* request queue */
   spinlock_t lock;			/* spin lock */
   struct delayproc_param_s params;	/* delayproc I/O parameters */
   struct delayproc_maininfo_s *main;	/* delayproc main info */
   struct work_struct delayprocd;	/* delayproc daemon */
+  unsigned long wait_nr;		/* the number of waits on rq_list */
+  unsigned long wait_timeout;		/* the number of timed-out waits */
+  unsigned long wait_last;		/* the last wait time [jiffies] */
+  unsigned long wait_max;		/* the longest wait time [jiffies] */
+  unsigned long wait_total;		/* the sum of wait times [jiffies] */
 #if defined(CONFIG_DELAYPROC_WRITE_ORDER)
   unsigned char order;			/* delayproc write order */
 #endif /* CONFIG_DELAYPROC_WRITE_ORDER */
@@ -38,8 +38,22 @@ typedef struct {
 	ScullP_IOC_buf_spec	buf_list[DMABUF_NUM];
 } ScullP_IOC_GETBUFLIST;
 
+/* Scatter-gather layout of the buffers.
+   Buffer #n is mmap()ed at offset "offset" and DMAed at "bus_addr".	*/
+typedef struct {
+	unsigned long	bus_addr;	/* bus address of the buffer       */
+	unsigned long	length;		/* size of the buffer              */
+	unsigned long	offset;		/* mmap offset of the buffer       */
+} ScullP_IOC_sg_entry;
+
+typedef struct {
+	int		valid_buf_num;	/* number of valid sg entries      */
+	ScullP_IOC_sg_entry	sg_list[DMABUF_NUM];
+} ScullP_IOC_GETSGLIST;
+
 /* Ioctl definitions  */
 #define IOC_SCULLP_GETBUFLIST 100
+#define IOC_SCULLP_GETSGLIST  101
 
 /* Structure for driver itself	*/
 typedef struct ScullP_Dev {
@@ -48,3 +62,10 @@ typedef struct ScullP_Dev {
 	size_t	buf_size;	/* 512KB of the allocated DM buffer #0	*/
 	int		buf_num;
 } ScullP_Dev;
+
+#ifdef __KERNEL__
+struct scatterlist;
+
+/* Fill sgl[] with the buffers for other drivers' DMA (main.c)	*/
+extern int scullp_get_sglist(struct scatterlist *sgl, int nents);
+#endif /* __KERNEL__ */
@@ -0,0 +1,44 @@
+#ifndef _LINUX_ZCOM_H_
+#define _LINUX_ZCOM_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Packet ring shared with user space, mmap()ed from a zcom port at
+ * offset 0.  Each direction is a single producer / single consumer ring
+ * of ZCOM_RING_DEPTH packets; the indices run freely and are masked
+ * with (ZCOM_RING_DEPTH - 1).
+ *
+ *  tx : user space fills tx[] and advances tx_head, then issues
+ *       ZCOM_IOC_TX_KICK once for the whole batch.  The driver advances
+ *       tx_tail as the packets enter the ZION queue.
+ *  rx : the driver fills rx[] and advances rx_head, user space reads
+ *       and advances rx_tail.  poll() reports POLLIN while they differ.
+ *
+ * While a port is mapped its received packets go to the ring only.
+ */
+#define ZCOM_RING_PACKET_SIZE	32
+#define ZCOM_RING_DEPTH		64
+
+struct zcom_ring_header {
+	volatile __u32 tx_head;
+	volatile __u32 tx_tail;
+	volatile __u32 rx_head;
+	volatile __u32 rx_tail;
+	volatile __u32 rx_drop;		/* packets lost on a full rx ring */
+	__u32 reserved[11];
+};
+
+struct zcom_ring {
+	struct zcom_ring_header hdr;
+	__u8 tx[ZCOM_RING_DEPTH][ZCOM_RING_PACKET_SIZE];
+	__u8 rx[ZCOM_RING_DEPTH][ZCOM_RING_PACKET_SIZE];
+};
+
+#define ZCOM_IOC_MAGIC		'z'
+
+/* push tx[tx_tail..tx_head) to ZION, returns the number of packets sent */
+#define ZCOM_IOC_TX_KICK	_IO(ZCOM_IOC_MAGIC, 0x80)
+
+#endif /* _LINUX_ZCOM_H_ */
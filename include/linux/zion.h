@@ -77,6 +77,29 @@ struct ZION_Interrupt_Bits
   __u16 NEOCTRL_INT;
 }__attribute__((packed));
 
+/* Timestamped Interrupt Events (ZION_READ_EVENTS) */
+#define ZION_NR_EVENT_SRC    (17)   /* MBUS bit number 0-15, 16 for PCI-IF */
+#define ZION_EVENT_RING_SIZE (256)  /* power of 2 */
+
+struct ZION_Event
+{
+  __u32 seq;         /* sequence number */
+  __u16 src;         /* interrupt source */
+  __u16 pci_status;  /* PCI interrupt status at the interrupt */
+  __u32 status;      /* source specific status (DMA-IF: (ch<<16)|status) */
+  __u32 reserved;
+  __u64 timestamp;   /* monotonic clock in nsec */
+};
+
+struct ZION_Event_Buf
+{
+  __u32 src_mask;    /* [in] sources to be read (bit = source) */
+  __u32 seq;         /* [in/out] sequence number to read next */
+  __u32 count;       /* [in] entries of events, [out] entries read */
+  __u32 lost;        /* [out] events overwritten before read */
+  struct ZION_Event *events;
+};
+
 /** only for kernel modules **/
 #ifdef __KERNEL__
 
@@ -129,6 +152,18 @@ struct _ZION_PARAMS
   struct ZION_Interrupt_Bits interrupt_bits;
   struct ZION_Interrupt_Bits interrupt_enable;
 
+  /* for ZION_WAIT_INTERRUPT (under zion_wait_list_lock) */
+  struct ZION_Interrupt_Bits delivered_bits;
+  unsigned long int_generation;
+  unsigned long force_generation;
+
+  /* Event Ring (written only in int_zion_event) */
+  wait_queue_head_t event_wait_queue[ZION_NR_EVENT_SRC];
+  struct ZION_Event event_ring[ZION_EVENT_RING_SIZE];
+  u32 event_head;
+  u16 event_pci_status;
+  u64 event_time;
+
 #define ZION_DEFAULT_TIMEOUT (5*HZ)
 
   long wait_timeout;
@@ -149,23 +184,6 @@ struct zion_file_operations {
   int (*release) (zion_params_t *, struct inode *, struct file *);
 };
 
-typedef struct __ZION_NAMEPLATE
-{
-  unsigned int pid;
-  zion_params_t *zion_params;
-  struct list_head task_list;
-  struct timer_list timer;
-
-  struct ZION_Interrupt_Bits interrupt_bits;
-
-#define ZION_WAKEUP         (1)
-#define ZION_FORCE_WAKEUP   (((u8)1)<<(1))
-#define ZION_TIMEOUT_WAKEUP (((u8)1)<<(2))
-
-  u8 status_flags;
-
-} zion_wait_nameplate_t;
-
 /* for convinience */
 
 #include <asm/byteorder.h>
@@ -251,6 +269,9 @@ void zion_goto_bed(zion_params_t *zion_params, struct ZION_Interrupt_Bits *zion_
 void zion_rout_them_up(zion_params_t *zion_params);
 void zion_set_enable_bits(zion_params_t *zion_params, struct ZION_Interrupt_Bits *zion_interrupt);
 void zion_get_enable_bits(zion_params_t *zion_params, struct ZION_Interrupt_Bits *zion_interrupt);
+void zion_init_interrupt(zion_params_t *zion_params);
+void zion_post_event(zion_params_t *zion_params, int src, u32 status);
+int zion_read_events(zion_params_t *zion_params, struct ZION_Event_Buf *user_buf);
 
 /* zion_init_list.c */
 int zion_init_modules(void);
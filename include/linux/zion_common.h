@@ -46,6 +46,7 @@ struct zion_buf
 #define ZION_SET_ENABLE_BITS _IOW(ZION_MAGIC, 16, struct ZION_Interrupt_Bits)
 #define ZION_GET_ENABLE_BITS _IOR(ZION_MAGIC, 17, struct ZION_Interrupt_Bits)
 #define ZION_SET_TIMEOUT     _IO(ZION_MAGIC, 18)
+#define ZION_READ_EVENTS     _IOWR(ZION_MAGIC, 19, struct ZION_Event_Buf)
 
 /* getting ZION's revision */
 #define ZION_GET_REVISION _IOR(ZION_MAGIC, 255, unsigned short)
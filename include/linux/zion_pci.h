@@ -69,8 +69,18 @@ typedef struct _NEO_DMA_ENT
 {
   void *data;
   ssize_t size;
+  struct page *page;   /* pinned user page (NEO_DMA_ENT_USER) */
+  int flags;
 } neo_dma_ent_t;
 
+/* neo_dma_ent_t.flags : 0 means allocated for this transfer */
+#define NEO_DMA_ENT_POOL   0x01  /* buffer of the channel pool */
+#define NEO_DMA_ENT_USER   0x02  /* user page mapped directly */
+#define NEO_DMA_ENT_DIRTY  0x04  /* user page written by the device */
+
+/* upper limit of the per channel buffer pool (DMA_MAX_ENTRY_SIZE each) */
+#define NEO_DMA_POOL_MAX   64
+
 #define ZION_PCI_INT_DISPATCH_DONE     0
 #define ZION_PCI_INT_DISPATCH_PENDING  1
 #define ZION_PCI_INT_DISPATCH_TIMEOUT  2
@@ -82,6 +92,9 @@ typedef struct _NEO_DMA_PARAM
   void *dma_chain;
   int entries;
   neo_dma_ent_t dma_entries[NEO_MAX_ENTRIES];
+  void *pool[NEO_DMA_POOL_MAX];
+  int pool_entries;
+  struct page **pages;
   struct timer_list timer;
   wait_queue_head_t neo_dma_wait_queue;
   int condition;
@@ -29,11 +29,14 @@
 #include <linux/init.h>
 #include <asm/atomic.h>
 #include "crc32defs.h"
-#if CRC_LE_BITS == 8
+#if CRC_LE_BITS >= 8
 #define tole(x) __constant_cpu_to_le32(x)
-#define tobe(x) __constant_cpu_to_be32(x)
 #else
 #define tole(x) (x)
+#endif
+#if CRC_BE_BITS >= 8
+#define tobe(x) __constant_cpu_to_be32(x)
+#else
 #define tobe(x) (x)
 #endif
 #include "crc32table.h"
@@ -51,6 +54,79 @@ MODULE_LICENSE("GPL");
  */
 u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len);
 
+#if CRC_LE_BITS > 8 || CRC_BE_BITS > 8
+/*
+ * Slice-by-4/8: crc32_le() and crc32_be() share this body.  The tables
+ * and crc are kept in the byte order of the data, so that the data
+ * words can be xor'ed into crc as loaded.  Row n of the tables is the
+ * crc of a byte followed by n zero bytes, thus one step folds 4 or 8
+ * bytes with 4 or 8 independent lookups instead of a chain of them.
+ */
+static inline u32
+crc32_body(u32 crc, unsigned char const *buf, size_t len,
+	   const u32 (*tab)[256], int bits)
+{
+# ifdef __LITTLE_ENDIAN
+#  define DO_CRC(x) crc = t0[(crc ^ (x)) & 255] ^ (crc >> 8)
+#  define DO_CRC4 (t3[(q) & 255] ^ t2[(q >> 8) & 255] ^ \
+		   t1[(q >> 16) & 255] ^ t0[(q >> 24) & 255])
+#  define DO_CRC8 (t7[(q) & 255] ^ t6[(q >> 8) & 255] ^ \
+		   t5[(q >> 16) & 255] ^ t4[(q >> 24) & 255])
+# else
+#  define DO_CRC(x) crc = t0[((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
+#  define DO_CRC4 (t0[(q) & 255] ^ t1[(q >> 8) & 255] ^ \
+		   t2[(q >> 16) & 255] ^ t3[(q >> 24) & 255])
+#  define DO_CRC8 (t4[(q) & 255] ^ t5[(q >> 8) & 255] ^ \
+		   t6[(q >> 16) & 255] ^ t7[(q >> 24) & 255])
+# endif
+	const u32 *b;
+	size_t rem_len;
+	const u32 *t0 = tab[0], *t1 = tab[1], *t2 = tab[2], *t3 = tab[3];
+	const u32 *t4 = tab[bits / 8 - 4], *t5 = tab[bits / 8 - 3];
+	const u32 *t6 = tab[bits / 8 - 2], *t7 = tab[bits / 8 - 1];
+	u32 q;
+
+	/* Align it */
+	if (unlikely((long)buf & 3 && len)) {
+		do {
+			DO_CRC(*buf++);
+		} while ((--len) && ((long)buf) & 3);
+	}
+
+	if (bits == 32) {
+		rem_len = len & 3;
+		len = len >> 2;
+	} else {
+		rem_len = len & 7;
+		len = len >> 3;
+	}
+
+	b = (const u32 *)buf;
+	for (--b; len; --len) {
+		q = crc ^ *++b; /* use pre increment for speed */
+		if (bits == 32) {
+			crc = DO_CRC4;
+		} else {
+			crc = DO_CRC8;
+			q = *++b;
+			crc ^= DO_CRC4;
+		}
+	}
+	len = rem_len;
+	/* And the last few bytes */
+	if (len) {
+		const u8 *p = (const u8 *)(b + 1) - 1;
+		do {
+			DO_CRC(*++p); /* use pre increment for speed */
+		} while (--len);
+	}
+	return crc;
+#undef DO_CRC
+#undef DO_CRC4
+#undef DO_CRC8
+}
+#endif
+
 #if CRC_LE_BITS == 1
 /*
  * In fact, the table-based code will work in this case, but it can be
@@ -67,6 +143,14 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 	}
 	return crc;
 }
+#elif CRC_LE_BITS > 8
+
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	crc = __cpu_to_le32(crc);
+	crc = crc32_body(crc, p, len, crc32table_le, CRC_LE_BITS);
+	return __le32_to_cpu(crc);
+}
 #else				/* Table-based approach */
 
 u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
@@ -166,6 +250,14 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 	return crc;
 }
 
+#elif CRC_BE_BITS > 8
+
+u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
+{
+	crc = __cpu_to_be32(crc);
+	crc = crc32_body(crc, p, len, crc32table_be, CRC_BE_BITS);
+	return __be32_to_cpu(crc);
+}
 #else				/* Table-based approach */
 u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 {
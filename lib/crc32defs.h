@@ -6,27 +6,42 @@
 #define CRCPOLY_LE 0xedb88320
 #define CRCPOLY_BE 0x04c11db7
 
-/* How many bits at a time to use.  Requires a table of 4<<CRC_xx_BITS bytes. */
-/* For less performance-sensitive, use 4 */
-#ifndef CRC_LE_BITS 
-# define CRC_LE_BITS 8
+/*
+ * How many bits at a time to use.  Up to 8, requires a table of
+ * 4<<CRC_xx_BITS bytes.  32 and 64 select the "slice-by-4" and
+ * "slice-by-8" methods: 32 or 64 bits of data are folded per step with
+ * 4 or 8 tables of 256 entries (4KiB or 8KiB).
+ * For less performance-sensitive, use 4
+ */
+#ifndef CRC_LE_BITS
+# if defined(CONFIG_CRC32_SLICEBY8)
+#  define CRC_LE_BITS 64
+# elif defined(CONFIG_CRC32_SLICEBY4)
+#  define CRC_LE_BITS 32
+# elif defined(CONFIG_CRC32_BIT)
+#  define CRC_LE_BITS 1
+# else
+#  define CRC_LE_BITS 8
+# endif
 #endif
 #ifndef CRC_BE_BITS
-# define CRC_BE_BITS 8
+# define CRC_BE_BITS CRC_LE_BITS
 #endif
 
 /*
  * Little-endian CRC computation.  Used with serial bit streams sent
  * lsbit-first.  Be sure to use cpu_to_le32() to append the computed CRC.
  */
-#if CRC_LE_BITS > 8 || CRC_LE_BITS < 1 || CRC_LE_BITS & CRC_LE_BITS-1
-# error CRC_LE_BITS must be a power of 2 between 1 and 8
+#if CRC_LE_BITS > 64 || CRC_LE_BITS < 1 || CRC_LE_BITS == 16 || \
+	CRC_LE_BITS & CRC_LE_BITS-1
+# error CRC_LE_BITS must be one of {1, 2, 4, 8, 32, 64}
 #endif
 
 /*
  * Big-endian CRC computation.  Used with serial bit streams sent
  * msbit-first.  Be sure to use cpu_to_be32() to append the computed CRC.
  */
-#if CRC_BE_BITS > 8 || CRC_BE_BITS < 1 || CRC_BE_BITS & CRC_BE_BITS-1
-# error CRC_BE_BITS must be a power of 2 between 1 and 8
+#if CRC_BE_BITS > 64 || CRC_BE_BITS < 1 || CRC_BE_BITS == 16 || \
+	CRC_BE_BITS & CRC_BE_BITS-1
+# error CRC_BE_BITS must be one of {1, 2, 4, 8, 32, 64}
 #endif
@@ -0,0 +1,157 @@
+/*
+ * Self test and throughput benchmark for crc32_le() and crc32_be().
+ *
+ * The table driven implementations are checked against the well-known
+ * check values and against a bit-at-a-time reference over all lengths
+ * up to TEST_LEN and all alignments within a 64 bit word, which covers
+ * the head, body and tail paths of the slice-by-4/8 code.  The
+ * throughput of both functions is then reported in MB/s.
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file COPYING for more details.
+ */
+
+#include <linux/crc32.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/slab.h>
+#include <linux/hrtimer.h>	/* ktime_get */
+#include <asm/div64.h>
+#include "crc32defs.h"
+
+#define TEST_LEN	256
+#define BENCH_LEN	(64 * 1024)
+#define BENCH_LOOPS	64
+
+static u32 crc32_le_bit(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+	}
+	return crc;
+}
+
+static u32 crc32_be_bit(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^
+			      ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+	}
+	return crc;
+}
+
+static int __init crc32test_check(unsigned char *buf)
+{
+	static const unsigned char check[] = "123456789";
+	int errors = 0;
+	size_t len;
+	int off;
+	u32 crc;
+
+	/* CRC-32 (Ethernet) and CRC-32/MPEG-2 check values */
+	crc = crc32_le(~0, check, 9) ^ ~0;
+	if (crc != 0xcbf43926) {
+		printk(KERN_ERR "crc32: crc32_le check 0x%08x != 0xcbf43926\n",
+		       crc);
+		errors++;
+	}
+	crc = crc32_be(~0, check, 9);
+	if (crc != 0x0376e6e7) {
+		printk(KERN_ERR "crc32: crc32_be check 0x%08x != 0x0376e6e7\n",
+		       crc);
+		errors++;
+	}
+
+	for (off = 0; off < 8; off++) {
+		for (len = 0; len <= TEST_LEN; len++) {
+			u32 seed = len * 0x9e3779b9;
+
+			if (crc32_le(seed, buf + off, len) !=
+			    crc32_le_bit(seed, buf + off, len)) {
+				printk(KERN_ERR "crc32: crc32_le mismatch"
+				       " at offset %d length %zu\n", off, len);
+				errors++;
+			}
+			if (crc32_be(seed, buf + off, len) !=
+			    crc32_be_bit(seed, buf + off, len)) {
+				printk(KERN_ERR "crc32: crc32_be mismatch"
+				       " at offset %d length %zu\n", off, len);
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
+static unsigned long __init crc32test_bench(u32 (*fn)(u32, unsigned char const *, size_t),
+					    unsigned char *buf)
+{
+	ktime_t start;
+	u64 nsec, bytes;
+	u32 crc = 0;
+	int i;
+
+	start = ktime_get();
+	for (i = 0; i < BENCH_LOOPS; i++)
+		crc = fn(crc, buf, BENCH_LEN);
+	nsec = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	/* keep the result alive */
+	if (crc == 0x12345678)
+		printk(KERN_DEBUG "crc32: 0x%08x\n", crc);
+
+	if (!nsec)
+		nsec = 1;
+	bytes = (u64)BENCH_LEN * BENCH_LOOPS * 1000;	/* bytes/ns -> MB/s */
+	do_div(bytes, nsec);
+	return (unsigned long)bytes;
+}
+
+static int __init crc32test_init(void)
+{
+	unsigned char *buf;
+	u32 seed = 1;
+	int errors, i;
+
+	buf = kmalloc(BENCH_LEN, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; i < BENCH_LEN; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	errors = crc32test_check(buf);
+	if (errors)
+		printk(KERN_ERR "crc32: self test failed, %d errors\n", errors);
+	else
+		printk(KERN_INFO "crc32: self test passed (%d/%d bits)\n",
+		       CRC_LE_BITS, CRC_BE_BITS);
+
+	printk(KERN_INFO "crc32: crc32_le %lu MB/s, crc32_be %lu MB/s\n",
+	       crc32test_bench(crc32_le, buf),
+	       crc32test_bench(crc32_be, buf));
+
+	kfree(buf);
+	return errors ? -EINVAL : 0;
+}
+
+static void __exit crc32test_exit(void)
+{
+}
+
+module_init(crc32test_init);
+module_exit(crc32test_exit);
+
+MODULE_DESCRIPTION("CRC32 self test and benchmark");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,5 @@
+/* host stub for lib/lzo */
+#define get_unaligned(ptr) ({						\
+	const struct { __typeof__(*(ptr)) v; } __attribute__((packed))	\
+		*__p = (const void *)(ptr);				\
+	__p->v; })
@@ -0,0 +1,7 @@
+/* host stub for lib/lzo */
+#include <stddef.h>
+#include <string.h>
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+#define noinline	__attribute__((noinline))
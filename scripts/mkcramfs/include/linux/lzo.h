@@ -0,0 +1,2 @@
+/* host stub for lib/lzo */
+#include "../../../../include/linux/lzo.h"
@@ -0,0 +1,4 @@
+/* host stub for lib/lzo */
+#define EXPORT_SYMBOL_GPL(sym)
+#define MODULE_LICENSE(license)
+#define MODULE_DESCRIPTION(desc)
@@ -0,0 +1,6 @@
+/*
+ * Host build of the kernel LZO1X-1 compressor, so that mkcramfs makes
+ * exactly the blocks lib/lzo decompresses.  The kernel headers it uses
+ * are stubbed in scripts/mkcramfs/include.
+ */
+#include "../../lib/lzo/lzo1x_compress.c"
@@ -0,0 +1,470 @@
+/*
+ * mkcramfs - make a cramfs file system image
+ *
+ * Usage: mkcramfs [-B|-L] [-c zlib|lzo] [-e edition] [-n name] [-v]
+ *                 dirname outfile
+ *
+ * The layout is the one described in fs/cramfs/README: the super block,
+ * the directory entries in "width-first" order with sorted directories,
+ * then the data of the regular files and symlinks in depth-first order,
+ * each as a table of block pointers followed by the compressed blocks.
+ * With "-c lzo" the blocks are compressed with LZO1X-1 and the image is
+ * marked CRAMFS_FLAG_LZO; such an image needs CONFIG_CRAMFS_LZO.
+ *
+ * The kernel never swabs, so the image has to be in the byte order of
+ * the target whatever the host is: big-endian by default (the e300
+ * target), little-endian with "-L".  The words are stored byte by byte
+ * and struct cramfs_inode is packed by hand in the bitfield layout that
+ * gcc uses for that byte order, so the host order does not matter.
+ *
+ * This source code is licensed under the GNU General Public License,
+ * Version 2.  See the file COPYING for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <zlib.h>
+
+#include "../../include/linux/cramfs_fs.h"
+#include "../../include/linux/lzo.h"
+
+#define BLKSIZE		4096	/* PAGE_CACHE_SIZE of the kernel */
+#define MAXFILESIZE	((1 << CRAMFS_SIZE_WIDTH) - 1)
+#define MAXOFFSET	(((1 << CRAMFS_OFFSET_WIDTH) - 1) << 2)
+
+struct entry {
+	char *name;			/* name in the parent directory */
+	char *path;			/* path on the host */
+	struct stat st;
+	unsigned int size;		/* cramfs size (entries of a dir) */
+	unsigned int offset;		/* of the data or the first entry */
+	unsigned int inode_offset;	/* where the entry itself goes */
+	struct entry *child;		/* sorted entries of a directory */
+	struct entry *next;
+};
+
+static int verbose;
+static int use_lzo;
+static int big_endian = 1;
+static unsigned char *image;
+static size_t image_size, image_alloc;
+static unsigned int nr_files, nr_blocks;
+static int warn_uid, warn_gid, warn_dev;
+
+static void die(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "mkcramfs: ");
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static void *xmalloc(size_t size)
+{
+	void *p = calloc(1, size);
+
+	if (!p)
+		die("out of memory\n");
+	return p;
+}
+
+/* make room for len more bytes at the end of the image */
+static unsigned char *image_grow(size_t len)
+{
+	if (image_size + len > image_alloc) {
+		image_alloc = (image_size + len) * 2;
+		image = realloc(image, image_alloc);
+		if (!image)
+			die("out of memory\n");
+	}
+	memset(image + image_size, 0, len);
+	image_size += len;
+	return image + image_size - len;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	const struct entry *ea = *(const struct entry **)a;
+	const struct entry *eb = *(const struct entry **)b;
+
+	return strcmp(ea->name, eb->name);
+}
+
+/*
+ * Read the directory tree below path, each directory sorted by name as
+ * cramfs_lookup() expects.
+ */
+static struct entry *read_tree(const char *path, const char *name)
+{
+	struct entry *e = xmalloc(sizeof(*e));
+	struct entry **list = NULL, **link;
+	unsigned int nr = 0, alloc = 0, i;
+	struct dirent *de;
+	DIR *dir;
+
+	e->name = strdup(name);
+	e->path = strdup(path);
+	if (lstat(path, &e->st) < 0)
+		die("%s: %s\n", path, strerror(errno));
+	nr_files++;
+
+	if (!S_ISDIR(e->st.st_mode))
+		return e;
+
+	dir = opendir(path);
+	if (!dir)
+		die("%s: %s\n", path, strerror(errno));
+	while ((de = readdir(dir)) != NULL) {
+		char *child;
+
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		if (strlen(de->d_name) > CRAMFS_MAXPATHLEN)
+			die("%s/%s: name too long\n", path, de->d_name);
+		if (nr == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			list = realloc(list, alloc * sizeof(*list));
+			if (!list)
+				die("out of memory\n");
+		}
+		child = xmalloc(strlen(path) + strlen(de->d_name) + 2);
+		sprintf(child, "%s/%s", path, de->d_name);
+		list[nr++] = read_tree(child, de->d_name);
+		free(child);
+	}
+	closedir(dir);
+
+	qsort(list, nr, sizeof(*list), cmp_entry);
+	link = &e->child;
+	for (i = 0; i < nr; i++) {
+		*link = list[i];
+		link = &list[i]->next;
+	}
+	free(list);
+	return e;
+}
+
+static unsigned int entry_size(const struct entry *e)
+{
+	return sizeof(struct cramfs_inode) + ((strlen(e->name) + 3) & ~3);
+}
+
+/*
+ * Reserve the directory entries: all entries of a directory, then the
+ * subdirectories one by one ("width-first").
+ */
+static void layout_dirs(struct entry *dir)
+{
+	struct entry *e;
+
+	if (!dir->child)
+		return;
+	dir->offset = image_size;
+	for (e = dir->child; e; e = e->next) {
+		e->inode_offset = image_size;
+		image_grow(entry_size(e));
+	}
+	dir->size = image_size - dir->offset;
+	if (dir->size > MAXFILESIZE)
+		die("%s: directory too large\n", dir->path);
+
+	for (e = dir->child; e; e = e->next)
+		if (S_ISDIR(e->st.st_mode))
+			layout_dirs(e);
+}
+
+static unsigned int compress_block(unsigned char *dst, size_t dstlen,
+				   const unsigned char *src, size_t srclen)
+{
+	if (use_lzo) {
+		static unsigned char wrkmem[LZO1X_1_MEM_COMPRESS];
+		size_t len = dstlen;
+
+		if (lzo1x_1_compress(src, srclen, dst, &len, wrkmem) != LZO_E_OK)
+			die("LZO compression failed\n");
+		return len;
+	} else {
+		uLongf len = dstlen;
+
+		if (compress2(dst, &len, src, srclen, Z_BEST_COMPRESSION) != Z_OK)
+			die("zlib compression failed\n");
+		return len;
+	}
+}
+
+/* store a 32-bit word in the byte order of the target */
+static void put32(unsigned char *p, uint32_t v)
+{
+	if (big_endian) {
+		p[0] = v >> 24;
+		p[1] = v >> 16;
+		p[2] = v >> 8;
+		p[3] = v;
+	} else {
+		p[0] = v;
+		p[1] = v >> 8;
+		p[2] = v >> 16;
+		p[3] = v >> 24;
+	}
+}
+
+/*
+ * Append the block pointers and the compressed blocks of one file.
+ */
+static void write_data(struct entry *e, const unsigned char *data, size_t size)
+{
+	unsigned int nblocks = (size - 1) / BLKSIZE + 1;
+	unsigned char out[BLKSIZE * 2];
+	unsigned int i, ptr;
+
+	if (size > MAXFILESIZE)
+		die("%s: file too large\n", e->path);
+
+	image_grow((4 - (image_size & 3)) & 3);
+	e->offset = image_size;
+	if (e->offset > MAXOFFSET)
+		die("%s: image too large\n", e->path);
+	ptr = image_size;
+	image_grow(nblocks * 4);
+
+	for (i = 0; i < nblocks; i++) {
+		size_t len = size - (size_t)i * BLKSIZE;
+		unsigned int clen;
+		uint32_t end;
+
+		if (len > BLKSIZE)
+			len = BLKSIZE;
+		clen = compress_block(out, sizeof(out), data + i * BLKSIZE, len);
+		if (clen > BLKSIZE * 2)
+			die("%s: block %u does not compress\n", e->path, i);
+		memcpy(image_grow(clen), out, clen);
+		end = image_size;
+		put32(image + ptr + i * 4, end);
+	}
+	nr_blocks += nblocks;
+
+	if (verbose)
+		printf("%6.2f%% (%+d bytes)\t%s\n",
+		       (image_size - e->offset) * 100.0 / size,
+		       (int)(image_size - e->offset) - (int)size, e->path);
+}
+
+/*
+ * Append the data of the regular files and symlinks, depth-first.
+ */
+static void layout_data(struct entry *dir)
+{
+	struct entry *e;
+
+	for (e = dir->child; e; e = e->next) {
+		if (S_ISDIR(e->st.st_mode)) {
+			layout_data(e);
+		} else if (S_ISLNK(e->st.st_mode)) {
+			char target[4096];
+			ssize_t len = readlink(e->path, target, sizeof(target));
+
+			if (len < 0)
+				die("%s: %s\n", e->path, strerror(errno));
+			e->size = len;
+			if (len)
+				write_data(e, (unsigned char *)target, len);
+		} else if (S_ISREG(e->st.st_mode)) {
+			unsigned char *data;
+			ssize_t len;
+			int fd;
+
+			e->size = e->st.st_size;
+			if (!e->size)
+				continue;
+			fd = open(e->path, O_RDONLY);
+			if (fd < 0)
+				die("%s: %s\n", e->path, strerror(errno));
+			data = xmalloc(e->size);
+			len = read(fd, data, e->size);
+			if (len != (ssize_t)e->size)
+				die("%s: short read\n", e->path);
+			close(fd);
+			write_data(e, data, e->size);
+			free(data);
+		} else {
+			/* device nodes keep the old encoded dev_t in size */
+			dev_t dev = e->st.st_rdev;
+
+			if (S_ISCHR(e->st.st_mode) || S_ISBLK(e->st.st_mode)) {
+				if (major(dev) > 255 || minor(dev) > 255)
+					warn_dev = 1;
+				e->size = (major(dev) << 8) | (minor(dev) & 0xff);
+			}
+		}
+	}
+}
+
+/*
+ * Pack a struct cramfs_inode.  gcc allocates bitfields from the most
+ * significant bit on big-endian and from the least significant bit on
+ * little-endian, so the first field of each word is at the top or at
+ * the bottom of it.
+ */
+static void fill_inode(unsigned char *p, const struct entry *e,
+		       unsigned int namelen)
+{
+	uint32_t mode = e->st.st_mode & ((1 << CRAMFS_MODE_WIDTH) - 1);
+	uint32_t uid = e->st.st_uid & ((1 << CRAMFS_UID_WIDTH) - 1);
+	uint32_t size = e->size & ((1 << CRAMFS_SIZE_WIDTH) - 1);
+	uint32_t gid = e->st.st_gid & ((1 << CRAMFS_GID_WIDTH) - 1);
+	uint32_t offset = e->offset >> 2;
+
+	if (big_endian) {
+		put32(p, mode << CRAMFS_UID_WIDTH | uid);
+		put32(p + 4, size << CRAMFS_GID_WIDTH | gid);
+		put32(p + 8, namelen << CRAMFS_OFFSET_WIDTH | offset);
+	} else {
+		put32(p, uid << CRAMFS_MODE_WIDTH | mode);
+		put32(p + 4, gid << CRAMFS_SIZE_WIDTH | size);
+		put32(p + 8, offset << CRAMFS_NAMELEN_WIDTH | namelen);
+	}
+	if (e->st.st_uid >> CRAMFS_UID_WIDTH)
+		warn_uid = 1;
+	if (e->st.st_gid >> CRAMFS_GID_WIDTH)
+		warn_gid = 1;
+}
+
+/*
+ * Now that every offset is known, write the directory entries.
+ */
+static void write_dirs(struct entry *dir)
+{
+	struct entry *e;
+
+	for (e = dir->child; e; e = e->next) {
+		unsigned char *inode = image + e->inode_offset;
+		size_t len = strlen(e->name);
+
+		fill_inode(inode, e, (len + 3) >> 2);
+		memcpy(inode + sizeof(struct cramfs_inode), e->name, len);
+		if (S_ISDIR(e->st.st_mode))
+			write_dirs(e);
+	}
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: mkcramfs [-B|-L] [-c zlib|lzo] [-e edition] [-n name]"
+		" [-v] dirname outfile\n"
+		" -B   big-endian image (default)\n"
+		" -L   little-endian image\n"
+		" -c   block compression, zlib (default) or lzo\n"
+		" -e   set edition number (part of fsid)\n"
+		" -n   set name of cramfs filesystem\n"
+		" -v   be verbose\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct cramfs_super *super;
+	struct entry *root;
+	const char *name = "Compressed";
+	unsigned int edition = 0;
+	uint32_t flags;
+	uLong crc;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "BLc:e:n:v")) != -1) {
+		switch (opt) {
+		case 'B':
+			big_endian = 1;
+			break;
+		case 'L':
+			big_endian = 0;
+			break;
+		case 'c':
+			if (!strcmp(optarg, "lzo"))
+				use_lzo = 1;
+			else if (strcmp(optarg, "zlib"))
+				usage();
+			break;
+		case 'e':
+			edition = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc - optind != 2)
+		usage();
+
+	root = read_tree(argv[optind], "");
+	if (!S_ISDIR(root->st.st_mode))
+		die("%s: not a directory\n", argv[optind]);
+
+	image_grow(sizeof(struct cramfs_super));
+	layout_dirs(root);
+	layout_data(root);
+	write_dirs(root);
+
+	/* pad to the block size so that the image can be loop mounted */
+	image_grow((BLKSIZE - (image_size & (BLKSIZE - 1))) & (BLKSIZE - 1));
+
+	super = (struct cramfs_super *)image;
+	flags = CRAMFS_FLAG_FSID_VERSION_2 | CRAMFS_FLAG_SORTED_DIRS;
+	if (use_lzo)
+		flags |= CRAMFS_FLAG_LZO;
+	put32(image + offsetof(struct cramfs_super, magic), CRAMFS_MAGIC);
+	put32(image + offsetof(struct cramfs_super, size), image_size);
+	put32(image + offsetof(struct cramfs_super, flags), flags);
+	memcpy(super->signature, CRAMFS_SIGNATURE, sizeof(super->signature));
+	put32(image + offsetof(struct cramfs_super, fsid.edition), edition);
+	put32(image + offsetof(struct cramfs_super, fsid.blocks), nr_blocks);
+	put32(image + offsetof(struct cramfs_super, fsid.files), nr_files);
+	strncpy((char *)super->name, name, sizeof(super->name));
+	fill_inode(image + offsetof(struct cramfs_super, root), root, 0);
+
+	/* the crc is taken with fsid.crc still zero, like cramfsck does */
+	crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, image, image_size);
+	put32(image + offsetof(struct cramfs_super, fsid.crc), crc);
+
+	fd = open(argv[optind + 1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		die("%s: %s\n", argv[optind + 1], strerror(errno));
+	if (write(fd, image, image_size) != (ssize_t)image_size)
+		die("%s: %s\n", argv[optind + 1], strerror(errno));
+	close(fd);
+
+	if (warn_uid)
+		fprintf(stderr, "mkcramfs: warning: uids truncated to %u bits\n",
+			CRAMFS_UID_WIDTH);
+	if (warn_gid)
+		fprintf(stderr, "mkcramfs: warning: gids truncated to %u bits\n",
+			CRAMFS_GID_WIDTH);
+	if (warn_dev)
+		fprintf(stderr, "mkcramfs: warning: device numbers truncated"
+			" to 8 bits\n");
+	if (verbose)
+		printf("%s: %zu bytes, %u files, %u blocks, %s, %s-endian\n",
+		       argv[optind + 1], image_size, nr_files, nr_blocks,
+		       use_lzo ? "lzo" : "zlib", big_endian ? "big" : "little");
+	return 0;
+}